@@ -49,8 +49,11 @@
 
 #include "libcorsaro_log.h"
 #include "libcorsaro_avro.h"
+#include "libcorsaro_ftindex.h"
+#include "libcorsaro_avroblock.h"
 #include "plugins/corsaro_flowtuple.h"
 #include "pqueue.h"
+#include "ftagg.h"
 
 #include <assert.h>
 #include <signal.h>
@@ -65,14 +68,41 @@
 /** Tool that will merge the flowtuple records from sorted interim files
  *  (e.g. the output produced by corsarotrace + the flowtuple plugin) into
  *  a single sorted avro file, combining any duplicate flowtuples together.
+ *
+ *  In aggregation mode, the inputs do not need to be sorted. Reader threads
+ *  decode each input and partition the flowtuples (by a hash of the full
+ *  flowtuple key) across a set of aggregator threads, each of which sums
+ *  the packet counts for its flowtuples in a hash table. Whenever a table
+ *  grows beyond its share of the memory limit, its contents are sorted and
+ *  spilled to a temporary "run" file. Once all of the inputs have been
+ *  read, the remaining table contents are either written out directly
+ *  (unsorted output) or sorted and written as a final run, after which the
+ *  runs are combined using the normal sorted merge.
+ *
+ *  IPv6 flowtuple files (see FLOWTUPLE6_RESULT_SCHEMA) are merged in
+ *  exactly the same way when the -6 option is given.
  */
 
 #define BASE_SOCKETNAME "inproc://ftmerger"
+#define AGG_SOCKETNAME "inproc://ftaggregator"
+
+/** Number of flowtuples sent from a reader to an aggregator at a time */
+#define AGG_BATCH_SIZE 1024
+
+/** Default number of aggregator threads */
+#define AGG_DEFAULT_PARTITIONS 4
+
+/** Default limit on the number of flowtuples held in memory (across all
+ *  aggregators) before spilling to disk */
+#define AGG_DEFAULT_MAX_TUPLES 20000000
+
+/** Default number of threads used to decode each input file */
+#define DEFAULT_DECODE_THREADS 2
 
 /** Describes a flowtuple record that is ready to be merged */
 struct merger_ft {
     /** The flowtuple record itself, decoded from avro into a native struct */
-    struct corsaro_flowtuple_data ft;
+    merge_ftdata_t ft;
     /** The identifier of the reader thread that sent us this record */
     int source;
     /** The flowtuple's position in the priority queue */
@@ -92,11 +122,84 @@ typedef struct avromerge_reader {
     void *outsock;
     /** The identifer for this reader thread */
     int readerid;
+    /** The number of threads to use to decode the input file */
+    int decodethreads;
     /** A corsaro logger instance, used to write log messages */
     corsaro_logger_t *logger;
 
+    /** In aggregation mode, the zeromq sockets for sending flowtuples to
+     *  each of the aggregator threads */
+    void **aggsocks;
+    /** The number of aggregator threads */
+    int aggcount;
+
 } avromerge_reader_t;
 
+/** A source of decoded flowtuples from an input file. The parallel block
+ *  reader is used whenever possible; files that it can't handle (e.g.
+ *  those using a codec it doesn't support) are read using the regular
+ *  avro reader instead.
+ */
+typedef struct ft_source {
+    corsaro_avroblock_reader_t *blkrdr;
+    corsaro_avroblock_batch_t *batch;
+    uint32_t batchpos;
+    corsaro_avro_reader_t *avrdr;
+} ft_source_t;
+
+/** A batch of flowtuples sent from a reader thread to an aggregator */
+typedef struct ftagg_batch {
+    int count;
+    merge_ftdata_t fts[AGG_BATCH_SIZE];
+} ftagg_batch_t;
+
+/** Thread-local data for an aggregator thread */
+typedef struct avromerge_aggregator {
+    pthread_t threadid;
+
+    /** The identifier for this aggregator thread */
+    int aggid;
+    /** The zeromq socket that flowtuples are received on */
+    void *insock;
+    /** The number of reader threads that will be sending us flowtuples */
+    int readercount;
+
+    /** The flowtuples that have been aggregated so far */
+    ftagg_table_t table;
+    /** The number of flowtuples we can hold before we must spill */
+    uint64_t maxtuples;
+
+    /** Prefix for the names of the run files that we spill to */
+    char *runprefix;
+    /** The names of the run files that we have written */
+    char **runs;
+    /** The number of run files that we have written */
+    int runcount;
+    /** If 1, write our final table contents as a sorted run even if we
+     *  have not needed to spill */
+    uint8_t sortfinal;
+
+    /** Set to 1 if something went wrong in this thread */
+    uint8_t error;
+    /** A corsaro logger instance, used to write log messages */
+    corsaro_logger_t *logger;
+} avromerge_aggregator_t;
+
+/** Encodes a flowtuple as an avro record for the given writer */
+static inline void ftdata_encode(merge_ftdata_t *ft,
+        corsaro_avro_writer_t *avwrt, corsaro_logger_t *logger) {
+    if (mergeipv6) {
+        encode_flowtuple6_as_avro(&(ft->v6), avwrt, logger);
+    } else {
+        encode_flowtuple_as_avro(&(ft->v4), avwrt, logger);
+    }
+}
+
+/** Returns the interval that a flowtuple belongs to */
+static inline uint32_t ftdata_interval(merge_ftdata_t *ft) {
+    return mergeipv6 ? ft->v6.interval_ts : ft->v4.interval_ts;
+}
+
 /** Getter function for the pqueue position of a merger_ft instance */
 static size_t ft_get_pos(void *a) {
     struct merger_ft *ft = (struct merger_ft *)a;
@@ -120,44 +223,20 @@ static int ft_same(struct merger_ft *a, struct merger_ft *b) {
         return 0;
     }
 
-    if (a->ft.interval_ts != b->ft.interval_ts) {
-        return 0;
-    }
-    if (a->ft.protocol != b->ft.protocol) {
-        return 0;
-    }
-    if (a->ft.ttl != b->ft.ttl) {
-        return 0;
-    }
-    if (a->ft.tcp_flags != b->ft.tcp_flags) {
-        return 0;
+    if (mergeipv6) {
+        return (corsaro_flowtuple6_data_cmp(&(a->ft.v6), &(b->ft.v6)) == 0);
     }
-    if (a->ft.src_ip != b->ft.src_ip) {
-        return 0;
-    }
-    if (a->ft.dst_ip != b->ft.dst_ip) {
-        return 0;
-    }
-    if (a->ft.src_port != b->ft.src_port) {
-        return 0;
-    }
-    if (a->ft.dst_port != b->ft.dst_port) {
-        return 0;
-    }
-    if (a->ft.ip_len != b->ft.ip_len) {
+
+    if (!corsaro_flowtuple_data_same_key(&(a->ft.v4), &(b->ft.v4))) {
         return 0;
     }
-    if (a->ft.tcp_synlen != b->ft.tcp_synlen) {
+    if (a->ft.v4.tcp_synlen != b->ft.v4.tcp_synlen) {
         return 0;
     }
-    if (a->ft.tcp_synwinlen != b->ft.tcp_synwinlen) {
+    if (a->ft.v4.tcp_synwinlen != b->ft.v4.tcp_synwinlen) {
         return 0;
     }
 
-    /* Ignore derived properties, such as ASN, "is spoofed" or country, as these
-     * should be the same as long as the source IP is the same.
-     */
-
     /* Also ignore statistics like packet count -- these don't describe
      * the flowtuple itself and are just a reflection of how often it was
      * seen by that corsarotrace thread.
@@ -178,51 +257,7 @@ static int ft_cmp_pri(void *next, void *curr) {
     struct merger_ft *nextft = (struct merger_ft *)next;
 	struct merger_ft *currft = (struct merger_ft *)curr;
 
-	if (currft->ft.interval_ts != nextft->ft.interval_ts) {
-		return (currft->ft.interval_ts < nextft->ft.interval_ts);
-	}
-
-	if (currft->ft.protocol != nextft->ft.protocol) {
-		return (currft->ft.protocol < nextft->ft.protocol);
-	}
-
-	if (currft->ft.ttl != nextft->ft.ttl) {
-		return (currft->ft.ttl < nextft->ft.ttl);
-	}
-
-	if (currft->ft.tcp_flags != nextft->ft.tcp_flags) {
-		return (currft->ft.tcp_flags < nextft->ft.tcp_flags);
-	}
-
-	if (currft->ft.src_ip != nextft->ft.src_ip) {
-		return (currft->ft.src_ip < nextft->ft.src_ip);
-	}
-
-	if (currft->ft.dst_ip != nextft->ft.dst_ip) {
-		return (currft->ft.dst_ip < nextft->ft.dst_ip);
-	}
-
-	if (currft->ft.src_port != nextft->ft.src_port) {
-		return (currft->ft.src_port < nextft->ft.src_port);
-	}
-
-	if (currft->ft.dst_port != nextft->ft.dst_port) {
-		return (currft->ft.dst_port < nextft->ft.dst_port);
-	}
-
-	if (currft->ft.ip_len != nextft->ft.ip_len) {
-		return (currft->ft.ip_len < nextft->ft.ip_len);
-	}
-
-	if (currft->ft.tcp_synlen != nextft->ft.tcp_synlen) {
-		return (currft->ft.tcp_synlen < nextft->ft.tcp_synlen);
-	}
-
-	if (currft->ft.tcp_synwinlen != nextft->ft.tcp_synwinlen) {
-		return (currft->ft.tcp_synwinlen < nextft->ft.tcp_synwinlen);
-	}
-
-	return 1;
+    return (ftdata_cmp(&(currft->ft), &(nextft->ft)) <= 0);
 }
 
 
@@ -241,17 +276,83 @@ static void cleanup_signal(int sig) {
 static inline void combine_flowtuple_records(struct merger_ft *prev,
         struct merger_ft *next) {
 
-    /** Packet count needs to be added together. */
-    next->ft.packet_cnt += prev->ft.packet_cnt;
+    ftdata_combine(&(next->ft), &(prev->ft));
+}
+
+/** Opens an input file for reading flowtuples.
+ *
+ *  @return 0 if successful, -1 if the file could not be opened.
+ */
+static int open_ft_source(avromerge_reader_t *rdata, ft_source_t *src) {
+
+    memset(src, 0, sizeof(ft_source_t));
+    src->blkrdr = corsaro_create_avroblock_reader(rdata->logger,
+            rdata->source, mergeipv6 ? CORSARO_AVROBLOCK_FLOWTUPLE6 :
+            CORSARO_AVROBLOCK_FLOWTUPLE, rdata->decodethreads);
+    if (src->blkrdr) {
+        return 0;
+    }
 
+    corsaro_log(rdata->logger,
+            "falling back to the generic avro reader for %s", rdata->source);
+    src->avrdr = corsaro_create_avro_reader(rdata->logger, rdata->source);
+    if (src->avrdr == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/** Reads the next flowtuple from an input file.
+ *
+ *  @return 1 if a flowtuple was read, 0 if there are no more flowtuples,
+ *          -1 if an error occurred.
+ */
+static inline int read_next_ft(ft_source_t *src, merge_ftdata_t *ft) {
+
+    avro_value_t *record;
+    int ret;
+
+    if (src->avrdr) {
+        if ((ret = corsaro_read_next_avro_record(src->avrdr, &record)) > 0) {
+            if (!mergeipv6) {
+                decode_flowtuple_from_avro(record, &(ft->v4));
+            } else if (decode_flowtuple6_from_avro(record, &(ft->v6)) < 0) {
+                return -1;
+            }
+        }
+        return ret;
+    }
+
+    while (src->batch == NULL || src->batchpos >= src->batch->count) {
+        if ((ret = corsaro_read_next_avroblock_batch(src->blkrdr,
+                        &(src->batch))) <= 0) {
+            return ret;
+        }
+        src->batchpos = 0;
+    }
+
+    if (mergeipv6) {
+        corsaro_avroblock_get_flowtuple6(src->batch, src->batchpos, &(ft->v6));
+    } else {
+        corsaro_avroblock_get_flowtuple(src->batch, src->batchpos, &(ft->v4));
+    }
+    src->batchpos ++;
+    return 1;
+}
+
+static void close_ft_source(ft_source_t *src) {
+    if (src->blkrdr) {
+        corsaro_destroy_avroblock_reader(src->blkrdr);
+    }
+    if (src->avrdr) {
+        corsaro_destroy_avro_reader(src->avrdr);
+    }
 }
 
 /** Function that operates a reader thread */
 static void *start_reader(void *arg) {
     avromerge_reader_t *rdata = (avromerge_reader_t *)arg;
-    corsaro_avro_reader_t *avrdr = corsaro_create_avro_reader(rdata->logger,
-            rdata->source);
-    avro_value_t *record;
+    ft_source_t src;
 
     int ret = 1, sendret;
     struct merger_ft *tosend, **end;
@@ -267,17 +368,20 @@ static void *start_reader(void *arg) {
      * the previous messages it had sent.
      */
 
-    while (ret > 0 && !halted) {
-        ret = corsaro_read_next_avro_record(avrdr, &(record));
+    if (open_ft_source(rdata, &src) < 0) {
+        ret = 0;
+    }
 
-        if (ret <= 0) {
-            break;
-        }
+    while (ret > 0 && !halted) {
         tosend = calloc(1, sizeof(struct merger_ft));
         tosend->source = rdata->readerid;
         tosend->pqueue_pos = 0;
 
-        decode_flowtuple_from_avro(record, &(tosend->ft));
+        ret = read_next_ft(&src, &(tosend->ft));
+        if (ret <= 0) {
+            free(tosend);
+            break;
+        }
 
         /* Don't actually block inside zeromq -- we want to be able to detect
          * when the user wants the program to halt, so we end up with this
@@ -324,7 +428,180 @@ static void *start_reader(void *arg) {
     }
 
 endreader:
-	corsaro_destroy_avro_reader(avrdr);
+    close_ft_source(&src);
+    pthread_exit(NULL);
+}
+
+/** Sorts the contents of an aggregator's table and writes them to a new
+ *  run file. The table is emptied afterwards.
+ *
+ *  @return 0 if successful, -1 if an error occurred.
+ */
+static int spill_aggregator_table(avromerge_aggregator_t *agg) {
+    ftagg_table_t *table = &(agg->table);
+    corsaro_avro_writer_t *runwrt;
+    char runname[4096];
+    uint64_t i, j;
+    int ret = 0;
+
+    j = ftagg_table_sort(table);
+
+    snprintf(runname, sizeof(runname), "%s.agg%d-%d.tmp", agg->runprefix,
+            agg->aggid, agg->runcount);
+
+    runwrt = corsaro_create_avro_writer(agg->logger,
+            mergeipv6 ? FLOWTUPLE6_RESULT_SCHEMA : FLOWTUPLE_RESULT_SCHEMA);
+    if (runwrt == NULL) {
+        return -1;
+    }
+    if (corsaro_start_avro_writer(runwrt, runname, 0) < 0) {
+        corsaro_destroy_avro_writer(runwrt);
+        return -1;
+    }
+
+    for (i = 0; i < j; i++) {
+        ftdata_encode(FTAGG_SLOT(table, i), runwrt, agg->logger);
+        if (corsaro_append_avro_writer(runwrt, NULL) < 0) {
+            corsaro_log(agg->logger, "Error while writing run file %s",
+                    runname);
+            ret = -1;
+            break;
+        }
+    }
+    corsaro_destroy_avro_writer(runwrt);
+
+    agg->runs = realloc(agg->runs, (agg->runcount + 1) * sizeof(char *));
+    agg->runs[agg->runcount] = strdup(runname);
+    agg->runcount ++;
+
+    ftagg_table_clear(table);
+    return ret;
+}
+
+/** Sends a batch of flowtuples to an aggregator thread. A NULL batch is
+ *  used to tell the aggregator that this reader has finished.
+ *
+ *  @return 0 if the batch was sent, -1 if not (in which case the caller
+ *          still owns the batch).
+ */
+static int send_agg_batch(avromerge_reader_t *rdata, int aggid,
+        ftagg_batch_t *batch) {
+
+    while (!halted) {
+        if (zmq_send(rdata->aggsocks[aggid], &batch, sizeof(ftagg_batch_t *),
+                    ZMQ_DONTWAIT) == sizeof(ftagg_batch_t *)) {
+            return 0;
+        }
+        if (errno != EAGAIN) {
+            corsaro_log(rdata->logger,
+                    "Error sending batch to aggregator %d: %s", aggid,
+                    strerror(errno));
+            return -1;
+        }
+        usleep(10);
+    }
+    return -1;
+}
+
+/** Function that operates a reader thread in aggregation mode */
+static void *start_partitioning_reader(void *arg) {
+    avromerge_reader_t *rdata = (avromerge_reader_t *)arg;
+    ft_source_t src;
+    ftagg_batch_t **batches;
+    merge_ftdata_t ft;
+    int ret = 1, i, part = 0;
+
+    batches = calloc(rdata->aggcount, sizeof(ftagg_batch_t *));
+    if (open_ft_source(rdata, &src) < 0) {
+        ret = 0;
+    }
+
+    while (ret > 0 && !halted) {
+        ret = read_next_ft(&src, &ft);
+        if (ret <= 0) {
+            break;
+        }
+
+        part = (ft_key_hash(&ft) >> 32) % rdata->aggcount;
+        if (batches[part] == NULL) {
+            batches[part] = malloc(sizeof(ftagg_batch_t));
+            batches[part]->count = 0;
+        }
+        memcpy(&(batches[part]->fts[batches[part]->count]), &ft,
+                sizeof(merge_ftdata_t));
+        batches[part]->count ++;
+
+        if (batches[part]->count == AGG_BATCH_SIZE) {
+            if (send_agg_batch(rdata, part, batches[part]) < 0) {
+                break;
+            }
+            batches[part] = NULL;
+        }
+    }
+
+    /* Flush any partial batches and then tell every aggregator that we
+     * are done. */
+    for (i = 0; i < rdata->aggcount; i++) {
+        if (batches[i] && send_agg_batch(rdata, i, batches[i]) < 0) {
+            free(batches[i]);
+        }
+        send_agg_batch(rdata, i, NULL);
+    }
+
+    free(batches);
+    close_ft_source(&src);
+    pthread_exit(NULL);
+}
+
+/** Function that operates an aggregator thread */
+static void *start_aggregator(void *arg) {
+    avromerge_aggregator_t *agg = (avromerge_aggregator_t *)arg;
+    ftagg_batch_t *batch;
+    int ended = 0, i, ret;
+
+    /* Keep receiving until every reader has finished, even if we have
+     * hit an error, so that the readers are never left blocked on us.
+     */
+    while (ended < agg->readercount) {
+        ret = zmq_recv(agg->insock, &batch, sizeof(ftagg_batch_t *),
+                ZMQ_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EAGAIN) {
+                if (halted) {
+                    break;
+                }
+                usleep(10);
+                continue;
+            }
+            corsaro_log(agg->logger,
+                    "failed to read flowtuples in aggregator %d: %s",
+                    agg->aggid, strerror(errno));
+            agg->error = 1;
+            break;
+        }
+
+        if (batch == NULL) {
+            ended ++;
+            continue;
+        }
+
+        for (i = 0; i < batch->count && !agg->error; i++) {
+            ftagg_table_add(&(agg->table), &(batch->fts[i]));
+            if (agg->table.count >= agg->maxtuples &&
+                    spill_aggregator_table(agg) < 0) {
+                agg->error = 1;
+                break;
+            }
+        }
+        free(batch);
+    }
+
+    if (!halted && !agg->error && agg->table.count > 0 &&
+            (agg->sortfinal || agg->runcount > 0)) {
+        if (spill_aggregator_table(agg) < 0) {
+            agg->error = 1;
+        }
+    }
     pthread_exit(NULL);
 }
 
@@ -338,7 +615,7 @@ endreader:
  *              tcount      the number of reader threads that have been started
  */
 void run_merger(corsaro_logger_t *logger, corsaro_avro_writer_t *avwrt,
-        void *zmq_ctxt, int tcount) {
+        corsaro_ftindex_writer_t *idxwrt, void *zmq_ctxt, int tcount) {
     void **insocks;
     int inhwm = 100;
     int i, ret;
@@ -395,13 +672,15 @@ void run_merger(corsaro_logger_t *logger, corsaro_avro_writer_t *avwrt,
             combine_flowtuple_records(prev, next);
             free(prev);
         } else if (prev) {
-            encode_flowtuple_as_avro(&(prev->ft), avwrt, logger);
+            ftdata_encode(&(prev->ft), avwrt, logger);
     		if (corsaro_append_avro_writer(avwrt, NULL) < 0) {
 	    		corsaro_log(logger, "Error while writing merged avro record...");
-		    }
-            if (prev->ft.interval_ts != next->ft.interval_ts) {
+		    } else if (idxwrt) {
+                corsaro_ftindex_add_record(idxwrt, avwrt, &(prev->ft.v4));
+            }
+            if (ftdata_interval(&(prev->ft)) != ftdata_interval(&(next->ft))) {
                 corsaro_log(logger, "Merged all flowtuples from interval %u",
-                        prev->ft.interval_ts);
+                        ftdata_interval(&(prev->ft)));
             }
             free(prev);
         }
@@ -437,12 +716,14 @@ void run_merger(corsaro_logger_t *logger, corsaro_avro_writer_t *avwrt,
 
     /* Make sure we write out the last flowtuple */
     if (prev != NULL) {
-        encode_flowtuple_as_avro(&(prev->ft), avwrt, logger);
+        ftdata_encode(&(prev->ft), avwrt, logger);
         if (corsaro_append_avro_writer(avwrt, NULL) < 0) {
             corsaro_log(logger, "Error while writing merged avro record...");
+        } else if (idxwrt) {
+            corsaro_ftindex_add_record(idxwrt, avwrt, &(prev->ft.v4));
         }
         corsaro_log(logger, "Merged all flowtuples from final interval %u",
-                prev->ft.interval_ts);
+                ftdata_interval(&(prev->ft)));
     }
 
 endmerger:
@@ -458,19 +739,365 @@ endmerger:
 	pqueue_free(pq);
 }
 
-int main(int argc, char *argv[]) {
-    char *outputpath = NULL;
-    int input_c, i;
-    struct sigaction sigact;
+/** Merges a set of sorted avro flowtuple files into a single output
+ *  file, using one reader thread per file.
+ *
+ *  Parameters: logger      a corsaro logging instance
+ *              avwrt       an open and started corsaro avro writer instance
+ *              idxwrt      an optional flowtuple index writer (may be NULL)
+ *              zmq_ctxt    the zeromq context for this process
+ *              files       the names of the files to merge
+ *              count       the number of files to merge
+ *              decodethreads   the number of threads to decode each file with
+ *
+ *  Returns: 0 if successful, -1 if the merge could not be started.
+ */
+static int merge_sorted_files(corsaro_logger_t *logger,
+        corsaro_avro_writer_t *avwrt, corsaro_ftindex_writer_t *idxwrt,
+        void *zmq_ctxt, char **files, int count, int decodethreads) {
+
+    avromerge_reader_t *readers;
+    void **push_sockets;
     sigset_t sig_before, sig_block_all;
+    int outhwm = 100;
+    int i, started = 0, ret = -1;
+
+    readers = calloc(count, sizeof(avromerge_reader_t));
+    push_sockets = calloc(count, sizeof(void *));
+
+    sigemptyset(&sig_block_all);
+    if (pthread_sigmask(SIG_SETMASK, &sig_block_all, &sig_before) < 0) {
+        corsaro_log(logger, "Error in pthread_sigmask?: %s", strerror(errno));
+        goto endmerge;
+    }
+
+    for (i = 0; i < count; i++) {
+        char sockname[1024];
+
+        /* Create the reader output sockets here, so we can close them
+         * once both the reader threads have ended and the merging process
+         * has finished reading from them. Helps avoid deadlocks on exit.
+         */
+        snprintf(sockname, 1024, "%s-%d", BASE_SOCKETNAME, i);
+        push_sockets[i] = zmq_socket(zmq_ctxt, ZMQ_PUSH);
+
+        if (zmq_setsockopt(push_sockets[i], ZMQ_SNDHWM, &outhwm,
+                sizeof(outhwm)) < 0) {
+            corsaro_log(logger, "Error configuring push socket %s: %s",
+                    sockname, strerror(errno));
+            goto endmerge;
+        }
+
+        if (zmq_bind(push_sockets[i], sockname) < 0) {
+            corsaro_log(logger, "Unable to bind push socket %s: %s",
+                    sockname, strerror(errno));
+            goto endmerge;
+        }
+
+        readers[i].readerid = i;
+        readers[i].sockname = strdup(sockname);
+        readers[i].source = files[i];
+        readers[i].logger = logger;
+        readers[i].decodethreads = decodethreads;
+        readers[i].outsock = push_sockets[i];
+        pthread_create(&(readers[i].threadid), NULL, start_reader, &(readers[i]));
+        started ++;
+    }
+
+    if (pthread_sigmask(SIG_SETMASK, &sig_before, NULL) < 0) {
+        corsaro_log(logger, "Error in pthread_sigmask?: %s", strerror(errno));
+        halted = 1;
+        goto endmerge;
+    }
+
+    run_merger(logger, avwrt, idxwrt, zmq_ctxt, count);
+    ret = 0;
+
+endmerge:
+    if (ret < 0) {
+        /* Make sure any readers that we did start will give up */
+        halted = 1;
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(readers[i].threadid, NULL);
+    }
+    for (i = 0; i < count; i++) {
+        if (push_sockets[i]) {
+            zmq_close(push_sockets[i]);
+        }
+        if (readers[i].sockname) {
+            free(readers[i].sockname);
+        }
+    }
+    free(readers);
+    free(push_sockets);
+    return ret;
+}
+
+/** Writes the contents of an aggregator's table directly to the output
+ *  file, without sorting them.
+ */
+static void write_unsorted_table(corsaro_logger_t *logger,
+        corsaro_avro_writer_t *avwrt, corsaro_ftindex_writer_t *idxwrt,
+        ftagg_table_t *table) {
+
+    uint64_t i;
+
+    for (i = 0; i < table->size && !halted; i++) {
+        if (!table->used[i]) {
+            continue;
+        }
+        ftdata_encode(FTAGG_SLOT(table, i), avwrt, logger);
+        if (corsaro_append_avro_writer(avwrt, NULL) < 0) {
+            corsaro_log(logger, "Error while writing merged avro record...");
+        } else if (idxwrt) {
+            corsaro_ftindex_add_record(idxwrt, avwrt,
+                    &(FTAGG_SLOT(table, i)->v4));
+        }
+    }
+}
+
+/** Combines the flowtuples from a set of (possibly unsorted) avro files
+ *  using hash aggregation, writing the results to the given avro writer.
+ *
+ *  Parameters: logger      a corsaro logging instance
+ *              avwrt       an open and started corsaro avro writer instance
+ *              idxwrt      an optional flowtuple index writer (may be NULL)
+ *              zmq_ctxt    the zeromq context for this process
+ *              files       the names of the files to aggregate
+ *              count       the number of files to aggregate
+ *              outputpath  the name of the output file, used as a prefix
+ *                          for any temporary run files
+ *              partitions  the number of aggregator threads to use
+ *              maxtuples   the number of flowtuples that may be held in
+ *                          memory (across all aggregators) before spilling
+ *              unsorted    if 1, the output does not need to be sorted
+ *              decodethreads   the number of threads to decode each file with
+ *
+ *  Returns: 0 if successful, -1 if an error occurred.
+ */
+static int run_aggregation(corsaro_logger_t *logger,
+        corsaro_avro_writer_t *avwrt, corsaro_ftindex_writer_t *idxwrt,
+        void *zmq_ctxt, char **files, int count, char *outputpath,
+        int partitions, uint64_t maxtuples, uint8_t unsorted,
+        int decodethreads) {
+
     avromerge_reader_t *readers;
+    avromerge_aggregator_t *aggs;
     void **push_sockets;
+    char **runs = NULL;
+    int runcount = 0;
+    sigset_t sig_before, sig_block_all;
+    int hwm = 16;
+    int i, j, rstarted = 0, astarted = 0, ret = -1;
+    char sockname[1024];
+
+    readers = calloc(count, sizeof(avromerge_reader_t));
+    aggs = calloc(partitions, sizeof(avromerge_aggregator_t));
+    push_sockets = calloc(count * partitions, sizeof(void *));
+
+    sigemptyset(&sig_block_all);
+    if (pthread_sigmask(SIG_SETMASK, &sig_block_all, &sig_before) < 0) {
+        corsaro_log(logger, "Error in pthread_sigmask?: %s", strerror(errno));
+        goto endagg;
+    }
+
+    /* Start the aggregators first, so that their sockets are bound
+     * before any of the readers try to connect to them.
+     */
+    for (i = 0; i < partitions; i++) {
+        snprintf(sockname, 1024, "%s-%d", AGG_SOCKETNAME, i);
+
+        aggs[i].aggid = i;
+        aggs[i].readercount = count;
+        aggs[i].maxtuples = maxtuples / partitions;
+        if (aggs[i].maxtuples == 0) {
+            aggs[i].maxtuples = 1;
+        }
+        aggs[i].runprefix = outputpath;
+        aggs[i].sortfinal = !unsorted;
+        aggs[i].logger = logger;
+
+        if (ftagg_table_init(&(aggs[i].table), aggs[i].maxtuples) < 0) {
+            corsaro_log(logger,
+                    "Unable to allocate aggregation table for %lu flowtuples",
+                    aggs[i].maxtuples);
+            goto endagg;
+        }
+
+        aggs[i].insock = zmq_socket(zmq_ctxt, ZMQ_PULL);
+        if (zmq_setsockopt(aggs[i].insock, ZMQ_RCVHWM, &hwm,
+                sizeof(hwm)) < 0) {
+            corsaro_log(logger, "Error configuring pull socket %s: %s",
+                    sockname, strerror(errno));
+            goto endagg;
+        }
+        if (zmq_bind(aggs[i].insock, sockname) < 0) {
+            corsaro_log(logger, "Unable to bind pull socket %s: %s",
+                    sockname, strerror(errno));
+            goto endagg;
+        }
+    }
+
+    for (i = 0; i < partitions; i++) {
+        pthread_create(&(aggs[i].threadid), NULL, start_aggregator,
+                &(aggs[i]));
+        astarted ++;
+    }
+
+    for (i = 0; i < count; i++) {
+        readers[i].readerid = i;
+        readers[i].source = files[i];
+        readers[i].logger = logger;
+        readers[i].decodethreads = decodethreads;
+        readers[i].aggcount = partitions;
+        readers[i].aggsocks = &(push_sockets[i * partitions]);
+
+        for (j = 0; j < partitions; j++) {
+            snprintf(sockname, 1024, "%s-%d", AGG_SOCKETNAME, j);
+            readers[i].aggsocks[j] = zmq_socket(zmq_ctxt, ZMQ_PUSH);
+
+            if (zmq_setsockopt(readers[i].aggsocks[j], ZMQ_SNDHWM, &hwm,
+                    sizeof(hwm)) < 0) {
+                corsaro_log(logger, "Error configuring push socket %s: %s",
+                        sockname, strerror(errno));
+                goto endagg;
+            }
+            if (zmq_connect(readers[i].aggsocks[j], sockname) < 0) {
+                corsaro_log(logger, "Unable to connect push socket %s: %s",
+                        sockname, strerror(errno));
+                goto endagg;
+            }
+        }
+
+        pthread_create(&(readers[i].threadid), NULL,
+                start_partitioning_reader, &(readers[i]));
+        rstarted ++;
+    }
+
+    if (pthread_sigmask(SIG_SETMASK, &sig_before, NULL) < 0) {
+        corsaro_log(logger, "Error in pthread_sigmask?: %s", strerror(errno));
+        goto endagg;
+    }
+
+    for (i = 0; i < rstarted; i++) {
+        pthread_join(readers[i].threadid, NULL);
+    }
+    rstarted = 0;
+    for (i = 0; i < astarted; i++) {
+        pthread_join(aggs[i].threadid, NULL);
+    }
+    astarted = 0;
+
+    if (halted) {
+        goto endagg;
+    }
+
+    for (i = 0; i < partitions; i++) {
+        if (aggs[i].error) {
+            corsaro_log(logger, "Aggregator %d failed -- not writing output",
+                    i);
+            goto endagg;
+        }
+    }
+
+    /* Any aggregators that didn't have to spill can write their tables
+     * straight out if we don't care about the order. Everything else has
+     * been written to sorted runs which now need to be merged.
+     */
+    for (i = 0; i < partitions; i++) {
+        if (aggs[i].runcount == 0) {
+            if (unsorted) {
+                write_unsorted_table(logger, avwrt, idxwrt,
+                        &(aggs[i].table));
+            }
+            continue;
+        }
+        runs = realloc(runs, (runcount + aggs[i].runcount) * sizeof(char *));
+        for (j = 0; j < aggs[i].runcount; j++) {
+            runs[runcount] = aggs[i].runs[j];
+            runcount ++;
+        }
+    }
+
+    for (i = 0; i < partitions; i++) {
+        ftagg_table_free(&(aggs[i].table));
+    }
+
+    if (runcount > 0) {
+        corsaro_log(logger, "Merging %d sorted aggregation runs", runcount);
+        if (merge_sorted_files(logger, avwrt, idxwrt, zmq_ctxt, runs,
+                    runcount, decodethreads) < 0) {
+            goto endagg;
+        }
+    }
+    ret = 0;
+
+endagg:
+    if (ret < 0) {
+        halted = 1;
+    }
+    for (i = 0; i < rstarted; i++) {
+        pthread_join(readers[i].threadid, NULL);
+    }
+    for (i = 0; i < astarted; i++) {
+        pthread_join(aggs[i].threadid, NULL);
+    }
+    for (i = 0; i < count * partitions; i++) {
+        if (push_sockets[i]) {
+            zmq_close(push_sockets[i]);
+        }
+    }
+    for (i = 0; i < partitions; i++) {
+        if (aggs[i].insock) {
+            zmq_close(aggs[i].insock);
+        }
+        ftagg_table_free(&(aggs[i].table));
+        for (j = 0; j < aggs[i].runcount; j++) {
+            unlink(aggs[i].runs[j]);
+            free(aggs[i].runs[j]);
+        }
+        free(aggs[i].runs);
+    }
+    free(runs);
+    free(aggs);
+    free(readers);
+    free(push_sockets);
+    return ret;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] -o outputfile inputfile [inputfile ...]\n\n"
+        "Options:\n"
+        "  -o, --outputfile=FILE   write the merged flowtuples to FILE\n"
+        "  -l, --log=MODE          log to stderr, syslog or disabled\n"
+        "  -a, --aggregate         use hash aggregation (inputs need not be sorted)\n"
+        "  -p, --partitions=N      number of aggregator threads (default %d)\n"
+        "  -m, --maxtuples=N       flowtuples to hold in memory before spilling\n"
+        "                          to disk (default %d)\n"
+        "  -u, --unsorted          don't sort the aggregated output\n"
+        "  -t, --decodethreads=N   threads used to decode each input (default %d)\n"
+        "  -6, --ipv6              merge IPv6 flowtuple files (flowtuple6)\n"
+        "  -h, --help              display this message\n",
+        prog, AGG_DEFAULT_PARTITIONS, AGG_DEFAULT_MAX_TUPLES,
+        DEFAULT_DECODE_THREADS);
+}
+
+int main(int argc, char *argv[]) {
+    char *outputpath = NULL;
+    int input_c, ret;
+    struct sigaction sigact;
     corsaro_logger_t *logger;
     void *zmq_ctxt;
 	corsaro_avro_writer_t *avwrt = NULL;
-    int outhwm = 100;
+    corsaro_ftindex_writer_t *idxwrt = NULL;
 	int logmode = GLOBAL_LOGMODE_STDERR;
 	char *logmodestr = NULL;
+    uint8_t aggregate = 0, unsorted = 0;
+    int partitions = AGG_DEFAULT_PARTITIONS;
+    uint64_t maxtuples = AGG_DEFAULT_MAX_TUPLES;
+    int decodethreads = DEFAULT_DECODE_THREADS;
 
     sigact.sa_handler = cleanup_signal;
     sigemptyset(&sigact.sa_mask);
@@ -480,17 +1107,23 @@ int main(int argc, char *argv[]) {
     sigaction(SIGTERM, &sigact, NULL);
     signal(SIGPIPE, SIG_IGN);
 
-    zmq_ctxt = zmq_ctx_new();
-
     while (1) {
         int optind;
         struct option long_options[] = {
             { "outputfile", 1, 0, 'o'},
             { "log", 1, 0, 'l'},
+            { "aggregate", 0, 0, 'a'},
+            { "partitions", 1, 0, 'p'},
+            { "maxtuples", 1, 0, 'm'},
+            { "unsorted", 0, 0, 'u'},
+            { "decodethreads", 1, 0, 't'},
+            { "ipv6", 0, 0, '6'},
+            { "help", 0, 0, 'h'},
             { NULL, 0, 0, 0 }
         };
 
-        int c  = getopt_long(argc, argv, "o:l:", long_options, &optind);
+        int c  = getopt_long(argc, argv, "o:l:ap:m:ut:6h", long_options,
+                &optind);
         if (c == -1) {
             break;
         }
@@ -502,6 +1135,30 @@ int main(int argc, char *argv[]) {
 			case 'l':
 				logmodestr = optarg;
 				break;
+            case 'a':
+                aggregate = 1;
+                break;
+            case 'p':
+                partitions = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                maxtuples = strtoul(optarg, NULL, 0);
+                break;
+            case 'u':
+                unsorted = 1;
+                break;
+            case 't':
+                decodethreads = strtoul(optarg, NULL, 0);
+                break;
+            case '6':
+                mergeipv6 = 1;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
         }
 
     }
@@ -542,58 +1199,32 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    /* Create one reader thread per input file specified on the command line */
-    input_c = argc - optind;
-    readers = calloc(input_c, sizeof(avromerge_reader_t));
-    push_sockets = calloc(input_c, sizeof(void *));
-
-    sigemptyset(&sig_block_all);
-    if (pthread_sigmask(SIG_SETMASK, &sig_block_all, &sig_before) < 0) {
-        corsaro_log(logger, "Error in pthread_sigmask?: %s", strerror(errno));
-        return 1;
+    if (unsorted && !aggregate) {
+        corsaro_log(logger,
+                "Unsorted output is only possible in aggregation mode (-a)");
+        return -1;
     }
 
-    for (i = 0; i < input_c; i++) {
-        char sockname[1024];
-
-        /* Create the reader output sockets here, so we can close them
-         * once both the reader threads have ended and the merging process
-         * has finished reading from them. Helps avoid deadlocks on exit.
-         */
-        snprintf(sockname, 1024, "%s-%d", BASE_SOCKETNAME, i);
-        push_sockets[i] = zmq_socket(zmq_ctxt, ZMQ_PUSH);
-
-        if (zmq_setsockopt(push_sockets[i], ZMQ_SNDHWM, &outhwm,
-                sizeof(outhwm)) < 0) {
-            corsaro_log(logger, "Error configuring push socket %s: %s",
-                    sockname, strerror(errno));
-            return 1;
-        }
-
-        if (zmq_bind(push_sockets[i], sockname) < 0) {
-            corsaro_log(logger, "Unable to bind push socket %s: %s",
-                    sockname, strerror(errno));
-            return 1;
-        }
-
-        readers[i].readerid = i;
-        readers[i].sockname = strdup(sockname);
-        readers[i].source = argv[optind+i];
-        readers[i].logger = logger;
-        readers[i].outsock = push_sockets[i];
-        pthread_create(&(readers[i].threadid), NULL, start_reader, &(readers[i]));
+    if (partitions <= 0) {
+        corsaro_log(logger, "Number of partitions must be at least 1");
+        return -1;
     }
 
-    if (pthread_sigmask(SIG_SETMASK, &sig_before, NULL) < 0) {
-        corsaro_log(logger, "Error in pthread_sigmask?: %s", strerror(errno));
-        return 1;
+    if (decodethreads <= 0) {
+        corsaro_log(logger, "Number of decoding threads must be at least 1");
+        return -1;
     }
 
+    input_c = argc - optind;
+    zmq_ctxt = zmq_ctx_new();
+
     /* Set up the avro writer that we're going to use for writing all
      * of the flowtuples to a single avro file on disk.
-     * FLOWTUPLE_RESULT_SCHEMA is defined in corsaro_flowtuple.h
+     * FLOWTUPLE_RESULT_SCHEMA and FLOWTUPLE6_RESULT_SCHEMA are defined in
+     * libcorsaro_flowtuple.h
      */
-	avwrt = corsaro_create_avro_writer(logger, FLOWTUPLE_RESULT_SCHEMA);
+	avwrt = corsaro_create_avro_writer(logger,
+            mergeipv6 ? FLOWTUPLE6_RESULT_SCHEMA : FLOWTUPLE_RESULT_SCHEMA);
 	if (avwrt == NULL) {
 		return 1;
 	}
@@ -602,17 +1233,43 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
-    run_merger(logger, avwrt, zmq_ctxt, input_c);
+    /* Write a block index alongside the merged file so that it can be
+     * queried without decoding the whole thing. If we can't, the merged
+     * file is still perfectly usable. The index only describes IPv4
+     * flowtuples.
+     */
+    if (!mergeipv6) {
+        idxwrt = corsaro_create_ftindex_writer(logger);
+    }
+    if (idxwrt && corsaro_start_ftindex_writer(idxwrt, avwrt) < 0) {
+        corsaro_destroy_ftindex_writer(idxwrt);
+        idxwrt = NULL;
+    }
+
+    if (aggregate) {
+        corsaro_log(logger,
+                "Aggregating %d inputs using %d partitions (%lu flowtuples in memory, %s output)",
+                input_c, partitions, maxtuples,
+                unsorted ? "unsorted" : "sorted");
+        ret = run_aggregation(logger, avwrt, idxwrt, zmq_ctxt,
+                &(argv[optind]), input_c, outputpath, partitions, maxtuples,
+                unsorted, decodethreads);
+    } else {
+        /* One reader thread per input file specified on the command line */
+        ret = merge_sorted_files(logger, avwrt, idxwrt, zmq_ctxt,
+                &(argv[optind]), input_c, decodethreads);
+    }
 
     /* All done -- tidy everything up */
-	corsaro_destroy_avro_writer(avwrt);
-    for (i = 0; i < input_c; i++) {
-        pthread_join(readers[i].threadid, NULL);
-        zmq_close(push_sockets[i]);
+    if (idxwrt) {
+        corsaro_close_ftindex_writer(idxwrt, avwrt);
+        corsaro_destroy_ftindex_writer(idxwrt);
     }
-    free(readers);
-    free(push_sockets);
+	corsaro_destroy_avro_writer(avwrt);
     zmq_ctx_destroy(zmq_ctxt);
+    if (ret < 0) {
+        return 1;
+    }
     return 0;
 
 }
@@ -0,0 +1,112 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ftagg.h"
+
+uint8_t mergeipv6 = 0;
+
+int ftdata_cmp_qsort(const void *a, const void *b) {
+    return ftdata_cmp((merge_ftdata_t *)a, (merge_ftdata_t *)b);
+}
+
+int ftagg_table_init(ftagg_table_t *table, uint64_t maxtuples) {
+    table->size = 1024;
+    while (table->size < maxtuples + (maxtuples / 3)) {
+        table->size <<= 1;
+    }
+    table->count = 0;
+    table->recsize = mergeipv6 ? sizeof(struct corsaro_flowtuple6_data) :
+            sizeof(struct corsaro_flowtuple_data);
+    table->slots = malloc(table->size * table->recsize);
+    table->used = calloc(table->size, sizeof(uint8_t));
+    if (table->slots == NULL || table->used == NULL) {
+        ftagg_table_free(table);
+        return -1;
+    }
+    return 0;
+}
+
+void ftagg_table_free(ftagg_table_t *table) {
+    free(table->slots);
+    free(table->used);
+    table->slots = NULL;
+    table->used = NULL;
+}
+
+uint64_t ftagg_table_sort(ftagg_table_t *table) {
+    uint64_t i, j;
+
+    /* Pack the used slots at the front of the table and sort them */
+    for (i = 0, j = 0; i < table->size; i++) {
+        if (!table->used[i]) {
+            continue;
+        }
+        if (i != j) {
+            memcpy(FTAGG_SLOT(table, j), FTAGG_SLOT(table, i),
+                    table->recsize);
+        }
+        j++;
+    }
+    assert(j == table->count);
+    qsort(table->slots, j, table->recsize, ftdata_cmp_qsort);
+    return j;
+}
+
+void ftagg_table_clear(ftagg_table_t *table) {
+    memset(table->used, 0, table->size * sizeof(uint8_t));
+    table->count = 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,259 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#ifndef CORSARO_FTMERGE_FTAGG_H_
+#define CORSARO_FTMERGE_FTAGG_H_
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "libcorsaro_flowtuple.h"
+
+/* Flowtuple comparison, combining and hash aggregation for corsaroftmerge.
+ *
+ * These are shared by the sorted merge and the aggregation mode of
+ * corsaroftmerge, and are kept separate from the avro / zeromq plumbing so
+ * that tests/bench_ftmerge_agg can exercise them directly.
+ */
+
+/** A flowtuple record of either address family. All of the inputs to a
+ *  single merge must be of the same family (see the -6 option).
+ */
+typedef union merge_ftdata {
+    struct corsaro_flowtuple_data v4;
+    struct corsaro_flowtuple6_data v6;
+} merge_ftdata_t;
+
+/** Set if we are merging IPv6 flowtuples. Must not change once any
+ *  aggregation tables have been created. */
+extern uint8_t mergeipv6;
+
+/** Open addressing (linear probing) table of flowtuples. The slots are
+ *  only as large as the flowtuple structure for the address family being
+ *  merged, so IPv4 tables are no bigger than they would be without IPv6
+ *  support.
+ */
+typedef struct ftagg_table {
+    /** The flowtuples themselves */
+    uint8_t *slots;
+    /** The size of each slot */
+    size_t recsize;
+    /** Flags indicating which slots are in use */
+    uint8_t *used;
+    /** The number of slots in the table (always a power of two) */
+    uint64_t size;
+    /** The number of slots in use */
+    uint64_t count;
+} ftagg_table_t;
+
+/** Returns a pointer to the flowtuple in a given aggregation table slot */
+#define FTAGG_SLOT(table, i) \
+    ((merge_ftdata_t *)((table)->slots + ((i) * (table)->recsize)))
+
+/** Compares two flowtuples using the flowtuple sort order */
+static inline int ftdata_cmp(merge_ftdata_t *a, merge_ftdata_t *b) {
+    if (mergeipv6) {
+        return corsaro_flowtuple6_data_cmp(&(a->v6), &(b->v6));
+    }
+    return corsaro_flowtuple_data_cmp(&(a->v4), &(b->v4));
+}
+
+#define FT_TAG_CMP(a, b, field) \
+    if ((a)->field != (b)->field) { \
+        return ((a)->field < (b)->field) ? -1 : 1; \
+    }
+
+/** Compares the derived properties (spoofing, masscan and geo / ASN tags)
+ *  of two flowtuples with the same key. Copies of the same flowtuple
+ *  written by different corsarotrace threads can disagree on these (e.g.
+ *  if the tagger reloaded its data part way through the interval), so we
+ *  need a total order to decide which copy to keep.
+ */
+static inline int ft_tags_cmp(merge_ftdata_t *a, merge_ftdata_t *b) {
+    if (mergeipv6) {
+        FT_TAG_CMP(&(a->v6), &(b->v6), is_spoofed);
+        FT_TAG_CMP(&(a->v6), &(b->v6), is_masscan);
+        FT_TAG_CMP(&(a->v6), &(b->v6), tagproviders);
+        FT_TAG_CMP(&(a->v6), &(b->v6), maxmind_continent);
+        FT_TAG_CMP(&(a->v6), &(b->v6), maxmind_country);
+        FT_TAG_CMP(&(a->v6), &(b->v6), netacq_continent);
+        FT_TAG_CMP(&(a->v6), &(b->v6), netacq_country);
+        FT_TAG_CMP(&(a->v6), &(b->v6), prefixasn);
+        return 0;
+    }
+    FT_TAG_CMP(&(a->v4), &(b->v4), is_spoofed);
+    FT_TAG_CMP(&(a->v4), &(b->v4), is_masscan);
+    FT_TAG_CMP(&(a->v4), &(b->v4), tagproviders);
+    FT_TAG_CMP(&(a->v4), &(b->v4), maxmind_continent);
+    FT_TAG_CMP(&(a->v4), &(b->v4), maxmind_country);
+    FT_TAG_CMP(&(a->v4), &(b->v4), netacq_continent);
+    FT_TAG_CMP(&(a->v4), &(b->v4), netacq_country);
+    FT_TAG_CMP(&(a->v4), &(b->v4), prefixasn);
+    return 0;
+}
+
+/** Adds the statistics from one flowtuple into an equivalent one.
+ *
+ *  The derived properties of the combined flowtuple are taken from
+ *  whichever of the two copies is ordered first by ft_tags_cmp(), so the
+ *  result does not depend on the order in which the copies arrived (which
+ *  is down to thread scheduling in both the merge and aggregation modes).
+ */
+static inline void ftdata_combine(merge_ftdata_t *into,
+        merge_ftdata_t *from) {
+
+    uint32_t pktcnt;
+
+    if (ft_tags_cmp(from, into) < 0) {
+        pktcnt = mergeipv6 ? into->v6.packet_cnt : into->v4.packet_cnt;
+        memcpy(into, from, mergeipv6 ? sizeof(struct corsaro_flowtuple6_data)
+                : sizeof(struct corsaro_flowtuple_data));
+        if (mergeipv6) {
+            into->v6.packet_cnt = pktcnt;
+        } else {
+            into->v4.packet_cnt = pktcnt;
+        }
+    }
+
+    if (mergeipv6) {
+        corsaro_combine_flowtuple6_data(&(into->v6), &(from->v6));
+    } else {
+        corsaro_combine_flowtuple_data(&(into->v4), &(from->v4));
+    }
+}
+
+/** Hashes all of the fields that make up a flowtuple's key (i.e. all of
+ *  the fields used by corsaro_flowtuple_data_cmp()). This extends the
+ *  standard flowtuple key hash with the interval and SYN properties, since
+ *  our inputs may cover more than one interval.
+ */
+static inline uint64_t ft_key_hash(merge_ftdata_t *ft) {
+    uint64_t h;
+
+    if (mergeipv6) {
+        struct corsaro_flowtuple6_data *f6 = &(ft->v6);
+
+        h = corsaro_flowtuple6_key_hash(f6->src_ip, f6->dst_ip,
+                f6->src_port, f6->dst_port, f6->protocol, f6->ttl,
+                f6->tcp_flags, f6->ip_len);
+        return corsaro_flowtuple_mum(h ^ (((uint64_t)f6->interval_ts) << 32),
+                (((uint64_t)f6->tcp_synlen) << 16 | f6->tcp_synwinlen) ^
+                0x589965cc75374cc3ULL);
+    }
+
+    h = corsaro_flowtuple_key_hash(ft->v4.src_ip, ft->v4.dst_ip,
+            ft->v4.src_port, ft->v4.dst_port, ft->v4.protocol, ft->v4.ttl,
+            ft->v4.tcp_flags, ft->v4.ip_len);
+    return corsaro_flowtuple_mum(h ^ (((uint64_t)ft->v4.interval_ts) << 32),
+            (((uint64_t)ft->v4.tcp_synlen) << 16 | ft->v4.tcp_synwinlen) ^
+            0x589965cc75374cc3ULL);
+}
+
+/** Adds a flowtuple to an aggregation table, combining it with any
+ *  existing flowtuple with the same key. The table must have room for
+ *  another flowtuple, see ftagg_table_init().
+ */
+static inline void ftagg_table_add(ftagg_table_t *table,
+        merge_ftdata_t *ft) {
+
+    uint64_t mask = table->size - 1;
+    uint64_t i = ft_key_hash(ft) & mask;
+
+    while (table->used[i]) {
+        if (ftdata_cmp(FTAGG_SLOT(table, i), ft) == 0) {
+            ftdata_combine(FTAGG_SLOT(table, i), ft);
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    table->used[i] = 1;
+    memcpy(FTAGG_SLOT(table, i), ft, table->recsize);
+    table->count ++;
+}
+
+/** Creates an aggregation table that can hold at least 'maxtuples'
+ *  flowtuples without becoming too full.
+ *
+ *  @param table        The table to initialise.
+ *  @param maxtuples    The number of flowtuples the table must hold.
+ *
+ *  @return 0 if successful, -1 if we ran out of memory.
+ */
+int ftagg_table_init(ftagg_table_t *table, uint64_t maxtuples);
+
+/** Frees the memory used by an aggregation table.
+ *
+ *  @param table        The table to free.
+ */
+void ftagg_table_free(ftagg_table_t *table);
+
+/** Packs the flowtuples in an aggregation table into the first 'count'
+ *  slots and sorts them into the flowtuple sort order. The table can no
+ *  longer be added to until ftagg_table_clear() is called.
+ *
+ *  @param table        The table to sort.
+ *
+ *  @return the number of flowtuples in the table.
+ */
+uint64_t ftagg_table_sort(ftagg_table_t *table);
+
+/** Removes all of the flowtuples from an aggregation table.
+ *
+ *  @param table        The table to empty.
+ */
+void ftagg_table_clear(ftagg_table_t *table);
+
+/** qsort() comparison function for flowtuples, using the flowtuple sort
+ *  order */
+int ftdata_cmp_qsort(const void *a, const void *b);
+
+#endif
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,318 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include "libcorsaro_log.h"
+#include "libcorsaro_avro.h"
+#include "libcorsaro_flowtuple.h"
+#include "libcorsaro_ftindex.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+/** Tool that prints the flowtuples from one or more flowtuple avro files
+ *  that match a simple query. If an avro file has a block index (see
+ *  libcorsaro_ftindex.h), only the parts of the file that might contain
+ *  matching flowtuples are decoded.
+ */
+
+volatile int halted = 0;
+
+static void cleanup_signal(int sig) {
+    (void)sig;
+    halted = 1;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] <input file 1> ... <input file N>\n\n"
+        "Options:\n"
+        "  -s, --srcip <addr>[/<bits>]  match flowtuples from this source address or prefix\n"
+        "  -d, --dstport <port>         match flowtuples with this destination port\n"
+        "  -P, --protocol <proto>       match flowtuples with this IP protocol number\n"
+        "  -S, --start <ts>             match flowtuples from intervals starting at or after <ts>\n"
+        "  -E, --end <ts>               match flowtuples from intervals starting at or before <ts>\n"
+        "  -c, --count                  only print the number of matching flowtuples\n"
+        "  -l, --log <mode>             log mode: stderr, syslog or disabled\n"
+        "  -h, --help                   print this message\n",
+        prog);
+}
+
+/** Parses an address or prefix (e.g. "192.0.2.0/24") into the range of
+ *  source addresses to match, in host byte order.
+ */
+static int parse_srcip_option(char *arg, corsaro_ftindex_query_t *query) {
+
+    char buf[128];
+    char *slash;
+    struct in_addr addr;
+    unsigned long bits = 32;
+    uint32_t mask;
+
+    if (strlen(arg) >= sizeof(buf)) {
+        return -1;
+    }
+    strcpy(buf, arg);
+
+    slash = strchr(buf, '/');
+    if (slash) {
+        *slash = '\0';
+        bits = strtoul(slash + 1, NULL, 10);
+        if (bits > 32) {
+            return -1;
+        }
+    }
+
+    if (inet_pton(AF_INET, buf, &addr) != 1) {
+        return -1;
+    }
+
+    mask = (bits == 0) ? 0 : (0xFFFFFFFF << (32 - bits));
+    query->match_src_ip = 1;
+    query->first_src_ip = ntohl(addr.s_addr) & mask;
+    query->last_src_ip = query->first_src_ip | (~mask);
+    return 0;
+}
+
+static void print_flowtuple(struct corsaro_flowtuple_data *ft) {
+
+    char srcstr[INET_ADDRSTRLEN];
+    char dststr[INET_ADDRSTRLEN];
+    struct in_addr addr;
+
+    addr.s_addr = htonl(ft->src_ip);
+    inet_ntop(AF_INET, &addr, srcstr, sizeof(srcstr));
+    addr.s_addr = htonl(ft->dst_ip);
+    inet_ntop(AF_INET, &addr, dststr, sizeof(dststr));
+
+    printf("%u|%s|%s|%u|%u|%u|%u|0x%02x|%u|%u\n", ft->interval_ts, srcstr,
+            dststr, ft->src_port, ft->dst_port, ft->protocol, ft->ttl,
+            ft->tcp_flags, ft->ip_len, ft->packet_cnt);
+}
+
+int main(int argc, char *argv[]) {
+    struct sigaction sigact;
+    corsaro_logger_t *logger;
+    corsaro_ftindex_query_t query;
+    corsaro_ftindex_reader_t *reader;
+    struct corsaro_flowtuple_data ft;
+    int logmode = GLOBAL_LOGMODE_STDERR;
+    char *logmodestr = NULL;
+    int countonly = 0, i, ret = 0, errors = 0;
+    uint64_t matched = 0;
+    unsigned long val;
+
+    memset(&query, 0, sizeof(query));
+
+    sigact.sa_handler = cleanup_signal;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = SA_RESTART;
+
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (1) {
+        int optind;
+        struct option long_options[] = {
+            { "srcip", 1, 0, 's'},
+            { "dstport", 1, 0, 'd'},
+            { "protocol", 1, 0, 'P'},
+            { "start", 1, 0, 'S'},
+            { "end", 1, 0, 'E'},
+            { "count", 0, 0, 'c'},
+            { "log", 1, 0, 'l'},
+            { "help", 0, 0, 'h'},
+            { NULL, 0, 0, 0 }
+        };
+
+        int c  = getopt_long(argc, argv, "s:d:P:S:E:cl:h", long_options,
+                &optind);
+        if (c == -1) {
+            break;
+        }
+
+        switch(c) {
+            case 's':
+                if (parse_srcip_option(optarg, &query) < 0) {
+                    fprintf(stderr, "corsaroftquery: invalid source address: %s\n",
+                            optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                val = strtoul(optarg, NULL, 10);
+                if (val > 65535) {
+                    fprintf(stderr, "corsaroftquery: invalid port: %s\n",
+                            optarg);
+                    return 1;
+                }
+                query.match_dst_port = 1;
+                query.dst_port = (uint16_t)val;
+                break;
+            case 'P':
+                val = strtoul(optarg, NULL, 10);
+                if (val > 255) {
+                    fprintf(stderr, "corsaroftquery: invalid protocol: %s\n",
+                            optarg);
+                    return 1;
+                }
+                query.match_protocol = 1;
+                query.protocol = (uint8_t)val;
+                break;
+            case 'S':
+                if (!query.match_time) {
+                    query.last_ts = 0xFFFFFFFF;
+                }
+                query.match_time = 1;
+                query.first_ts = strtoul(optarg, NULL, 10);
+                break;
+            case 'E':
+                if (!query.match_time) {
+                    query.first_ts = 0;
+                }
+                query.match_time = 1;
+                query.last_ts = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                countonly = 1;
+                break;
+            case 'l':
+                logmodestr = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    /* Configure our logging */
+    if (logmodestr != NULL) {
+        if (strcmp(logmodestr, "stderr") == 0 ||
+                    strcmp(logmodestr, "terminal") == 0) {
+            logmode = GLOBAL_LOGMODE_STDERR;
+        } else if (strcmp(logmodestr, "syslog") == 0) {
+            logmode = GLOBAL_LOGMODE_SYSLOG;
+        } else if (strcmp(logmodestr, "disabled") == 0 ||
+                strcmp(logmodestr, "off") == 0 ||
+                strcmp(logmodestr, "none") == 0) {
+            logmode = GLOBAL_LOGMODE_DISABLED;
+        } else {
+            fprintf(stderr, "corsaroftquery: unexpected logmode: %s\n",
+                    logmodestr);
+            return 1;
+        }
+    }
+
+    if (logmode == GLOBAL_LOGMODE_STDERR) {
+        logger = init_corsaro_logger("corsaroftquery", "");
+    } else if (logmode == GLOBAL_LOGMODE_SYSLOG) {
+        logger = init_corsaro_logger("corsaroftquery", NULL);
+    } else {
+        logger = NULL;
+    }
+
+    if (optind >= argc) {
+        corsaro_log(logger, "No inputs specified -- exiting");
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (i = optind; i < argc && !halted; i++) {
+        reader = corsaro_create_ftindex_reader(logger, argv[i], &query);
+        if (reader == NULL) {
+            errors ++;
+            continue;
+        }
+
+        while (!halted &&
+                (ret = corsaro_read_next_ftindex_record(reader, &ft)) > 0) {
+            matched ++;
+            if (!countonly) {
+                print_flowtuple(&ft);
+            }
+        }
+
+        if (ret < 0) {
+            errors ++;
+        }
+
+        if (reader->indexed) {
+            corsaro_log(logger, "%s: decoded %u of %u indexed runs", argv[i],
+                    reader->runs_selected, reader->runs_total);
+        } else {
+            corsaro_log(logger, "%s: no usable block index, decoded the whole file",
+                    argv[i]);
+        }
+        corsaro_destroy_ftindex_reader(reader);
+    }
+
+    if (countonly) {
+        printf("%" PRIu64 "\n", matched);
+    }
+
+    if (logger) {
+        destroy_corsaro_logger(logger);
+    }
+
+    if (errors > 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,1138 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include "config.h"
+#include "libcorsaro_log.h"
+#include "libcorsaro_trace.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <libtrace.h>
+
+/** Tool that writes synthetic darknet traffic to trace files, so that
+ *  performance changes can be evaluated against reproducible inputs
+ *  rather than production captures that cannot be shared.
+ *
+ *  Each packet belongs to one of four traffic classes:
+ *   - Mirai-style TCP SYN scans from a fixed population of scanners
+ *   - backscatter (SYN-ACKs, RSTs and ICMP) from DoS victims
+ *   - UDP amplification responses from reflectors
+ *   - spoofed TCP SYNs from random sources, which only occur during
+ *     periodic bursts
+ *
+ *  Scanner, victim and reflector activity and the choice of darknet
+ *  destination all follow Zipf-like distributions, so a small number of
+ *  sources and destinations account for most of the packets.
+ *
+ *  The requested time span is split into fixed length chunks and each
+ *  chunk is written to its own file by whichever thread claims it. Every
+ *  random choice for a chunk comes from an RNG seeded by the global seed
+ *  and the chunk index, so the same seed and options always produce the
+ *  same files regardless of the number of threads.
+ */
+
+/** Largest frame that we will ever generate (not including the pcap
+ *  header) */
+#define GEN_MAX_FRAME 1514
+
+/** Length, in seconds, of the windows that may contain a spoofed burst */
+#define GEN_BURST_WINDOW 10
+
+enum {
+    GEN_CLASS_SCAN,
+    GEN_CLASS_BACKSCATTER,
+    GEN_CLASS_AMPLIFICATION,
+    GEN_CLASS_SPOOFED,
+    GEN_CLASS_COUNT
+};
+
+/** A preset traffic profile */
+typedef struct gen_profile {
+    const char *name;
+    const char *description;
+
+    /** Relative weight of each traffic class outside of spoofed bursts.
+     *  The spoofed weight only applies during a burst. */
+    double weights[GEN_CLASS_COUNT];
+
+    uint32_t scanners;
+    uint32_t victims;
+    uint32_t reflectors;
+
+    /** Zipf exponent for the darknet destination addresses (0 for
+     *  uniform) */
+    double dstskew;
+    /** Zipf exponent for picking scanners, victims and reflectors */
+    double srcskew;
+    /** Probability that any given burst window contains a burst */
+    double burstprob;
+} gen_profile_t;
+
+static const gen_profile_t gen_profiles[] = {
+    { "mixed", "a blend of all traffic classes",
+      { 0.70, 0.15, 0.10, 0.50 }, 100000, 2000, 20000, 0.8, 1.1, 0.1 },
+    { "mirai", "Mirai-style TCP SYN scans only",
+      { 1.00, 0.00, 0.00, 0.00 }, 250000, 0, 0, 0.0, 1.0, 0.0 },
+    { "backscatter", "DoS backscatter only",
+      { 0.00, 1.00, 0.00, 0.00 }, 0, 5000, 0, 0.5, 1.3, 0.0 },
+    { "amplification", "UDP amplification responses only",
+      { 0.00, 0.00, 1.00, 0.00 }, 0, 0, 50000, 1.0, 1.2, 0.0 },
+    { "spoofed", "background scanning with frequent spoofed bursts",
+      { 0.90, 0.10, 0.00, 4.00 }, 50000, 1000, 0, 0.6, 1.1, 0.5 },
+    { NULL, NULL, { 0, 0, 0, 0 }, 0, 0, 0, 0, 0, 0 }
+};
+
+/** Well known services that are abused for amplification, along with the
+ *  range of UDP payload sizes that they respond with */
+static const struct {
+    uint16_t port;
+    uint16_t minlen;
+    uint16_t maxlen;
+} gen_amp_services[] = {
+    { 53, 1200, 1472 },     /* DNS ANY */
+    { 123, 468, 468 },      /* NTP monlist */
+    { 1900, 280, 360 },     /* SSDP */
+    { 11211, 1400, 1472 },  /* memcached */
+    { 19, 300, 1024 },      /* chargen */
+};
+
+#define GEN_AMP_SERVICE_COUNT \
+    (sizeof(gen_amp_services) / sizeof(gen_amp_services[0]))
+
+typedef struct pcaphdr_t {
+    uint32_t ts_sec;        /* Seconds portion of the timestamp */
+    uint32_t ts_usec;       /* Microseconds portion of the timestamp */
+    uint32_t caplen;        /* Capture length of the packet */
+    uint32_t wirelen;       /* The wire length of the packet */
+} pcaphdr_t;
+
+/** xorshift128+ RNG state */
+typedef struct gen_rng {
+    uint64_t s[2];
+} gen_rng_t;
+
+/** State shared by all of the generator threads */
+typedef struct gen_global {
+    corsaro_logger_t *logger;
+    gen_profile_t profile;
+
+    char *template;
+    int compresslevel;
+    trace_option_compresstype_t compressmethod;
+
+    uint64_t seed;
+    uint32_t starttime;
+    uint32_t duration;
+    uint32_t chunklen;
+    uint64_t rate;
+
+    uint32_t darknet;
+    uint32_t darknetmask;
+    uint8_t darknetbits;
+
+    uint32_t chunkcount;
+    uint32_t nextchunk;
+    pthread_mutex_t mutex;
+
+    uint64_t packets;
+    uint64_t bytes;
+    int errors;
+} gen_global_t;
+
+/** Per-thread generator state */
+typedef struct gen_thread {
+    gen_global_t *glob;
+    pthread_t tid;
+    gen_rng_t rng;
+    libtrace_t *deadtrace;
+    libtrace_packet_t *packet;
+
+    /** Precomputed terms for the Zipf samplers */
+    double dstexp, dstscale;
+} gen_thread_t;
+
+volatile int halted = 0;
+
+static void cleanup_signal(int sig) {
+    (void)sig;
+    halted = 1;
+}
+
+static void usage(char *prog) {
+    int i;
+
+    fprintf(stderr,
+        "Usage: %s [options] -o <output template>\n\n"
+        "Options:\n"
+        "  -o, --output <uri>       output trace URI, e.g. pcapfile:/tmp/gen-%%s.pcap.gz\n"
+        "                           (%%s is replaced by the chunk start time)\n"
+        "  -p, --profile <name>     traffic profile to generate (default mixed)\n"
+        "  -r, --rate <pps>         packets per second to generate (default 1000000)\n"
+        "  -d, --duration <secs>    length of the trace to generate (default 300)\n"
+        "  -c, --chunk <secs>       length of each output file (default 60)\n"
+        "  -S, --start <ts>         unix timestamp of the first packet (default 1600000000)\n"
+        "  -s, --seed <n>           seed for the random number generator (default 1)\n"
+        "  -n, --darknet <prefix>   darknet prefix to send packets to (default 10.0.0.0/8)\n"
+        "  -P, --scanners <n>       override the size of the scanner population\n"
+        "  -V, --victims <n>        override the number of DoS victims\n"
+        "  -a, --dstskew <alpha>    override the skew of the destination addresses\n"
+        "  -t, --threads <n>        number of threads to generate with (default 4)\n"
+        "  -z, --compresslevel <n>  compression level for output files (default 0)\n"
+        "  -m, --compressmethod <m> compression method: gzip, bzip2, lzo or lzma\n"
+        "  -l, --log <mode>         log mode: stderr, syslog or disabled\n"
+        "  -h, --help               print this message\n\n"
+        "Profiles:\n",
+        prog);
+
+    for (i = 0; gen_profiles[i].name != NULL; i++) {
+        fprintf(stderr, "  %-14s %s\n", gen_profiles[i].name,
+                gen_profiles[i].description);
+    }
+}
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void seed_rng(gen_rng_t *rng, uint64_t seed, uint64_t stream) {
+    uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ULL);
+
+    rng->s[0] = splitmix64(&x);
+    rng->s[1] = splitmix64(&x);
+}
+
+static inline uint64_t rng_next(gen_rng_t *rng) {
+    uint64_t s1 = rng->s[0];
+    const uint64_t s0 = rng->s[1];
+
+    rng->s[0] = s0;
+    s1 ^= s1 << 23;
+    rng->s[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+    return rng->s[1] + s0;
+}
+
+/** Returns a uniformly distributed double in [0, 1) */
+static inline double rng_double(gen_rng_t *rng) {
+    return (rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/** Returns a uniformly distributed integer in [0, n) */
+static inline uint32_t rng_below(gen_rng_t *rng, uint32_t n) {
+    return (uint32_t)(((rng_next(rng) >> 32) * (uint64_t)n) >> 32);
+}
+
+/** Draws a rank in [0, n) from a continuous approximation of a Zipf
+ *  distribution with the given exponent, using inverse transform
+ *  sampling.
+ */
+static inline uint32_t rng_zipf(gen_rng_t *rng, uint32_t n, double skew) {
+    double u = rng_double(rng), x;
+
+    if (n <= 1) {
+        return 0;
+    }
+    if (skew <= 0) {
+        return rng_below(rng, n);
+    }
+    if (fabs(skew - 1.0) < 1e-9) {
+        x = pow((double)n + 1, u);
+    } else {
+        x = pow((pow((double)n + 1, 1.0 - skew) - 1.0) * u + 1.0,
+                1.0 / (1.0 - skew));
+    }
+    if (x < 1.0) {
+        x = 1.0;
+    }
+    if (x - 1.0 >= n) {
+        return n - 1;
+    }
+    return (uint32_t)(x - 1.0);
+}
+
+/** Mixes a value into a well distributed 32 bit hash */
+static inline uint32_t mix32(uint64_t x) {
+    return (uint32_t)(splitmix64(&x) >> 32);
+}
+
+/** Maps the rank of a member of a population (scanner, victim, etc.) to
+ *  a stable, routable-looking IPv4 address (in host byte order).
+ */
+static uint32_t population_address(gen_global_t *glob, uint32_t salt,
+        uint32_t rank) {
+
+    uint32_t addr = mix32(glob->seed ^ ((uint64_t)salt << 32) ^ rank);
+    uint8_t first;
+
+    while (1) {
+        first = addr >> 24;
+        if (first != 0 && first != 10 && first != 127 && first < 224 &&
+                (addr & glob->darknetmask) != glob->darknet) {
+            break;
+        }
+        addr = mix32(addr);
+    }
+    return addr;
+}
+
+/** Picks the darknet destination for a packet. Ranks are scattered across
+ *  the darknet by multiplying with an odd constant, which is a bijection
+ *  modulo the (power of two) size of the darknet.
+ */
+static inline uint32_t pick_destination(gen_thread_t *gt) {
+    gen_global_t *glob = gt->glob;
+    uint32_t hostbits = 32 - glob->darknetbits;
+    uint64_t size = ((uint64_t)1) << hostbits;
+    uint64_t rank;
+
+    if (glob->profile.dstskew <= 0) {
+        rank = rng_next(&(gt->rng)) & (size - 1);
+    } else {
+        double x;
+
+        if (gt->dstexp == 0) {
+            x = pow((double)size + 1, rng_double(&(gt->rng)));
+        } else {
+            x = pow(gt->dstscale * rng_double(&(gt->rng)) + 1.0,
+                    gt->dstexp);
+        }
+        rank = (uint64_t)(x - 1.0);
+        if (rank >= size) {
+            rank = size - 1;
+        }
+        rank = (rank * 0x9E3779B1ULL + (glob->seed & 0xffffffff)) &
+                (size - 1);
+    }
+    return glob->darknet | (uint32_t)rank;
+}
+
+static uint16_t checksum_fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)(~sum);
+}
+
+static uint32_t checksum_add(uint32_t sum, const uint8_t *buf, uint32_t len) {
+    uint32_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += (buf[i] << 8) | buf[i + 1];
+    }
+    if (len & 1) {
+        sum += buf[len - 1] << 8;
+    }
+    return sum;
+}
+
+/** Fills in the Ethernet and IPv4 headers for a generated frame.
+ *
+ *  @return a pointer to the start of the transport header.
+ */
+static uint8_t *build_ip_header(uint8_t *frame, uint32_t src, uint32_t dst,
+        uint8_t proto, uint8_t ttl, uint16_t ipid, uint16_t iplen) {
+
+    libtrace_ether_t *eth = (libtrace_ether_t *)frame;
+    libtrace_ip_t *ip = (libtrace_ip_t *)(frame + sizeof(libtrace_ether_t));
+    static const uint8_t dmac[6] = {0x00, 0x1b, 0x21, 0x00, 0x00, 0x01};
+    static const uint8_t smac[6] = {0x00, 0x1b, 0x21, 0x00, 0x00, 0x02};
+
+    memcpy(eth->ether_dhost, dmac, 6);
+    memcpy(eth->ether_shost, smac, 6);
+    eth->ether_type = htons(TRACE_ETHERTYPE_IP);
+
+    memset(ip, 0, sizeof(libtrace_ip_t));
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(iplen);
+    ip->ip_id = htons(ipid);
+    ip->ip_ttl = ttl;
+    ip->ip_p = proto;
+    ip->ip_src.s_addr = htonl(src);
+    ip->ip_dst.s_addr = htonl(dst);
+    ip->ip_sum = htons(checksum_fold(checksum_add(0, (uint8_t *)ip,
+            sizeof(libtrace_ip_t))));
+
+    return ((uint8_t *)ip) + sizeof(libtrace_ip_t);
+}
+
+/** Computes the TCP or UDP checksum for a transport segment */
+static uint16_t transport_checksum(uint32_t src, uint32_t dst, uint8_t proto,
+        uint8_t *seg, uint16_t seglen) {
+
+    uint32_t sum = 0;
+
+    sum += (src >> 16) + (src & 0xffff);
+    sum += (dst >> 16) + (dst & 0xffff);
+    sum += proto;
+    sum += seglen;
+    return checksum_fold(checksum_add(sum, seg, seglen));
+}
+
+static uint16_t build_tcp(uint8_t *frame, uint32_t src, uint32_t dst,
+        uint16_t sport, uint16_t dport, uint32_t seq, uint32_t ack,
+        uint8_t flags, uint16_t window, uint8_t ttl, uint16_t ipid) {
+
+    uint16_t iplen = sizeof(libtrace_ip_t) + sizeof(libtrace_tcp_t);
+    uint8_t *l4 = build_ip_header(frame, src, dst, TRACE_IPPROTO_TCP, ttl,
+            ipid, iplen);
+    libtrace_tcp_t *tcp = (libtrace_tcp_t *)l4;
+
+    memset(tcp, 0, sizeof(libtrace_tcp_t));
+    tcp->source = htons(sport);
+    tcp->dest = htons(dport);
+    tcp->seq = htonl(seq);
+    tcp->ack_seq = htonl(ack);
+    tcp->doff = 5;
+    /* The flags byte follows the data offset */
+    *(l4 + 13) = flags;
+    tcp->window = htons(window);
+    tcp->check = htons(transport_checksum(src, dst, TRACE_IPPROTO_TCP, l4,
+            sizeof(libtrace_tcp_t)));
+
+    return sizeof(libtrace_ether_t) + iplen;
+}
+
+#define GEN_TCP_FIN 0x01
+#define GEN_TCP_SYN 0x02
+#define GEN_TCP_RST 0x04
+#define GEN_TCP_ACK 0x10
+
+/** Mirai scanners probe telnet (mostly on port 23) with a SYN whose
+ *  sequence number is equal to the destination address.
+ */
+static uint16_t build_scan(gen_thread_t *gt, uint8_t *frame) {
+    gen_global_t *glob = gt->glob;
+    uint32_t rank = rng_zipf(&(gt->rng), glob->profile.scanners,
+            glob->profile.srcskew);
+    uint32_t src = population_address(glob, 1, rank);
+    uint32_t dst = pick_destination(gt);
+    uint16_t dport = rng_below(&(gt->rng), 10) == 0 ? 2323 : 23;
+    /* hop count is a property of the scanner */
+    uint8_t ttl = 64 - (mix32(src) % 24);
+    uint64_t r = rng_next(&(gt->rng));
+
+    return build_tcp(frame, src, dst, 1024 + (r % 64511), dport, dst, 0,
+            GEN_TCP_SYN, (uint16_t)(r >> 16), ttl, (uint16_t)(r >> 32));
+}
+
+/** DoS victims reply to the spoofed packets that were sent to them, some
+ *  of which claimed to come from the darknet.
+ */
+static uint16_t build_backscatter(gen_thread_t *gt, uint8_t *frame) {
+    gen_global_t *glob = gt->glob;
+    uint32_t rank = rng_zipf(&(gt->rng), glob->profile.victims,
+            glob->profile.srcskew);
+    uint32_t src = population_address(glob, 2, rank);
+    uint32_t dst = pick_destination(gt);
+    uint32_t attr = mix32(src);
+    uint8_t ttl = (attr & 1 ? 128 : 64) - ((attr >> 1) % 20);
+    uint16_t sport = (attr >> 8) & 1 ? 443 : 80;
+    uint64_t r = rng_next(&(gt->rng));
+    uint32_t kind = rng_below(&(gt->rng), 100);
+    uint16_t iplen;
+    uint8_t *l4;
+    libtrace_icmp_t *icmp;
+    libtrace_ip_t *quoted;
+
+    if (kind < 60) {
+        return build_tcp(frame, src, dst, sport, 1024 + (r % 64511),
+                (uint32_t)(r >> 8), (uint32_t)r, GEN_TCP_SYN | GEN_TCP_ACK,
+                65535, ttl, (uint16_t)(r >> 32));
+    }
+    if (kind < 85) {
+        return build_tcp(frame, src, dst, sport, 1024 + (r % 64511), 0,
+                (uint32_t)r, GEN_TCP_RST | GEN_TCP_ACK, 0, ttl,
+                (uint16_t)(r >> 32));
+    }
+
+    /* ICMP echo reply or port unreachable quoting the original packet */
+    if (kind < 93) {
+        iplen = sizeof(libtrace_ip_t) + sizeof(libtrace_icmp_t);
+    } else {
+        iplen = sizeof(libtrace_ip_t) + sizeof(libtrace_icmp_t) +
+                sizeof(libtrace_ip_t) + 8;
+    }
+    l4 = build_ip_header(frame, src, dst, TRACE_IPPROTO_ICMP, ttl,
+            (uint16_t)(r >> 32), iplen);
+    icmp = (libtrace_icmp_t *)l4;
+    memset(icmp, 0, iplen - sizeof(libtrace_ip_t));
+
+    if (kind < 93) {
+        icmp->type = 0;
+        icmp->code = 0;
+        icmp->un.echo.id = htons((uint16_t)r);
+        icmp->un.echo.sequence = htons((uint16_t)(r >> 16));
+    } else {
+        icmp->type = 3;
+        icmp->code = 3;
+        quoted = (libtrace_ip_t *)(l4 + sizeof(libtrace_icmp_t));
+        quoted->ip_v = 4;
+        quoted->ip_hl = 5;
+        quoted->ip_len = htons(sizeof(libtrace_ip_t) + 8);
+        quoted->ip_ttl = 64;
+        quoted->ip_p = TRACE_IPPROTO_UDP;
+        quoted->ip_src.s_addr = htonl(dst);
+        quoted->ip_dst.s_addr = htonl(src);
+    }
+    icmp->checksum = htons(checksum_fold(checksum_add(0, l4,
+            iplen - sizeof(libtrace_ip_t))));
+    return sizeof(libtrace_ether_t) + iplen;
+}
+
+/** Reflectors send large UDP responses to the (spoofed) darknet address
+ *  that the request claimed to come from.
+ */
+static uint16_t build_amplification(gen_thread_t *gt, uint8_t *frame) {
+    gen_global_t *glob = gt->glob;
+    uint32_t rank = rng_zipf(&(gt->rng), glob->profile.reflectors,
+            glob->profile.srcskew);
+    uint32_t src = population_address(glob, 3, rank);
+    uint32_t dst = pick_destination(gt);
+    uint32_t attr = mix32(src);
+    int svc = attr % GEN_AMP_SERVICE_COUNT;
+    uint16_t paylen = gen_amp_services[svc].minlen + rng_below(&(gt->rng),
+            gen_amp_services[svc].maxlen - gen_amp_services[svc].minlen + 1);
+    uint16_t iplen = sizeof(libtrace_ip_t) + sizeof(libtrace_udp_t) + paylen;
+    uint64_t r = rng_next(&(gt->rng));
+    uint8_t *l4;
+    libtrace_udp_t *udp;
+
+    l4 = build_ip_header(frame, src, dst, TRACE_IPPROTO_UDP,
+            64 - ((attr >> 8) % 24), (uint16_t)(r >> 32), iplen);
+    udp = (libtrace_udp_t *)l4;
+    udp->source = htons(gen_amp_services[svc].port);
+    udp->dest = htons(1024 + (r % 64511));
+    udp->len = htons(sizeof(libtrace_udp_t) + paylen);
+    /* a checksum of zero means "no checksum" for UDP over IPv4 */
+    udp->check = 0;
+    memset(l4 + sizeof(libtrace_udp_t), 0, paylen);
+
+    return sizeof(libtrace_ether_t) + iplen;
+}
+
+/** Spoofed SYN floods use a fresh random source address for every packet
+ */
+static uint16_t build_spoofed(gen_thread_t *gt, uint8_t *frame) {
+    static const uint16_t ports[] = {80, 443, 22, 3389, 8080, 53};
+    uint32_t dst = pick_destination(gt);
+    uint64_t r = rng_next(&(gt->rng));
+    uint64_t r2 = rng_next(&(gt->rng));
+
+    return build_tcp(frame, (uint32_t)r, dst, 1024 + ((r >> 32) % 64511),
+            ports[(r2 >> 40) % 6], (uint32_t)r2, 0, GEN_TCP_SYN,
+            (uint16_t)(r2 >> 32), 32 + (r2 % 224), (uint16_t)(r >> 48));
+}
+
+/** Decides whether the burst window containing a timestamp has a spoofed
+ *  burst in it. This depends only on the seed, so bursts that span a
+ *  chunk boundary carry over into the next file.
+ */
+static inline int in_spoofed_burst(gen_global_t *glob, uint32_t ts) {
+    uint32_t window = ts / GEN_BURST_WINDOW;
+
+    if (glob->profile.burstprob <= 0) {
+        return 0;
+    }
+    return (mix32(glob->seed ^ 0xB0B5ULL ^ ((uint64_t)window << 16)) /
+            4294967296.0) < glob->profile.burstprob;
+}
+
+/** Populates a libtrace packet with a generated frame. Like
+ *  trace_construct_packet(), but reuses the packet buffer and lets us
+ *  set the timestamp.
+ */
+static void fill_packet(gen_thread_t *gt, uint32_t ts_sec, uint32_t ts_usec,
+        uint16_t len) {
+
+    libtrace_packet_t *packet = gt->packet;
+    pcaphdr_t *hdr = (pcaphdr_t *)packet->buffer;
+
+    hdr->ts_sec = ts_sec;
+    hdr->ts_usec = ts_usec;
+    hdr->caplen = len;
+    hdr->wirelen = len;
+
+    packet->trace = gt->deadtrace;
+    packet->buf_control = TRACE_CTRL_PACKET;
+    packet->header = packet->buffer;
+    packet->payload = ((char *)(packet->buffer) + sizeof(pcaphdr_t));
+    packet->type = TRACE_RT_DATA_DLT + TRACE_DLT_EN10MB;
+
+    packet->cached.l2_header = packet->payload;
+    packet->cached.l3_header = NULL;
+    packet->cached.l4_header = NULL;
+    packet->cached.link_type = TRACE_TYPE_ETH;
+    packet->cached.l3_ethertype = 0;
+    packet->cached.transport_proto = 0;
+    packet->cached.capture_length = len;
+    packet->cached.wire_length = len;
+    packet->cached.payload_length = -1;
+    packet->cached.l2_remaining = len;
+    packet->cached.l3_remaining = 0;
+    packet->cached.l4_remaining = 0;
+}
+
+/** Expands the output template for a chunk. '%s' is replaced with the
+ *  unix timestamp of the start of the chunk and any other modifiers are
+ *  passed to strftime().
+ */
+static char *derive_output_name(gen_global_t *glob, uint32_t timestamp) {
+    char scratch[4096];
+    char outname[4096];
+    char tsbuf[11];
+    char *ptr, *w = scratch, *end = scratch + sizeof(scratch) - 1;
+    struct tm tm;
+    time_t t = timestamp;
+
+    snprintf(tsbuf, sizeof(tsbuf), "%u", timestamp);
+    for (ptr = glob->template; *ptr && w < end; ptr++) {
+        if (*ptr == '%' && *(ptr + 1) == 's') {
+            char *ts = tsbuf;
+            while (*ts && w < end) {
+                *w++ = *ts++;
+            }
+            ptr ++;
+            continue;
+        }
+        *w++ = *ptr;
+    }
+    if (w >= end) {
+        return NULL;
+    }
+    *w = '\0';
+
+    gmtime_r(&t, &tm);
+    if (strftime(outname, sizeof(outname), scratch, &tm) == 0) {
+        return NULL;
+    }
+    return strdup(outname);
+}
+
+/** Generates and writes all of the packets for one chunk of time.
+ *
+ *  @return the number of packets written, or -1 if an error occurred.
+ */
+static int64_t generate_chunk(gen_thread_t *gt, uint32_t chunk,
+        uint64_t *bytes) {
+
+    gen_global_t *glob = gt->glob;
+    uint32_t chunkstart = glob->starttime + chunk * glob->chunklen;
+    uint32_t chunkend = chunkstart + glob->chunklen;
+    double cumw[2][GEN_CLASS_COUNT];
+    double totalw[2] = {0, 0};
+    double gap = 1000000000.0 / glob->rate, tsns = 0;
+    uint64_t chunkns;
+    libtrace_out_t *out;
+    uint8_t *frame;
+    char *outname;
+    int64_t written = 0;
+    int i, b, cls;
+
+    if (chunkend > glob->starttime + glob->duration) {
+        chunkend = glob->starttime + glob->duration;
+    }
+    chunkns = (uint64_t)(chunkend - chunkstart) * 1000000000ULL;
+
+    /* Cumulative class weights outside (0) and inside (1) a burst */
+    for (b = 0; b < 2; b++) {
+        for (i = 0; i < GEN_CLASS_COUNT; i++) {
+            if (i != GEN_CLASS_SPOOFED || b == 1) {
+                totalw[b] += glob->profile.weights[i];
+            }
+            cumw[b][i] = totalw[b];
+        }
+    }
+
+    outname = derive_output_name(glob, chunkstart);
+    if (outname == NULL) {
+        corsaro_log(glob->logger, "unable to derive output file name for chunk %u",
+                chunk);
+        return -1;
+    }
+
+    out = corsaro_create_trace_writer(glob->logger, outname,
+            glob->compresslevel, glob->compressmethod);
+    if (out == NULL) {
+        free(outname);
+        return -1;
+    }
+
+    seed_rng(&(gt->rng), glob->seed, chunk);
+    frame = ((uint8_t *)gt->packet->buffer) + sizeof(pcaphdr_t);
+
+    while (!halted) {
+        uint64_t now;
+        uint16_t len;
+        uint32_t ts_sec;
+        double u;
+
+        /* Poisson arrivals at the requested rate */
+        tsns += -log(1.0 - rng_double(&(gt->rng))) * gap;
+        now = (uint64_t)tsns;
+        if (now >= chunkns) {
+            break;
+        }
+        ts_sec = chunkstart + (uint32_t)(now / 1000000000ULL);
+
+        b = in_spoofed_burst(glob, ts_sec);
+        if (totalw[b] <= 0) {
+            continue;
+        }
+        u = rng_double(&(gt->rng)) * totalw[b];
+        for (cls = 0; cls < GEN_CLASS_COUNT - 1; cls++) {
+            if (u < cumw[b][cls]) {
+                break;
+            }
+        }
+        if (cls == GEN_CLASS_SPOOFED && b == 0) {
+            /* only reachable through rounding */
+            cls = GEN_CLASS_SCAN;
+        }
+
+        switch(cls) {
+            case GEN_CLASS_SCAN:
+                len = build_scan(gt, frame);
+                break;
+            case GEN_CLASS_BACKSCATTER:
+                len = build_backscatter(gt, frame);
+                break;
+            case GEN_CLASS_AMPLIFICATION:
+                len = build_amplification(gt, frame);
+                break;
+            default:
+                len = build_spoofed(gt, frame);
+                break;
+        }
+
+        fill_packet(gt, ts_sec,
+                (uint32_t)((now % 1000000000ULL) / 1000), len);
+        if (corsaro_write_packet(glob->logger, out, gt->packet) < 0) {
+            written = -1;
+            break;
+        }
+        written ++;
+        *bytes += len;
+    }
+
+    corsaro_destroy_trace_writer(out);
+    if (written >= 0) {
+        corsaro_log(glob->logger, "wrote %ld packets to %s", written,
+                outname);
+    }
+    free(outname);
+    return written;
+}
+
+static void *start_gen_thread(void *data) {
+    gen_thread_t *gt = (gen_thread_t *)data;
+    gen_global_t *glob = gt->glob;
+    uint32_t chunk;
+    uint64_t bytes;
+    int64_t written;
+    uint64_t dstsize = ((uint64_t)1) << (32 - glob->darknetbits);
+
+    /* The inverse CDF has a different form when the exponent is 1,
+     * which is flagged by leaving dstexp as zero */
+    if (glob->profile.dstskew > 0) {
+        if (fabs(glob->profile.dstskew - 1.0) < 1e-9) {
+            gt->dstexp = 0;
+        } else {
+            gt->dstexp = 1.0 / (1.0 - glob->profile.dstskew);
+            gt->dstscale = pow((double)dstsize + 1,
+                    1.0 - glob->profile.dstskew) - 1.0;
+        }
+    }
+
+    gt->deadtrace = trace_create_dead("pcapfile:-");
+    gt->packet = trace_create_packet();
+    gt->packet->buffer = malloc(sizeof(pcaphdr_t) + GEN_MAX_FRAME);
+
+    while (!halted) {
+        pthread_mutex_lock(&(glob->mutex));
+        chunk = glob->nextchunk;
+        if (chunk < glob->chunkcount) {
+            glob->nextchunk ++;
+        }
+        pthread_mutex_unlock(&(glob->mutex));
+
+        if (chunk >= glob->chunkcount) {
+            break;
+        }
+
+        bytes = 0;
+        written = generate_chunk(gt, chunk, &bytes);
+
+        pthread_mutex_lock(&(glob->mutex));
+        if (written < 0) {
+            glob->errors ++;
+        } else {
+            glob->packets += written;
+            glob->bytes += bytes;
+        }
+        pthread_mutex_unlock(&(glob->mutex));
+    }
+
+    trace_destroy_packet(gt->packet);
+    trace_destroy_dead(gt->deadtrace);
+    pthread_exit(NULL);
+}
+
+static int parse_darknet(gen_global_t *glob, const char *prefix) {
+    char addrstr[INET_ADDRSTRLEN];
+    char *slash;
+    struct in_addr addr;
+    unsigned long bits = 24;
+
+    strncpy(addrstr, prefix, sizeof(addrstr) - 1);
+    addrstr[sizeof(addrstr) - 1] = '\0';
+    slash = strchr(addrstr, '/');
+    if (slash) {
+        *slash = '\0';
+        bits = strtoul(slash + 1, NULL, 10);
+    }
+    if (inet_pton(AF_INET, addrstr, &addr) != 1 || bits < 8 || bits > 30) {
+        return -1;
+    }
+
+    glob->darknetbits = bits;
+    glob->darknetmask = 0xffffffff << (32 - bits);
+    glob->darknet = ntohl(addr.s_addr) & glob->darknetmask;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+    gen_global_t glob;
+    gen_thread_t *threads = NULL;
+    struct sigaction sigact;
+    sigset_t sig_before, sig_block_all;
+    char *profilename = (char *)"mixed";
+    char *logmodestr = NULL, *darknetstr = NULL, *methodstr = NULL;
+    int logmode = GLOBAL_LOGMODE_STDERR;
+    int threadcount = 4, i;
+    int64_t scanners = -1, victims = -1;
+    double dstskew = -1;
+    struct timeval start, end;
+    double elapsed;
+
+    memset(&glob, 0, sizeof(glob));
+    glob.seed = 1;
+    glob.starttime = 1600000000;
+    glob.duration = 300;
+    glob.chunklen = 60;
+    glob.rate = 1000000;
+    glob.compressmethod = TRACE_OPTION_COMPRESSTYPE_NONE;
+
+    sigact.sa_handler = cleanup_signal;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = SA_RESTART;
+
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (1) {
+        int optind;
+        struct option long_options[] = {
+            { "output", 1, 0, 'o'},
+            { "profile", 1, 0, 'p'},
+            { "rate", 1, 0, 'r'},
+            { "duration", 1, 0, 'd'},
+            { "chunk", 1, 0, 'c'},
+            { "start", 1, 0, 'S'},
+            { "seed", 1, 0, 's'},
+            { "darknet", 1, 0, 'n'},
+            { "scanners", 1, 0, 'P'},
+            { "victims", 1, 0, 'V'},
+            { "dstskew", 1, 0, 'a'},
+            { "threads", 1, 0, 't'},
+            { "compresslevel", 1, 0, 'z'},
+            { "compressmethod", 1, 0, 'm'},
+            { "log", 1, 0, 'l'},
+            { "help", 0, 0, 'h'},
+            { NULL, 0, 0, 0 }
+        };
+
+        int c = getopt_long(argc, argv, "o:p:r:d:c:S:s:n:P:V:a:t:z:m:l:h",
+                long_options, &optind);
+        if (c == -1) {
+            break;
+        }
+
+        switch(c) {
+            case 'o':
+                glob.template = optarg;
+                break;
+            case 'p':
+                profilename = optarg;
+                break;
+            case 'r':
+                glob.rate = strtoull(optarg, NULL, 10);
+                break;
+            case 'd':
+                glob.duration = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                glob.chunklen = strtoul(optarg, NULL, 10);
+                break;
+            case 'S':
+                glob.starttime = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                glob.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'n':
+                darknetstr = optarg;
+                break;
+            case 'P':
+                scanners = strtoll(optarg, NULL, 10);
+                break;
+            case 'V':
+                victims = strtoll(optarg, NULL, 10);
+                break;
+            case 'a':
+                dstskew = strtod(optarg, NULL);
+                break;
+            case 't':
+                threadcount = strtoul(optarg, NULL, 10);
+                break;
+            case 'z':
+                glob.compresslevel = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                methodstr = optarg;
+                break;
+            case 'l':
+                logmodestr = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    /* Configure our logging */
+    if (logmodestr != NULL) {
+        if (strcmp(logmodestr, "stderr") == 0 ||
+                    strcmp(logmodestr, "terminal") == 0) {
+            logmode = GLOBAL_LOGMODE_STDERR;
+        } else if (strcmp(logmodestr, "syslog") == 0) {
+            logmode = GLOBAL_LOGMODE_SYSLOG;
+        } else if (strcmp(logmodestr, "disabled") == 0 ||
+                strcmp(logmodestr, "off") == 0 ||
+                strcmp(logmodestr, "none") == 0) {
+            logmode = GLOBAL_LOGMODE_DISABLED;
+        } else {
+            fprintf(stderr, "corsarogen: unexpected logmode: %s\n",
+                    logmodestr);
+            return 1;
+        }
+    }
+
+    if (logmode == GLOBAL_LOGMODE_STDERR) {
+        glob.logger = init_corsaro_logger("corsarogen", "");
+    } else if (logmode == GLOBAL_LOGMODE_SYSLOG) {
+        glob.logger = init_corsaro_logger("corsarogen", NULL);
+    } else {
+        glob.logger = NULL;
+    }
+
+    if (glob.template == NULL) {
+        corsaro_log(glob.logger, "Must specify an output template with -o!");
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (i = 0; gen_profiles[i].name != NULL; i++) {
+        if (strcasecmp(gen_profiles[i].name, profilename) == 0) {
+            break;
+        }
+    }
+    if (gen_profiles[i].name == NULL) {
+        corsaro_log(glob.logger, "Unknown traffic profile: %s", profilename);
+        usage(argv[0]);
+        return 1;
+    }
+    glob.profile = gen_profiles[i];
+
+    if (scanners >= 0) {
+        glob.profile.scanners = scanners;
+    }
+    if (victims >= 0) {
+        glob.profile.victims = victims;
+    }
+    if (dstskew >= 0) {
+        glob.profile.dstskew = dstskew;
+    }
+
+    /* A class with an empty population cannot produce any packets */
+    if (glob.profile.scanners == 0) {
+        glob.profile.weights[GEN_CLASS_SCAN] = 0;
+    }
+    if (glob.profile.victims == 0) {
+        glob.profile.weights[GEN_CLASS_BACKSCATTER] = 0;
+    }
+    if (glob.profile.reflectors == 0) {
+        glob.profile.weights[GEN_CLASS_AMPLIFICATION] = 0;
+    }
+
+    if (parse_darknet(&glob, darknetstr ? darknetstr : "10.0.0.0/8") < 0) {
+        corsaro_log(glob.logger,
+                "Invalid darknet prefix: must be an IPv4 prefix between /8 and /30");
+        return 1;
+    }
+
+    if (methodstr != NULL) {
+        if (strcmp(methodstr, "gzip") == 0 || strcmp(methodstr, "zlib") == 0) {
+            glob.compressmethod = TRACE_OPTION_COMPRESSTYPE_ZLIB;
+        } else if (strcmp(methodstr, "bzip") == 0 ||
+                strcmp(methodstr, "bzip2") == 0) {
+            glob.compressmethod = TRACE_OPTION_COMPRESSTYPE_BZ2;
+        } else if (strcmp(methodstr, "lzo") == 0) {
+            glob.compressmethod = TRACE_OPTION_COMPRESSTYPE_LZO;
+        } else if (strcmp(methodstr, "lzma") == 0) {
+            glob.compressmethod = TRACE_OPTION_COMPRESSTYPE_LZMA;
+        } else {
+            corsaro_log(glob.logger, "Unknown compression method: %s",
+                    methodstr);
+            return 1;
+        }
+    } else if (glob.compresslevel > 0) {
+        glob.compressmethod = TRACE_OPTION_COMPRESSTYPE_ZLIB;
+    }
+
+    if (glob.rate == 0 || glob.duration == 0 || glob.chunklen == 0) {
+        corsaro_log(glob.logger,
+                "Rate, duration and chunk length must all be non-zero");
+        return 1;
+    }
+
+    glob.chunkcount = (glob.duration + glob.chunklen - 1) / glob.chunklen;
+    if (glob.chunkcount > 1 && strchr(glob.template, '%') == NULL) {
+        corsaro_log(glob.logger,
+                "Output template must contain %%s (or a strftime modifier) when writing more than one chunk");
+        return 1;
+    }
+
+    if (threadcount <= 0) {
+        threadcount = 1;
+    }
+    if ((uint32_t)threadcount > glob.chunkcount) {
+        threadcount = glob.chunkcount;
+    }
+
+    corsaro_log(glob.logger,
+            "generating %u seconds of '%s' traffic at %lu pps into %u files, using %d threads (seed %lu)",
+            glob.duration, glob.profile.name, glob.rate, glob.chunkcount,
+            threadcount, glob.seed);
+
+    pthread_mutex_init(&(glob.mutex), NULL);
+    threads = calloc(threadcount, sizeof(gen_thread_t));
+
+    sigemptyset(&sig_block_all);
+    if (pthread_sigmask(SIG_SETMASK, &sig_block_all, &sig_before) < 0) {
+        corsaro_log(glob.logger, "Error in pthread_sigmask?: %s",
+                strerror(errno));
+        return 1;
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < threadcount; i++) {
+        threads[i].glob = &glob;
+        pthread_create(&(threads[i].tid), NULL, start_gen_thread,
+                &(threads[i]));
+    }
+
+    if (pthread_sigmask(SIG_SETMASK, &sig_before, NULL) < 0) {
+        corsaro_log(glob.logger, "Error in pthread_sigmask?: %s",
+                strerror(errno));
+        return 1;
+    }
+
+    for (i = 0; i < threadcount; i++) {
+        pthread_join(threads[i].tid, NULL);
+    }
+    gettimeofday(&end, NULL);
+
+    elapsed = (end.tv_sec - start.tv_sec) +
+            (end.tv_usec - start.tv_usec) / 1000000.0;
+    corsaro_log(glob.logger,
+            "wrote %lu packets (%lu bytes) in %.1f seconds (%.0f pps)",
+            glob.packets, glob.bytes, elapsed,
+            elapsed > 0 ? glob.packets / elapsed : 0.0);
+
+    free(threads);
+    pthread_mutex_destroy(&(glob.mutex));
+    if (glob.logger) {
+        destroy_corsaro_logger(glob.logger);
+    }
+
+    if (glob.errors > 0 || halted) {
+        return 1;
+    }
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
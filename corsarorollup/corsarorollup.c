@@ -0,0 +1,850 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include "libcorsaro_log.h"
+#include "libcorsaro_avro.h"
+#include "libcorsaro_avroblock.h"
+#include "plugins/report/corsaro_report.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <Judy.h>
+
+/** Tool that rolls up the per-interval results written by the report
+ *  plugin into coarser time bins (e.g. hourly or daily summaries).
+ *
+ *  Records are grouped by bin, source label, metric name and metric value.
+ *  Packet and byte counts are summed. The report output does not include
+ *  any mergeable sketches for the unique IP and ASN counts, so we report
+ *  the largest per-interval count seen within each bin instead (which is
+ *  a lower bound for the true unique count across the bin). These are
+ *  written using a separate schema, with field names that make it clear
+ *  that they are not exact unique counts.
+ *
+ *  Input files are processed one bin at a time, so memory use is limited
+ *  to the distinct metrics within a single bin. Within each bin, files are
+ *  decoded by a pool of threads and the tallies are spread across a set of
+ *  partitions (by hash of the metric) that each have their own lock.
+ */
+
+/** Avro schema for rolled up report results */
+static const char ROLLUP_RESULT_SCHEMA[] =
+"{\"type\": \"record\",\
+  \"namespace\": \"org.caida.corsaro\",\
+  \"name\": \"report_rollup\",\
+  \"doc\":  \"Corsaro report results that have been rolled up into a \
+              coarser time bin by corsarorollup. Packet and byte counts \
+              are totals for the bin; the unique IP and ASN counts are \
+              the largest count seen in any single interval within the \
+              bin.\",\
+  \"fields\": [\
+        {\"name\": \"bin_timestamp\", \"type\": \"long\"}, \
+        {\"name\": \"bin_length\", \"type\": \"long\"}, \
+        {\"name\": \"source_label\", \"type\": \"string\"}, \
+        {\"name\": \"metric_name\", \"type\": \"string\"}, \
+        {\"name\": \"metric_value\", \"type\": \"string\"}, \
+        {\"name\": \"max_interval_src_ip_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"max_interval_dest_ip_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"pkt_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"byte_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"max_interval_src_asn_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"ip_cnt_method\", \"type\": \"string\"} \
+        ]}";
+
+/** Separator between the components of a tally key */
+#define ROLLUP_KEY_SEP '\x1f'
+
+/** Number of tally partitions to create per thread */
+#define ROLLUP_PARTITIONS_PER_THREAD 16
+
+/** Maximum length of a tally key */
+#define ROLLUP_MAX_KEYLEN 1024
+
+/** Rolled up counters for a single metric within a bin */
+typedef struct rollup_tally {
+    uint64_t src_ip_cnt;
+    uint64_t dest_ip_cnt;
+    uint64_t pkt_cnt;
+    uint64_t byte_cnt;
+    uint64_t src_asn_cnt;
+    /** Set if any of the rolled up IP counts were estimates */
+    uint8_t estimated;
+} rollup_tally_t;
+
+/** A single set of tallies, keyed by a string of the form
+ *  <bin>SEP<label>SEP<metric name>SEP<metric value>
+ */
+typedef struct rollup_partition {
+    pthread_mutex_t mutex;
+    Pvoid_t tallies;
+} rollup_partition_t;
+
+/** An input file, along with the bin that its first record belongs to */
+typedef struct rollup_input {
+    char *path;
+    uint32_t firstbin;
+} rollup_input_t;
+
+/** State shared by all of the rollup threads */
+typedef struct rollup_global {
+    corsaro_logger_t *logger;
+    uint32_t binsize;
+
+    rollup_input_t *inputs;
+    int inputcount;
+
+    /** The next input to be decoded, and the input after the last one in
+     *  the current bin */
+    int nextinput;
+    int batchend;
+    pthread_mutex_t mutex;
+
+    rollup_partition_t *partitions;
+    int partcount;
+
+    uint64_t records;
+    int errors;
+} rollup_global_t;
+
+volatile int halted = 0;
+
+static void cleanup_signal(int sig) {
+    (void)sig;
+    halted = 1;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] -o <output file> <input file 1> ... <input file N>\n\n"
+        "Options:\n"
+        "  -o, --outputfile <file>  write the rolled up report results to <file>\n"
+        "  -b, --binsize <secs>     length of each rolled up time bin (default 3600)\n"
+        "  -t, --threads <n>        number of threads to decode input with (default 4)\n"
+        "  -l, --log <mode>         log mode: stderr, syslog or disabled\n"
+        "  -h, --help               print this message\n",
+        prog);
+}
+
+/** FNV-1a hash of the metric portion of a tally key, used to pick the
+ *  partition for the tally.
+ */
+static inline uint32_t hash_metric(const char *key, size_t len) {
+    uint32_t h = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static inline int get_string_field(avro_value_t *record, int index,
+        const char **str, size_t *len) {
+
+    avro_value_t av;
+
+    if (avro_value_get_by_index(record, index, &av, NULL) != 0) {
+        return -1;
+    }
+    if (avro_value_get_string(&av, str, len) != 0) {
+        return -1;
+    }
+    /* avro includes the NUL terminator in the string length */
+    if (*len > 0 && (*str)[*len - 1] == '\0') {
+        (*len) --;
+    }
+    return 0;
+}
+
+static inline int get_long_field(avro_value_t *record, int index,
+        int64_t *val) {
+
+    avro_value_t av;
+
+    if (avro_value_get_by_index(record, index, &av, NULL) != 0) {
+        return -1;
+    }
+    return avro_value_get_long(&av, val);
+}
+
+/** Adds a single report record to the tally for its metric.
+ *
+ *  @param glob         The global state for the rollup.
+ *  @param ts           The interval timestamp of the record.
+ *  @param label        The source label of the record.
+ *  @param labellen     The length of the source label.
+ *  @param name         The metric name of the record.
+ *  @param namelen      The length of the metric name.
+ *  @param value        The metric value of the record.
+ *  @param valuelen     The length of the metric value.
+ *  @param counts       The src IP, dest IP, packet, byte and src ASN
+ *                      counts for the record.
+ *  @param estimated    Set if the record's IP counts were estimates.
+ */
+static void rollup_record(rollup_global_t *glob, int64_t ts,
+        const char *label, size_t labellen, const char *name,
+        size_t namelen, const char *value, size_t valuelen,
+        int64_t *counts, uint8_t estimated) {
+
+    char key[ROLLUP_MAX_KEYLEN];
+    int keylen, metricstart;
+    uint32_t bin;
+    rollup_partition_t *part;
+    rollup_tally_t *tally;
+    PWord_t pval;
+
+    bin = ((uint32_t)ts) - (((uint32_t)ts) % glob->binsize);
+
+    /* The bin is zero-padded so that the tallies sort by bin first */
+    keylen = snprintf(key, sizeof(key), "%010u%c%.*s%c", bin, ROLLUP_KEY_SEP,
+            (int)labellen, label, ROLLUP_KEY_SEP);
+    metricstart = keylen;
+    keylen += snprintf(key + keylen, sizeof(key) - keylen, "%.*s%c%.*s",
+            (int)namelen, name, ROLLUP_KEY_SEP, (int)valuelen, value);
+    if (keylen >= (int)sizeof(key)) {
+        corsaro_log(glob->logger, "skipping report record with oversized metric %.*s",
+                (int)namelen, name);
+        return;
+    }
+
+    part = &(glob->partitions[hash_metric(key + metricstart,
+            keylen - metricstart) % glob->partcount]);
+
+    pthread_mutex_lock(&(part->mutex));
+    JSLI(pval, part->tallies, (uint8_t *)key);
+    if (*pval == 0) {
+        tally = (rollup_tally_t *)calloc(1, sizeof(rollup_tally_t));
+        *pval = (Word_t)tally;
+    } else {
+        tally = (rollup_tally_t *)(*pval);
+    }
+
+    if ((uint64_t)counts[0] > tally->src_ip_cnt) {
+        tally->src_ip_cnt = counts[0];
+    }
+    if ((uint64_t)counts[1] > tally->dest_ip_cnt) {
+        tally->dest_ip_cnt = counts[1];
+    }
+    tally->pkt_cnt += counts[2];
+    tally->byte_cnt += counts[3];
+    if ((uint64_t)counts[4] > tally->src_asn_cnt) {
+        tally->src_asn_cnt = counts[4];
+    }
+    if (estimated) {
+        tally->estimated = 1;
+    }
+    pthread_mutex_unlock(&(part->mutex));
+}
+
+/** Checks whether an ip_cnt_method value says that the IP counts for a
+ *  report record were estimated.
+ */
+static inline uint8_t is_estimated_method(const char *method,
+        size_t methodlen) {
+    return (methodlen != strlen(REPORT_IP_CNT_EXACT) ||
+            memcmp(method, REPORT_IP_CNT_EXACT, methodlen) != 0);
+}
+
+/** Adds a report record that was read using the generic avro reader to
+ *  the tally for its metric.
+ *
+ *  @param glob         The global state for the rollup.
+ *  @param record       The decoded report record.
+ *  @return 0 if successful, -1 if the record could not be decoded.
+ */
+static int rollup_avro_record(rollup_global_t *glob, avro_value_t *record) {
+
+    const char *label, *name, *value, *method;
+    size_t labellen, namelen, valuelen, methodlen;
+    int64_t ts, counts[5];
+    int i;
+
+    if (get_long_field(record, 0, &ts) != 0 ||
+            get_string_field(record, 1, &label, &labellen) != 0 ||
+            get_string_field(record, 2, &name, &namelen) != 0 ||
+            get_string_field(record, 3, &value, &valuelen) != 0) {
+        return -1;
+    }
+
+    for (i = 0; i < 5; i++) {
+        if (get_long_field(record, 4 + i, &(counts[i])) != 0) {
+            return -1;
+        }
+    }
+
+    /* Files written before the ip_cnt_method field was added only ever
+     * contain exact counts */
+    if (get_string_field(record, 9, &method, &methodlen) != 0) {
+        method = REPORT_IP_CNT_EXACT;
+        methodlen = strlen(REPORT_IP_CNT_EXACT);
+    }
+
+    rollup_record(glob, ts, label, labellen, name, namelen, value, valuelen,
+            counts, is_estimated_method(method, methodlen));
+    return 0;
+}
+
+/** Adds every record in a batch from the block decoder to the tallies.
+ *
+ *  @param glob         The global state for the rollup.
+ *  @param batch        The decoded batch of report records.
+ */
+static void rollup_batch(rollup_global_t *glob,
+        corsaro_avroblock_batch_t *batch) {
+
+    corsaro_avroblock_report_columns_t *c = &(batch->cols.report);
+    int64_t counts[5];
+    uint32_t i;
+
+    for (i = 0; i < batch->count; i++) {
+        counts[0] = c->src_ip_cnt[i];
+        counts[1] = c->dest_ip_cnt[i];
+        counts[2] = c->pkt_cnt[i];
+        counts[3] = c->byte_cnt[i];
+        counts[4] = c->src_asn_cnt[i];
+
+        rollup_record(glob, c->bin_timestamp[i], c->source_label[i],
+                c->source_label_len[i], c->metric_name[i],
+                c->metric_name_len[i], c->metric_value[i],
+                c->metric_value_len[i], counts,
+                is_estimated_method(c->ip_cnt_method[i],
+                        c->ip_cnt_method_len[i]));
+    }
+}
+
+/** Reads every record in an input file using the generic avro reader,
+ *  for files that the block decoder cannot handle (e.g. those written
+ *  before the current report schema).
+ *
+ *  @param glob         The global state for the rollup.
+ *  @param path         The input file to read.
+ *  @param records      Updated with the number of records read.
+ *  @return 0 if successful, -1 if an error occurred.
+ */
+static int rollup_file_generic(rollup_global_t *glob, char *path,
+        uint64_t *records) {
+
+    corsaro_avro_reader_t *avrdr;
+    avro_value_t *record;
+    int ret;
+
+    avrdr = corsaro_create_avro_reader(glob->logger, path);
+    if (avrdr == NULL) {
+        return -1;
+    }
+
+    while (!halted &&
+            (ret = corsaro_read_next_avro_record(avrdr, &record)) > 0) {
+        if (rollup_avro_record(glob, record) < 0) {
+            corsaro_log(glob->logger,
+                    "%s does not appear to contain report results", path);
+            ret = -1;
+            break;
+        }
+        (*records) ++;
+    }
+    corsaro_destroy_avro_reader(avrdr);
+    return (ret < 0) ? -1 : 0;
+}
+
+/** Reads every record in an input file and adds it to the tallies, using
+ *  the report block decoder where possible.
+ *
+ *  @param glob         The global state for the rollup.
+ *  @param path         The input file to read.
+ *  @param records      Updated with the number of records read.
+ *  @return 0 if successful, -1 if an error occurred.
+ */
+static int rollup_file(rollup_global_t *glob, char *path, uint64_t *records) {
+
+    corsaro_avroblock_reader_t *blkrdr;
+    corsaro_avroblock_batch_t *batch;
+    int ret;
+
+    /* Files are already spread across our threads, so a single decoding
+     * thread per file is enough */
+    blkrdr = corsaro_create_avroblock_reader(glob->logger, path,
+            CORSARO_AVROBLOCK_REPORT, 1);
+    if (blkrdr == NULL) {
+        corsaro_log(glob->logger,
+                "falling back to the generic avro reader for %s", path);
+        return rollup_file_generic(glob, path, records);
+    }
+
+    while (!halted &&
+            (ret = corsaro_read_next_avroblock_batch(blkrdr, &batch)) > 0) {
+        rollup_batch(glob, batch);
+        (*records) += batch->count;
+    }
+    corsaro_destroy_avroblock_reader(blkrdr);
+
+    if (ret < 0) {
+        corsaro_log(glob->logger, "error while decoding report results in %s",
+                path);
+        return -1;
+    }
+    return 0;
+}
+
+/** Function that operates a decoding thread -- keeps claiming input files
+ *  from the current bin until there are none left.
+ */
+static void *start_rollup_thread(void *arg) {
+
+    rollup_global_t *glob = (rollup_global_t *)arg;
+    uint64_t records;
+    int next, ret;
+
+    while (!halted) {
+        pthread_mutex_lock(&(glob->mutex));
+        next = glob->nextinput;
+        if (next < glob->batchend) {
+            glob->nextinput ++;
+        }
+        pthread_mutex_unlock(&(glob->mutex));
+
+        if (next >= glob->batchend) {
+            break;
+        }
+
+        records = 0;
+        ret = rollup_file(glob, glob->inputs[next].path, &records);
+
+        pthread_mutex_lock(&(glob->mutex));
+        glob->records += records;
+        if (ret < 0) {
+            glob->errors ++;
+        }
+        pthread_mutex_unlock(&(glob->mutex));
+    }
+
+    pthread_exit(NULL);
+}
+
+/** Writes a single rolled up tally to the output file.
+ *
+ *  @param writer       The avro writer for the output file.
+ *  @param key          The key for the tally.
+ *  @param tally        The tally itself.
+ *  @param binsize      The length of each bin, in seconds.
+ *  @return 0 if successful, -1 if an error occurred.
+ */
+static int write_rollup_tally(corsaro_avro_writer_t *writer, char *key,
+        rollup_tally_t *tally, uint32_t binsize) {
+
+    char *label, *name, *value;
+    const char *method;
+    uint32_t bin;
+
+    bin = strtoul(key, NULL, 10);
+    label = strchr(key, ROLLUP_KEY_SEP) + 1;
+    name = strchr(label, ROLLUP_KEY_SEP) + 1;
+    value = strchr(name, ROLLUP_KEY_SEP) + 1;
+
+    if (corsaro_start_avro_encoding(writer) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, &bin,
+                sizeof(bin)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, &binsize,
+                sizeof(binsize)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING, label,
+                (name - label) - 1) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING, name,
+                (value - name) - 1) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING, value,
+                strlen(value)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(tally->src_ip_cnt), sizeof(tally->src_ip_cnt)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(tally->dest_ip_cnt), sizeof(tally->dest_ip_cnt)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(tally->pkt_cnt), sizeof(tally->pkt_cnt)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(tally->byte_cnt), sizeof(tally->byte_cnt)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(tally->src_asn_cnt), sizeof(tally->src_asn_cnt)) < 0) {
+        return -1;
+    }
+    method = tally->estimated ? REPORT_IP_CNT_HLL : REPORT_IP_CNT_EXACT;
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                (void *)method, strlen(method)) < 0) {
+        return -1;
+    }
+
+    return corsaro_append_avro_writer(writer, NULL);
+}
+
+/** Writes out (and frees) all of the tallies for bins up to and including
+ *  the given bin. Tallies for later bins are kept, as they may still be
+ *  added to by the files for those bins.
+ *
+ *  @param glob         The global state for the rollup.
+ *  @param writer       The avro writer for the output file.
+ *  @param lastbin      The latest bin that is complete.
+ *  @return the number of tallies written, or -1 if an error occurred.
+ */
+static int64_t flush_rollup_tallies(rollup_global_t *glob,
+        corsaro_avro_writer_t *writer, uint32_t lastbin) {
+
+    uint8_t key[ROLLUP_MAX_KEYLEN];
+    PWord_t pval;
+    int i, rc;
+    int64_t written = 0;
+
+    for (i = 0; i < glob->partcount; i++) {
+        rollup_partition_t *part = &(glob->partitions[i]);
+
+        key[0] = '\0';
+        JSLF(pval, part->tallies, key);
+        while (pval != NULL) {
+            if (strtoul((char *)key, NULL, 10) > lastbin) {
+                /* Keys are sorted by bin, so we're done */
+                break;
+            }
+            if (write_rollup_tally(writer, (char *)key,
+                        (rollup_tally_t *)(*pval), glob->binsize) < 0) {
+                corsaro_log(glob->logger,
+                        "error while writing rolled up report record");
+                return -1;
+            }
+            written ++;
+            free((rollup_tally_t *)(*pval));
+            JSLD(rc, part->tallies, key);
+            JSLN(pval, part->tallies, key);
+        }
+    }
+    return written;
+}
+
+/** Works out which bin the first record in each input file belongs to, so
+ *  that the inputs can be processed one bin at a time.
+ */
+static int peek_input_bins(rollup_global_t *glob) {
+
+    corsaro_avro_reader_t *avrdr;
+    avro_value_t *record;
+    int64_t ts;
+    int i;
+
+    for (i = 0; i < glob->inputcount && !halted; i++) {
+        glob->inputs[i].firstbin = 0;
+
+        avrdr = corsaro_create_avro_reader(glob->logger, glob->inputs[i].path);
+        if (avrdr == NULL) {
+            continue;
+        }
+        if (corsaro_read_next_avro_record(avrdr, &record) > 0 &&
+                get_long_field(record, 0, &ts) == 0) {
+            glob->inputs[i].firstbin = ((uint32_t)ts) -
+                    (((uint32_t)ts) % glob->binsize);
+        }
+        corsaro_destroy_avro_reader(avrdr);
+    }
+    return 0;
+}
+
+static int cmp_rollup_inputs(const void *a, const void *b) {
+    const rollup_input_t *ia = (const rollup_input_t *)a;
+    const rollup_input_t *ib = (const rollup_input_t *)b;
+
+    if (ia->firstbin != ib->firstbin) {
+        return (ia->firstbin < ib->firstbin) ? -1 : 1;
+    }
+    return strcmp(ia->path, ib->path);
+}
+
+int main(int argc, char *argv[]) {
+    struct sigaction sigact;
+    sigset_t sig_before, sig_block_all;
+    rollup_global_t glob;
+    corsaro_avro_writer_t *avwrt = NULL;
+    pthread_t *threads;
+    char *outputpath = NULL;
+    int logmode = GLOBAL_LOGMODE_STDERR;
+    char *logmodestr = NULL;
+    int threadcount = 4, i, ret = 0;
+    int64_t written, totalwritten = 0;
+    uint32_t bin;
+    Word_t freed;
+
+    memset(&glob, 0, sizeof(glob));
+    glob.binsize = 3600;
+
+    sigact.sa_handler = cleanup_signal;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = SA_RESTART;
+
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (1) {
+        int optind;
+        struct option long_options[] = {
+            { "outputfile", 1, 0, 'o'},
+            { "binsize", 1, 0, 'b'},
+            { "threads", 1, 0, 't'},
+            { "log", 1, 0, 'l'},
+            { "help", 0, 0, 'h'},
+            { NULL, 0, 0, 0 }
+        };
+
+        int c  = getopt_long(argc, argv, "o:b:t:l:h", long_options,
+                &optind);
+        if (c == -1) {
+            break;
+        }
+
+        switch(c) {
+            case 'o':
+                outputpath = optarg;
+                break;
+            case 'b':
+                glob.binsize = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                threadcount = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                logmodestr = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    /* Configure our logging */
+    if (logmodestr != NULL) {
+        if (strcmp(logmodestr, "stderr") == 0 ||
+                    strcmp(logmodestr, "terminal") == 0) {
+            logmode = GLOBAL_LOGMODE_STDERR;
+        } else if (strcmp(logmodestr, "syslog") == 0) {
+            logmode = GLOBAL_LOGMODE_SYSLOG;
+        } else if (strcmp(logmodestr, "disabled") == 0 ||
+                strcmp(logmodestr, "off") == 0 ||
+                strcmp(logmodestr, "none") == 0) {
+            logmode = GLOBAL_LOGMODE_DISABLED;
+        } else {
+            fprintf(stderr, "corsarorollup: unexpected logmode: %s\n",
+                    logmodestr);
+            return 1;
+        }
+    }
+
+    if (logmode == GLOBAL_LOGMODE_STDERR) {
+        glob.logger = init_corsaro_logger("corsarorollup", "");
+    } else if (logmode == GLOBAL_LOGMODE_SYSLOG) {
+        glob.logger = init_corsaro_logger("corsarorollup", NULL);
+    } else {
+        glob.logger = NULL;
+    }
+
+    if (outputpath == NULL) {
+        corsaro_log(glob.logger, "Must specify an output file path with -o!");
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (glob.binsize == 0) {
+        corsaro_log(glob.logger, "Bin size must be a non-zero number of seconds");
+        return 1;
+    }
+
+    if (threadcount <= 0) {
+        threadcount = 1;
+    }
+
+    if (optind >= argc) {
+        corsaro_log(glob.logger, "No inputs specified -- exiting");
+        usage(argv[0]);
+        return 1;
+    }
+
+    glob.inputcount = argc - optind;
+    glob.inputs = calloc(glob.inputcount, sizeof(rollup_input_t));
+    for (i = 0; i < glob.inputcount; i++) {
+        glob.inputs[i].path = argv[optind + i];
+    }
+
+    peek_input_bins(&glob);
+    qsort(glob.inputs, glob.inputcount, sizeof(rollup_input_t),
+            cmp_rollup_inputs);
+
+    glob.partcount = threadcount * ROLLUP_PARTITIONS_PER_THREAD;
+    glob.partitions = calloc(glob.partcount, sizeof(rollup_partition_t));
+    for (i = 0; i < glob.partcount; i++) {
+        pthread_mutex_init(&(glob.partitions[i].mutex), NULL);
+        glob.partitions[i].tallies = NULL;
+    }
+    pthread_mutex_init(&(glob.mutex), NULL);
+
+    avwrt = corsaro_create_avro_writer(glob.logger, ROLLUP_RESULT_SCHEMA);
+    if (avwrt == NULL) {
+        return 1;
+    }
+
+    if (corsaro_start_avro_writer(avwrt, outputpath, 0) < 0) {
+        return 1;
+    }
+
+    threads = calloc(threadcount, sizeof(pthread_t));
+
+    /* Process the inputs one bin at a time */
+    while (glob.nextinput < glob.inputcount && !halted) {
+        bin = glob.inputs[glob.nextinput].firstbin;
+        glob.batchend = glob.nextinput;
+        while (glob.batchend < glob.inputcount &&
+                glob.inputs[glob.batchend].firstbin == bin) {
+            glob.batchend ++;
+        }
+
+        sigemptyset(&sig_block_all);
+        if (pthread_sigmask(SIG_SETMASK, &sig_block_all, &sig_before) < 0) {
+            corsaro_log(glob.logger, "Error in pthread_sigmask?: %s",
+                    strerror(errno));
+            return 1;
+        }
+
+        for (i = 0; i < threadcount; i++) {
+            pthread_create(&(threads[i]), NULL, start_rollup_thread, &glob);
+        }
+
+        if (pthread_sigmask(SIG_SETMASK, &sig_before, NULL) < 0) {
+            corsaro_log(glob.logger, "Error in pthread_sigmask?: %s",
+                    strerror(errno));
+            return 1;
+        }
+
+        for (i = 0; i < threadcount; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        if (halted) {
+            break;
+        }
+
+        written = flush_rollup_tallies(&glob, avwrt, bin);
+        if (written < 0) {
+            ret = 1;
+            break;
+        }
+        totalwritten += written;
+        corsaro_log(glob.logger, "Rolled up bin %u: %ld metrics", bin,
+                written);
+    }
+
+    /* Any remaining tallies belong to bins that no input file started in */
+    if (!halted && ret == 0) {
+        written = flush_rollup_tallies(&glob, avwrt, 0xFFFFFFFF);
+        if (written < 0) {
+            ret = 1;
+        } else {
+            totalwritten += written;
+        }
+    }
+
+    corsaro_log(glob.logger, "Read %lu report records, wrote %ld rolled up records",
+            glob.records, totalwritten);
+    if (glob.errors > 0) {
+        corsaro_log(glob.logger, "%d input files could not be fully read",
+                glob.errors);
+    }
+
+    /* All done -- tidy everything up */
+    corsaro_destroy_avro_writer(avwrt);
+    for (i = 0; i < glob.partcount; i++) {
+        uint8_t key[ROLLUP_MAX_KEYLEN];
+        PWord_t pval;
+
+        key[0] = '\0';
+        JSLF(pval, glob.partitions[i].tallies, key);
+        while (pval != NULL) {
+            free((rollup_tally_t *)(*pval));
+            JSLN(pval, glob.partitions[i].tallies, key);
+        }
+        JSLFA(freed, glob.partitions[i].tallies);
+        pthread_mutex_destroy(&(glob.partitions[i].mutex));
+    }
+    pthread_mutex_destroy(&(glob.mutex));
+    free(glob.partitions);
+    free(glob.inputs);
+    free(threads);
+    return ret;
+}
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
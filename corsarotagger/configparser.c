@@ -53,6 +53,7 @@
 #include "libcorsaro_log.h"
 #include "libcorsaro_common.h"
 #include "libcorsaro_tagging.h"
+#include "libcorsaro_flowhash.h"
 #include "corsarotagger.h"
 
 #include <zmq.h>
@@ -166,6 +167,39 @@ static int parse_config(void *globalin,
         }
     }
 
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "hashmethod")) {
+        char *method = (char *)value->data.scalar.value;
+
+        if (strcasecmp(method, "table") == 0) {
+            glob->hasher_method = CORSARO_TAGGER_HASH_TABLE;
+        } else if (strcasecmp(method, "libtrace") == 0) {
+            glob->hasher_method = CORSARO_TAGGER_HASH_LIBTRACE;
+        } else {
+            corsaro_log(logger,
+                    "invalid value for 'hashmethod' option: %s", method);
+            corsaro_log(logger,
+                    "should be one of 'table' or 'libtrace'");
+            return -1;
+        }
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "sourcememo")) {
+        if (parse_onoff_option(logger, (char *)value->data.scalar.value,
+                &(glob->source_memo), "source memo") < 0) {
+            return -1;
+        }
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "batchlookups")) {
+        if (parse_onoff_option(logger, (char *)value->data.scalar.value,
+                &(glob->batch_lookups), "batched lookups") < 0) {
+            return -1;
+        }
+    }
+
     if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
             && !strcmp((char *)key->data.scalar.value, "consterfframing")) {
 
@@ -215,6 +249,18 @@ static int parse_config(void *globalin,
         glob->pkt_threads = strtoul((char *)value->data.scalar.value, NULL, 10);
     }
 
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "pktburstsize")) {
+        unsigned long burst = strtoul((char *)value->data.scalar.value,
+                NULL, 10);
+        if (burst > TAGGER_MAX_PACKET_BURST) {
+            corsaro_log(logger, "packet burst size must be no more than %d, setting to %d.",
+                    TAGGER_MAX_PACKET_BURST, TAGGER_MAX_PACKET_BURST);
+            burst = TAGGER_MAX_PACKET_BURST;
+        }
+        glob->pkt_burst = (uint16_t)burst;
+    }
+
     if (key->type == YAML_SCALAR_NODE && value->type == YAML_SEQUENCE_NODE
             && !strcmp((char *)key->data.scalar.value, "tagproviders")) {
         if (corsaro_parse_tagging_provider_config(&(glob->pfxtagopts),
@@ -237,6 +283,12 @@ static int parse_config(void *globalin,
 static void log_configuration(corsaro_tagger_global_t *glob) {
     corsaro_log(glob->logger, "using %d processing threads", glob->pkt_threads);
 
+    if (glob->pkt_burst > 0) {
+        corsaro_log(glob->logger,
+                "processing threads will read up to %u packets at a time",
+                glob->pkt_burst);
+    }
+
     if (glob->statfilename) {
         corsaro_log(glob->logger, "writing loss statistics to files beginning with %s", glob->statfilename);
     } else {
@@ -260,6 +312,13 @@ static void log_configuration(corsaro_tagger_global_t *glob) {
         corsaro_log(glob->logger, "enabling promiscuous mode on all inputs");
     }
 
+    if (glob->hasher_required) {
+        corsaro_log(glob->logger,
+                "assigning packets to threads using the %s hasher",
+                glob->hasher_method == CORSARO_TAGGER_HASH_LIBTRACE ?
+                "libtrace toeplitz" : "table-driven flow");
+    }
+
     if (glob->pfxtagopts.enabled) {
         corsaro_log(glob->logger,
                 "prefix->asn tagging will be applied to all packets");
@@ -281,6 +340,16 @@ static void log_configuration(corsaro_tagger_global_t *glob) {
                 glob->sample_rate);
     }
 
+    if (glob->batch_lookups) {
+        corsaro_log(glob->logger,
+                "performing IPmeta lookups in batches, sorted by source address");
+    }
+
+    if (glob->source_memo) {
+        corsaro_log(glob->logger,
+                "re-using IPmeta tags for consecutive packets from the same source");
+    }
+
 }
 
 corsaro_tagger_global_t *corsaro_tagger_init_global(char *filename,
@@ -309,6 +378,7 @@ corsaro_tagger_global_t *corsaro_tagger_init_global(char *filename,
     glob->logfilename = NULL;
     glob->statfilename = NULL;
     glob->pkt_threads = 2;
+    glob->pkt_burst = 0;
 
     glob->pubqueuename = NULL;
     glob->trace = NULL;
@@ -316,11 +386,14 @@ corsaro_tagger_global_t *corsaro_tagger_init_global(char *filename,
     glob->logger = NULL;
 
     glob->sample_rate = 1;
+    glob->source_memo = 1;
+    glob->batch_lookups = 0;
 
     glob->threaddata = NULL;
     glob->hasher = NULL;
     glob->hasher_data = NULL;
     glob->hasher_required = 0;
+    glob->hasher_method = CORSARO_TAGGER_HASH_TABLE;
 
     glob->ndag_monitorid = 0;
     glob->ndag_beaconport = 9000;
@@ -402,14 +475,30 @@ corsaro_tagger_global_t *corsaro_tagger_init_global(char *filename,
         return NULL;
     }
 
-    glob->hasher = (fn_hasher)toeplitz_hash_packet;
-    glob->hasher_data = calloc(1, sizeof(toeplitz_conf_t));
+    if (glob->hasher_method == CORSARO_TAGGER_HASH_LIBTRACE) {
+        glob->hasher = (fn_hasher)toeplitz_hash_packet;
+        glob->hasher_data = calloc(1, sizeof(toeplitz_conf_t));
+        if (glob->hasher_data == NULL) {
+            corsaro_log(glob->logger, "unable to allocate packet hasher");
+            corsaro_tagger_free_global(glob);
+            return NULL;
+        }
 
-    /* Bidirectional hash -- set arg to 0 for unidirectional
-     *
-     * XXX is this a desirable config option?
-     */
-    toeplitz_init_config(glob->hasher_data, 1);
+        /* Bidirectional hash -- set arg to 0 for unidirectional
+         *
+         * XXX is this a desirable config option?
+         */
+        toeplitz_init_config(glob->hasher_data, 1);
+    } else {
+        glob->hasher = (fn_hasher)corsaro_flowhash_packet;
+        glob->hasher_data = calloc(1, sizeof(corsaro_flowhash_t));
+        if (glob->hasher_data == NULL) {
+            corsaro_log(glob->logger, "unable to allocate packet hasher");
+            corsaro_tagger_free_global(glob);
+            return NULL;
+        }
+        corsaro_init_flowhash(glob->hasher_data);
+    }
 
     return glob;
 
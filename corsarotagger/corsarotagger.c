@@ -329,6 +329,16 @@ static int start_trace_input(corsaro_tagger_global_t *glob) {
     }
     trace_set_perpkt_threads(glob->trace, glob->pkt_threads);
 
+    /* Have each processing thread pull packets from the input in bursts
+     * (e.g. with recvmmsg() for nDAG, or in one pass over the stream
+     * buffer for DAG). The packets are still handed to per_packet() one
+     * at a time and are returned to libtrace straight away, so no capture
+     * memory is held between callbacks.
+     */
+    if (glob->pkt_burst > 0) {
+        trace_set_burst_size(glob->trace, glob->pkt_burst);
+    }
+
     /* trigger a tick every minute -- used for monitoring performance only */
     trace_set_tick_interval(glob->trace, 500);
 
@@ -68,6 +68,20 @@
 
 #define TAGGER_BUFFER_SIZE (1 * 1024 * 1024)
 
+/** The largest number of packets that a packet thread may ask libtrace to
+ *  read from the input in a single call */
+#define TAGGER_MAX_PACKET_BURST 1024
+
+
+/** Software hashers that can be used to assign packets to processing
+ *  threads */
+enum {
+    /** The table-driven libcorsaro flow hasher */
+    CORSARO_TAGGER_HASH_TABLE,
+    /** The libtrace bidirectional Toeplitz hasher */
+    CORSARO_TAGGER_HASH_LIBTRACE,
+};
+
 
 typedef struct corsaro_tagger_local corsaro_tagger_local_t;
 typedef struct corsaro_packet_local corsaro_packet_local_t;
@@ -105,6 +119,14 @@ typedef struct corsaro_tagger_glob {
 
     int sample_rate;
 
+    /** A boolean flag describing whether the tagger threads should re-use
+     *  libipmeta results for consecutive packets from the same source */
+    uint8_t source_memo;
+
+    /** A boolean flag describing whether the tagger threads should perform
+     *  all of the libipmeta lookups for a buffer together in a second pass */
+    uint8_t batch_lookups;
+
     /** The index of the input URI that we are currently reading from */
     int currenturi;
 
@@ -130,6 +152,10 @@ typedef struct corsaro_tagger_glob {
     /** The number of packet processing threads to use */
     uint8_t pkt_threads;
 
+    /** The maximum number of packets that libtrace should read from the
+     *  input in a single call, or 0 to use the libtrace default */
+    uint16_t pkt_burst;
+
     /** The configuration options for the libipmeta prefix to ASN module */
     pfx2asn_opts_t pfxtagopts;
     /** The configuration options for the libipmeta Maxmind geolocation
@@ -156,6 +182,9 @@ typedef struct corsaro_tagger_glob {
      */
     uint8_t hasher_required;
 
+    /** Which software hasher to use when hashing is required */
+    uint8_t hasher_method;
+
     /** The zeromq context used to create zeromq sockets */
     void *zmq_ctxt;
 
@@ -240,6 +269,10 @@ struct corsaro_tagger_local {
     /** A corsaro tagger instance */
     corsaro_packet_tagger_t *tagger;
 
+    /** Deferred libipmeta lookups for the buffer being tagged, if
+     *  batched lookups are enabled */
+    corsaro_ipmeta_batch_t *ipmeta_batch;
+
     void *controlsock;
 
     uint16_t mcast_port;
@@ -262,6 +295,15 @@ struct corsaro_tagger_local {
      *  thread.
      */
     uint64_t errorcount;
+
+    /** Start of the current statistics interval (packet time) */
+    uint32_t laststat;
+
+    /** Cumulative number of source memo lookups at the last stats dump */
+    uint64_t lastmemolookups;
+
+    /** Cumulative number of source memo hits at the last stats dump */
+    uint64_t lastmemohits;
 };
 
 
@@ -55,11 +55,32 @@
 #include <libtrace_parallel.h>
 #include <zmq.h>
 #include <assert.h>
+#include <arpa/inet.h>
 
 #include "libcorsaro_log.h"
 #include "libcorsaro_tagging.h"
 #include "corsarotagger.h"
 
+/** The ERF record type for Ethernet packets */
+#define TAGGER_ERF_TYPE_ETH (2)
+
+/** The fixed portion of an ERF record header, as delivered by DAG, nDAG
+ *  and ERF inputs */
+typedef struct corsaro_erf_header {
+    /** Timestamp, as a little-endian 32.32 fixed point number of seconds */
+    uint64_t ts;
+    /** Record type (the top bit indicates extension headers) */
+    uint8_t type;
+    /** Record flags */
+    uint8_t flags;
+    /** Length of the record, including the ERF header */
+    uint16_t rlen;
+    /** Loss counter or color */
+    uint16_t lctr;
+    /** Wire length of the packet */
+    uint16_t wlen;
+} PACKED corsaro_erf_header_t;
+
 /** Initialises thread-local state for a packet processing thread.
  *
  *  @param tls          The thread local state for this thread
@@ -143,7 +164,9 @@ int corsaro_publish_tags(corsaro_tagger_global_t *glob,
     uint32_t rem;
     libtrace_linktype_t linktype;
     corsaro_tagged_packet_header_t *tpkt;
+    corsaro_erf_header_t *erf;
     size_t bufsize;
+    uint16_t wirelen;
 
     pktcontents = trace_get_layer2(packet, &linktype, &rem);
     if (rem == 0 || pktcontents == NULL) {
@@ -153,7 +176,27 @@ int corsaro_publish_tags(corsaro_tagger_global_t *glob,
     if (linktype != TRACE_TYPE_ETH) {
         return 0;
     }
-    tv = trace_get_timeval(packet);
+
+    /* DAG and nDAG inputs deliver ERF records, which already contain the
+     * timestamp and wire length in their fixed header. Read them directly
+     * rather than going through libtrace's format callbacks for each one.
+     */
+    erf = (corsaro_erf_header_t *)packet->header;
+    if (packet->type == TRACE_RT_DATA_ERF && erf != NULL &&
+            (erf->type & 0x7f) == TAGGER_ERF_TYPE_ETH) {
+        uint64_t erfts = bswap_le_to_host64(erf->ts);
+
+        tv.tv_sec = erfts >> 32;
+        tv.tv_usec = ((erfts & 0xffffffff) * 1000000) >> 32;
+        if (tv.tv_usec >= 1000000) {
+            tv.tv_usec -= 1000000;
+            tv.tv_sec += 1;
+        }
+        wirelen = ntohs(erf->wlen);
+    } else {
+        tv = trace_get_timeval(packet);
+        wirelen = trace_get_wire_length(packet);
+    }
 
     bufsize = sizeof(corsaro_tagged_packet_header_t) + rem;
 
@@ -179,7 +222,7 @@ int corsaro_publish_tags(corsaro_tagger_global_t *glob,
     tpkt->ts_sec = tv.tv_sec;
     tpkt->ts_usec = tv.tv_usec;
     tpkt->pktlen = rem;
-    tpkt->wirelen = trace_get_wire_length(packet);
+    tpkt->wirelen = wirelen;
     memset(&(tpkt->tags), 0, sizeof(corsaro_packet_tags_t));
 
     tls->buf->used += sizeof(corsaro_tagged_packet_header_t);
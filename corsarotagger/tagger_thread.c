@@ -82,6 +82,9 @@ void init_tagger_thread_data(corsaro_tagger_local_t *tls,
     tls->threadid = threadid;
     tls->mcast_port = mcast_port;
     tls->next_seq = 1;
+    tls->laststat = 0;
+    tls->lastmemolookups = 0;
+    tls->lastmemohits = 0;
 
     if (tls->tagger == NULL) {
         corsaro_log(glob->logger,
@@ -90,6 +93,19 @@ void init_tagger_thread_data(corsaro_tagger_local_t *tls,
         return;
     }
 
+    corsaro_set_tagger_source_memo(tls->tagger, glob->source_memo);
+
+    tls->ipmeta_batch = NULL;
+    if (glob->batch_lookups) {
+        tls->ipmeta_batch = corsaro_create_ipmeta_batch();
+        if (tls->ipmeta_batch == NULL) {
+            corsaro_log(glob->logger,
+                    "out of memory while creating IPmeta lookup batch.");
+            tls->stopped = 1;
+            return;
+        }
+    }
+
     tls->mcast_sock = ndag_create_multicaster_socket(mcast_port,
             glob->ndag_mcastgroup, glob->ndag_sourceaddr, &(tls->mcast_target),
             glob->ndag_ttl);
@@ -147,6 +163,10 @@ void destroy_local_tagger_state(corsaro_tagger_global_t *glob,
         corsaro_destroy_packet_tagger(tls->tagger);
     }
 
+    if (tls->ipmeta_batch) {
+        corsaro_free_ipmeta_batch(tls->ipmeta_batch);
+    }
+
     if (tls->controlsock) {
         zmq_setsockopt(tls->controlsock, ZMQ_LINGER, &linger, sizeof(linger));
         zmq_close(tls->controlsock);
@@ -194,6 +214,169 @@ static inline int push_message_to_ndag(ndag_encap_params_t *params,
 }
 
 
+/** Writes the source memo statistics for the previous minute to the
+ *  tagger thread's stats file, if one has been configured.
+ *
+ *  Tagger threads have no libtrace ticks, so the packet timestamps are used
+ *  to decide when a minute has passed.
+ *
+ *  @param tls      The thread-local state for this tagging thread.
+ *  @param now      The timestamp (seconds) of the most recent packet.
+ */
+static void update_tagger_thread_stats(corsaro_tagger_local_t *tls,
+        uint32_t now) {
+
+    FILE *f = NULL;
+    char sfname[1024];
+    uint64_t lookups, hits;
+
+    if (tls->laststat == 0) {
+        tls->laststat = now - (now % 60);
+        return;
+    }
+
+    if (now < tls->laststat + 60) {
+        return;
+    }
+
+    lookups = tls->tagger->memo_lookups - tls->lastmemolookups;
+    hits = tls->tagger->memo_hits - tls->lastmemohits;
+
+    if (tls->glob->statfilename && tls->tagger->memo_enabled) {
+        snprintf(sfname, 1024, "%s-tagger%02d", tls->glob->statfilename,
+                tls->threadid);
+        f = fopen(sfname, "w");
+        if (!f) {
+            corsaro_log(tls->glob->logger,
+                    "unable to open statistic file %s for writing: %s",
+                    sfname, strerror(errno));
+        } else {
+            fprintf(f, "time=%u memolookups=%lu memohits=%lu memohitrate=%.4f\n",
+                    tls->laststat, lookups, hits,
+                    lookups > 0 ? ((double)hits) / lookups : 0.0);
+            fclose(f);
+        }
+    }
+
+    tls->lastmemolookups = tls->tagger->memo_lookups;
+    tls->lastmemohits = tls->tagger->memo_hits;
+    tls->laststat = now - (now % 60);
+}
+
+/** Finds the IP header inside an untagged packet, skipping over any
+ *  VLAN, MPLS or PPPoE headers.
+ *
+ *  @param l2       The start of the packet (i.e. the Ethernet header).
+ *  @param rem      The number of bytes in the packet. Will be updated to
+ *                  contain the number of bytes remaining after the IP header.
+ *  @return a pointer to the IP header, or NULL if there isn't one.
+ */
+static inline libtrace_ip_t *find_ip_header(void *l2, uint32_t *rem) {
+    void *next;
+    uint16_t ethertype;
+
+    next = trace_get_payload_from_layer2(l2, TRACE_TYPE_ETH,
+            &ethertype, rem);
+    while (next != NULL && *rem > 0) {
+        switch(ethertype) {
+            case TRACE_ETHERTYPE_8021Q:
+                next = trace_get_payload_from_vlan(next, &ethertype, rem);
+                continue;
+            case TRACE_ETHERTYPE_MPLS:
+                next = trace_get_payload_from_mpls(next, &ethertype, rem);
+                continue;
+            case TRACE_ETHERTYPE_PPP_SES:
+                next = trace_get_payload_from_pppoe(next, &ethertype, rem);
+                continue;
+            default:
+                break;
+        }
+        break;
+    }
+
+    if (*rem == 0) {
+        next = NULL;
+    }
+
+    return (libtrace_ip_t *)next;
+}
+
+/** Tags every packet in a buffer of untagged packets.
+ *
+ *  If batched lookups are enabled, the libipmeta lookups for the whole
+ *  buffer are deferred until all of the other tagging has been done and are
+ *  then performed together, in source address order.
+ *
+ *  @param tls      The thread-local state for this tagging thread.
+ *  @param buf      The buffer containing the packets to be tagged.
+ *  @param tagged   Set to the number of bytes of the buffer that contain
+ *                  complete packets.
+ *  @return 1 if the buffer was tagged successfully, -1 if the buffer
+ *          contents are invalid.
+ */
+static int tag_buffer_contents(corsaro_tagger_local_t *tls,
+        corsaro_tagger_buffer_t *buf, uint32_t *tagged) {
+
+    uint32_t processed = 0;
+    int ret = 1;
+
+    while (processed < buf->used) {
+        corsaro_tagged_packet_header_t *packet;
+        libtrace_ip_t *ip;
+        uint32_t rem;
+        int r;
+
+        packet = (corsaro_tagged_packet_header_t *)(buf->space + processed);
+
+        if (buf->used - processed < sizeof(corsaro_tagged_packet_header_t)) {
+            corsaro_log(tls->glob->logger,
+                    "error: not enough buffer content for a complete header...");
+            ret = -1;
+            break;
+        }
+        if (buf->used - processed - sizeof(corsaro_tagged_packet_header_t)
+                < packet->pktlen) {
+            corsaro_log(tls->glob->logger,
+                    "error: missing packet contents in tagger thread...");
+            ret = -1;
+            break;
+        }
+
+        /* Find the IP header in the packet contents.
+         * The packet should start with an Ethernet header */
+        rem = packet->pktlen;
+        ip = find_ip_header(((uint8_t *)packet) +
+                sizeof(corsaro_tagged_packet_header_t), &rem);
+
+        /* Actually do the tagging */
+        if (tls->ipmeta_batch) {
+            r = corsaro_tag_ippayload_deferred(tls->tagger, &(packet->tags),
+                    ip, rem, tls->ipmeta_batch);
+        } else {
+            r = corsaro_tag_ippayload(tls->tagger, &(packet->tags), ip, rem);
+        }
+
+        if (r < 0) {
+            corsaro_log(tls->glob->logger,
+                    "error while tagging IP payload in tagger thread.");
+            tls->errorcount ++;
+        }
+
+        processed += sizeof(corsaro_tagged_packet_header_t) + packet->pktlen;
+    }
+
+    if (tls->ipmeta_batch) {
+        if (corsaro_tag_ipmeta_batch(tls->tagger, tls->ipmeta_batch) < 0) {
+            corsaro_log(tls->glob->logger,
+                    "error while performing batched IPmeta lookups in tagger thread.");
+            tls->errorcount ++;
+        }
+    }
+
+    *tagged = processed;
+    return ret;
+}
+
 /** Receives and processes a buffer of untagged packets for a tagger thread,
  *  tagging each packet contained within that buffer appropriately and
  *  publishing it to the external proxy thread.
@@ -205,7 +388,7 @@ static inline int push_message_to_ndag(ndag_encap_params_t *params,
 static int tagger_thread_process_buffer(corsaro_tagger_local_t *tls) {
     uint8_t recvbuf[TAGGER_BUFFER_SIZE];
     int r, ret;
-    uint32_t processed;
+    uint32_t processed, tagged;
     corsaro_tagger_buffer_t *buf = NULL;
     corsaro_tagger_internal_msg_t *recvd = NULL;
     uint16_t maxmsg = tls->glob->ndag_mtu - sizeof(ndag_common_t) -
@@ -237,37 +420,20 @@ static int tagger_thread_process_buffer(corsaro_tagger_local_t *tls) {
 
     ndag_reset_encap_state(&(tls->ndag_params));
 
-    /* The buffer probably contains multiple untagged packets, so keep
-     * looping until we've tagged them all */
-    while (processed < buf->used) {
+    /* The buffer probably contains multiple untagged packets, so tag them
+     * all first. */
+    ret = tag_buffer_contents(tls, buf, &tagged);
+
+    /* Now finalise the headers for the tagged packets and publish them */
+    while (processed < tagged) {
         corsaro_tagged_packet_header_t *packet;
-        libtrace_ip_t *ip;
-        void *l2, *next;
-        uint32_t rem;
-        uint16_t ethertype, filtbits;
+        uint16_t filtbits;
 
         packet = (corsaro_tagged_packet_header_t *)(buf->space + processed);
-
-        if (buf->used - processed < sizeof(corsaro_tagged_packet_header_t)) {
-            corsaro_log(tls->glob->logger,
-                    "error: not enough buffer content for a complete header...");
-            ret = -1;
-            break;
-        }
         processed += sizeof(corsaro_tagged_packet_header_t);
-        if (buf->used - processed < packet->pktlen) {
-            corsaro_log(tls->glob->logger,
-                    "error: missing packet contents in tagger thread...");
-            ret = -1;
-            break;
-        }
 
-        /* Find the IP header in the packet contents.
-         * The packet should start with an Ethernet header */
-        l2 = buf->space + processed;
-        rem = packet->pktlen;
-
-        if (rem + sizeof(corsaro_tagged_packet_header_t) > maxmsg - msgused) {
+        if (packet->pktlen + sizeof(corsaro_tagged_packet_header_t) >
+                maxmsg - msgused) {
             if (push_message_to_ndag(&(tls->ndag_params), msgstart, msgused,
                     reccount, &savedtosend, tls->glob->logger, 0) < 0) {
                 ret = -1;
@@ -280,39 +446,6 @@ static int tagger_thread_process_buffer(corsaro_tagger_local_t *tls) {
             msgused = 0;
         }
 
-        next = trace_get_payload_from_layer2(l2, TRACE_TYPE_ETH,
-                &ethertype, &rem);
-        while (next != NULL && rem > 0) {
-            switch(ethertype) {
-                case TRACE_ETHERTYPE_8021Q:
-                    next = trace_get_payload_from_vlan(next, &ethertype, &rem);
-                    continue;
-                case TRACE_ETHERTYPE_MPLS:
-                    next = trace_get_payload_from_mpls(next, &ethertype, &rem);
-                    continue;
-                case TRACE_ETHERTYPE_PPP_SES:
-                    next = trace_get_payload_from_pppoe(next, &ethertype, &rem);
-                    continue;
-                default:
-                    break;
-            }
-            break;
-        }
-
-        if (rem == 0) {
-            next = NULL;
-        }
-
-        ip = (libtrace_ip_t *)next;
-
-        /* Actually do the tagging */
-        if (corsaro_tag_ippayload(tls->tagger, &(packet->tags),
-                    ip, rem) < 0) {
-            corsaro_log(tls->glob->logger,
-                    "error while tagging IP payload in tagger thread.");
-            tls->errorcount ++;
-        }
-
         /* Using the results of the flowtuple hash tag, assign this packet
          * to one of our output hash bins, so clients will be able to
          * receive the tagged packets in parallel if they desire.
@@ -328,6 +461,8 @@ static int tagger_thread_process_buffer(corsaro_tagger_local_t *tls) {
         msgused += packet->pktlen + sizeof(corsaro_tagged_packet_header_t);
         reccount += 1;
 
+        update_tagger_thread_stats(tls, packet->ts_sec);
+
         packet->pktlen = htons(packet->pktlen);
         packet->wirelen = htons(packet->wirelen);
         packet->ts_sec = htonl(packet->ts_sec);
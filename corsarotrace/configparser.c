@@ -58,6 +58,7 @@
 
 #include <yaml.h>
 #include <zmq.h>
+#include <glob.h>
 
 static corsaro_plugin_t *allplugins = NULL;
 
@@ -159,6 +160,129 @@ static int parse_plugin_config(corsaro_trace_global_t *glob,
     return plugincount;
 }
 
+/* Wrapper around glob(3), which is otherwise hidden by our habit of
+ * calling the global state 'glob' */
+static int match_trace_files(const char *path, glob_t *matches) {
+    return glob(path, 0, NULL, matches);
+}
+
+static int add_offline_file(corsaro_trace_global_t *glob, char *uri) {
+
+    char **tmp;
+    char *copy;
+
+    if (glob->offlinefilecount == glob->offlinefilesalloced) {
+        tmp = (char **)realloc(glob->offlinefiles,
+                (glob->offlinefilesalloced + 32) * sizeof(char *));
+        if (tmp == NULL) {
+            corsaro_log(glob->logger,
+                    "unable to grow the list of offline trace files");
+            return -1;
+        }
+        glob->offlinefiles = tmp;
+        glob->offlinefilesalloced += 32;
+    }
+
+    copy = strdup(uri);
+    if (copy == NULL) {
+        corsaro_log(glob->logger,
+                "unable to allocate memory for offline trace file %s", uri);
+        return -1;
+    }
+    glob->offlinefiles[glob->offlinefilecount] = copy;
+    glob->offlinefilecount ++;
+    return 0;
+}
+
+/** Expands a trace URI containing a wildcard pattern (e.g.
+ *  pcapfile:/data/2020-*.pcap) into the list of matching trace files.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param pattern      The URI to expand. The optional libtrace format
+ *                      prefix is retained on each expanded URI.
+ *  @return the number of files added, or -1 if an error occurred.
+ */
+static int expand_offline_pattern(corsaro_trace_global_t *glob,
+        char *pattern) {
+
+    glob_t matches;
+    char *colon, *path;
+    char uri[4096];
+    int prefixlen = 0, ret;
+    size_t i;
+
+    /* Only treat the text before the first colon as a format prefix if
+     * it does not look like part of a path */
+    colon = strchr(pattern, ':');
+    if (colon && memchr(pattern, '/', colon - pattern) == NULL) {
+        prefixlen = (colon - pattern) + 1;
+    }
+    path = pattern + prefixlen;
+
+    ret = match_trace_files(path, &matches);
+    if (ret == GLOB_NOMATCH) {
+        /* Not a pattern (or a pattern that matched nothing) -- pass it to
+         * libtrace as is and let it complain if the file doesn't exist */
+        if (add_offline_file(glob, pattern) < 0) {
+            return -1;
+        }
+        return 1;
+    }
+    if (ret != 0) {
+        corsaro_log(glob->logger, "unable to expand offline file pattern %s",
+                pattern);
+        return -1;
+    }
+
+    for (i = 0; i < matches.gl_pathc; i++) {
+        snprintf(uri, sizeof(uri), "%.*s%s", prefixlen, pattern,
+                matches.gl_pathv[i]);
+        if (add_offline_file(glob, uri) < 0) {
+            globfree(&matches);
+            return -1;
+        }
+    }
+    globfree(&matches);
+    return (int)i;
+}
+
+static int cmp_offline_files(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int parse_offline_files(corsaro_trace_global_t *glob,
+        yaml_document_t *doc, yaml_node_t *value) {
+
+    yaml_node_item_t *item;
+
+    if (value->type == YAML_SCALAR_NODE) {
+        if (expand_offline_pattern(glob,
+                    (char *)value->data.scalar.value) < 0) {
+            return -1;
+        }
+    } else {
+        for (item = value->data.sequence.items.start;
+                item != value->data.sequence.items.top; item ++) {
+            yaml_node_t *node = yaml_document_get_node(doc, *item);
+
+            if (node->type != YAML_SCALAR_NODE) {
+                corsaro_log(glob->logger,
+                        "offlinefiles should be a list of file names or patterns");
+                return -1;
+            }
+            if (expand_offline_pattern(glob,
+                        (char *)node->data.scalar.value) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    /* Trace files are usually named after the time that they start, so
+     * sorting by name should put them in time order */
+    qsort(glob->offlinefiles, glob->offlinefilecount, sizeof(char *),
+            cmp_offline_files);
+    return 0;
+}
 
 static int grab_corsaro_filename_template(corsaro_trace_global_t *glob,
         yaml_document_t *doc, yaml_node_t *key, yaml_node_t *value) {
@@ -211,6 +335,47 @@ static int parse_remaining_config(corsaro_trace_global_t *glob,
         }
     }
 
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "monitorsockets")) {
+        if (parse_onoff_option(glob->logger, (char *)value->data.scalar.value,
+                &(glob->sockmonitor), "monitor receive sockets") < 0) {
+            return -1;
+        }
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "rcvbufceiling")) {
+        glob->rcvbufceiling = strtoul((char *)value->data.scalar.value,
+                NULL, 10);
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "resultbacklog")) {
+        glob->resultbacklog = strtoul((char *)value->data.scalar.value,
+                NULL, 10);
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "backlogpolicy")) {
+        if (strcasecmp((char *)value->data.scalar.value, "block") == 0) {
+            glob->backlogpolicy = CORSARO_RESULT_BACKLOG_BLOCK;
+        } else if (strcasecmp((char *)value->data.scalar.value,
+                    "shed") == 0) {
+            glob->backlogpolicy = CORSARO_RESULT_BACKLOG_SHED;
+        } else {
+            corsaro_log(glob->logger,
+                    "invalid backlog policy '%s', must be 'block' or 'shed'",
+                    (char *)value->data.scalar.value);
+            return -1;
+        }
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "mergedelay")) {
+        glob->mergedelay = strtoul((char *)value->data.scalar.value,
+                NULL, 10);
+    }
+
     if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
             && !strcmp((char *)key->data.scalar.value, "monitorid")) {
         glob->monitorid = strdup((char *)value->data.scalar.value);
@@ -226,6 +391,26 @@ static int parse_remaining_config(corsaro_trace_global_t *glob,
         glob->source_uri = strdup((char *)value->data.scalar.value);
     }
 
+    if (key->type == YAML_SCALAR_NODE && (value->type == YAML_SCALAR_NODE ||
+                value->type == YAML_SEQUENCE_NODE)
+            && !strcmp((char *)key->data.scalar.value, "offlinefiles")) {
+        if (parse_offline_files(glob, doc, value) < 0) {
+            return -1;
+        }
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "offlineinputs")) {
+        glob->offlineinputs = strtoul((char *)value->data.scalar.value,
+                NULL, 10);
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "offlinelookahead")) {
+        glob->offlinelookahead = strtoul((char *)value->data.scalar.value,
+                NULL, 10);
+    }
+
     if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
             && !strcmp((char *)key->data.scalar.value, "controlsocketname")) {
         glob->control_uri = strdup((char *)value->data.scalar.value);
@@ -283,6 +468,18 @@ static int parse_remaining_config(corsaro_trace_global_t *glob,
     return 1;
 }
 
+static int parse_input_plugins(corsaro_trace_global_t *glob,
+        yaml_document_t *doc, yaml_node_t *key, yaml_node_t *value) {
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SEQUENCE_NODE
+            && !strcmp((char *)key->data.scalar.value, "plugins")) {
+        if (parse_plugin_config(glob, doc, value) == 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
 static void log_configuration(corsaro_trace_global_t *glob) {
     corsaro_log(glob->logger, "running on monitor %s", glob->monitorid);
     if (glob->statfilename) {
@@ -294,8 +491,22 @@ static void log_configuration(corsaro_trace_global_t *glob) {
     corsaro_log(glob->logger, "rotating files every %u intervals",
             glob->rotatefreq);
 
-    corsaro_log(glob->logger, "packets are being read from %s",
-            glob->source_uri);
+    if (glob->offlinefilecount > 0) {
+        corsaro_log(glob->logger,
+                "reading packets from %d trace files using %u parallel inputs",
+                glob->offlinefilecount, glob->offlineinputs);
+        if (glob->offlinelookahead == 0) {
+            corsaro_log(glob->logger,
+                    "offlinelookahead must be at least 1, using 1 instead");
+            glob->offlinelookahead = 1;
+        }
+        corsaro_log(glob->logger,
+                "processing threads may have up to %u interval results waiting to be merged",
+                glob->offlinelookahead);
+    } else {
+        corsaro_log(glob->logger, "packets are being read from %s",
+                glob->source_uri);
+    }
 
     if (glob->control_uri) {
         corsaro_log(glob->logger,
@@ -330,6 +541,28 @@ static void log_configuration(corsaro_trace_global_t *glob) {
         corsaro_log(glob->logger, "only included traffic from RFC 5735 addresses");
     }
 
+    if (glob->sockmonitor) {
+        corsaro_log(glob->logger, "monitoring kernel drops on multicast receive sockets");
+        if (glob->rcvbufceiling > 0) {
+            corsaro_log(glob->logger, "growing receive buffers up to %u bytes if drops occur",
+                    glob->rcvbufceiling);
+        }
+    }
+
+    if (glob->resultbacklog > 0) {
+        corsaro_log(glob->logger,
+                "workers may have up to %u interval results waiting for the merger, then will %s",
+                glob->resultbacklog,
+                glob->backlogpolicy == CORSARO_RESULT_BACKLOG_SHED ?
+                        "shed optional plugins" : "block");
+    }
+
+    if (glob->mergedelay > 0) {
+        corsaro_log(glob->logger,
+                "delaying each merge by %u ms (testing only!)",
+                glob->mergedelay);
+    }
+
 }
 
 static int parse_corsaro_trace_config(corsaro_trace_global_t *glob,
@@ -395,6 +628,53 @@ yamlfail:
 }
 
 
+/** Creates a separate set of plugin instances for each offline input, so
+ *  that each input has its own processing state (e.g. the report plugin's
+ *  IP tracker threads).
+ *
+ *  The first input uses the plugins that were created when the config
+ *  was first parsed; we re-read the plugin config for the others.
+ *
+ *  Because each input gets its own plugin instances, each instance also
+ *  gets its own 'memorybudget', so the total memory allowed for a plugin
+ *  is 'offlineinputs' times its configured budget.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param filename     The path to the configuration file.
+ *  @return 0 if successful, -1 if an error occurred.
+ */
+static int configure_offline_inputs(corsaro_trace_global_t *glob,
+        char *filename) {
+
+    corsaro_plugin_t *saved = glob->active_plugins;
+    int i;
+
+    if (glob->offlineinputs == 0) {
+        glob->offlineinputs = 1;
+    }
+    if (glob->offlineinputs > glob->offlinefilecount) {
+        glob->offlineinputs = glob->offlinefilecount;
+    }
+
+    glob->offlineplugins = (corsaro_plugin_t **)calloc(glob->offlineinputs,
+            sizeof(corsaro_plugin_t *));
+    glob->offlineplugins[0] = saved;
+
+    for (i = 1; i < glob->offlineinputs; i++) {
+        glob->active_plugins = NULL;
+        if (parse_corsaro_trace_config(glob, filename,
+                    parse_input_plugins) == -1) {
+            glob->offlineplugins[i] = glob->active_plugins;
+            glob->active_plugins = saved;
+            return -1;
+        }
+        glob->offlineplugins[i] = glob->active_plugins;
+    }
+
+    glob->active_plugins = saved;
+    return 0;
+}
+
 corsaro_trace_global_t *corsaro_trace_init_global(char *filename, int logmode) {
     corsaro_trace_global_t *glob = NULL;
 
@@ -409,7 +689,6 @@ corsaro_trace_global_t *corsaro_trace_init_global(char *filename, int logmode) {
 
     /* Initialise all globals */
     glob->active_plugins = NULL;
-    glob->first_pkt_ts = 0;
     glob->boundstartts = 0;
     glob->boundendts = 0;
     glob->interval = 60;
@@ -427,10 +706,25 @@ corsaro_trace_global_t *corsaro_trace_init_global(char *filename, int logmode) {
     glob->removerouted = 0;
     glob->removenotscan = 0;
 
+    glob->sockmonitor = 1;
+    glob->rcvbufceiling = 0;
+    memset(&(glob->sockmon), 0, sizeof(corsaro_trace_sockmon_t));
+
+    glob->resultbacklog = 0;
+    glob->backlogpolicy = CORSARO_RESULT_BACKLOG_BLOCK;
+    glob->mergedelay = 0;
+    memset(&(glob->resultchan), 0, sizeof(corsaro_trace_resultchan_t));
+
     glob->subsource = CORSARO_TRACE_SOURCE_FANNER;
     glob->logger = NULL;
     glob->source_uri = NULL;
     glob->control_uri = NULL;
+    glob->offlinefiles = NULL;
+    glob->offlinefilecount = 0;
+    glob->offlinefilesalloced = 0;
+    glob->offlineinputs = 4;
+    glob->offlinelookahead = 16;
+    glob->offlineplugins = NULL;
     glob->zmq_ctxt = zmq_ctx_new();
 
     memset(&(glob->pfxtagopts), 0, sizeof(pfx2asn_opts_t));
@@ -438,8 +732,6 @@ corsaro_trace_global_t *corsaro_trace_init_global(char *filename, int logmode) {
     memset(&(glob->netacqtagopts), 0, sizeof(netacq_opts_t));
     glob->ipmeta_state = NULL;
 
-    pthread_mutex_init(&(glob->mutex), NULL);
-
     init_libts_ascii_backend(&(glob->libtsascii));
     init_libts_dbats_backend(&(glob->libtsdbats));
     init_libts_kafka_backend(&(glob->libtskafka));
@@ -493,7 +785,7 @@ corsaro_trace_global_t *corsaro_trace_init_global(char *filename, int logmode) {
         return NULL;
     }
 
-    if (glob->source_uri == NULL) {
+    if (glob->source_uri == NULL && glob->offlinefilecount == 0) {
         corsaro_log(glob->logger,
                 "corsarotrace: no source of tagged packets specified in configuration file ('packetsource')");
         corsaro_trace_free_global(glob);
@@ -501,6 +793,15 @@ corsaro_trace_global_t *corsaro_trace_init_global(char *filename, int logmode) {
         return NULL;
     }
 
+    if (glob->offlinefilecount > 0 &&
+            configure_offline_inputs(glob, filename) < 0) {
+        corsaro_log(glob->logger,
+            "corsarotrace: errors while configuring plugins for offline inputs");
+        corsaro_trace_free_global(glob);
+        corsaro_cleanse_plugin_list(allplugins);
+        return NULL;
+    }
+
     log_configuration(glob);
 
     /* Ok to cleanse this now, the config parsing above should have made
@@ -532,12 +833,28 @@ corsaro_trace_global_t *corsaro_trace_init_global(char *filename, int logmode) {
 
 void corsaro_trace_free_global(corsaro_trace_global_t *glob) {
 
+    int i;
+
     if (glob == NULL) {
         return;
     }
 
     corsaro_cleanse_plugin_list(glob->active_plugins);
 
+    if (glob->offlineplugins) {
+        for (i = 1; i < glob->offlineinputs; i++) {
+            corsaro_cleanse_plugin_list(glob->offlineplugins[i]);
+        }
+        free(glob->offlineplugins);
+    }
+
+    if (glob->offlinefiles) {
+        for (i = 0; i < glob->offlinefilecount; i++) {
+            free(glob->offlinefiles[i]);
+        }
+        free(glob->offlinefiles);
+    }
+
     destroy_libts_ascii_backend(&(glob->libtsascii));
     destroy_libts_kafka_backend(&(glob->libtskafka));
     destroy_libts_dbats_backend(&(glob->libtsdbats));
@@ -577,7 +894,6 @@ void corsaro_trace_free_global(corsaro_trace_global_t *glob) {
         zmq_ctx_destroy(glob->zmq_ctxt);
     }
 
-    pthread_mutex_destroy(&(glob->mutex));
     destroy_corsaro_logger(glob->logger);
     free(glob);
 }
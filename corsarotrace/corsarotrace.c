@@ -82,7 +82,9 @@ libtrace_t *inputtrace = NULL;
 static void cleanup_signal(int sig) {
     (void)sig;
     corsaro_halted = 1;
-    trace_pstop(inputtrace);
+    if (inputtrace) {
+        trace_pstop(inputtrace);
+    }
 }
 
 
@@ -137,7 +139,7 @@ static void fast_construct_packet(libtrace_t *deadtrace,
     packet->which_trace_start = 0;
 }
 
-static int push_interval_result(corsaro_logger_t *logger,
+static int push_interval_result(corsaro_trace_global_t *glob,
 		corsaro_trace_worker_t *tls, void **result) {
 
     corsaro_result_msg_t res;
@@ -148,8 +150,19 @@ static int push_interval_result(corsaro_logger_t *logger,
     res.interval_time = tls->current_interval.time;
     res.plugindata = result;
 
+    /* Shedding is only ever switched on or off at an interval boundary,
+     * so this tells the merger whether the optional plugins missed any
+     * packets during the interval that this result covers.
+     */
+    res.shed = tls->plugins->shedding;
+
+    /* May block until the merger has caught up, depending on the
+     * backlog policy */
+    tls->plugins->shedding = acquire_result_credit(glob, tls);
+
     if (zmq_send(tls->zmq_pushsock, &res, sizeof(res), 0) < 0) {
-        corsaro_log(logger,
+        release_result_credit(glob, tls->workerid);
+        corsaro_log(glob->logger,
                 "error while pushing result from worker %d: %s",
                 tls->workerid, strerror(errno));
         return -1;
@@ -167,6 +180,7 @@ static int push_rotate_output(corsaro_logger_t *logger,
     res.source = tls->workerid;
     res.interval_num = tls->current_interval.number;
     res.interval_time = ts;
+    res.shed = 0;
     res.plugindata = NULL;
 
     if (zmq_send(tls->zmq_pushsock, &res, sizeof(res), 0) < 0) {
@@ -188,6 +202,7 @@ static int push_stop_merging(corsaro_logger_t *logger,
     res.source = tls->workerid;
     res.interval_num = tls->current_interval.number;
     res.interval_time = 0;
+    res.shed = 0;
     res.plugindata = NULL;
 
     if (zmq_send(tls->zmq_pushsock, &res, sizeof(res), 0) < 0) {
@@ -206,8 +221,7 @@ static void publish_thread_statistics(corsaro_trace_global_t *glob,
     FILE *f = NULL;
     char sfname[1024];
 
-    snprintf(sfname, 1024, "%s-t%02d", glob->statfilename,
-                trace_get_perpkt_thread_id(t));
+    snprintf(sfname, 1024, "%s-t%02d", glob->statfilename, tls->workerid);
 
     f = fopen(sfname, "w");
     if (!f) {
@@ -229,7 +243,8 @@ static libtrace_packet_t * per_packet(libtrace_t *trace,
 		libtrace_packet_t *packet) {
 
 	corsaro_trace_worker_t *tls = (corsaro_trace_worker_t *)local;
-	corsaro_trace_global_t *glob = (corsaro_trace_global_t *)global;
+	corsaro_trace_input_t *input = (corsaro_trace_input_t *)global;
+	corsaro_trace_global_t *glob = input->glob;
     corsaro_packet_tags_t *tags, localtags;
     corsaro_tagged_packet_header_t *taghdr;
 	void **interval_data;
@@ -290,7 +305,7 @@ static libtrace_packet_t * per_packet(libtrace_t *trace,
         final_result = corsaro_push_end_plugins(tls->plugins,
                 tls->current_interval.number, glob->boundendts, 0);
 
-        if (push_interval_result(glob->logger, tls, final_result) < 0) {
+        if (push_interval_result(glob, tls, final_result) < 0) {
             corsaro_log(glob->logger,
                     "error while publishing results for final interval %u",
                     tls->current_interval.number);
@@ -310,12 +325,12 @@ static libtrace_packet_t * per_packet(libtrace_t *trace,
 
         if (tls->first_pkt_ts == 0) {
             tls->first_pkt_ts = ts;
-            pthread_mutex_lock(&(glob->mutex));
-            if (tls->first_pkt_ts < glob->first_pkt_ts ||
-                    glob->first_pkt_ts == 0) {
-                glob->first_pkt_ts = tls->first_pkt_ts;
+            pthread_mutex_lock(&(input->mutex));
+            if (tls->first_pkt_ts < input->first_pkt_ts ||
+                    input->first_pkt_ts == 0) {
+                input->first_pkt_ts = tls->first_pkt_ts;
             }
-            pthread_mutex_unlock(&(glob->mutex));
+            pthread_mutex_unlock(&(input->mutex));
         }
 
         /* First non-ignored packet */
@@ -327,9 +342,19 @@ static libtrace_packet_t * per_packet(libtrace_t *trace,
             return packet;
         }
 
-        pthread_mutex_lock(&(glob->mutex));
-        tls->current_interval.time = glob->first_pkt_ts;
-        pthread_mutex_unlock(&(glob->mutex));
+        pthread_mutex_lock(&(input->mutex));
+        tls->current_interval.time = input->first_pkt_ts;
+        pthread_mutex_unlock(&(input->mutex));
+
+        /* Offline inputs may start part way through an interval that an
+         * earlier input has already begun, so start on the interval
+         * boundary to make sure everyone agrees on the interval
+         * timestamps.
+         */
+        if (input->offline) {
+            tls->current_interval.time -=
+                    (tls->current_interval.time % glob->interval);
+        }
         tls->lastrotateinterval.time = tls->current_interval.time -
                 (tls->current_interval.time %
                 (glob->interval * glob->rotatefreq));
@@ -361,7 +386,7 @@ static libtrace_packet_t * per_packet(libtrace_t *trace,
         interval_data = corsaro_push_end_plugins(tls->plugins,
                 tls->current_interval.number, tls->next_report, complete);
 
-        if (push_interval_result(glob->logger, tls, interval_data) < 0) {
+        if (push_interval_result(glob, tls, interval_data) < 0) {
             corsaro_log(glob->logger,
                     "error while publishing results for interval %u",
                     tls->current_interval.number);
@@ -373,6 +398,8 @@ static libtrace_packet_t * per_packet(libtrace_t *trace,
             publish_thread_statistics(glob, t, tls);
         }
 
+        socket_monitor_end_interval(glob, tls);
+
         if (tls->tracker->lostpackets > 0) {
             corsaro_log(glob->logger,
                     "warning: worker thread %d has observed %lu packets dropped in the past interval (%u instances) -- %lu",
@@ -439,10 +466,19 @@ static void *init_corsarotrace_worker(libtrace_t *trace, libtrace_thread_t *t,
 		void *global) {
 
     corsaro_trace_worker_t *tls;
-	corsaro_trace_global_t *glob = (corsaro_trace_global_t *)global;
+	corsaro_trace_input_t *input = (corsaro_trace_input_t *)global;
+	corsaro_trace_global_t *glob = input->glob;
+    int localid = trace_get_perpkt_thread_id(t);
+
+    /* Offline inputs carry their worker state over from one trace file to
+     * the next, so the trace files behave like one continuous stream.
+     */
+    if (input->workers && input->workers[localid]) {
+        return input->workers[localid];
+    }
 
 	tls = calloc(1, sizeof(corsaro_trace_worker_t));
-	tls->workerid = trace_get_perpkt_thread_id(t);
+	tls->workerid = (input->inputid * glob->threads) + localid;
 	tls->tracker = corsaro_create_tagged_loss_tracker(glob->threads);
     tls->tagger = corsaro_create_packet_tagger(glob->logger,
             glob->ipmeta_state);
@@ -462,9 +498,11 @@ static void *init_corsarotrace_worker(libtrace_t *trace, libtrace_thread_t *t,
 		return tls;
     }
 
+    /* Each input has its own plugin instances, so the plugins only need
+     * to know which of this input's threads they are running on.
+     */
     tls->plugins = corsaro_start_plugins(glob->logger,
-            glob->active_plugins, glob->plugincount,
-            tls->workerid);
+            input->plugins, glob->plugincount, localid);
 
     if (tls->plugins == NULL) {
         corsaro_log(glob->logger, "worker %d unable to start plugins.",
@@ -472,19 +510,28 @@ static void *init_corsarotrace_worker(libtrace_t *trace, libtrace_thread_t *t,
 		tls->stopped = 1;
     }
 
+    if (input->workers) {
+        input->workers[localid] = tls;
+    }
 	return tls;
 }
 
-static void halt_corsarotrace_worker(libtrace_t *trace, libtrace_thread_t *t,
-		void *global, void *local) {
+/** Publishes the final results for a worker, tells the merger that the
+ *  worker is done and then stops the worker's plugins.
+ *
+ *  @param input        The input that the worker was reading from.
+ *  @param tls          The worker to finish.
+ *  @param live         Set to 1 if the input is a live capture.
+ */
+static void finish_corsarotrace_worker(corsaro_trace_input_t *input,
+        corsaro_trace_worker_t *tls, int live) {
 
-	corsaro_trace_worker_t *tls = (corsaro_trace_worker_t *)local;
-	corsaro_trace_global_t *glob = (corsaro_trace_global_t *)global;
+	corsaro_trace_global_t *glob = input->glob;
     void **final_result;
 
-    if (tls->pkts_outstanding > 0) {
+    if (tls->pkts_outstanding > 0 || (input->offline && !tls->stopped &&
+                tls->current_interval.time != 0)) {
         uint8_t complete = 0;
-        libtrace_info_t *tinfo = trace_get_information(trace);
 
         /* Deal with case where we are reading from a rotated trace file and
          * have reached the end of the file.
@@ -493,15 +540,20 @@ static void halt_corsarotrace_worker(libtrace_t *trace, libtrace_thread_t *t,
          * but we still want the last interval to register as complete to
          * ensure plugins (e.g. report) will output a result for that last
          * interval.
+         *
+         * The same goes for any offline input other than the last one:
+         * the rest of the interval will be provided by the next input.
          */
-        if (tinfo->live == 0 && tls->next_report - tls->last_ts <= 1) {
+        if (live == 0 && (tls->next_report - tls->last_ts <= 1 ||
+                    (input->offline &&
+                     input->inputid < glob->offlineinputs - 1))) {
             complete = 1;
             tls->last_ts = tls->next_report;
         }
 
         final_result = corsaro_push_end_plugins(tls->plugins,
                 tls->current_interval.number, tls->last_ts, complete);
-        if (push_interval_result(glob->logger, tls, final_result) < 0) {
+        if (push_interval_result(glob, tls, final_result) < 0) {
             corsaro_log(glob->logger,
                     "error while publishing results for final interval %u",
                     tls->current_interval.number);
@@ -524,6 +576,23 @@ static void halt_corsarotrace_worker(libtrace_t *trace, libtrace_thread_t *t,
     }
 
     zmq_close(tls->zmq_pushsock);
+    tls->finished = 1;
+}
+
+static void halt_corsarotrace_worker(libtrace_t *trace, libtrace_thread_t *t,
+		void *global, void *local) {
+
+	corsaro_trace_worker_t *tls = (corsaro_trace_worker_t *)local;
+	corsaro_trace_input_t *input = (corsaro_trace_input_t *)global;
+    libtrace_info_t *tinfo = trace_get_information(trace);
+
+    /* Keep the worker going if there are more trace files to come */
+    if (input->offline && input->nextfile < input->filecount &&
+            !corsaro_halted) {
+        return;
+    }
+
+    finish_corsarotrace_worker(input, tls, tinfo->live);
 }
 
 static inline void *reconnect_taggersock(corsaro_trace_global_t *glob,
@@ -543,6 +612,49 @@ static inline void *reconnect_taggersock(corsaro_trace_global_t *glob,
     return newsock;
 }
 
+static void publish_budget_statistics(corsaro_trace_global_t *glob,
+        corsaro_plugin_set_t *pset, uint32_t timestamp) {
+
+    FILE *f = NULL;
+    char sfname[1024];
+    corsaro_plugin_t *p;
+
+    for (p = pset->active_plugins; p != NULL; p = p->next) {
+        if (p->budget) {
+            break;
+        }
+    }
+    if (p == NULL) {
+        return;
+    }
+
+    snprintf(sfname, 1024, "%s-budgets", glob->statfilename);
+
+    f = fopen(sfname, "w");
+    if (!f) {
+        corsaro_log(glob->logger, "unable to open statistic file %s for writing: %s",
+                sfname, strerror(errno));
+        return;
+    }
+
+    for (p = pset->active_plugins; p != NULL; p = p->next) {
+        corsaro_mem_budget_write_stats(p->budget, f, timestamp);
+    }
+    fclose(f);
+}
+
+/** Adds a result received from a worker to the interval that it belongs
+ *  to, merging the interval once every worker has provided a result.
+ *
+ *  The credit for each result is only returned once its interval has been
+ *  merged and the per-worker results freed, so 'resultbacklog' bounds the
+ *  number of intervals that can be held here as well as the number of
+ *  results waiting on the socket.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param merge        The state for the merging thread.
+ *  @param msg          The result received from the worker.
+ */
 static void process_mergeable_result(corsaro_trace_global_t *glob,
         corsaro_trace_merger_t *merge, corsaro_result_msg_t *msg) {
 
@@ -556,6 +668,7 @@ static void process_mergeable_result(corsaro_trace_global_t *glob,
         quik.threads_ended = 1;
         quik.next = NULL;
         quik.rotate_after = 0;
+        quik.shed = msg->shed;
         quik.thread_plugin_data = (void ***)(calloc(glob->threads,
                     sizeof(void **)));
         quik.thread_plugin_data[0] = msg->plugindata;
@@ -566,9 +679,14 @@ static void process_mergeable_result(corsaro_trace_global_t *glob,
             merge->zmq_taggersock = reconnect_taggersock(glob,
                     merge->zmq_taggersock);
         }
+        if (glob->statfilename) {
+            publish_budget_statistics(glob, merge->pluginset, quik.timestamp);
+        }
 
         free(msg->plugindata);
         free(quik.thread_plugin_data);
+        release_result_credit(glob, msg->source);
+        publish_result_channel_statistics(glob, quik.timestamp, quik.shed);
         return;
     }
 
@@ -585,6 +703,7 @@ static void process_mergeable_result(corsaro_trace_global_t *glob,
 
         fin->thread_plugin_data[fin->threads_ended] = msg->plugindata;
         fin->threads_ended ++;
+        fin->shed |= msg->shed;
         if (fin->threads_ended == glob->threads) {
             assert(fin == merge->finished_intervals);
             if (corsaro_merge_plugin_outputs(glob->logger, merge->pluginset,
@@ -593,14 +712,22 @@ static void process_mergeable_result(corsaro_trace_global_t *glob,
                 merge->zmq_taggersock = reconnect_taggersock(glob,
                         merge->zmq_taggersock);
             }
+            if (glob->statfilename) {
+                publish_budget_statistics(glob, merge->pluginset,
+                        fin->timestamp);
+            }
             if (fin->rotate_after) {
                 corsaro_rotate_plugin_output(glob->logger, merge->pluginset);
                 merge->next_rotate_interval = msg->interval_num + 1;
             }
             merge->finished_intervals = fin->next;
+            /* Every worker provided exactly one result for this interval */
             for (i = 0; i < glob->threads; i++) {
                 free(fin->thread_plugin_data[i]);
+                release_result_credit(glob, i);
             }
+            publish_result_channel_statistics(glob, fin->timestamp,
+                    fin->shed);
             free(fin->thread_plugin_data);
             free(fin);
         }
@@ -611,6 +738,7 @@ static void process_mergeable_result(corsaro_trace_global_t *glob,
         fin->threads_ended = 1;
         fin->next = NULL;
         fin->rotate_after = 0;
+        fin->shed = msg->shed;
         fin->thread_plugin_data = (void ***)(calloc(glob->threads,
                 sizeof(void **)));
         fin->thread_plugin_data[0] = msg->plugindata;
@@ -624,11 +752,361 @@ static void process_mergeable_result(corsaro_trace_global_t *glob,
 
 }
 
+/** Checks whether every worker in an offline input has finished with the
+ *  interval at a given timestamp. Workers always finish intervals in order,
+ *  so once a worker has sent us a result for an interval at or after the
+ *  timestamp (or has stopped) then nothing more is coming from it for that
+ *  timestamp.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param merge        The state for the merging thread.
+ *  @param inputid      The offline input to check.
+ *  @param timestamp    The timestamp of the interval to check.
+ *  @return 1 if every worker in the input is done with the interval, 0
+ *          otherwise.
+ */
+static int offline_input_passed(corsaro_trace_global_t *glob,
+        corsaro_trace_merger_t *merge, int inputid, uint32_t timestamp) {
+
+    int i;
+
+    for (i = inputid * glob->threads; i < (inputid + 1) * glob->threads;
+            i++) {
+        if (merge->progress[i] < timestamp) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** Checks whether an offline input has heard from all of its workers
+ *  without receiving any results, e.g. because none of its trace files
+ *  could be opened.
+ */
+static inline int offline_input_empty(corsaro_trace_global_t *glob,
+        corsaro_offline_merge_t *om) {
+    return om->reported == glob->threads && om->first_ts == UINT32_MAX;
+}
+
+/** Finds the next offline input after a given input that has produced
+ *  any results.
+ *
+ *  @return the id of the next input, -1 if there are no later inputs with
+ *          any results or -2 if we cannot tell yet because a later input
+ *          has not heard from all of its workers.
+ */
+static int next_offline_input(corsaro_trace_global_t *glob,
+        corsaro_trace_merger_t *merge, int inputid) {
+
+    int i;
+
+    for (i = inputid + 1; i < glob->offlineinputs; i++) {
+        if (merge->inputs[i].reported < glob->threads) {
+            return -2;
+        }
+        if (!offline_input_empty(glob, &(merge->inputs[i]))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/** Finds the closest offline input before a given input that may have
+ *  produced results, or -1 if there is none.
+ */
+static int prev_offline_input(corsaro_trace_global_t *glob,
+        corsaro_trace_merger_t *merge, int inputid) {
+
+    int i;
+
+    for (i = inputid - 1; i >= 0; i--) {
+        if (!offline_input_empty(glob, &(merge->inputs[i]))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/** Returns the credit for any results in a buffered offline interval that
+ *  have not been returned yet.
+ */
+static void release_offline_interval_credit(corsaro_trace_global_t *glob,
+        corsaro_offline_interval_t *off) {
+
+    int i;
+
+    for (i = 0; i < off->fin.threads_ended; i++) {
+        if (!off->sources[i].credited) {
+            release_result_credit(glob, off->sources[i].workerid);
+            off->sources[i].credited = 1;
+        }
+    }
+}
+
+/** Merges a single buffered interval using the plugin instances for an
+ *  offline input, then frees it.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param merge        The state for the merging thread.
+ *  @param om           The merge state for the input that owns the
+ *                      interval.
+ *  @param fin          The interval to merge.
+ */
+static void merge_offline_interval(corsaro_trace_global_t *glob,
+        corsaro_trace_merger_t *merge, corsaro_offline_merge_t *om,
+        corsaro_fin_interval_t *fin) {
+
+    corsaro_offline_interval_t *off = (corsaro_offline_interval_t *)fin;
+    int i;
+
+    if (corsaro_merge_plugin_outputs(glob->logger, om->pluginset,
+            fin, merge->zmq_taggersock) == CORSARO_MERGE_CONTROL_FAILURE) {
+        merge->zmq_taggersock = reconnect_taggersock(glob,
+                merge->zmq_taggersock);
+    }
+    if (glob->statfilename) {
+        publish_budget_statistics(glob, om->pluginset, fin->timestamp);
+    }
+
+    /* Workers from different inputs disagree on interval numbering, so
+     * decide when to rotate based on the interval timestamp instead.
+     */
+    if (glob->rotatefreq > 0 && (fin->timestamp + glob->interval) %
+            (glob->interval * glob->rotatefreq) == 0) {
+        corsaro_rotate_plugin_output(glob->logger, om->pluginset);
+    }
+    om->last_merged = fin->timestamp;
+
+    for (i = 0; i < fin->threads_ended; i++) {
+        free(fin->thread_plugin_data[i]);
+    }
+    release_offline_interval_credit(glob, off);
+    publish_result_channel_statistics(glob, fin->timestamp, fin->shed);
+    free(fin->thread_plugin_data);
+    free(off->sources);
+    free(off);
+}
+
+/** Inserts a buffered interval into the pending list for an offline
+ *  input, combining it with the existing entry for the same timestamp if
+ *  there is one.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param om           The merge state for the input.
+ *  @param off          The interval to insert. It is freed if it is
+ *                      combined with an existing entry.
+ */
+static void insert_offline_interval(corsaro_trace_global_t *glob,
+        corsaro_offline_merge_t *om, corsaro_offline_interval_t *off) {
+
+    corsaro_fin_interval_t *fin = om->pending;
+    corsaro_fin_interval_t *prev = NULL;
+    corsaro_offline_interval_t *dst;
+    int i;
+
+    if (om->last_merged != 0 && off->fin.timestamp <= om->last_merged) {
+        corsaro_log(glob->logger,
+                "results for interval %u arrived after it was merged, do the offline trace files overlap in time?",
+                off->fin.timestamp);
+    }
+
+    while (fin != NULL && fin->timestamp < off->fin.timestamp) {
+        prev = fin;
+        fin = fin->next;
+    }
+
+    if (fin == NULL || fin->timestamp != off->fin.timestamp) {
+        off->fin.next = fin;
+        if (prev) {
+            prev->next = &(off->fin);
+        } else {
+            om->pending = &(off->fin);
+        }
+        return;
+    }
+
+    /* Each worker sends at most one result per interval, so the combined
+     * results always fit.
+     */
+    dst = (corsaro_offline_interval_t *)fin;
+    for (i = 0; i < off->fin.threads_ended; i++) {
+        dst->sources[fin->threads_ended] = off->sources[i];
+        fin->thread_plugin_data[fin->threads_ended] =
+                off->fin.thread_plugin_data[i];
+        fin->threads_ended ++;
+    }
+    fin->shed |= off->fin.shed;
+    free(off->fin.thread_plugin_data);
+    free(off->sources);
+    free(off);
+}
+
+/** Moves the first interval of an offline input over to the previous
+ *  input, once we know which interval that is.
+ *
+ *  The files for each input follow on from those of the previous input, so
+ *  the first interval of an input is also the last interval that the
+ *  previous input might see. Merging it as part of the previous input
+ *  keeps the output for both inputs in time order and means that neither
+ *  input has to wait for the other.
+ *
+ *  The credit for the moved results is returned straight away, as the
+ *  previous input may still be a long way from reaching the interval and
+ *  there is only ever one such interval per input.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param merge        The state for the merging thread.
+ *  @param inputid      The input to move the first interval away from.
+ */
+static void hand_back_first_offline_interval(corsaro_trace_global_t *glob,
+        corsaro_trace_merger_t *merge, int inputid) {
+
+    corsaro_offline_merge_t *om = &(merge->inputs[inputid]);
+    corsaro_offline_interval_t *off;
+    corsaro_fin_interval_t *fin;
+    int previd;
+
+    if (om->reported < glob->threads) {
+        return;
+    }
+    previd = prev_offline_input(glob, merge, inputid);
+    if (previd < 0) {
+        return;
+    }
+
+    while ((fin = om->pending) != NULL && fin->timestamp <= om->first_ts) {
+        om->pending = fin->next;
+        fin->next = NULL;
+        off = (corsaro_offline_interval_t *)fin;
+        release_offline_interval_credit(glob, off);
+        insert_offline_interval(glob, &(merge->inputs[previd]), off);
+    }
+}
+
+/** Merges any buffered offline intervals that are now complete.
+ *
+ *  In offline mode, the inputs are working on different stretches of time
+ *  and each input is merged separately, so an interval can be merged as
+ *  soon as all of the workers for its own input have finished with it.
+ *  The one interval that two inputs can share is merged by the earlier
+ *  input (see hand_back_first_offline_interval()).
+ *
+ *  An interval cannot be merged until we know where the next input
+ *  starts, in case the next input has results for it too. This only holds
+ *  things up until every worker in the next input has sent us its first
+ *  result.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param merge        The state for the merging thread.
+ */
+static void merge_completed_offline_intervals(corsaro_trace_global_t *glob,
+        corsaro_trace_merger_t *merge) {
+
+    corsaro_offline_merge_t *om;
+    corsaro_fin_interval_t *fin;
+    int i;
+
+    for (i = 1; i < glob->offlineinputs; i++) {
+        hand_back_first_offline_interval(glob, merge, i);
+    }
+
+    for (i = 0; i < glob->offlineinputs; i++) {
+        om = &(merge->inputs[i]);
+
+        while ((fin = om->pending) != NULL) {
+            if (next_offline_input(glob, merge, i) == -2) {
+                break;
+            }
+            if (!offline_input_passed(glob, merge, i, fin->timestamp)) {
+                break;
+            }
+            om->pending = fin->next;
+            merge_offline_interval(glob, merge, om, fin);
+        }
+    }
+}
+
+/** Adds a result received from a worker in offline mode to the interval
+ *  that it belongs to and merges any intervals that are now complete.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param merge        The state for the merging thread.
+ *  @param msg          The result received from the worker.
+ */
+static void process_offline_result(corsaro_trace_global_t *glob,
+        corsaro_trace_merger_t *merge, corsaro_result_msg_t *msg) {
+
+    corsaro_offline_merge_t *om = &(merge->inputs[msg->source /
+            glob->threads]);
+    corsaro_offline_interval_t *newoff;
+
+    if (merge->progress[msg->source] == 0) {
+        om->reported ++;
+        if (msg->interval_time < om->first_ts) {
+            om->first_ts = msg->interval_time;
+        }
+    }
+    merge->progress[msg->source] = msg->interval_time;
+
+    newoff = (corsaro_offline_interval_t *)calloc(1,
+            sizeof(corsaro_offline_interval_t));
+    if (newoff == NULL) {
+        goto nomemory;
+    }
+    newoff->fin.thread_plugin_data = (void ***)(calloc(
+            merge->workercount, sizeof(void **)));
+    newoff->sources = (corsaro_offline_source_t *)calloc(
+            merge->workercount, sizeof(corsaro_offline_source_t));
+    if (newoff->fin.thread_plugin_data == NULL || newoff->sources == NULL) {
+        free(newoff->fin.thread_plugin_data);
+        free(newoff->sources);
+        free(newoff);
+        goto nomemory;
+    }
+
+    newoff->fin.interval_id = msg->interval_num;
+    newoff->fin.timestamp = msg->interval_time;
+    newoff->fin.threads_ended = 1;
+    newoff->fin.shed = msg->shed;
+    newoff->fin.thread_plugin_data[0] = msg->plugindata;
+    newoff->sources[0].workerid = msg->source;
+
+    insert_offline_interval(glob, om, newoff);
+    merge_completed_offline_intervals(glob, merge);
+    return;
+
+nomemory:
+    corsaro_log(glob->logger,
+            "out of memory while buffering results for interval %u from worker %u, results for this interval will be incomplete",
+            msg->interval_time, msg->source);
+    free(msg->plugindata);
+    release_result_credit(glob, msg->source);
+    merge_completed_offline_intervals(glob, merge);
+}
+
+/** Notes that a worker in offline mode has stopped and merges any
+ *  intervals that were waiting on it.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param merge        The state for the merging thread.
+ *  @param source       The id of the worker that stopped.
+ */
+static void stop_offline_worker(corsaro_trace_global_t *glob,
+        corsaro_trace_merger_t *merge, int source) {
+
+    if (merge->progress[source] == 0) {
+        merge->inputs[source / glob->threads].reported ++;
+    }
+    merge->progress[source] = UINT32_MAX;
+    merge_completed_offline_intervals(glob, merge);
+}
+
 static void *start_merger(void *tdata) {
     corsaro_trace_merger_t *merge = (corsaro_trace_merger_t *)tdata;
     corsaro_trace_global_t *glob = merge->glob;
     corsaro_result_msg_t res;
     corsaro_fin_interval_t *fin;
+    int i;
 
     merge->zmq_pullsock = zmq_socket(glob->zmq_ctxt, ZMQ_PULL);
     merge->zmq_taggersock = reconnect_taggersock(glob, NULL);
@@ -644,8 +1122,19 @@ static void *start_merger(void *tdata) {
         goto endmerger;
     }
 
-    merge->pluginset = corsaro_start_merging_plugins(glob->logger,
-            glob->active_plugins, glob->plugincount, glob->threads);
+    if (merge->inputs) {
+        /* Each offline input writes its own output using the plugin
+         * instances that were configured for it */
+        for (i = 0; i < glob->offlineinputs; i++) {
+            merge->inputs[i].pluginset = corsaro_start_merging_plugins(
+                    glob->logger, glob->offlineplugins[i],
+                    glob->plugincount, merge->workercount);
+        }
+    } else {
+        merge->pluginset = corsaro_start_merging_plugins(glob->logger,
+                glob->active_plugins, glob->plugincount,
+                merge->workercount);
+    }
 
     while (1) {
         if (zmq_recv(merge->zmq_pullsock, &res, sizeof(res), 0) < 0) {
@@ -661,10 +1150,22 @@ static void *start_merger(void *tdata) {
 
         if (res.type == CORSARO_TRACE_MSG_STOP) {
             merge->stops_seen ++;
-            if (merge->stops_seen == glob->threads) {
+            if (merge->progress) {
+                stop_offline_worker(glob, merge, res.source);
+            }
+            if (merge->stops_seen == merge->workercount) {
                 break;
             }
         }
+        else if (merge->progress) {
+            if (res.type == CORSARO_TRACE_MSG_MERGE) {
+                if (glob->mergedelay) {
+                    usleep(glob->mergedelay * 1000);
+                }
+                /* Credit is returned once the interval is merged */
+                process_offline_result(glob, merge, &res);
+            }
+        }
         else if (res.type == CORSARO_TRACE_MSG_ROTATE) {
             fin = merge->finished_intervals;
 
@@ -682,10 +1183,18 @@ static void *start_merger(void *tdata) {
                 fin = fin->next;
             }
         } else if (res.type == CORSARO_TRACE_MSG_MERGE) {
+            if (glob->mergedelay) {
+                usleep(glob->mergedelay * 1000);
+            }
+            /* Credit is returned once the interval is merged */
             process_mergeable_result(glob, merge, &res);
         }
     }
 endmerger:
+    /* Nothing more will be taken off the result socket, so make sure no
+     * worker is left waiting for credit */
+    halt_result_channel(glob);
+
     while (merge->finished_intervals) {
         fin = merge->finished_intervals;
 
@@ -700,13 +1209,164 @@ endmerger:
         free(fin);
     }
 
+    if (merge->inputs) {
+        for (i = 0; i < glob->offlineinputs; i++) {
+            while ((fin = merge->inputs[i].pending) != NULL) {
+                merge->inputs[i].pending = fin->next;
+                merge_offline_interval(glob, merge, &(merge->inputs[i]),
+                        fin);
+            }
+            if (merge->inputs[i].pluginset) {
+                corsaro_stop_plugins(merge->inputs[i].pluginset);
+            }
+        }
+    }
+
     if (merge->zmq_taggersock) {
        zmq_close(merge->zmq_taggersock);
     }
-    corsaro_stop_plugins(merge->pluginset);
+    if (merge->pluginset) {
+        corsaro_stop_plugins(merge->pluginset);
+    }
     pthread_exit(NULL);
 }
 
+/** Sends a stop message to the merger on behalf of a worker that never
+ *  got started, e.g. because none of its input's trace files could be
+ *  opened.
+ */
+static void push_stop_for_idle_worker(corsaro_trace_global_t *glob,
+        int workerid) {
+
+    corsaro_trace_worker_t idle;
+
+    memset(&idle, 0, sizeof(idle));
+    idle.workerid = workerid;
+    idle.zmq_pushsock = zmq_socket(glob->zmq_ctxt, ZMQ_PUSH);
+    if (zmq_connect(idle.zmq_pushsock, "inproc://pluginresults") < 0) {
+        corsaro_log(glob->logger,
+                "error while connecting worker %d to result socket: %s",
+                workerid, strerror(errno));
+    } else {
+        push_stop_merging(glob->logger, &idle);
+    }
+    zmq_close(idle.zmq_pushsock);
+}
+
+static void *start_offline_input(void *tdata) {
+    corsaro_trace_input_t *input = (corsaro_trace_input_t *)tdata;
+    corsaro_trace_global_t *glob = input->glob;
+	libtrace_callback_set_t *processing = NULL;
+    libtrace_t *trace;
+    char *uri;
+    int i;
+
+    processing = trace_create_callback_set();
+    trace_set_starting_cb(processing, init_corsarotrace_worker);
+    trace_set_stopping_cb(processing, halt_corsarotrace_worker);
+    trace_set_packet_cb(processing, per_packet);
+
+    while (input->nextfile < input->filecount && !corsaro_halted) {
+        uri = input->files[input->nextfile];
+        input->nextfile ++;
+
+        trace = trace_create(uri);
+        if (trace_is_err(trace)) {
+            libtrace_err_t err = trace_get_err(trace);
+            corsaro_log(glob->logger, "unable to create trace object for %s: %s",
+                    uri, err.problem);
+            trace_destroy(trace);
+            continue;
+        }
+
+        trace_set_perpkt_threads(trace, glob->threads);
+
+        if (trace_pstart(trace, input, processing, NULL) == -1) {
+            libtrace_err_t err = trace_get_err(trace);
+            corsaro_log(glob->logger, "unable to start reading from %s: %s",
+                    uri, err.problem);
+            trace_destroy(trace);
+            continue;
+        }
+
+        while (!trace_has_finished(trace)) {
+            if (corsaro_halted) {
+                trace_pstop(trace);
+                break;
+            }
+            usleep(100000);
+        }
+        trace_join(trace);
+        trace_destroy(trace);
+    }
+
+    /* Make sure every worker has told the merger that it is done, even if
+     * the last file for this input could not be read.
+     */
+    for (i = 0; i < glob->threads; i++) {
+        if (input->workers[i] == NULL) {
+            push_stop_for_idle_worker(glob,
+                    (input->inputid * glob->threads) + i);
+        } else if (!input->workers[i]->finished) {
+            finish_corsarotrace_worker(input, input->workers[i], 0);
+        }
+    }
+
+    trace_destroy_callback_set(processing);
+    pthread_exit(NULL);
+}
+
+/** Processes a list of trace files using several libtrace inputs in
+ *  parallel.
+ *
+ *  The files are split into contiguous groups, one per input, and each
+ *  input works through its group in order. The results from all of the
+ *  inputs are combined by the merging thread, so an interval that spans
+ *  the boundary between two groups is still reported as a single
+ *  interval.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ */
+static void run_offline_inputs(corsaro_trace_global_t *glob) {
+
+    corsaro_trace_input_t *inputs;
+    int i, next = 0;
+    int pergroup = glob->offlinefilecount / glob->offlineinputs;
+    int extra = glob->offlinefilecount % glob->offlineinputs;
+
+    inputs = (corsaro_trace_input_t *)calloc(glob->offlineinputs,
+            sizeof(corsaro_trace_input_t));
+
+    for (i = 0; i < glob->offlineinputs; i++) {
+        inputs[i].glob = glob;
+        inputs[i].inputid = i;
+        inputs[i].offline = 1;
+        inputs[i].plugins = glob->offlineplugins[i];
+        inputs[i].files = &(glob->offlinefiles[next]);
+        inputs[i].filecount = pergroup + (i < extra ? 1 : 0);
+        inputs[i].nextfile = 0;
+        inputs[i].first_pkt_ts = 0;
+        inputs[i].workers = (corsaro_trace_worker_t **)calloc(glob->threads,
+                sizeof(corsaro_trace_worker_t *));
+        pthread_mutex_init(&(inputs[i].mutex), NULL);
+        next += inputs[i].filecount;
+    }
+
+    for (i = 0; i < glob->offlineinputs; i++) {
+        corsaro_log(glob->logger, "offline input %d is reading %d files, starting with %s",
+                i, inputs[i].filecount, inputs[i].files[0]);
+        pthread_create(&(inputs[i].threadid), NULL, start_offline_input,
+                &(inputs[i]));
+    }
+
+    for (i = 0; i < glob->offlineinputs; i++) {
+        pthread_join(inputs[i].threadid, NULL);
+        pthread_mutex_destroy(&(inputs[i].mutex));
+        free(inputs[i].workers);
+    }
+    free(inputs);
+}
+
 void usage(char *prog) {
     printf("Usage: %s [ -l logmode ] -c configfile \n\n", prog);
     printf("Accepted logmodes:\n");
@@ -804,7 +1464,9 @@ int main(int argc, char *argv[]) {
 	libtrace_stat_t *stats;
 	libtrace_callback_set_t *processing = NULL;
     corsaro_plugin_proc_options_t stdopts;
+    corsaro_trace_input_t liveinput;
     pthread_t fauxcontrol = 0;
+    int i;
 
     glob = configure_corsaro(argc, argv);
     if (glob == NULL) {
@@ -878,13 +1540,56 @@ int main(int argc, char *argv[]) {
         goto endcorsarotrace;
     }
 
-
     merger.glob = glob;
     merger.stops_seen = 0;
+    merger.workercount = glob->threads;
+    merger.progress = NULL;
+    merger.inputs = NULL;
     merger.next_rotate_interval = 0;
     merger.pluginset = NULL;
     merger.finished_intervals = NULL;
 
+    if (glob->offlinefilecount > 0) {
+        /* Worker IDs have to fit in the result messages */
+        if (glob->offlineinputs * glob->threads > 255) {
+            corsaro_log(glob->logger,
+                    "too many offline inputs (%u) for %u threads per input. Exiting.",
+                    glob->offlineinputs, glob->threads);
+            goto endcorsarotrace;
+        }
+
+        for (i = 1; i < glob->offlineinputs; i++) {
+            if (corsaro_finish_plugin_config(glob->offlineplugins[i],
+                        &stdopts, glob->zmq_ctxt) < 0) {
+                corsaro_log(glob->logger,
+                        "error while finishing plugin configuration for offline input %d. Exiting.",
+                        i);
+                goto endcorsarotrace;
+            }
+        }
+
+        merger.workercount = glob->offlineinputs * glob->threads;
+        merger.progress = (uint32_t *)calloc(merger.workercount,
+                sizeof(uint32_t));
+        merger.inputs = (corsaro_offline_merge_t *)calloc(
+                glob->offlineinputs, sizeof(corsaro_offline_merge_t));
+        if (merger.progress == NULL || merger.inputs == NULL) {
+            corsaro_log(glob->logger,
+                    "unable to allocate merge state for %u offline inputs. Exiting.",
+                    glob->offlineinputs);
+            free(merger.progress);
+            free(merger.inputs);
+            goto endcorsarotrace;
+        }
+        for (i = 0; i < glob->offlineinputs; i++) {
+            merger.inputs[i].first_ts = UINT32_MAX;
+        }
+    }
+
+    if (start_result_channel(glob, merger.workercount) < 0) {
+        goto endcorsarotrace;
+    }
+
     sigemptyset(&sig_block_all);
     if (pthread_sigmask(SIG_SETMASK, &sig_block_all, &sig_before) < 0) {
         corsaro_log(glob->logger,
@@ -900,6 +1605,16 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (glob->offlinefilecount > 0) {
+        run_offline_inputs(glob);
+        goto joinmerger;
+    }
+
+    memset(&liveinput, 0, sizeof(liveinput));
+    liveinput.glob = glob;
+    liveinput.plugins = glob->active_plugins;
+    pthread_mutex_init(&(liveinput.mutex), NULL);
+
     inputtrace = trace_create(glob->source_uri);
     if (trace_is_err(inputtrace)) {
         libtrace_err_t err = trace_get_err(inputtrace);
@@ -922,14 +1637,20 @@ int main(int argc, char *argv[]) {
     }
      */
 
-    if (trace_pstart(inputtrace, glob, processing, NULL) == -1) {
+    if (trace_pstart(inputtrace, &liveinput, processing, NULL) == -1) {
         libtrace_err_t err = trace_get_err(inputtrace);
         corsaro_log(glob->logger, "unable to start reading from trace object: %s",
                 err.problem);
         return -1;
     }
 
+    if (start_socket_monitor(glob) < 0) {
+        corsaro_log(glob->logger,
+                "continuing without monitoring kernel drops on receive sockets");
+    }
+
     trace_join(inputtrace);
+    halt_socket_monitor(glob);
 	stats = trace_get_statistics(inputtrace, NULL);
 	if (stats->dropped_valid) {
 		corsaro_log(glob->logger, "dropped packet count: %lu",
@@ -944,11 +1665,20 @@ int main(int argc, char *argv[]) {
 	} else {
 		corsaro_log(glob->logger, "missing packet count: unknown");
 	}
+    pthread_mutex_destroy(&(liveinput.mutex));
 
+joinmerger:
     pthread_join(merger.threadid, NULL);
     if (merger.zmq_pullsock) {
         zmq_close(merger.zmq_pullsock);
     }
+    if (merger.progress) {
+        free(merger.progress);
+    }
+    if (merger.inputs) {
+        free(merger.inputs);
+    }
+    destroy_result_channel(glob);
 
     if (fauxcontrol && control_sock) {
         ctrlreq.request_type = TAGGER_REQUEST_HALT_FAUX;
@@ -75,6 +75,11 @@ enum {
     CORSARO_TRACE_SOURCE_TAGGER
 };
 
+enum {
+    CORSARO_RESULT_BACKLOG_BLOCK = 0,
+    CORSARO_RESULT_BACKLOG_SHED = 1,
+};
+
 typedef struct corsaro_worker_msg {
     uint8_t type;
     corsaro_tagged_packet_header_t header;
@@ -86,12 +91,96 @@ typedef struct corsaro_result_msg {
     uint8_t source;
     uint32_t interval_num;
     uint32_t interval_time;
+    uint8_t shed;
     void **plugindata;
 } corsaro_result_msg_t;
 
 typedef struct corsaro_trace_worker corsaro_trace_worker_t;
 typedef struct corsaro_trace_merger corsaro_trace_merger_t;
 
+/** Drop counter state for a single UDP socket owned by this process */
+typedef struct corsaro_sockmon_entry {
+    unsigned long inode;
+    int fd;
+    uint32_t lastdrops;
+    uint8_t seen;
+} corsaro_sockmon_entry_t;
+
+/** The number of intervals that the workers can be spread across while
+ *  their sequence loss is being collected */
+#define SOCKMON_PENDING_INTERVALS 4
+
+/** Sequence loss reported by the workers for a single interval */
+typedef struct corsaro_sockmon_interval {
+    /** The timestamp of the interval */
+    uint32_t time;
+    /** Tagged packets reported missing by the workers for this interval */
+    uint64_t seqloss;
+    /** The number of workers that have reported this interval, 0 if the
+     *  slot is unused */
+    uint16_t reported;
+} corsaro_sockmon_interval_t;
+
+/** State for the thread that watches the kernel receive buffers of the
+ *  multicast sockets that libtrace uses to receive tagged packets.
+ */
+typedef struct corsaro_trace_sockmon {
+    pthread_t threadid;
+    pthread_mutex_t mutex;
+    uint8_t running;
+    uint8_t halted;
+
+    corsaro_sockmon_entry_t *socks;
+    int sockcount;
+    int socksalloced;
+
+    /** Datagrams dropped by the kernel since the last report */
+    uint64_t kerneldrops;
+    /** Tagged packets reported missing by the workers, for each interval
+     *  that not every worker has finished yet */
+    corsaro_sockmon_interval_t pending[SOCKMON_PENDING_INTERVALS];
+    /** Largest receive buffer size across all monitored sockets */
+    uint32_t maxrcvbuf;
+} corsaro_trace_sockmon_t;
+
+/** Credit accounting for the interval results that the workers push to
+ *  the merging thread. Each worker may have at most 'resultbacklog'
+ *  results that the merger has not yet finished with; the
+ *  'backlogpolicy' decides what happens once a worker runs out of
+ *  credit. In offline mode, 'offlinelookahead' is used as the limit
+ *  instead.
+ */
+typedef struct corsaro_trace_resultchan {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint8_t running;
+    uint8_t halted;
+
+    /** Results pushed by each worker that are still awaiting the merger */
+    uint32_t *outstanding;
+    int sources;
+
+    /** Total results awaiting the merger, across all workers */
+    uint32_t depth;
+    /** Largest queue depth seen since the last report */
+    uint32_t peakdepth;
+    /** Largest backlog for a single worker seen since the last report */
+    uint32_t peaklag;
+
+    /** Number of times a worker had to wait for credit, and for how long
+     *  (in microseconds), since the last report */
+    uint64_t blocked;
+    uint64_t blockedusec;
+    /** Number of worker intervals where optional plugins were shed since
+     *  the last report */
+    uint64_t shedintervals;
+
+    /** Offline mode only: the maximum number of unmerged results for each
+     *  worker */
+    uint8_t offline;
+    uint32_t lookahead;
+} corsaro_trace_resultchan_t;
+
 typedef struct corsaro_trace_glob {
     corsaro_plugin_t *active_plugins;
     corsaro_logger_t *logger;
@@ -103,12 +192,26 @@ typedef struct corsaro_trace_glob {
     char *monitorid;
     char *control_uri;
 
+    /** Trace files to process in offline mode, sorted by name (and
+     *  therefore, hopefully, by time) */
+    char **offlinefiles;
+    int offlinefilecount;
+    int offlinefilesalloced;
+
+    /** Number of offline inputs to process in parallel */
+    uint8_t offlineinputs;
+
+    /** Maximum number of interval results that a worker in an offline
+     *  input may have waiting to be merged */
+    uint32_t offlinelookahead;
+
+    /** Separately configured plugin instances for each offline input */
+    corsaro_plugin_t **offlineplugins;
+
     libts_ascii_backend_t libtsascii;
     libts_kafka_backend_t libtskafka;
     libts_dbats_backend_t libtsdbats;
 
-    pthread_mutex_t mutex;
-    uint32_t first_pkt_ts;
     uint32_t boundstartts;
     uint32_t boundendts;
     uint32_t interval;
@@ -124,6 +227,19 @@ typedef struct corsaro_trace_glob {
     uint8_t removerouted;
     uint8_t removenotscan;
 
+    uint8_t sockmonitor;
+    uint32_t rcvbufceiling;
+    corsaro_trace_sockmon_t sockmon;
+
+    /** Maximum number of interval results that a worker may have waiting
+     *  for the merger, or 0 for no limit */
+    uint32_t resultbacklog;
+    uint8_t backlogpolicy;
+    /** Artificial delay (in milliseconds) added to each merge, for testing
+     *  how the workers behave when the merger falls behind */
+    uint32_t mergedelay;
+    corsaro_trace_resultchan_t resultchan;
+
     void *zmq_ctxt;
 
     corsaro_ipmeta_state_t *ipmeta_state;
@@ -133,8 +249,37 @@ typedef struct corsaro_trace_glob {
 
 } corsaro_trace_global_t;
 
+/** State for a single packet input, i.e. a libtrace input and the set of
+ *  packet processing threads that are reading from it.
+ *
+ *  Normally there is just the one input, but in offline mode we can have
+ *  several, each working through a contiguous group of trace files.
+ */
+typedef struct corsaro_trace_input {
+    corsaro_trace_global_t *glob;
+    int inputid;
+    uint8_t offline;
+
+    /** The plugin instances used by this input's processing threads */
+    corsaro_plugin_t *plugins;
+
+    /** The trace files assigned to this input (offline mode only) */
+    char **files;
+    int filecount;
+    int nextfile;
+
+    pthread_t threadid;
+    pthread_mutex_t mutex;
+    uint32_t first_pkt_ts;
+
+    /** Worker state for each processing thread, which is carried over from
+     *  one trace file to the next (offline mode only) */
+    corsaro_trace_worker_t **workers;
+} corsaro_trace_input_t;
+
 struct corsaro_trace_worker {
     int workerid;
+    uint8_t finished;
 
     corsaro_interval_t current_interval;
     corsaro_interval_t lastrotateinterval;
@@ -153,12 +298,60 @@ struct corsaro_trace_worker {
     void *zmq_pushsock;
 };
 
+/** A worker that provided one of the results for an interval buffered by
+ *  the merger in offline mode */
+typedef struct corsaro_offline_source {
+    uint8_t workerid;
+    /** Set once the credit for the result has been returned */
+    uint8_t credited;
+} corsaro_offline_source_t;
+
+/** An interval buffered by the merger in offline mode, along with the
+ *  workers that its results came from so that their credit can be returned
+ *  once the interval has been merged.
+ */
+typedef struct corsaro_offline_interval {
+    corsaro_fin_interval_t fin;
+    corsaro_offline_source_t *sources;
+} corsaro_offline_interval_t;
+
+/** Merger state for a single offline input.
+ *
+ *  Each input covers its own stretch of time, so each one is merged
+ *  separately using its own merging plugin instances. The first interval
+ *  of an input may also be the last interval of the previous input, so
+ *  it is merged by the previous input.
+ */
+typedef struct corsaro_offline_merge {
+    /** Buffered intervals waiting to be merged, sorted by timestamp */
+    corsaro_fin_interval_t *pending;
+    corsaro_plugin_set_t *pluginset;
+
+    /** Timestamp of the earliest interval reported by any of this input's
+     *  workers, and the number of workers that have sent us a result or
+     *  stopped. The first interval is only known for certain once every
+     *  worker has been heard from. */
+    uint32_t first_ts;
+    int reported;
+
+    /** Timestamp of the most recent interval that has been merged */
+    uint32_t last_merged;
+} corsaro_offline_merge_t;
+
 struct corsaro_trace_merger {
     corsaro_trace_global_t *glob;
     pthread_t threadid;
 
     int stops_seen;
+    int workercount;
     uint32_t next_rotate_interval;
+
+    /** Timestamp of the most recent interval that each worker has sent us
+     *  results for, and the merge state for each input (offline mode
+     *  only) */
+    uint32_t *progress;
+    corsaro_offline_merge_t *inputs;
+
     corsaro_plugin_set_t *pluginset;
     corsaro_fin_interval_t *finished_intervals;
 
@@ -170,5 +363,19 @@ corsaro_trace_global_t *corsaro_trace_init_global(char *filename, int logmode);
 void corsaro_trace_free_global(corsaro_trace_global_t *glob);
 void *start_faux_control_thread(void *data);
 
+int start_socket_monitor(corsaro_trace_global_t *glob);
+void halt_socket_monitor(corsaro_trace_global_t *glob);
+void socket_monitor_end_interval(corsaro_trace_global_t *glob,
+        corsaro_trace_worker_t *tls);
+
+int start_result_channel(corsaro_trace_global_t *glob, int sources);
+void halt_result_channel(corsaro_trace_global_t *glob);
+void destroy_result_channel(corsaro_trace_global_t *glob);
+int acquire_result_credit(corsaro_trace_global_t *glob,
+        corsaro_trace_worker_t *tls);
+void release_result_credit(corsaro_trace_global_t *glob, int source);
+void publish_result_channel_statistics(corsaro_trace_global_t *glob,
+        uint32_t timestamp, uint8_t shed);
+
 #endif
 // vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,309 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "libcorsaro_log.h"
+#include "corsarotrace.h"
+
+/* Interval results are passed from the workers to the merger as pointers
+ * over an inproc zeroMQ socket, so the socket itself never holds much
+ * memory -- the plugin state that the results point to does. If the merger
+ * cannot keep up, that state piles up without limit. To prevent this, each
+ * worker is given a fixed number of credits: one is spent whenever the
+ * worker pushes a result and it is returned once the merger has merged the
+ * interval that the result belongs to and freed the plugin state for it.
+ *
+ * Credit is tracked per worker rather than for the whole process. The
+ * merger can only merge an interval once every worker has provided a
+ * result for it, so a single shared pool could be exhausted by the fast
+ * workers and leave a slow worker unable to push the result that the
+ * merger is waiting on.
+ *
+ * In offline mode, each input is merged separately as soon as its own
+ * workers have finished an interval, so no input has to wait for another
+ * and every worker simply gets 'offlinelookahead' credits. The first
+ * interval of each input is merged by the previous input, which may not
+ * get there for a long time, so the credit for those results is returned
+ * as soon as they are handed over.
+ */
+
+/** Prepares the result channel for a given number of workers.
+ *
+ *  @param glob     The global state for this corsarotrace instance.
+ *  @param sources  The number of workers that will be pushing results.
+ *  @return 0 if successful, -1 if an error occurred.
+ */
+int start_result_channel(corsaro_trace_global_t *glob, int sources) {
+    corsaro_trace_resultchan_t *rc = &(glob->resultchan);
+
+    memset(rc, 0, sizeof(corsaro_trace_resultchan_t));
+    rc->outstanding = (uint32_t *)calloc(sources, sizeof(uint32_t));
+    if (rc->outstanding == NULL) {
+        corsaro_log(glob->logger,
+                "unable to allocate credit counters for %d workers",
+                sources);
+        return -1;
+    }
+    rc->sources = sources;
+
+    if (glob->offlinefilecount > 0) {
+        rc->offline = 1;
+        rc->lookahead = glob->offlinelookahead;
+    }
+
+    pthread_mutex_init(&(rc->mutex), NULL);
+    pthread_cond_init(&(rc->cond), NULL);
+    rc->running = 1;
+    return 0;
+}
+
+/** Releases any workers that are waiting for credit, e.g. because the
+ *  merger has stopped.
+ *
+ *  @param glob     The global state for this corsarotrace instance.
+ */
+void halt_result_channel(corsaro_trace_global_t *glob) {
+    corsaro_trace_resultchan_t *rc = &(glob->resultchan);
+
+    if (!rc->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&(rc->mutex));
+    rc->halted = 1;
+    pthread_cond_broadcast(&(rc->cond));
+    pthread_mutex_unlock(&(rc->mutex));
+}
+
+void destroy_result_channel(corsaro_trace_global_t *glob) {
+    corsaro_trace_resultchan_t *rc = &(glob->resultchan);
+
+    if (!rc->running) {
+        return;
+    }
+
+    pthread_mutex_destroy(&(rc->mutex));
+    pthread_cond_destroy(&(rc->cond));
+    free(rc->outstanding);
+    rc->outstanding = NULL;
+    rc->running = 0;
+}
+
+/** Waits until a worker has fewer than 'limit' results outstanding, or
+ *  the result channel has been halted.
+ *
+ *  The caller must be holding the result channel mutex.
+ *
+ *  @param rc       The result channel.
+ *  @param owed     The number of outstanding results for the worker.
+ *  @param limit    The number of outstanding results allowed.
+ */
+static void wait_for_result_credit(corsaro_trace_resultchan_t *rc,
+        uint32_t *owed, uint32_t limit) {
+
+    struct timeval start, end;
+
+    if (*owed < limit) {
+        return;
+    }
+
+    gettimeofday(&start, NULL);
+    while (*owed >= limit && !rc->halted) {
+        pthread_cond_wait(&(rc->cond), &(rc->mutex));
+    }
+    gettimeofday(&end, NULL);
+    rc->blocked ++;
+    rc->blockedusec += ((end.tv_sec - start.tv_sec) * 1000000) +
+            (end.tv_usec - start.tv_usec);
+}
+
+/** Spends one credit on behalf of a worker that is about to push an
+ *  interval result to the merger.
+ *
+ *  If the worker has run out of credit, it waits for the merger to catch
+ *  up. Under the shed policy, a worker that has used half of its credit
+ *  also stops passing packets to its optional plugins until the merger
+ *  catches up, so that it is less likely to run out. Workers in offline
+ *  inputs always wait once they have 'offlinelookahead' results
+ *  outstanding.
+ *
+ *  @param glob     The global state for this corsarotrace instance.
+ *  @param tls      The thread-local state for the worker thread.
+ *  @return 1 if the worker should shed its optional plugins for the next
+ *          interval, 0 otherwise.
+ */
+int acquire_result_credit(corsaro_trace_global_t *glob,
+        corsaro_trace_worker_t *tls) {
+
+    corsaro_trace_resultchan_t *rc = &(glob->resultchan);
+    uint32_t *owed;
+    int shed = 0;
+
+    if (!rc->running || tls->workerid >= rc->sources) {
+        return 0;
+    }
+    owed = &(rc->outstanding[tls->workerid]);
+
+    pthread_mutex_lock(&(rc->mutex));
+    if (rc->offline) {
+        wait_for_result_credit(rc, owed, rc->lookahead);
+    } else if (glob->resultbacklog > 0) {
+        if (glob->backlogpolicy == CORSARO_RESULT_BACKLOG_SHED &&
+                *owed >= (glob->resultbacklog + 1) / 2) {
+            rc->shedintervals ++;
+            shed = 1;
+        }
+        /* Shed results still carry the state of the other plugins, so
+         * they must not pile up beyond the limit either */
+        wait_for_result_credit(rc, owed, glob->resultbacklog);
+    }
+
+    (*owed) ++;
+    rc->depth ++;
+    if (rc->depth > rc->peakdepth) {
+        rc->peakdepth = rc->depth;
+    }
+    if (*owed > rc->peaklag) {
+        rc->peaklag = *owed;
+    }
+    pthread_mutex_unlock(&(rc->mutex));
+    return shed;
+}
+
+/** Returns the credit for a result that the merger has finished with.
+ *
+ *  @param glob     The global state for this corsarotrace instance.
+ *  @param source   The id of the worker that pushed the result.
+ */
+void release_result_credit(corsaro_trace_global_t *glob, int source) {
+    corsaro_trace_resultchan_t *rc = &(glob->resultchan);
+
+    if (!rc->running || source >= rc->sources) {
+        return;
+    }
+
+    pthread_mutex_lock(&(rc->mutex));
+    if (rc->outstanding[source] > 0) {
+        rc->outstanding[source] --;
+        rc->depth --;
+    }
+    pthread_cond_broadcast(&(rc->cond));
+    pthread_mutex_unlock(&(rc->mutex));
+}
+
+/** Writes the current state of the result channel to the "-results"
+ *  statistics file and resets the per-report counters.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param timestamp    The timestamp of the interval that was just merged.
+ *  @param shed         1 if optional plugins were shed by any worker during
+ *                      that interval, 0 otherwise.
+ */
+void publish_result_channel_statistics(corsaro_trace_global_t *glob,
+        uint32_t timestamp, uint8_t shed) {
+
+    corsaro_trace_resultchan_t *rc = &(glob->resultchan);
+    uint32_t depth, peakdepth, lag = 0, peaklag;
+    uint64_t blocked, blockedusec, shedintervals;
+    FILE *f = NULL;
+    char sfname[1024];
+    int i;
+
+    if (!rc->running || glob->statfilename == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(rc->mutex));
+    for (i = 0; i < rc->sources; i++) {
+        if (rc->outstanding[i] > lag) {
+            lag = rc->outstanding[i];
+        }
+    }
+    depth = rc->depth;
+    peakdepth = rc->peakdepth;
+    peaklag = rc->peaklag;
+    blocked = rc->blocked;
+    blockedusec = rc->blockedusec;
+    shedintervals = rc->shedintervals;
+    rc->peakdepth = rc->depth;
+    rc->peaklag = lag;
+    rc->blocked = 0;
+    rc->blockedusec = 0;
+    rc->shedintervals = 0;
+    pthread_mutex_unlock(&(rc->mutex));
+
+    if (blocked > 0) {
+        corsaro_log(glob->logger,
+                "warning: workers waited %lu times (%lu ms in total) for the merger to catch up",
+                blocked, blockedusec / 1000);
+    }
+    if (shedintervals > 0) {
+        corsaro_log(glob->logger,
+                "warning: optional plugins were shed for %lu worker intervals because the merger is falling behind",
+                shedintervals);
+    }
+
+    snprintf(sfname, 1024, "%s-results", glob->statfilename);
+    f = fopen(sfname, "w");
+    if (!f) {
+        corsaro_log(glob->logger, "unable to open statistic file %s for writing: %s",
+                sfname, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "time=%u depth=%u peakdepth=%u lag=%u peaklag=%u limit=%u blocked=%lu blockedms=%lu shedintervals=%lu incomplete=%u\n",
+            timestamp, depth, peakdepth, lag, peaklag, glob->resultbacklog,
+            blocked, blockedusec / 1000, shedintervals, shed);
+    fclose(f);
+}
@@ -0,0 +1,503 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "libcorsaro_log.h"
+#include "corsarotrace.h"
+
+/* How often, in seconds, the kernel drop counters are polled */
+#define SOCKMON_POLL_FREQ 1
+
+/* The multicast receive sockets are created and owned by libtrace's nDAG
+ * format, so we cannot configure them ourselves. Instead, we find them by
+ * matching the socket inodes that appear in /proc/self/fd against the
+ * entries in /proc/net/udp(6) -- the latter also gives us the number of
+ * datagrams that the kernel has dropped for each socket because the
+ * receive buffer was full.
+ */
+
+static corsaro_sockmon_entry_t *find_sockmon_entry(
+        corsaro_trace_sockmon_t *sm, unsigned long inode) {
+
+    int i;
+
+    for (i = 0; i < sm->sockcount; i++) {
+        if (sm->socks[i].inode == inode) {
+            return &(sm->socks[i]);
+        }
+    }
+    return NULL;
+}
+
+static void refresh_socket_fds(corsaro_trace_sockmon_t *sm) {
+
+    DIR *dir;
+    struct dirent *ent;
+    char linkpath[300];
+    char target[128];
+    ssize_t len;
+    unsigned long inode;
+    corsaro_sockmon_entry_t *entry;
+    int i, j;
+
+    for (i = 0; i < sm->sockcount; i++) {
+        sm->socks[i].fd = -1;
+    }
+
+    dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        return;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(linkpath, 300, "/proc/self/fd/%s", ent->d_name);
+        len = readlink(linkpath, target, sizeof(target) - 1);
+        if (len <= 0) {
+            continue;
+        }
+        target[len] = '\0';
+
+        if (sscanf(target, "socket:[%lu]", &inode) != 1) {
+            continue;
+        }
+
+        entry = find_sockmon_entry(sm, inode);
+        if (entry == NULL) {
+            if (sm->sockcount == sm->socksalloced) {
+                corsaro_sockmon_entry_t *socks;
+
+                socks = realloc(sm->socks, (sm->socksalloced + 16) *
+                        sizeof(corsaro_sockmon_entry_t));
+                if (socks == NULL) {
+                    /* Try again on the next poll */
+                    break;
+                }
+                sm->socks = socks;
+                sm->socksalloced += 16;
+            }
+            entry = &(sm->socks[sm->sockcount]);
+            entry->inode = inode;
+            entry->lastdrops = 0;
+            entry->seen = 0;
+            sm->sockcount ++;
+        }
+        entry->fd = (int)strtol(ent->d_name, NULL, 10);
+    }
+    closedir(dir);
+
+    /* Forget about any sockets that have been closed since the last
+     * poll -- their inodes will not be re-used by the sockets that
+     * replace them */
+    for (i = 0, j = 0; i < sm->sockcount; i++) {
+        if (sm->socks[i].fd < 0) {
+            continue;
+        }
+        if (i != j) {
+            sm->socks[j] = sm->socks[i];
+        }
+        j ++;
+    }
+    sm->sockcount = j;
+}
+
+static void grow_receive_buffer(corsaro_trace_global_t *glob,
+        corsaro_sockmon_entry_t *entry) {
+
+    int current, target;
+    socklen_t optlen = sizeof(current);
+
+    if (getsockopt(entry->fd, SOL_SOCKET, SO_RCVBUF, &current,
+                &optlen) < 0) {
+        return;
+    }
+
+    /* getsockopt reports double the value that was requested, as the
+     * kernel reserves half of the buffer for bookkeeping */
+    current = current / 2;
+    if (current >= glob->rcvbufceiling) {
+        return;
+    }
+
+    target = current * 2;
+    if (target > glob->rcvbufceiling) {
+        target = glob->rcvbufceiling;
+    }
+
+    /* SO_RCVBUFFORCE ignores net.core.rmem_max but requires
+     * CAP_NET_ADMIN, so fall back to SO_RCVBUF if we don't have that */
+    if (setsockopt(entry->fd, SOL_SOCKET, SO_RCVBUFFORCE, &target,
+                sizeof(target)) < 0) {
+        if (setsockopt(entry->fd, SOL_SOCKET, SO_RCVBUF, &target,
+                    sizeof(target)) < 0) {
+            corsaro_log(glob->logger,
+                    "unable to increase receive buffer for socket %lu: %s",
+                    entry->inode, strerror(errno));
+            return;
+        }
+    }
+
+    corsaro_log(glob->logger,
+            "increased receive buffer for socket %lu from %d to %d bytes",
+            entry->inode, current, target);
+}
+
+static void poll_udp_table(corsaro_trace_global_t *glob, const char *path,
+        uint64_t *newdrops) {
+
+    FILE *f;
+    char line[512];
+    unsigned long inode;
+    unsigned int drops;
+    uint32_t delta;
+    corsaro_sockmon_entry_t *entry;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+
+    /* skip the header line */
+    if (fgets(line, sizeof(line), f) == NULL) {
+        fclose(f);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line,
+                "%*d: %*s %*s %*x %*x:%*x %*x:%*x %*x %*u %*d %lu %*d %*s %u",
+                &inode, &drops) != 2) {
+            continue;
+        }
+
+        entry = find_sockmon_entry(&(glob->sockmon), inode);
+        if (entry == NULL || entry->fd < 0) {
+            /* not one of ours */
+            continue;
+        }
+
+        if (!entry->seen) {
+            /* first time we've seen this socket, just take a baseline */
+            entry->lastdrops = drops;
+            entry->seen = 1;
+            continue;
+        }
+
+        delta = (uint32_t)drops - entry->lastdrops;
+        entry->lastdrops = drops;
+        if (delta == 0) {
+            continue;
+        }
+
+        *newdrops += delta;
+        if (glob->rcvbufceiling > 0) {
+            grow_receive_buffer(glob, entry);
+        }
+    }
+    fclose(f);
+}
+
+static uint32_t largest_receive_buffer(corsaro_trace_sockmon_t *sm) {
+    int i, rcvbuf;
+    uint32_t largest = 0;
+    socklen_t optlen;
+
+    for (i = 0; i < sm->sockcount; i++) {
+        if (sm->socks[i].fd < 0 || !sm->socks[i].seen) {
+            continue;
+        }
+        optlen = sizeof(rcvbuf);
+        if (getsockopt(sm->socks[i].fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                    &optlen) < 0) {
+            continue;
+        }
+        if ((uint32_t)rcvbuf > largest) {
+            largest = (uint32_t)rcvbuf;
+        }
+    }
+    return largest;
+}
+
+static void *start_sockmon_thread(void *data) {
+    corsaro_trace_global_t *glob = (corsaro_trace_global_t *)data;
+    corsaro_trace_sockmon_t *sm = &(glob->sockmon);
+    uint64_t newdrops;
+    uint32_t maxrcvbuf;
+    uint8_t halted = 0;
+
+    while (!halted) {
+        newdrops = 0;
+
+        /* libtrace may open and close sockets as the tagger's beacon
+         * announces new streams, so refresh our fd mapping every time */
+        refresh_socket_fds(sm);
+        poll_udp_table(glob, "/proc/net/udp", &newdrops);
+        poll_udp_table(glob, "/proc/net/udp6", &newdrops);
+        maxrcvbuf = largest_receive_buffer(sm);
+
+        pthread_mutex_lock(&(sm->mutex));
+        sm->kerneldrops += newdrops;
+        sm->maxrcvbuf = maxrcvbuf;
+        halted = sm->halted;
+        pthread_mutex_unlock(&(sm->mutex));
+
+        if (!halted) {
+            sleep(SOCKMON_POLL_FREQ);
+        }
+    }
+    return NULL;
+}
+
+/** Starts a thread that monitors the kernel receive buffers for the
+ *  sockets that are receiving tagged packets.
+ *
+ *  Only applies when reading from an nDAG multicast source.
+ *
+ *  @param glob     The global state for this corsarotrace instance.
+ *  @return 1 if the monitor was started, 0 if monitoring is not applicable
+ *          to this input, -1 if an error occurred.
+ */
+int start_socket_monitor(corsaro_trace_global_t *glob) {
+    corsaro_trace_sockmon_t *sm = &(glob->sockmon);
+
+    if (!glob->sockmonitor || strncmp(glob->source_uri, "ndag:", 5) != 0) {
+        return 0;
+    }
+
+    sm->socks = NULL;
+    sm->sockcount = 0;
+    sm->socksalloced = 0;
+    sm->kerneldrops = 0;
+    memset(sm->pending, 0, sizeof(sm->pending));
+    sm->maxrcvbuf = 0;
+    sm->halted = 0;
+    pthread_mutex_init(&(sm->mutex), NULL);
+
+    if (pthread_create(&(sm->threadid), NULL, start_sockmon_thread,
+                glob) != 0) {
+        corsaro_log(glob->logger,
+                "unable to start receive socket monitoring thread: %s",
+                strerror(errno));
+        pthread_mutex_destroy(&(sm->mutex));
+        return -1;
+    }
+    sm->running = 1;
+    corsaro_log(glob->logger, "started receive socket monitoring thread");
+    return 1;
+}
+
+/** Stops the receive socket monitoring thread, if it is running.
+ *
+ *  @param glob     The global state for this corsarotrace instance.
+ */
+void halt_socket_monitor(corsaro_trace_global_t *glob) {
+    corsaro_trace_sockmon_t *sm = &(glob->sockmon);
+
+    if (!sm->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&(sm->mutex));
+    sm->halted = 1;
+    pthread_mutex_unlock(&(sm->mutex));
+
+    pthread_join(sm->threadid, NULL);
+    pthread_mutex_destroy(&(sm->mutex));
+    if (sm->socks) {
+        free(sm->socks);
+    }
+    sm->socks = NULL;
+    sm->running = 0;
+}
+
+/** Reports the input-side loss for an interval that every worker thread
+ *  has finished.
+ *
+ *  Kernel drops are counted in nDAG datagrams (each of which carries
+ *  many tagged packets), whereas the sequence loss is counted in tagged
+ *  packets, so the two numbers cannot be subtracted from one another.
+ *  Instead, any interval where the kernel has dropped datagrams is
+ *  attributed to local receive buffer overflow; sequence loss without
+ *  any kernel drops must have happened upstream of us.
+ *
+ *  @param glob         The global state for this corsarotrace instance.
+ *  @param time         The timestamp of the interval.
+ *  @param kerneldrops  Datagrams dropped by the kernel during the interval.
+ *  @param seqloss      Tagged packets lost during the interval, summed
+ *                      across all workers.
+ *  @param maxrcvbuf    The largest receive buffer size across all sockets.
+ */
+static void report_interval_loss(corsaro_trace_global_t *glob,
+        uint32_t time, uint64_t kerneldrops, uint64_t seqloss,
+        uint32_t maxrcvbuf) {
+
+    const char *losssource;
+    FILE *f = NULL;
+    char sfname[1024];
+
+    if (kerneldrops > 0) {
+        losssource = "kernel";
+        corsaro_log(glob->logger,
+                "warning: kernel dropped %lu datagrams on the receive sockets in the past interval (receive buffer %u bytes)",
+                kerneldrops, maxrcvbuf);
+    } else if (seqloss > 0) {
+        losssource = "upstream";
+        corsaro_log(glob->logger,
+                "warning: %lu tagged packets were lost upstream of corsarotrace in the past interval",
+                seqloss);
+    } else {
+        losssource = "none";
+    }
+
+    if (glob->statfilename == NULL) {
+        return;
+    }
+
+    snprintf(sfname, 1024, "%s-input", glob->statfilename);
+    f = fopen(sfname, "w");
+    if (!f) {
+        corsaro_log(glob->logger, "unable to open statistic file %s for writing: %s",
+                sfname, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "time=%u kerneldrops=%lu seqloss=%lu losssource=%s rcvbuf=%u\n",
+            time, kerneldrops, seqloss, losssource, maxrcvbuf);
+    fclose(f);
+}
+
+/** Records the tagged packet loss observed by a worker thread for the
+ *  interval that has just ended. Once every worker has reported the
+ *  interval, the input-side loss for the whole process is reported.
+ *
+ *  Workers do not finish an interval at exactly the same time, so the
+ *  loss is collected separately for each interval rather than in a single
+ *  running total -- otherwise loss from a slow worker would be attributed
+ *  to the following interval.
+ *
+ *  @param glob     The global state for this corsarotrace instance.
+ *  @param tls      The thread-local state for the worker thread.
+ */
+void socket_monitor_end_interval(corsaro_trace_global_t *glob,
+        corsaro_trace_worker_t *tls) {
+
+    corsaro_trace_sockmon_t *sm = &(glob->sockmon);
+    corsaro_sockmon_interval_t *slot = NULL;
+    corsaro_sockmon_interval_t ready[2];
+    uint64_t readydrops[2];
+    uint32_t maxrcvbuf;
+    uint32_t time = tls->current_interval.time;
+    int i, nready = 0;
+
+    if (!sm->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&(sm->mutex));
+    for (i = 0; i < SOCKMON_PENDING_INTERVALS; i++) {
+        if (sm->pending[i].reported > 0 && sm->pending[i].time == time) {
+            slot = &(sm->pending[i]);
+            break;
+        }
+    }
+
+    if (slot == NULL) {
+        /* Use an empty slot, or the oldest one if there are none */
+        for (i = 0; i < SOCKMON_PENDING_INTERVALS; i++) {
+            if (sm->pending[i].reported == 0) {
+                slot = &(sm->pending[i]);
+                break;
+            }
+            if (slot == NULL || sm->pending[i].time < slot->time) {
+                slot = &(sm->pending[i]);
+            }
+        }
+
+        if (slot->reported > 0) {
+            /* A worker must have stopped reporting, so give up on
+             * waiting for it and report that interval as it is */
+            ready[nready] = *slot;
+            readydrops[nready] = sm->kerneldrops;
+            sm->kerneldrops = 0;
+            nready ++;
+        }
+        slot->time = time;
+        slot->seqloss = 0;
+        slot->reported = 0;
+    }
+
+    slot->seqloss += tls->tracker->lostpackets;
+    slot->reported ++;
+
+    if (slot->reported >= glob->threads) {
+        ready[nready] = *slot;
+        readydrops[nready] = sm->kerneldrops;
+        sm->kerneldrops = 0;
+        nready ++;
+        slot->reported = 0;
+    }
+    maxrcvbuf = sm->maxrcvbuf;
+    pthread_mutex_unlock(&(sm->mutex));
+
+    for (i = 0; i < nready; i++) {
+        report_interval_loss(glob, ready[i].time, readydrops[i],
+                ready[i].seqloss, maxrcvbuf);
+    }
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
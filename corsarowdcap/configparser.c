@@ -72,6 +72,50 @@ static int grab_corsaro_filename_template(corsaro_wdcap_global_t *glob,
     return 1;
 }
 
+static int parse_snaplen_option(corsaro_logger_t *logger, char *value,
+        int32_t *snaplen, const char *optname) {
+
+    unsigned long len = strtoul(value, NULL, 10);
+
+    if (len > 65535) {
+        corsaro_log(logger,
+                "bad %s %lu, must be between 0 and 65535 inclusive -- ignoring.",
+                optname, len);
+        return 0;
+    }
+    if (len != CORSARO_WDCAP_SNAPLEN_FULL && len < 14) {
+        corsaro_log(logger,
+                "%s %lu is shorter than an Ethernet header, using 14 instead.",
+                optname, len);
+        len = 14;
+    }
+    *snaplen = (int32_t)len;
+    return 1;
+}
+
+static void derive_protocol_snaplens(corsaro_wdcap_global_t *glob) {
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        glob->protosnaplens[i] = glob->snaplen;
+    }
+
+    glob->snapbyproto = 0;
+    if (glob->tcpsnaplen != CORSARO_WDCAP_SNAPLEN_UNSET) {
+        glob->protosnaplens[TRACE_IPPROTO_TCP] = glob->tcpsnaplen;
+        glob->snapbyproto = 1;
+    }
+    if (glob->udpsnaplen != CORSARO_WDCAP_SNAPLEN_UNSET) {
+        glob->protosnaplens[TRACE_IPPROTO_UDP] = glob->udpsnaplen;
+        glob->snapbyproto = 1;
+    }
+    if (glob->icmpsnaplen != CORSARO_WDCAP_SNAPLEN_UNSET) {
+        glob->protosnaplens[TRACE_IPPROTO_ICMP] = glob->icmpsnaplen;
+        glob->protosnaplens[TRACE_IPPROTO_ICMPV6] = glob->icmpsnaplen;
+        glob->snapbyproto = 1;
+    }
+}
+
 static int parse_remaining_config(corsaro_wdcap_global_t *glob,
         yaml_document_t *doc, yaml_node_t *key, yaml_node_t *value) {
 
@@ -91,6 +135,63 @@ static int parse_remaining_config(corsaro_wdcap_global_t *glob,
         }
     }
 
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "directio")) {
+        if (parse_onoff_option(glob->logger, (char *)value->data.scalar.value,
+                &(glob->directio), "direct I/O") < 0) {
+            return -1;
+        }
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "interimprealloc")) {
+        /* Specified in megabytes */
+        glob->interimprealloc = strtoull((char *)value->data.scalar.value,
+                NULL, 10) * 1024 * 1024;
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "srcindex")) {
+        if (parse_onoff_option(glob->logger, (char *)value->data.scalar.value,
+                &(glob->srcindex), "source address index") < 0) {
+            return -1;
+        }
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value,
+                    "srcindexbloomthreshold")) {
+        glob->srcindexbloomthreshold = strtoull(
+                (char *)value->data.scalar.value, NULL, 10);
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "snaplen")) {
+        int32_t snaplen;
+        if (parse_snaplen_option(glob->logger,
+                (char *)value->data.scalar.value, &snaplen, "snaplen")) {
+            glob->snaplen = (uint16_t)snaplen;
+        }
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "tcpsnaplen")) {
+        parse_snaplen_option(glob->logger, (char *)value->data.scalar.value,
+                &(glob->tcpsnaplen), "tcpsnaplen");
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "udpsnaplen")) {
+        parse_snaplen_option(glob->logger, (char *)value->data.scalar.value,
+                &(glob->udpsnaplen), "udpsnaplen");
+    }
+
+    if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+            && !strcmp((char *)key->data.scalar.value, "icmpsnaplen")) {
+        parse_snaplen_option(glob->logger, (char *)value->data.scalar.value,
+                &(glob->icmpsnaplen), "icmpsnaplen");
+    }
+
     if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
             && !strcmp((char *)key->data.scalar.value, "monitorid")) {
         glob->monitorid = strdup((char *)value->data.scalar.value);
@@ -234,6 +335,35 @@ static void log_configuration(corsaro_wdcap_global_t *glob) {
 
     corsaro_log(glob->logger, "stripping vlans has been %s",
             glob->stripvlans ? "enabled" : "disabled");
+    corsaro_log(glob->logger, "direct I/O for interim files has been %s",
+            glob->directio ? "enabled" : "disabled");
+    if (glob->interimprealloc > 0) {
+        corsaro_log(glob->logger, "preallocating %lu MB for each interim file",
+                glob->interimprealloc / (1024 * 1024));
+    }
+    if (glob->snaplen == CORSARO_WDCAP_SNAPLEN_FULL) {
+        corsaro_log(glob->logger, "writing full packets");
+    } else {
+        corsaro_log(glob->logger, "truncating packets to %u bytes",
+                glob->snaplen);
+    }
+    if (glob->tcpsnaplen != CORSARO_WDCAP_SNAPLEN_UNSET) {
+        corsaro_log(glob->logger, "TCP snap length is set to %d",
+                glob->tcpsnaplen);
+    }
+    if (glob->udpsnaplen != CORSARO_WDCAP_SNAPLEN_UNSET) {
+        corsaro_log(glob->logger, "UDP snap length is set to %d",
+                glob->udpsnaplen);
+    }
+    if (glob->icmpsnaplen != CORSARO_WDCAP_SNAPLEN_UNSET) {
+        corsaro_log(glob->logger, "ICMP snap length is set to %d",
+                glob->icmpsnaplen);
+    }
+    if (glob->srcindex) {
+        corsaro_log(glob->logger,
+                "writing source address indexes (bloom filter above %lu sources)",
+                glob->srcindexbloomthreshold);
+    }
     corsaro_log(glob->logger, "stats output file creation has been %s",
             glob->writestats ? "enabled" : "disabled");
     corsaro_log(glob->logger, "pid file is set to %s", glob->pidfile);
@@ -328,6 +458,15 @@ corsaro_wdcap_global_t *corsaro_wdcap_init_global(char *filename, int logmode) {
     glob->inputuri = NULL;
     glob->stripvlans = CORSARO_DEFAULT_WDCAP_STRIP_VLANS;
     glob->writestats = CORSARO_DEFAULT_WDCAP_WRITE_STATS;
+    glob->directio = 0;
+    glob->srcindex = 0;
+    glob->srcindexbloomthreshold =
+            CORSARO_DEFAULT_WDCAP_SRCINDEX_BLOOM_THRESHOLD;
+    glob->interimprealloc = 0;
+    glob->snaplen = CORSARO_WDCAP_SNAPLEN_FULL;
+    glob->tcpsnaplen = CORSARO_WDCAP_SNAPLEN_UNSET;
+    glob->udpsnaplen = CORSARO_WDCAP_SNAPLEN_UNSET;
+    glob->icmpsnaplen = CORSARO_WDCAP_SNAPLEN_UNSET;
     glob->threads_ended = 0;
     glob->pidfile = NULL;
     glob->filterstring = NULL;
@@ -387,6 +526,8 @@ corsaro_wdcap_global_t *corsaro_wdcap_init_global(char *filename, int logmode) {
         glob->pidfile = strdup(CORSARO_WDCAP_DEFAULT_PIDFILE);
     }
 
+    derive_protocol_snaplens(glob);
+
     log_configuration(glob);
 
     if (glob->template == NULL) {
@@ -246,6 +246,8 @@ static char *stradd(const char *str, char *bufp, char *buflim) {
  *                      complete and ready to be archived.
  *                      If 2, append the '.stats' extension to the filename.
  *                      This is used to create the stats files.
+ *                      If 3, append the '.srcidx' extension to the filename.
+ *                      This is used to create the source index files.
  *  @return A pointer to a string allocated via strdup() that contains the
  *  output file name derived from the given parameters. This name must be
  *  later freed by the caller to avoid leaking the memory holding the string.
@@ -345,6 +347,8 @@ char *corsaro_wdcap_derive_output_name(corsaro_wdcap_global_t *glob,
         w = stradd(".done", w, end);
     } else if (exttype == 2) {
         w = stradd(".stats", w, end);
+    } else if (exttype == 3) {
+        w = stradd(".srcidx", w, end);
     }
 
     if (w >= end) {
@@ -364,6 +368,31 @@ char *corsaro_wdcap_derive_output_name(corsaro_wdcap_global_t *glob,
 }
 
 
+/** Finds the largest number of bytes that we will keep from any packet.
+ *
+ *  @param glob         The global state for this corsarowdcap instance.
+ *
+ *  @return the largest of the global and per-protocol snap lengths, or
+ *          CORSARO_WDCAP_SNAPLEN_FULL if any packets are kept in full.
+ */
+static uint16_t max_snaplen(corsaro_wdcap_global_t *glob) {
+    uint16_t maxlen = glob->snaplen;
+    int i;
+
+    if (maxlen == CORSARO_WDCAP_SNAPLEN_FULL) {
+        return CORSARO_WDCAP_SNAPLEN_FULL;
+    }
+    for (i = 0; i < 256; i++) {
+        if (glob->protosnaplens[i] == CORSARO_WDCAP_SNAPLEN_FULL) {
+            return CORSARO_WDCAP_SNAPLEN_FULL;
+        }
+        if (glob->protosnaplens[i] > maxlen) {
+            maxlen = glob->protosnaplens[i];
+        }
+    }
+    return maxlen;
+}
+
 /** Initialises local thread state data for a processing thread.
  *
  *  @param tls          The thread local data to be initialised.
@@ -374,6 +403,10 @@ static inline void init_wdcap_thread_data(corsaro_wdcap_local_t *tls,
 		int threadid, corsaro_wdcap_global_t *glob) {
 
 	tls->writer = corsaro_create_fast_trace_writer();
+    if (tls->writer) {
+        corsaro_configure_fast_trace_writer(tls->writer, glob->directio,
+                glob->interimprealloc, max_snaplen(glob));
+    }
 	tls->interimfilename = NULL;
 	tls->glob = glob;
 
@@ -384,6 +417,7 @@ static inline void init_wdcap_thread_data(corsaro_wdcap_local_t *tls,
 	tls->next_report = 0;
 	tls->current_interval.time = 0;
     tls->zmq_pushsock = NULL;
+    tls->srcindex = NULL;
 
     tls->ending = 0;
 
@@ -428,6 +462,11 @@ static inline void clear_wdcap_thread_data(corsaro_wdcap_local_t *tls) {
     if (tls->zmq_pushsock) {
         zmq_close(tls->zmq_pushsock);
     }
+
+    if (tls->srcindex) {
+        Word_t freed;
+        J1FA(freed, tls->srcindex);
+    }
 }
 
 
@@ -470,6 +509,12 @@ static int check_interval_over(libtrace_t *trace, libtrace_thread_t *t,
             trace_get_thread_statistics(trace, t, &mergemsg.lt_stats);
         }
 
+        /* Hand our source index for this interval over to the merger,
+         * which is responsible for freeing it.
+         */
+        mergemsg.srcindex = tls->srcindex;
+        tls->srcindex = NULL;
+
         /* Prepare to rotate our interim output file */
         if (tls->writer) {
             int srcfd;
@@ -657,6 +702,66 @@ static void process_tick(libtrace_t *trace, libtrace_thread_t *t,
     }
 }
 
+/** Looks at the IP header of a packet to find the snap length that applies
+ *  to it and, if required, adds its source address to the per-interval
+ *  source index.
+ *
+ *  The headers are only walked once per packet: the same network header
+ *  offset is handed to the fast writer if VLAN and MPLS headers are to be
+ *  stripped.
+ *
+ *  @param glob         The global state for this corsarowdcap instance.
+ *  @param tls          The thread local state for this thread.
+ *  @param packet       The packet that is about to be written.
+ *  @param l3off        Set to the offset of the network header if the
+ *                      packet should be stripped, or 0 otherwise.
+ *  @param ethertype    Set to the ethertype of the network header.
+ *
+ *  @return the number of bytes of the packet that should be written to disk,
+ *          or CORSARO_WDCAP_SNAPLEN_FULL to write the whole packet.
+ */
+static inline uint16_t inspect_packet(corsaro_wdcap_global_t *glob,
+        corsaro_wdcap_local_t *tls, libtrace_packet_t *packet,
+        uint16_t *l3off, uint16_t *ethertype) {
+
+    uint8_t *l3;
+    uint16_t off;
+    uint32_t caplen, rem;
+    int ret;
+
+    *l3off = 0;
+    if (!glob->snapbyproto && !glob->srcindex &&
+            glob->stripvlans != CORSARO_WDCAP_STRIP_VLANS_ON) {
+        return glob->snaplen;
+    }
+
+    caplen = trace_get_capture_length(packet);
+    off = corsaro_find_network_header((uint8_t *)packet->payload, caplen,
+            ethertype);
+    if (off == 0) {
+        return glob->snaplen;
+    }
+    if (glob->stripvlans == CORSARO_WDCAP_STRIP_VLANS_ON) {
+        *l3off = off;
+    }
+    l3 = ((uint8_t *)packet->payload) + off;
+    rem = caplen - off;
+
+    if (*ethertype == TRACE_ETHERTYPE_IP && rem >= 20) {
+        if (glob->srcindex) {
+            J1S(ret, tls->srcindex, ntohl(*((uint32_t *)(l3 + 12))));
+        }
+        return glob->protosnaplens[l3[9]];
+    }
+    if (*ethertype == TRACE_ETHERTYPE_IPV6 && rem >= 7) {
+        /* Only the first next header is checked, so IPv6 packets with
+         * extension headers will fall back to the global snap length.
+         */
+        return glob->protosnaplens[l3[6]];
+    }
+    return glob->snaplen;
+}
+
 /** Per-packet callback for a processing thread.
  *
  *  Writes the received packet to the interim output file. If the packet
@@ -680,6 +785,7 @@ static libtrace_packet_t *per_packet(libtrace_t *trace, libtrace_thread_t *t,
     corsaro_wdcap_global_t *glob = (corsaro_wdcap_global_t *)global;
     corsaro_wdcap_local_t *tls = (corsaro_wdcap_local_t *)local;
     struct timeval ptv;
+    uint16_t snaplen, l3off, ethertype = 0;
     int ret;
 
     if (tls->ending) {
@@ -730,19 +836,14 @@ static libtrace_packet_t *per_packet(libtrace_t *trace, libtrace_thread_t *t,
         return packet;
     }
 
-    /* WARNING: only enable VLAN stripping if you definitely have VLAN
-     * tags that need to be stripped. Even if your packets have no VLAN
-     * tags, this is a relatively expensive operation so you're much
-     * better off just disabling stripping instead.
+    /* Write the packet to the interim file using asynchronous I/O. Any
+     * VLAN or MPLS headers are removed by the fast writer as it copies
+     * the packet, which is much cheaper than trace_strip_packet().
      */
-	if (glob->stripvlans == CORSARO_WDCAP_STRIP_VLANS_ON) {
-		packet = trace_strip_packet(packet);
-	}
-
-    /* Write the packet to the interim file using asynchronous I/O */
 	tls->last_ts = ptv.tv_sec;
+    snaplen = inspect_packet(glob, tls, packet, &l3off, &ethertype);
 	if (corsaro_fast_write_erf_packet(glob->logger, tls->writer,
-            packet) < 0) {
+            packet, snaplen, l3off, ethertype) < 0) {
 		corsaro_halted = 1;
 	}
 	return packet;
@@ -53,9 +53,24 @@
 
 #define CORSARO_DEFAULT_WDCAP_WRITE_STATS 0
 
+/** Number of unique source addresses above which the source index for an
+ *  interval is written as a bloom filter rather than a list of addresses.
+ */
+#define CORSARO_DEFAULT_WDCAP_SRCINDEX_BLOOM_THRESHOLD 1000000
+
+/** Snap length value meaning "write the entire packet" */
+#define CORSARO_WDCAP_SNAPLEN_FULL 0
+
+/** Marks a per-protocol snap length that has not been configured, i.e.
+ *  packets for that protocol should use the global snap length instead.
+ */
+#define CORSARO_WDCAP_SNAPLEN_UNSET -1
+
 #define CORSARO_WDCAP_INTERNAL_QUEUE_BACK "inproc://wdcapinternalback"
 #define CORSARO_WDCAP_INTERNAL_QUEUE_FRONT "inproc://wdcapinternalfront"
 
+#include <Judy.h>
+
 #include "libcorsaro_trace.h"
 #include "libcorsaro_log.h"
 #include "libcorsaro.h"
@@ -109,6 +124,12 @@ typedef struct corsaro_wdcap_message {
 
     /** Stats counters from libtrace */
     libtrace_stat_t lt_stats;
+
+    /** Judy1 set of the source addresses seen by the sending thread during
+     *  the completed interval (used by CORSARO_WDCAP_MSG_INTERVAL_DONE
+     *  messages). Ownership passes to the merging thread.
+     */
+    Pvoid_t srcindex;
 } corsaro_wdcap_message_t;
 
 typedef struct corsaro_wdcap_interval corsaro_wdcap_interval_t;
@@ -127,6 +148,8 @@ struct corsaro_wdcap_interval {
     uint8_t *thread_ids;
     /** Array of stats stuctures (one per done thread) */
     libtrace_stat_t *thread_stats;
+    /** Array of source address sets (one per done thread) */
+    Pvoid_t *thread_srcindexes;
     /** Next pointer to maintain a linked list of outstanding intervals */
     corsaro_wdcap_interval_t *next;
 };
@@ -198,6 +221,47 @@ typedef struct corsaro_wdcap_global {
     /** Indicates whether a stats file should be written */
     uint8_t writestats;
 
+    /** The maximum number of bytes of each packet to write to disk, or
+     *  CORSARO_WDCAP_SNAPLEN_FULL to keep entire packets.
+     */
+    uint16_t snaplen;
+
+    /** Per-protocol snap length overrides, as set in the config file (or
+     *  CORSARO_WDCAP_SNAPLEN_UNSET if not configured).
+     */
+    int32_t tcpsnaplen;
+    int32_t udpsnaplen;
+    int32_t icmpsnaplen;
+
+    /** Snap length to apply to packets for each IP protocol, derived from
+     *  the global and per-protocol snap length options.
+     */
+    uint16_t protosnaplens[256];
+
+    /** Indicates whether interim files should be written using direct I/O */
+    uint8_t directio;
+
+    /** Number of bytes to preallocate for each interim file, or 0 to size
+     *  the preallocation based on the previous interim file.
+     */
+    uint64_t interimprealloc;
+
+    /** Indicates whether a source address index should be written
+     *  alongside each merged output file.
+     */
+    uint8_t srcindex;
+
+    /** Number of unique source addresses above which the source index is
+     *  written as a bloom filter instead of an exact list.
+     */
+    uint64_t srcindexbloomthreshold;
+
+    /** Set to 1 if any per-protocol snap length has been configured, in
+     *  which case we need to look at each packet's IP protocol to find
+     *  the right snap length.
+     */
+    uint8_t snapbyproto;
+
     /** ZeroMQ context for managing message queues */
     void *zmq_ctxt;
 
@@ -296,6 +360,9 @@ struct corsaro_wdcap_local {
     /** ZeroMQ socket for pushing messages to the merging thread */
     void *zmq_pushsock;
 
+    /** Judy1 set of source addresses seen during the current interval */
+    Pvoid_t srcindex;
+
     /** The last "missed" packet count for this thread */
     uint64_t lastmisscount;
     /** The last "accepted" packet count for this thread */
@@ -361,6 +428,8 @@ void *start_merging_thread(void *data);
  *                      complete and ready to be archived.
  *                      If 2, append the '.stats' extension to the filename.
  *                      This is used to create the stats files.
+ *                      If 3, append the '.srcidx' extension to the filename.
+ *                      This is used to create the source index files.
  *  @return A pointer to a string allocated via strdup() that contains the
  *  output file name derived from the given parameters. This name must be
  *  later freed by the caller to avoid leaking the memory holding the string.
@@ -0,0 +1,419 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libcorsaro_log.h"
+#include "srcindex.h"
+
+/** Tool that searches the source address index files written alongside
+ *  corsarowdcap trace files, to find out which trace files contain packets
+ *  from a given set of source addresses.
+ *
+ *  Index files are loaded and searched by a pool of threads. Results are
+ *  reported in the order that the index files were given on the command
+ *  line.
+ */
+
+/** An address that was found in an index file */
+typedef struct query_match {
+    uint32_t addr;
+    /** CORSARO_WDCAP_SRCINDEX_PRESENT or CORSARO_WDCAP_SRCINDEX_MAYBE */
+    int result;
+} query_match_t;
+
+/** The results of searching a single index file */
+typedef struct query_input {
+    char *path;
+    uint32_t timestamp;
+    uint8_t failed;
+    query_match_t *matches;
+    int matchcount;
+} query_input_t;
+
+/** State shared by all of the query threads */
+typedef struct query_global {
+    corsaro_logger_t *logger;
+
+    /** The addresses to search for (host byte order) */
+    uint32_t *addrs;
+    int addrcount;
+
+    query_input_t *inputs;
+    int inputcount;
+
+    /** The next index file to be searched */
+    int nextinput;
+    pthread_mutex_t mutex;
+} query_global_t;
+
+volatile int halted = 0;
+
+static void cleanup_signal(int sig) {
+    (void)sig;
+    halted = 1;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] <index file 1> ... <index file N>\n\n"
+        "Options:\n"
+        "  -a, --address <addr>     search for source address <addr> (may be repeated)\n"
+        "  -A, --addressfile <file> search for each address listed in <file>, one per line\n"
+        "  -t, --threads <n>        number of threads to search with (default 4)\n"
+        "  -l, --log <mode>         log mode: stderr, syslog or disabled\n"
+        "  -h, --help               print this message\n\n"
+        "Prints '<timestamp> <address> <index file> <exact|maybe>' for each match.\n"
+        "'maybe' matches come from bloom filter indexes and may be false positives.\n",
+        prog);
+}
+
+/** Adds an address (as a dotted quad string) to the list of addresses
+ *  being searched for.
+ *
+ *  @return 0 if the address was added, -1 if it is not a valid address.
+ */
+static int add_query_address(query_global_t *glob, char *addrstr) {
+    struct in_addr in;
+
+    if (inet_pton(AF_INET, addrstr, &in) != 1) {
+        corsaro_log(glob->logger, "invalid IPv4 address: %s", addrstr);
+        return -1;
+    }
+
+    glob->addrs = realloc(glob->addrs,
+            (glob->addrcount + 1) * sizeof(uint32_t));
+    glob->addrs[glob->addrcount] = ntohl(in.s_addr);
+    glob->addrcount ++;
+    return 0;
+}
+
+/** Reads the addresses to search for from a file, one per line.
+ *
+ *  @return 0 if successful, -1 if the file could not be read or contains
+ *          an invalid address.
+ */
+static int read_address_file(query_global_t *glob, char *filename) {
+    char line[256];
+    FILE *f;
+
+    if ((f = fopen(filename, "r")) == NULL) {
+        corsaro_log(glob->logger, "unable to open address file %s: %s",
+                filename, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *end = line + strlen(line);
+
+        while (end > line && (end[-1] == '\n' || end[-1] == '\r' ||
+                    end[-1] == ' ' || end[-1] == '\t')) {
+            end --;
+        }
+        *end = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (add_query_address(glob, line) < 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/** Loads an index file and searches it for each of the query addresses.
+ *
+ *  @param glob         The global state for this query.
+ *  @param input        The index file to search.
+ */
+static void search_index_file(query_global_t *glob, query_input_t *input) {
+    corsaro_wdcap_srcindex_t *idx;
+    int i, res;
+
+    idx = corsaro_wdcap_srcindex_load(glob->logger, input->path);
+    if (idx == NULL) {
+        input->failed = 1;
+        return;
+    }
+
+    input->timestamp = idx->header.timestamp;
+    for (i = 0; i < glob->addrcount; i++) {
+        res = corsaro_wdcap_srcindex_lookup(idx, glob->addrs[i]);
+        if (res == CORSARO_WDCAP_SRCINDEX_ABSENT) {
+            continue;
+        }
+        input->matches = realloc(input->matches,
+                (input->matchcount + 1) * sizeof(query_match_t));
+        input->matches[input->matchcount].addr = glob->addrs[i];
+        input->matches[input->matchcount].result = res;
+        input->matchcount ++;
+    }
+    corsaro_wdcap_srcindex_free(idx);
+}
+
+static void *start_query_thread(void *data) {
+    query_global_t *glob = (query_global_t *)data;
+    int next;
+
+    while (!halted) {
+        pthread_mutex_lock(&(glob->mutex));
+        next = glob->nextinput;
+        glob->nextinput ++;
+        pthread_mutex_unlock(&(glob->mutex));
+
+        if (next >= glob->inputcount) {
+            break;
+        }
+        search_index_file(glob, &(glob->inputs[next]));
+    }
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[]) {
+    struct sigaction sigact;
+    sigset_t sig_before, sig_block_all;
+    query_global_t glob;
+    pthread_t *threads;
+    int logmode = GLOBAL_LOGMODE_STDERR;
+    char *logmodestr = NULL;
+    char *addrfile = NULL;
+    char **addrargs = NULL;
+    int addrargcount = 0;
+    int threadcount = 4, i, j, errors = 0;
+    uint64_t matches = 0;
+
+    memset(&glob, 0, sizeof(glob));
+
+    sigact.sa_handler = cleanup_signal;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = SA_RESTART;
+
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (1) {
+        int optind;
+        struct option long_options[] = {
+            { "address", 1, 0, 'a'},
+            { "addressfile", 1, 0, 'A'},
+            { "threads", 1, 0, 't'},
+            { "log", 1, 0, 'l'},
+            { "help", 0, 0, 'h'},
+            { NULL, 0, 0, 0 }
+        };
+
+        int c  = getopt_long(argc, argv, "a:A:t:l:h", long_options,
+                &optind);
+        if (c == -1) {
+            break;
+        }
+
+        switch(c) {
+            case 'a':
+                addrargs = realloc(addrargs,
+                        (addrargcount + 1) * sizeof(char *));
+                addrargs[addrargcount] = optarg;
+                addrargcount ++;
+                break;
+            case 'A':
+                addrfile = optarg;
+                break;
+            case 't':
+                threadcount = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                logmodestr = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    /* Configure our logging */
+    if (logmodestr != NULL) {
+        if (strcmp(logmodestr, "stderr") == 0 ||
+                    strcmp(logmodestr, "terminal") == 0) {
+            logmode = GLOBAL_LOGMODE_STDERR;
+        } else if (strcmp(logmodestr, "syslog") == 0) {
+            logmode = GLOBAL_LOGMODE_SYSLOG;
+        } else if (strcmp(logmodestr, "disabled") == 0 ||
+                strcmp(logmodestr, "off") == 0 ||
+                strcmp(logmodestr, "none") == 0) {
+            logmode = GLOBAL_LOGMODE_DISABLED;
+        } else {
+            fprintf(stderr, "corsarowdcapquery: unexpected logmode: %s\n",
+                    logmodestr);
+            return 1;
+        }
+    }
+
+    if (logmode == GLOBAL_LOGMODE_STDERR) {
+        glob.logger = init_corsaro_logger("corsarowdcapquery", "");
+    } else if (logmode == GLOBAL_LOGMODE_SYSLOG) {
+        glob.logger = init_corsaro_logger("corsarowdcapquery", NULL);
+    } else {
+        glob.logger = NULL;
+    }
+
+    for (i = 0; i < addrargcount; i++) {
+        if (add_query_address(&glob, addrargs[i]) < 0) {
+            return 1;
+        }
+    }
+    free(addrargs);
+
+    if (addrfile && read_address_file(&glob, addrfile) < 0) {
+        return 1;
+    }
+
+    if (glob.addrcount == 0) {
+        corsaro_log(glob.logger,
+                "Must specify at least one address with -a or -A!");
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (threadcount <= 0) {
+        threadcount = 1;
+    }
+
+    if (optind >= argc) {
+        corsaro_log(glob.logger, "No index files specified -- exiting");
+        usage(argv[0]);
+        return 1;
+    }
+
+    glob.inputcount = argc - optind;
+    glob.inputs = calloc(glob.inputcount, sizeof(query_input_t));
+    for (i = 0; i < glob.inputcount; i++) {
+        glob.inputs[i].path = argv[optind + i];
+    }
+    pthread_mutex_init(&(glob.mutex), NULL);
+
+    if (threadcount > glob.inputcount) {
+        threadcount = glob.inputcount;
+    }
+    threads = calloc(threadcount, sizeof(pthread_t));
+
+    sigemptyset(&sig_block_all);
+    if (pthread_sigmask(SIG_SETMASK, &sig_block_all, &sig_before) < 0) {
+        corsaro_log(glob.logger, "Error in pthread_sigmask?: %s",
+                strerror(errno));
+        return 1;
+    }
+
+    for (i = 0; i < threadcount; i++) {
+        pthread_create(&(threads[i]), NULL, start_query_thread, &glob);
+    }
+
+    if (pthread_sigmask(SIG_SETMASK, &sig_before, NULL) < 0) {
+        corsaro_log(glob.logger, "Error in pthread_sigmask?: %s",
+                strerror(errno));
+        return 1;
+    }
+
+    for (i = 0; i < threadcount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Report matches in the same order as the index files were given */
+    for (i = 0; i < glob.inputcount; i++) {
+        query_input_t *input = &(glob.inputs[i]);
+
+        if (input->failed) {
+            errors ++;
+        }
+        for (j = 0; j < input->matchcount; j++) {
+            struct in_addr in;
+            char addrstr[INET_ADDRSTRLEN];
+
+            in.s_addr = htonl(input->matches[j].addr);
+            inet_ntop(AF_INET, &in, addrstr, sizeof(addrstr));
+            printf("%u %s %s %s\n", input->timestamp, addrstr, input->path,
+                    input->matches[j].result == CORSARO_WDCAP_SRCINDEX_PRESENT
+                    ? "exact" : "maybe");
+            matches ++;
+        }
+        free(input->matches);
+    }
+
+    corsaro_log(glob.logger, "Searched %d index files for %d addresses: %lu matches",
+            glob.inputcount, glob.addrcount, matches);
+    if (errors > 0) {
+        corsaro_log(glob.logger, "%d index files could not be read", errors);
+    }
+
+    pthread_mutex_destroy(&(glob.mutex));
+    free(threads);
+    free(glob.inputs);
+    free(glob.addrs);
+    if (glob.logger) {
+        destroy_corsaro_logger(glob.logger);
+    }
+    return (errors > 0 || halted) ? 1 : 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -49,6 +49,7 @@
 
 #include "config.h"
 #include "corsarowdcap.h"
+#include "srcindex.h"
 #include "libcorsaro_log.h"
 
 #include <stdio.h>
@@ -56,6 +57,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <zmq.h>
 
 #include "utils.h"
@@ -157,6 +159,40 @@ static int choose_next_merge_packet(corsaro_wdcap_merger_t *mergestate,
 }
 
 
+/** Flushes a completed output file to disk and then evicts it from the
+ *  page cache.
+ *
+ *  @param glob         The global state for this instance of corsarowdcap.
+ *  @param uri          The libtrace URI for the output file.
+ */
+static void drop_cached_output(corsaro_wdcap_global_t *glob, char *uri) {
+    char *path;
+    int fd;
+
+    path = strchr(uri, ':');
+    if (path == NULL) {
+        path = uri;
+    } else {
+        path ++;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    /* DONTNEED only drops clean pages, so we need to sync first. This
+     * may take a while, but the merging thread can afford to wait.
+     */
+    if (fdatasync(fd) < 0) {
+        corsaro_log(glob->logger, "error syncing merged output file %s: %s",
+                path, strerror(errno));
+    } else {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    close(fd);
+}
+
 /** Merges all interim files for a given interval into a single output file.
  *
  *  @param glob         The global state for this instance of corsarowdcap.
@@ -271,6 +307,41 @@ fail:
         }
     }
 
+    if (glob->srcindex) {
+        Pvoid_t sources = NULL;
+        Word_t freed;
+
+        /* Combine the source addresses seen by each processing thread
+         * into a single set for the whole interval.
+         */
+        for (i = 0; i < interval->threads_done; i++) {
+            corsaro_wdcap_srcindex_union(&sources,
+                    &(interval->thread_srcindexes[i]));
+        }
+
+        if (success) {
+            char *idxname = corsaro_wdcap_derive_output_name(glob,
+                    interval->timestamp, -1, 0, 3);
+            if (idxname == NULL || corsaro_wdcap_srcindex_write(glob->logger,
+                        idxname, interval->timestamp, sources,
+                        glob->srcindexbloomthreshold) < 0) {
+                corsaro_log(glob->logger,
+                        "unable to write source index for interval %u",
+                        interval->timestamp);
+            }
+            free(idxname);
+        }
+        J1FA(freed, sources);
+    }
+
+    if (success && glob->directio) {
+        /* The interim files never went through the page cache, so don't
+         * let the merged output fill it up instead. Nobody is going to
+         * read this file again until it is archived.
+         */
+        drop_cached_output(glob, outname);
+    }
+
     if (success) {
         /* All packets have been written to the merged file, now create a
          * special ".done" file so that our archiving scripts can tell that
@@ -318,9 +389,26 @@ fail:
     return ret;
 }
 
+/** Frees the state for an interval that we have finished with.
+ *
+ *  @param fin      The interval to be freed.
+ */
+static void free_interval(corsaro_wdcap_interval_t *fin) {
+    Word_t freed;
+    int i;
+
+    for (i = 0; i < fin->threads_done; i++) {
+        J1FA(freed, fin->thread_srcindexes[i]);
+    }
+    free(fin->thread_ids);
+    free(fin->thread_stats);
+    free(fin->thread_srcindexes);
+    free(fin);
+}
+
 static int merge_finished_interval(corsaro_wdcap_global_t *glob,
     corsaro_wdcap_merger_t *mergestate, uint8_t threadid,
-    uint32_t timestamp, libtrace_stat_t *lt_stats) {
+    uint32_t timestamp, libtrace_stat_t *lt_stats, Pvoid_t srcindex) {
 
     corsaro_wdcap_interval_t *fin = mergestate->waiting;
     corsaro_wdcap_interval_t *prev = NULL;
@@ -344,8 +432,10 @@ static int merge_finished_interval(corsaro_wdcap_global_t *glob,
         fin->threads_done = 1;
         fin->thread_ids = malloc(glob->threads);
         fin->thread_stats = malloc(sizeof(libtrace_stat_t) * glob->threads);
+        fin->thread_srcindexes = calloc(glob->threads, sizeof(Pvoid_t));
         fin->thread_ids[0] = threadid;
         memcpy(&fin->thread_stats[0], lt_stats, sizeof(libtrace_stat_t));
+        fin->thread_srcindexes[0] = srcindex;
         fin->next = NULL;
 
         if (prev) {
@@ -358,6 +448,7 @@ static int merge_finished_interval(corsaro_wdcap_global_t *glob,
         fin->thread_ids[fin->threads_done] = threadid;
         memcpy(&fin->thread_stats[fin->threads_done], lt_stats,
                sizeof(libtrace_stat_t));
+        fin->thread_srcindexes[fin->threads_done] = srcindex;
         /* XXX we assume that each processing thread will only send us ONE
          * interval over message per interval...
          */
@@ -380,9 +471,7 @@ static int merge_finished_interval(corsaro_wdcap_global_t *glob,
             ret = 1;
         }
         mergestate->waiting = fin->next;
-        free(fin->thread_ids);
-        free(fin->thread_stats);
-        free(fin);
+        free_interval(fin);
         return ret;
     }
 
@@ -456,7 +545,8 @@ void *start_merging_thread(void *data) {
                 close(msg.src_fd);
             }
             merge_finished_interval(glob, mergestate, msg.threadid,
-                                    msg.timestamp, &msg.lt_stats);
+                                    msg.timestamp, &msg.lt_stats,
+                                    msg.srcindex);
         } else {
             corsaro_log(glob->logger,
                     "received unexpected message (type %u) in merging thread %u.",
@@ -476,9 +566,7 @@ endmerge:
     while (mergestate->waiting) {
         corsaro_wdcap_interval_t *fin = mergestate->waiting;
         mergestate->waiting = fin->next;
-        free(fin->thread_ids);
-        free(fin->thread_stats);
-        free(fin);
+        free_interval(fin);
     }
 
     zmq_close(mergestate->zmq_subsock);
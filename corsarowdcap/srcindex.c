@@ -0,0 +1,348 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcorsaro_common.h"
+#include "srcindex.h"
+
+/** Hashes an address for use with the bloom filter. The two halves of the
+ *  result are used as the two base hashes for double hashing.
+ */
+static inline uint64_t srcindex_hash(uint32_t addr) {
+    uint64_t h = addr;
+
+    /* murmur3 64-bit finaliser */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/** Finds the bloom filter bit for a given hash function.
+ *
+ *  @param h            The hash of the address, from srcindex_hash().
+ *  @param i            The index of the hash function.
+ *  @param bits         The size of the bloom filter (a power of two).
+ *
+ *  @return the bit in the bloom filter to set or test.
+ */
+static inline uint64_t srcindex_bloom_bit(uint64_t h, int i, uint64_t bits) {
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+
+    return ((uint64_t)h1 + (uint64_t)i * h2) & (bits - 1);
+}
+
+/** Converts a source index header between host byte order and the
+ *  little-endian order used on disk. The conversion is its own inverse.
+ */
+static void srcindex_swap_header(corsaro_wdcap_srcindex_header_t *hdr) {
+    hdr->version = bswap_host_to_le32(hdr->version);
+    hdr->byteorder = bswap_host_to_le32(hdr->byteorder);
+    hdr->timestamp = bswap_host_to_le32(hdr->timestamp);
+    hdr->reserved = bswap_host_to_le16(hdr->reserved);
+    hdr->addrcount = bswap_host_to_le64(hdr->addrcount);
+    hdr->bloombits = bswap_host_to_le64(hdr->bloombits);
+}
+
+void corsaro_wdcap_srcindex_union(Pvoid_t *dest, Pvoid_t *src) {
+    Word_t index = 0, freed;
+    int ret;
+
+    if (*src == NULL) {
+        return;
+    }
+
+    if (*dest == NULL) {
+        /* Nothing to merge into, just take over the whole set */
+        *dest = *src;
+        *src = NULL;
+        return;
+    }
+
+    J1F(ret, *src, index);
+    while (ret) {
+        J1S(ret, *dest, index);
+        J1N(ret, *src, index);
+    }
+    J1FA(freed, *src);
+    *src = NULL;
+}
+
+int corsaro_wdcap_srcindex_write(corsaro_logger_t *logger, char *filename,
+        uint32_t timestamp, Pvoid_t sources, uint64_t bloomthresh) {
+
+    corsaro_wdcap_srcindex_header_t hdr;
+    Word_t count, index = 0;
+    uint8_t *data;
+    size_t datalen;
+    FILE *f;
+    int ret, i;
+
+    J1C(count, sources, 0, -1);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CORSARO_WDCAP_SRCINDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = CORSARO_WDCAP_SRCINDEX_VERSION;
+    hdr.byteorder = CORSARO_WDCAP_SRCINDEX_BYTEORDER;
+    hdr.timestamp = timestamp;
+    hdr.addrcount = count;
+
+    if (count > bloomthresh) {
+        uint64_t bits = 64;
+
+        while (bits < count * CORSARO_WDCAP_SRCINDEX_BLOOM_BITS_PER_ADDR) {
+            bits <<= 1;
+        }
+        hdr.type = CORSARO_WDCAP_SRCINDEX_BLOOM;
+        hdr.hashes = CORSARO_WDCAP_SRCINDEX_BLOOM_HASHES;
+        hdr.bloombits = bits;
+
+        datalen = bits / 8;
+        data = calloc(1, datalen);
+        if (data == NULL) {
+            corsaro_log(logger, "out of memory while creating source index");
+            return -1;
+        }
+
+        J1F(ret, sources, index);
+        while (ret) {
+            uint64_t h = srcindex_hash((uint32_t)index);
+            uint64_t bit;
+
+            for (i = 0; i < CORSARO_WDCAP_SRCINDEX_BLOOM_HASHES; i++) {
+                bit = srcindex_bloom_bit(h, i, bits);
+                data[bit >> 3] |= (1 << (bit & 0x07));
+            }
+            J1N(ret, sources, index);
+        }
+    } else {
+        uint32_t *addrs;
+
+        hdr.type = CORSARO_WDCAP_SRCINDEX_LIST;
+        datalen = count * sizeof(uint32_t);
+        data = malloc(datalen ? datalen : 1);
+        if (data == NULL) {
+            corsaro_log(logger, "out of memory while creating source index");
+            return -1;
+        }
+
+        /* Judy iterates in ascending order, so the list ends up sorted */
+        addrs = (uint32_t *)data;
+        J1F(ret, sources, index);
+        while (ret) {
+            *addrs = bswap_host_to_le32((uint32_t)index);
+            addrs ++;
+            J1N(ret, sources, index);
+        }
+    }
+
+    srcindex_swap_header(&hdr);
+    if ((f = fopen(filename, "w")) == NULL) {
+        corsaro_log(logger, "unable to create source index file %s: %s",
+                filename, strerror(errno));
+        free(data);
+        return -1;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+            (datalen > 0 && fwrite(data, datalen, 1, f) != 1)) {
+        corsaro_log(logger, "error while writing source index file %s: %s",
+                filename, strerror(errno));
+        fclose(f);
+        free(data);
+        return -1;
+    }
+
+    fclose(f);
+    free(data);
+    return 0;
+}
+
+corsaro_wdcap_srcindex_t *corsaro_wdcap_srcindex_load(
+        corsaro_logger_t *logger, char *filename) {
+
+    corsaro_wdcap_srcindex_t *idx;
+    size_t datalen;
+    uint64_t i;
+    FILE *f;
+
+    if ((f = fopen(filename, "r")) == NULL) {
+        corsaro_log(logger, "unable to open source index file %s: %s",
+                filename, strerror(errno));
+        return NULL;
+    }
+
+    idx = calloc(1, sizeof(corsaro_wdcap_srcindex_t));
+    if (idx == NULL) {
+        corsaro_log(logger, "out of memory while loading source index %s",
+                filename);
+        fclose(f);
+        return NULL;
+    }
+    if (fread(&(idx->header), sizeof(idx->header), 1, f) != 1) {
+        corsaro_log(logger, "source index file %s is truncated", filename);
+        goto loadfail;
+    }
+    srcindex_swap_header(&(idx->header));
+
+    if (memcmp(idx->header.magic, CORSARO_WDCAP_SRCINDEX_MAGIC,
+                sizeof(idx->header.magic)) != 0) {
+        corsaro_log(logger, "%s is not a source index file", filename);
+        goto loadfail;
+    }
+
+    if (idx->header.version != CORSARO_WDCAP_SRCINDEX_VERSION) {
+        corsaro_log(logger,
+                "source index file %s has unsupported version %u", filename,
+                idx->header.version);
+        goto loadfail;
+    }
+
+    if (idx->header.byteorder != CORSARO_WDCAP_SRCINDEX_BYTEORDER) {
+        corsaro_log(logger,
+                "source index file %s has an invalid byte order marker",
+                filename);
+        goto loadfail;
+    }
+
+    if (idx->header.type == CORSARO_WDCAP_SRCINDEX_LIST &&
+            idx->header.addrcount <= ((uint64_t)1 << 32)) {
+        datalen = idx->header.addrcount * sizeof(uint32_t);
+    } else if (idx->header.type == CORSARO_WDCAP_SRCINDEX_BLOOM &&
+            idx->header.bloombits >= 8 &&
+            (idx->header.bloombits & (idx->header.bloombits - 1)) == 0) {
+        datalen = idx->header.bloombits / 8;
+    } else {
+        corsaro_log(logger, "source index file %s has an invalid header",
+                filename);
+        goto loadfail;
+    }
+
+    idx->data = malloc(datalen ? datalen : 1);
+    if (idx->data == NULL) {
+        corsaro_log(logger, "out of memory while loading source index %s",
+                filename);
+        goto loadfail;
+    }
+    if (datalen > 0 && fread(idx->data, datalen, 1, f) != 1) {
+        corsaro_log(logger, "source index file %s is truncated", filename);
+        goto loadfail;
+    }
+
+    if (idx->header.type == CORSARO_WDCAP_SRCINDEX_LIST) {
+        uint32_t *addrs = (uint32_t *)idx->data;
+
+        for (i = 0; i < idx->header.addrcount; i++) {
+            addrs[i] = bswap_le_to_host32(addrs[i]);
+        }
+    }
+
+    fclose(f);
+    return idx;
+
+loadfail:
+    fclose(f);
+    corsaro_wdcap_srcindex_free(idx);
+    return NULL;
+}
+
+int corsaro_wdcap_srcindex_lookup(corsaro_wdcap_srcindex_t *idx,
+        uint32_t addr) {
+
+    if (idx->header.type == CORSARO_WDCAP_SRCINDEX_BLOOM) {
+        uint64_t h = srcindex_hash(addr);
+        uint64_t bit;
+        int i;
+
+        for (i = 0; i < idx->header.hashes; i++) {
+            bit = srcindex_bloom_bit(h, i, idx->header.bloombits);
+            if ((idx->data[bit >> 3] & (1 << (bit & 0x07))) == 0) {
+                return CORSARO_WDCAP_SRCINDEX_ABSENT;
+            }
+        }
+        return CORSARO_WDCAP_SRCINDEX_MAYBE;
+    } else {
+        uint32_t *addrs = (uint32_t *)idx->data;
+        uint64_t lo = 0, hi = idx->header.addrcount;
+
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (addrs[mid] == addr) {
+                return CORSARO_WDCAP_SRCINDEX_PRESENT;
+            }
+            if (addrs[mid] < addr) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+    }
+    return CORSARO_WDCAP_SRCINDEX_ABSENT;
+}
+
+void corsaro_wdcap_srcindex_free(corsaro_wdcap_srcindex_t *idx) {
+    if (idx == NULL) {
+        return;
+    }
+    if (idx->data) {
+        free(idx->data);
+    }
+    free(idx);
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
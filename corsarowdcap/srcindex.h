@@ -0,0 +1,198 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#ifndef CORSARO_WDCAP_SRCINDEX_H_
+#define CORSARO_WDCAP_SRCINDEX_H_
+
+#include <inttypes.h>
+#include <Judy.h>
+
+#include "libcorsaro.h"
+#include "libcorsaro_log.h"
+
+/* Source address index sidecar files for corsarowdcap output.
+ *
+ * If enabled, each merged trace file is accompanied by a sidecar file
+ * (same name plus a ".srcidx" suffix) that records which IPv4 source
+ * addresses appear in the trace. This lets us find the files that contain
+ * traffic from a given source without having to decompress and scan every
+ * trace file.
+ *
+ * Intervals with relatively few sources are written as a sorted list of
+ * addresses, which gives exact answers. Once the number of sources passes
+ * a configurable threshold, a bloom filter is written instead. Bloom
+ * filter lookups may return false positives (roughly 1% of the time) but
+ * never false negatives.
+ *
+ * All of the header fields and the addresses in a list are stored in
+ * little-endian byte order, regardless of the host that wrote the file.
+ * The header includes a byte order marker so that readers can check this.
+ * In memory, a loaded index is always in host byte order.
+ */
+
+/** Magic string at the start of every source index file */
+#define CORSARO_WDCAP_SRCINDEX_MAGIC "CWSRCIDX"
+
+/** Current version of the source index file format. Version 1 files were
+ *  written in host byte order and cannot be read. */
+#define CORSARO_WDCAP_SRCINDEX_VERSION (2)
+
+/** Byte order marker, which must read back as this value once the header
+ *  has been converted from little-endian */
+#define CORSARO_WDCAP_SRCINDEX_BYTEORDER (0x01020304)
+
+/** Number of bloom filter bits to allocate for each source address */
+#define CORSARO_WDCAP_SRCINDEX_BLOOM_BITS_PER_ADDR (10)
+
+/** Number of hash functions to use for the bloom filter */
+#define CORSARO_WDCAP_SRCINDEX_BLOOM_HASHES (7)
+
+/** Ways in which the addresses in a source index may be stored */
+enum {
+    /** Sorted array of uint32_t addresses */
+    CORSARO_WDCAP_SRCINDEX_LIST = 0,
+    /** Bloom filter bitmap */
+    CORSARO_WDCAP_SRCINDEX_BLOOM = 1,
+};
+
+/** Results of looking up an address in a source index */
+enum {
+    /** The address is definitely not present */
+    CORSARO_WDCAP_SRCINDEX_ABSENT = 0,
+    /** The address is definitely present */
+    CORSARO_WDCAP_SRCINDEX_PRESENT = 1,
+    /** The address is probably present (bloom filter match) */
+    CORSARO_WDCAP_SRCINDEX_MAYBE = 2,
+};
+
+/** Header at the start of a source index file */
+typedef struct corsaro_wdcap_srcindex_header {
+    /** Always CORSARO_WDCAP_SRCINDEX_MAGIC (without the nul terminator) */
+    char magic[8];
+    /** The version of the index file format */
+    uint32_t version;
+    /** Always CORSARO_WDCAP_SRCINDEX_BYTEORDER */
+    uint32_t byteorder;
+    /** The timestamp of the interval that the index describes */
+    uint32_t timestamp;
+    /** How the addresses are stored, see CORSARO_WDCAP_SRCINDEX_LIST and
+     *  CORSARO_WDCAP_SRCINDEX_BLOOM */
+    uint8_t type;
+    /** The number of bloom filter hash functions (0 for lists) */
+    uint8_t hashes;
+    uint16_t reserved;
+    /** The number of unique source addresses in the interval */
+    uint64_t addrcount;
+    /** The size of the bloom filter in bits (0 for lists). Always a power
+     *  of two. */
+    uint64_t bloombits;
+} PACKED corsaro_wdcap_srcindex_header_t;
+
+/** A source index that has been loaded from disk */
+typedef struct corsaro_wdcap_srcindex {
+    /** The header from the index file */
+    corsaro_wdcap_srcindex_header_t header;
+    /** The sorted address list (host byte order) or the bloom filter
+     *  bitmap */
+    uint8_t *data;
+} corsaro_wdcap_srcindex_t;
+
+/** Merges one set of source addresses into another, freeing the merged set.
+ *
+ *  @param dest         The set to merge the addresses into.
+ *  @param src          The set to merge addresses from. Will be freed and
+ *                      set to NULL.
+ */
+void corsaro_wdcap_srcindex_union(Pvoid_t *dest, Pvoid_t *src);
+
+/** Writes a set of source addresses to a source index file.
+ *
+ *  @param logger       A corsaro logger instance to use for logging errors.
+ *  @param filename     The name of the index file to write.
+ *  @param timestamp    The timestamp of the interval that the set covers.
+ *  @param sources      A Judy1 set of source addresses (host byte order).
+ *  @param bloomthresh  If the set contains more addresses than this, write
+ *                      a bloom filter instead of a list of addresses.
+ *
+ *  @return 0 if the file is written successfully, -1 otherwise.
+ */
+int corsaro_wdcap_srcindex_write(corsaro_logger_t *logger, char *filename,
+        uint32_t timestamp, Pvoid_t sources, uint64_t bloomthresh);
+
+/** Loads a source index file from disk.
+ *
+ *  @param logger       A corsaro logger instance to use for logging errors.
+ *  @param filename     The name of the index file to read.
+ *
+ *  @return the loaded index, or NULL if the file could not be read. Must be
+ *          freed using corsaro_wdcap_srcindex_free().
+ */
+corsaro_wdcap_srcindex_t *corsaro_wdcap_srcindex_load(
+        corsaro_logger_t *logger, char *filename);
+
+/** Checks whether an address is present in a source index.
+ *
+ *  @param idx          The source index to search.
+ *  @param addr         The address to look for (host byte order).
+ *
+ *  @return one of CORSARO_WDCAP_SRCINDEX_ABSENT,
+ *          CORSARO_WDCAP_SRCINDEX_PRESENT or CORSARO_WDCAP_SRCINDEX_MAYBE.
+ */
+int corsaro_wdcap_srcindex_lookup(corsaro_wdcap_srcindex_t *idx,
+        uint32_t addr);
+
+/** Frees a source index that was loaded using corsaro_wdcap_srcindex_load().
+ *
+ *  @param idx          The source index to free.
+ */
+void corsaro_wdcap_srcindex_free(corsaro_wdcap_srcindex_t *idx);
+
+#endif
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -51,6 +51,8 @@
 #include <stdio.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "libcorsaro_avro.h"
 #include "libcorsaro.h"
@@ -241,6 +243,35 @@ int corsaro_close_avro_writer(corsaro_avro_writer_t *writer) {
     return 0;
 }
 
+/** Forces any records buffered by an Avro writer to be written to disk as
+ *  a complete Avro block.
+ *
+ *  @param writer       The Avro writer to flush
+ *  @return the size of the output file after the flush (i.e. the offset
+ *          where the next block will begin), or -1 if an error occurs.
+ */
+int64_t corsaro_flush_avro_writer(corsaro_avro_writer_t *writer) {
+
+    struct stat st;
+
+    if (writer->out == NULL) {
+        return -1;
+    }
+
+    if (avro_file_writer_flush(writer->out)) {
+        corsaro_log(writer->logger, "unable to flush Avro output file %s: %s",
+                writer->fname, avro_strerror());
+        return -1;
+    }
+
+    if (stat(writer->fname, &st) < 0) {
+        corsaro_log(writer->logger, "unable to stat Avro output file %s: %s",
+                writer->fname, strerror(errno));
+        return -1;
+    }
+    return (int64_t)st.st_size;
+}
+
 int corsaro_is_avro_writer_active(corsaro_avro_writer_t *writer) {
     if (writer->out != NULL) {
         return 1;
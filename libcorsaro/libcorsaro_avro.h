@@ -124,6 +124,7 @@ int corsaro_start_avro_writer(corsaro_avro_writer_t *writer, char *fname,
 int corsaro_append_avro_writer(corsaro_avro_writer_t *writer,
         avro_value_t *value);
 int corsaro_close_avro_writer(corsaro_avro_writer_t *writer);
+int64_t corsaro_flush_avro_writer(corsaro_avro_writer_t *writer);
 int corsaro_is_avro_writer_active(corsaro_avro_writer_t *writer);
 
 int corsaro_start_avro_encoding(corsaro_avro_writer_t *writer);
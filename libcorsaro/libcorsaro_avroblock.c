@@ -0,0 +1,989 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2021 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <avro.h>
+#include <zlib.h>
+#include <libipmeta.h>
+#ifdef HAVE_SNAPPY
+#include <snappy-c.h>
+#endif
+
+#include "libcorsaro_avroblock.h"
+#include "libcorsaro_flowtuple.h"
+#include "libcorsaro_log.h"
+#include "report/corsaro_report.h"
+
+enum {
+    AVROBLOCK_CODEC_NULL,
+    AVROBLOCK_CODEC_DEFLATE,
+    AVROBLOCK_CODEC_SNAPPY,
+};
+
+enum {
+    AVROBLOCK_SLOT_FREE,
+    AVROBLOCK_SLOT_DECODING,
+    AVROBLOCK_SLOT_READY,
+    AVROBLOCK_SLOT_FAILED,
+};
+
+/** Number of slots in the decoding window for each decoding thread */
+#define AVROBLOCK_SLOTS_PER_THREAD 4
+
+/** The smallest possible encoding of a single record for each schema (one
+ *  byte per field), used to reject corrupt record counts before we try to
+ *  allocate space for them.
+ */
+#define AVROBLOCK_MIN_FT_RECORD 19
+#define AVROBLOCK_MIN_REPORT_RECORD 9
+
+/** Reads a zig-zag encoded avro long (or int) from a buffer.
+ *
+ *  @return 0 if successful, -1 if the buffer ended before the value did.
+ */
+static inline int read_avro_long(const uint8_t **p, const uint8_t *end,
+        int64_t *val) {
+
+    uint64_t n = 0;
+    int shift = 0;
+    uint8_t b;
+
+    do {
+        if (*p >= end || shift > 63) {
+            return -1;
+        }
+        b = **p;
+        (*p) ++;
+        n |= ((uint64_t)(b & 0x7f)) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    *val = (int64_t)((n >> 1) ^ (~(n & 1) + 1));
+    return 0;
+}
+
+/** Reads an avro string (or bytes) from a buffer, without copying it.
+ *
+ *  @return 0 if successful, -1 if the buffer ended before the value did.
+ */
+static inline int read_avro_string(const uint8_t **p, const uint8_t *end,
+        const char **str, uint32_t *len) {
+
+    int64_t l;
+
+    if (read_avro_long(p, end, &l) < 0 || l < 0 || l > end - *p) {
+        return -1;
+    }
+    *str = (const char *)(*p);
+    *len = (uint32_t)l;
+    (*p) += l;
+    return 0;
+}
+
+/** Converts a two character string into the uint16_t representation used
+ *  by struct corsaro_flowtuple_data, matching decode_flowtuple_from_avro().
+ */
+static inline uint16_t ft_string_code(const char *str, uint32_t len) {
+    uint16_t code = 0;
+
+    if (len > 0) {
+        code = (uint16_t)(str[0]);
+    }
+    if (len > 1) {
+        code += ((uint16_t)str[1]) << 8;
+    }
+    return code;
+}
+
+/** Makes sure that the column arrays in a batch can hold 'records'
+ *  records.
+ *
+ *  @return 0 if successful, -1 if we ran out of memory.
+ */
+static int grow_batch_columns(corsaro_avroblock_reader_t *reader,
+        corsaro_avroblock_batch_t *batch, uint32_t records) {
+
+    uint32_t cap = batch->capacity;
+
+    if (records <= cap) {
+        return 0;
+    }
+    if (cap == 0) {
+        cap = 512;
+    }
+    while (cap < records) {
+        cap *= 2;
+    }
+
+#define GROW_COLUMN(col) \
+    do { \
+        void *tmp = realloc((col), cap * sizeof(*(col))); \
+        if (tmp == NULL) { \
+            return -1; \
+        } \
+        (col) = tmp; \
+    } while (0)
+
+    if (reader->schematype != CORSARO_AVROBLOCK_REPORT) {
+        corsaro_avroblock_ft_columns_t *c = &(batch->cols.ft);
+        GROW_COLUMN(c->interval_ts);
+        if (reader->schematype == CORSARO_AVROBLOCK_FLOWTUPLE6) {
+            GROW_COLUMN(c->src_ip6);
+            GROW_COLUMN(c->dst_ip6);
+        } else {
+            GROW_COLUMN(c->src_ip);
+            GROW_COLUMN(c->dst_ip);
+        }
+        GROW_COLUMN(c->src_port);
+        GROW_COLUMN(c->dst_port);
+        GROW_COLUMN(c->protocol);
+        GROW_COLUMN(c->ttl);
+        GROW_COLUMN(c->tcp_flags);
+        GROW_COLUMN(c->ip_len);
+        GROW_COLUMN(c->tcp_synlen);
+        GROW_COLUMN(c->tcp_synwinlen);
+        GROW_COLUMN(c->packet_cnt);
+        GROW_COLUMN(c->is_spoofed);
+        GROW_COLUMN(c->is_masscan);
+        GROW_COLUMN(c->maxmind_continent);
+        GROW_COLUMN(c->maxmind_country);
+        GROW_COLUMN(c->netacq_continent);
+        GROW_COLUMN(c->netacq_country);
+        GROW_COLUMN(c->prefixasn);
+    } else {
+        corsaro_avroblock_report_columns_t *c = &(batch->cols.report);
+        GROW_COLUMN(c->bin_timestamp);
+        GROW_COLUMN(c->source_label);
+        GROW_COLUMN(c->source_label_len);
+        GROW_COLUMN(c->metric_name);
+        GROW_COLUMN(c->metric_name_len);
+        GROW_COLUMN(c->metric_value);
+        GROW_COLUMN(c->metric_value_len);
+        GROW_COLUMN(c->src_ip_cnt);
+        GROW_COLUMN(c->dest_ip_cnt);
+        GROW_COLUMN(c->pkt_cnt);
+        GROW_COLUMN(c->byte_cnt);
+        GROW_COLUMN(c->src_asn_cnt);
+        GROW_COLUMN(c->ip_cnt_method);
+        GROW_COLUMN(c->ip_cnt_method_len);
+    }
+#undef GROW_COLUMN
+
+    batch->capacity = cap;
+    return 0;
+}
+
+static void free_batch_columns(corsaro_avroblock_reader_t *reader,
+        corsaro_avroblock_batch_t *batch) {
+
+    if (reader->schematype != CORSARO_AVROBLOCK_REPORT) {
+        corsaro_avroblock_ft_columns_t *c = &(batch->cols.ft);
+        free(c->interval_ts);
+        free(c->src_ip);
+        free(c->dst_ip);
+        free(c->src_ip6);
+        free(c->dst_ip6);
+        free(c->src_port);
+        free(c->dst_port);
+        free(c->protocol);
+        free(c->ttl);
+        free(c->tcp_flags);
+        free(c->ip_len);
+        free(c->tcp_synlen);
+        free(c->tcp_synwinlen);
+        free(c->packet_cnt);
+        free(c->is_spoofed);
+        free(c->is_masscan);
+        free(c->maxmind_continent);
+        free(c->maxmind_country);
+        free(c->netacq_continent);
+        free(c->netacq_country);
+        free(c->prefixasn);
+    } else {
+        corsaro_avroblock_report_columns_t *c = &(batch->cols.report);
+        free(c->bin_timestamp);
+        free(c->source_label);
+        free(c->source_label_len);
+        free(c->metric_name);
+        free(c->metric_name_len);
+        free(c->metric_value);
+        free(c->metric_value_len);
+        free(c->src_ip_cnt);
+        free(c->dest_ip_cnt);
+        free(c->pkt_cnt);
+        free(c->byte_cnt);
+        free(c->src_asn_cnt);
+        free(c->ip_cnt_method);
+        free(c->ip_cnt_method_len);
+    }
+    free(batch->inflated);
+}
+
+/** Decodes a block of flowtuple records into the columns of a batch.
+ *  If 'ipv6' is set, the records are expected to use the
+ *  FLOWTUPLE6_RESULT_SCHEMA instead.
+ */
+static int decode_flowtuple_block(corsaro_avroblock_batch_t *batch,
+        const uint8_t *p, const uint8_t *end, uint32_t records,
+        uint8_t ipv6) {
+
+    corsaro_avroblock_ft_columns_t *c = &(batch->cols.ft);
+    int64_t v[19];
+    const char *str[4];
+    uint32_t len[4];
+    uint32_t i;
+    int j;
+
+    for (i = 0; i < records; i++) {
+        for (j = 0; j < 14; j++) {
+            if (ipv6 && (j == 1 || j == 2)) {
+                /* The addresses are 16 byte "bytes" fields */
+                if (read_avro_string(&p, end, &(str[0]), &(len[0])) < 0 ||
+                        len[0] != 16) {
+                    return -1;
+                }
+                memcpy(j == 1 ? c->src_ip6[i] : c->dst_ip6[i], str[0], 16);
+                continue;
+            }
+            if (read_avro_long(&p, end, &(v[j])) < 0) {
+                return -1;
+            }
+        }
+        for (j = 0; j < 4; j++) {
+            if (read_avro_string(&p, end, &(str[j]), &(len[j])) < 0) {
+                return -1;
+            }
+        }
+        if (read_avro_long(&p, end, &(v[18])) < 0) {
+            return -1;
+        }
+
+        c->interval_ts[i] = (uint32_t)v[0];
+        if (!ipv6) {
+            c->src_ip[i] = (uint32_t)v[1];
+            c->dst_ip[i] = (uint32_t)v[2];
+        }
+        c->src_port[i] = (uint16_t)v[3];
+        c->dst_port[i] = (uint16_t)v[4];
+        c->protocol[i] = (uint8_t)v[5];
+        c->ttl[i] = (uint8_t)v[6];
+        c->tcp_flags[i] = (uint8_t)v[7];
+        c->ip_len[i] = (uint16_t)v[8];
+        c->tcp_synlen[i] = (uint16_t)v[9];
+        c->tcp_synwinlen[i] = (uint16_t)v[10];
+        c->packet_cnt[i] = (uint32_t)v[11];
+        c->is_spoofed[i] = (uint8_t)v[12];
+        c->is_masscan[i] = (uint8_t)v[13];
+        c->maxmind_continent[i] = ft_string_code(str[0], len[0]);
+        c->maxmind_country[i] = ft_string_code(str[1], len[1]);
+        c->netacq_continent[i] = ft_string_code(str[2], len[2]);
+        c->netacq_country[i] = ft_string_code(str[3], len[3]);
+        c->prefixasn[i] = (uint32_t)v[18];
+    }
+
+    return (p == end) ? 0 : -1;
+}
+
+/** Decodes a block of report records into the columns of a batch */
+static int decode_report_block(corsaro_avroblock_batch_t *batch,
+        const uint8_t *p, const uint8_t *end, uint32_t records) {
+
+    corsaro_avroblock_report_columns_t *c = &(batch->cols.report);
+    uint32_t i;
+
+    for (i = 0; i < records; i++) {
+        if (read_avro_long(&p, end, &(c->bin_timestamp[i])) < 0 ||
+                read_avro_string(&p, end, &(c->source_label[i]),
+                        &(c->source_label_len[i])) < 0 ||
+                read_avro_string(&p, end, &(c->metric_name[i]),
+                        &(c->metric_name_len[i])) < 0 ||
+                read_avro_string(&p, end, &(c->metric_value[i]),
+                        &(c->metric_value_len[i])) < 0 ||
+                read_avro_long(&p, end, &(c->src_ip_cnt[i])) < 0 ||
+                read_avro_long(&p, end, &(c->dest_ip_cnt[i])) < 0 ||
+                read_avro_long(&p, end, &(c->pkt_cnt[i])) < 0 ||
+                read_avro_long(&p, end, &(c->byte_cnt[i])) < 0 ||
+                read_avro_long(&p, end, &(c->src_asn_cnt[i])) < 0 ||
+                read_avro_string(&p, end, &(c->ip_cnt_method[i]),
+                        &(c->ip_cnt_method_len[i])) < 0) {
+            return -1;
+        }
+    }
+
+    return (p == end) ? 0 : -1;
+}
+
+/** Makes sure that the inflated buffer for a batch is at least 'size'
+ *  bytes long.
+ */
+static int grow_inflated(corsaro_avroblock_batch_t *batch, uint64_t size) {
+    uint8_t *tmp;
+
+    if (size <= batch->inflatedsize) {
+        return 0;
+    }
+    tmp = realloc(batch->inflated, size);
+    if (tmp == NULL) {
+        return -1;
+    }
+    batch->inflated = tmp;
+    batch->inflatedsize = size;
+    return 0;
+}
+
+/** Decompresses the block assigned to a slot into the slot's inflated
+ *  buffer.
+ *
+ *  @return the length of the decompressed block, or -1 if the block could
+ *          not be decompressed.
+ */
+static int64_t inflate_block(corsaro_avroblock_reader_t *reader,
+        corsaro_avroblock_slot_t *slot, z_stream *zs) {
+
+    corsaro_avroblock_batch_t *batch = &(slot->batch);
+    uint64_t used = 0;
+    int ret;
+
+    if (reader->codec == AVROBLOCK_CODEC_SNAPPY) {
+#ifdef HAVE_SNAPPY
+        size_t outlen;
+        const uint8_t *crcp;
+        uint32_t crc;
+
+        if (slot->datalen < 4) {
+            return -1;
+        }
+        if (snappy_uncompressed_length((const char *)slot->data,
+                    slot->datalen - 4, &outlen) != SNAPPY_OK) {
+            return -1;
+        }
+        if (grow_inflated(batch, outlen) < 0) {
+            return -1;
+        }
+        if (snappy_uncompress((const char *)slot->data, slot->datalen - 4,
+                    (char *)batch->inflated, &outlen) != SNAPPY_OK) {
+            return -1;
+        }
+
+        /* Snappy blocks are followed by a big-endian CRC32 of the
+         * uncompressed data */
+        crcp = slot->data + slot->datalen - 4;
+        crc = ((uint32_t)crcp[0] << 24) | ((uint32_t)crcp[1] << 16) |
+                ((uint32_t)crcp[2] << 8) | crcp[3];
+        if (crc32(0, batch->inflated, outlen) != crc) {
+            return -1;
+        }
+        return (int64_t)outlen;
+#else
+        return -1;
+#endif
+    }
+
+    /* Deflate: blocks are raw deflate streams, so we can only guess at
+     * how big the output will be and grow the buffer as required. */
+    if (batch->inflatedsize < slot->datalen * 4) {
+        if (grow_inflated(batch, slot->datalen * 4 < 65536 ? 65536 :
+                    slot->datalen * 4) < 0) {
+            return -1;
+        }
+    }
+
+    if (inflateReset(zs) != Z_OK) {
+        return -1;
+    }
+    zs->next_in = (Bytef *)slot->data;
+    zs->avail_in = slot->datalen;
+
+    while (1) {
+        if (used == batch->inflatedsize &&
+                grow_inflated(batch, batch->inflatedsize * 2) < 0) {
+            return -1;
+        }
+        zs->next_out = batch->inflated + used;
+        zs->avail_out = batch->inflatedsize - used;
+        ret = inflate(zs, Z_NO_FLUSH);
+        used = batch->inflatedsize - zs->avail_out;
+
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+        if (ret == Z_BUF_ERROR && zs->avail_out == 0) {
+            continue;
+        }
+        if (ret != Z_OK) {
+            return -1;
+        }
+        if (zs->avail_in == 0 && zs->avail_out != 0) {
+            /* Input ran out before the end of the stream */
+            return -1;
+        }
+    }
+    return (int64_t)used;
+}
+
+/** Decompresses and decodes the block assigned to a slot.
+ *
+ *  @return 0 if successful, -1 if the block could not be decoded.
+ */
+static int decode_slot(corsaro_avroblock_reader_t *reader,
+        corsaro_avroblock_slot_t *slot, z_stream *zs) {
+
+    corsaro_avroblock_batch_t *batch = &(slot->batch);
+    const uint8_t *start;
+    int64_t len;
+    uint64_t minrec;
+
+    if (reader->codec == AVROBLOCK_CODEC_NULL) {
+        start = slot->data;
+        len = slot->datalen;
+    } else {
+        len = inflate_block(reader, slot, zs);
+        if (len < 0) {
+            corsaro_log(reader->logger,
+                    "unable to decompress avro block at offset %lu in %s",
+                    batch->offset, reader->filename);
+            return -1;
+        }
+        start = batch->inflated;
+    }
+
+    minrec = (reader->schematype == CORSARO_AVROBLOCK_REPORT) ?
+            AVROBLOCK_MIN_REPORT_RECORD : AVROBLOCK_MIN_FT_RECORD;
+    if (slot->records > (uint64_t)len / minrec ||
+            grow_batch_columns(reader, batch, slot->records) < 0) {
+        corsaro_log(reader->logger,
+                "bad record count %lu in avro block at offset %lu in %s",
+                slot->records, batch->offset, reader->filename);
+        return -1;
+    }
+
+    if (reader->schematype != CORSARO_AVROBLOCK_REPORT) {
+        if (decode_flowtuple_block(batch, start, start + len,
+                    slot->records,
+                    reader->schematype == CORSARO_AVROBLOCK_FLOWTUPLE6) < 0) {
+            goto decodefail;
+        }
+    } else if (decode_report_block(batch, start, start + len,
+                slot->records) < 0) {
+        goto decodefail;
+    }
+
+    batch->count = slot->records;
+    return 0;
+
+decodefail:
+    corsaro_log(reader->logger,
+            "unable to decode avro block at offset %lu in %s",
+            batch->offset, reader->filename);
+    return -1;
+}
+
+/** Claims the next block in the file for a decoding thread, assigning it
+ *  to the next free slot in the window. Must be called with the reader
+ *  mutex held.
+ *
+ *  @return the slot that the block was assigned to, or NULL if there are
+ *          no more blocks to decode.
+ */
+static corsaro_avroblock_slot_t *claim_next_block(
+        corsaro_avroblock_reader_t *reader) {
+
+    corsaro_avroblock_slot_t *slot;
+    const uint8_t *p, *end;
+    int64_t records, len;
+
+    while (!reader->halt && !reader->scandone && !reader->scanerror) {
+        if (reader->nextseqno >= reader->deliverseqno + reader->slotcount) {
+            /* Window is full, wait for the caller to catch up */
+            pthread_cond_wait(&(reader->freed), &(reader->mutex));
+            continue;
+        }
+
+        if (reader->scanpos == reader->mapsize) {
+            reader->scandone = 1;
+            break;
+        }
+
+        p = reader->map + reader->scanpos;
+        end = reader->map + reader->mapsize;
+        if (read_avro_long(&p, end, &records) < 0 ||
+                read_avro_long(&p, end, &len) < 0 ||
+                records < 0 || len < 0 || len > end - p ||
+                end - p - len < 16 ||
+                memcmp(p + len, reader->sync, 16) != 0) {
+            corsaro_log(reader->logger,
+                    "corrupt avro block header at offset %lu in %s",
+                    reader->scanpos, reader->filename);
+            reader->scanerror = 1;
+            break;
+        }
+
+        slot = &(reader->slots[reader->nextseqno % reader->slotcount]);
+        slot->seqno = reader->nextseqno;
+        slot->data = p;
+        slot->datalen = len;
+        slot->records = records;
+        slot->state = AVROBLOCK_SLOT_DECODING;
+        slot->batch.offset = reader->scanpos;
+        slot->batch.count = 0;
+
+        reader->nextseqno ++;
+        reader->scanpos = (p + len + 16) - reader->map;
+        return slot;
+    }
+
+    /* Make sure the caller notices that we've run out of blocks */
+    pthread_cond_broadcast(&(reader->decoded));
+    return NULL;
+}
+
+/** Function that operates a decoding thread */
+static void *start_avroblock_decoder(void *arg) {
+
+    corsaro_avroblock_reader_t *reader = (corsaro_avroblock_reader_t *)arg;
+    corsaro_avroblock_slot_t *slot;
+    z_stream zs;
+    int ret;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK) {
+        pthread_mutex_lock(&(reader->mutex));
+        reader->scanerror = 1;
+        pthread_cond_broadcast(&(reader->decoded));
+        pthread_mutex_unlock(&(reader->mutex));
+        pthread_exit(NULL);
+    }
+
+    pthread_mutex_lock(&(reader->mutex));
+    while ((slot = claim_next_block(reader)) != NULL) {
+        pthread_mutex_unlock(&(reader->mutex));
+
+        ret = decode_slot(reader, slot, &zs);
+
+        pthread_mutex_lock(&(reader->mutex));
+        slot->state = (ret == 0) ? AVROBLOCK_SLOT_READY :
+                AVROBLOCK_SLOT_FAILED;
+        pthread_cond_broadcast(&(reader->decoded));
+    }
+    pthread_mutex_unlock(&(reader->mutex));
+
+    inflateEnd(&zs);
+    pthread_exit(NULL);
+}
+
+/** Parses the header of a mapped avro file, checking that it was written
+ *  using the schema that we expect and a codec that we support.
+ *
+ *  @return 0 if successful, -1 if the file cannot be read by the block
+ *          reader.
+ */
+static int parse_avroblock_header(corsaro_avroblock_reader_t *reader) {
+
+    const uint8_t *p = reader->map;
+    const uint8_t *end = reader->map + reader->mapsize;
+    const char *key, *val, *schemajson = NULL, *codec = NULL;
+    uint32_t keylen, vallen, schemalen = 0, codeclen = 0;
+    int64_t count, bytes;
+    avro_schema_t fileschema, expected;
+    const char *expectedjson;
+    int equal;
+
+    if (reader->mapsize < 4 || memcmp(p, "Obj\x01", 4) != 0) {
+        corsaro_log(reader->logger, "%s is not an avro file",
+                reader->filename);
+        return -1;
+    }
+    p += 4;
+
+    /* File metadata is an avro map of strings to bytes */
+    while (1) {
+        if (read_avro_long(&p, end, &count) < 0) {
+            goto badheader;
+        }
+        if (count == 0) {
+            break;
+        }
+        if (count < 0) {
+            count = -count;
+            if (read_avro_long(&p, end, &bytes) < 0) {
+                goto badheader;
+            }
+        }
+        while (count > 0) {
+            if (read_avro_string(&p, end, &key, &keylen) < 0 ||
+                    read_avro_string(&p, end, &val, &vallen) < 0) {
+                goto badheader;
+            }
+            if (keylen == 11 && memcmp(key, "avro.schema", 11) == 0) {
+                schemajson = val;
+                schemalen = vallen;
+            } else if (keylen == 10 && memcmp(key, "avro.codec", 10) == 0) {
+                codec = val;
+                codeclen = vallen;
+            }
+            count --;
+        }
+    }
+
+    if (end - p < 16 || schemajson == NULL) {
+        goto badheader;
+    }
+    memcpy(reader->sync, p, 16);
+    p += 16;
+    reader->scanpos = p - reader->map;
+
+    if (codec == NULL || (codeclen == 4 && memcmp(codec, "null", 4) == 0)) {
+        reader->codec = AVROBLOCK_CODEC_NULL;
+    } else if (codeclen == 7 && memcmp(codec, "deflate", 7) == 0) {
+        reader->codec = AVROBLOCK_CODEC_DEFLATE;
+#ifdef HAVE_SNAPPY
+    } else if (codeclen == 6 && memcmp(codec, "snappy", 6) == 0) {
+        reader->codec = AVROBLOCK_CODEC_SNAPPY;
+#endif
+    } else {
+        corsaro_log(reader->logger,
+                "unsupported avro codec '%.*s' in %s", (int)codeclen, codec,
+                reader->filename);
+        return -1;
+    }
+
+    /* Our decoders are only valid for the exact schema they were written
+     * for, so make sure that is what we've got. */
+    if (reader->schematype == CORSARO_AVROBLOCK_FLOWTUPLE) {
+        expectedjson = FLOWTUPLE_RESULT_SCHEMA;
+    } else if (reader->schematype == CORSARO_AVROBLOCK_FLOWTUPLE6) {
+        expectedjson = FLOWTUPLE6_RESULT_SCHEMA;
+    } else {
+        expectedjson = REPORT_RESULT_SCHEMA;
+    }
+
+    if (avro_schema_from_json_length(schemajson, schemalen,
+                &fileschema) != 0) {
+        corsaro_log(reader->logger, "unable to parse avro schema in %s: %s",
+                reader->filename, avro_strerror());
+        return -1;
+    }
+    if (avro_schema_from_json_length(expectedjson, strlen(expectedjson),
+                &expected) != 0) {
+        corsaro_log(reader->logger, "unable to parse built-in schema: %s",
+                avro_strerror());
+        avro_schema_decref(fileschema);
+        return -1;
+    }
+    equal = avro_schema_equal(fileschema, expected);
+    avro_schema_decref(fileschema);
+    avro_schema_decref(expected);
+
+    if (!equal) {
+        corsaro_log(reader->logger,
+                "%s was not written using the expected schema",
+                reader->filename);
+        return -1;
+    }
+    return 0;
+
+badheader:
+    corsaro_log(reader->logger, "invalid avro file header in %s",
+            reader->filename);
+    return -1;
+}
+
+/** Creates a reader that decodes an avro file in parallel.
+ *
+ *  @param logger       The logger to write error messages to
+ *  @param filename     The avro file to read
+ *  @param schematype   The schema that the file is expected to use
+ *  @param threads      The number of decoding threads to use
+ *
+ *  @return a new block reader, or NULL if the file cannot be read by the
+ *          block reader (in which case the regular avro reader may still be
+ *          able to read it).
+ */
+corsaro_avroblock_reader_t *corsaro_create_avroblock_reader(
+        corsaro_logger_t *logger, char *filename,
+        corsaro_avroblock_schema_t schematype, int threads) {
+
+    corsaro_avroblock_reader_t *reader;
+    struct stat st;
+    int fd, i;
+
+    reader = calloc(1, sizeof(corsaro_avroblock_reader_t));
+    if (reader == NULL) {
+        corsaro_log(logger, "unable to allocate memory for avro block reader");
+        return NULL;
+    }
+    reader->filename = filename;
+    reader->schematype = schematype;
+    reader->logger = logger;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        corsaro_log(logger, "unable to open avro file %s: %s", filename,
+                strerror(errno));
+        free(reader);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        corsaro_log(logger, "unable to read avro file %s", filename);
+        close(fd);
+        free(reader);
+        return NULL;
+    }
+
+    reader->mapsize = st.st_size;
+    reader->map = mmap(NULL, reader->mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (reader->map == MAP_FAILED) {
+        corsaro_log(logger, "unable to map avro file %s: %s", filename,
+                strerror(errno));
+        free(reader);
+        return NULL;
+    }
+    madvise(reader->map, reader->mapsize, MADV_SEQUENTIAL);
+
+    if (parse_avroblock_header(reader) < 0) {
+        munmap(reader->map, reader->mapsize);
+        free(reader);
+        return NULL;
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    reader->slotcount = threads * AVROBLOCK_SLOTS_PER_THREAD;
+    reader->slots = calloc(reader->slotcount,
+            sizeof(corsaro_avroblock_slot_t));
+    reader->threads = calloc(threads, sizeof(pthread_t));
+
+    pthread_mutex_init(&(reader->mutex), NULL);
+    pthread_cond_init(&(reader->decoded), NULL);
+    pthread_cond_init(&(reader->freed), NULL);
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&(reader->threads[i]), NULL,
+                    start_avroblock_decoder, reader) != 0) {
+            corsaro_log(logger, "unable to start avro decoding thread: %s",
+                    strerror(errno));
+            break;
+        }
+        reader->threadcount ++;
+    }
+
+    if (reader->threadcount == 0) {
+        corsaro_destroy_avroblock_reader(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+/** Gets the next batch of decoded records from a block reader. The batch
+ *  remains valid until the next call to this function or until the
+ *  reader is destroyed.
+ *
+ *  @return 1 if a batch was returned, 0 if there are no more blocks in the
+ *          file, -1 if an error occurred.
+ */
+int corsaro_read_next_avroblock_batch(corsaro_avroblock_reader_t *reader,
+        corsaro_avroblock_batch_t **batch) {
+
+    corsaro_avroblock_slot_t *slot;
+
+    *batch = NULL;
+    pthread_mutex_lock(&(reader->mutex));
+
+    /* The caller has finished with the previous batch, so its slot can
+     * be reused. */
+    if (reader->delivered) {
+        reader->delivered->state = AVROBLOCK_SLOT_FREE;
+        reader->delivered = NULL;
+        reader->deliverseqno ++;
+        pthread_cond_broadcast(&(reader->freed));
+    }
+
+    slot = &(reader->slots[reader->deliverseqno % reader->slotcount]);
+    while (1) {
+        if (reader->deliverseqno < reader->nextseqno) {
+            if (slot->state == AVROBLOCK_SLOT_READY ||
+                    slot->state == AVROBLOCK_SLOT_FAILED) {
+                break;
+            }
+        } else if (reader->scanerror) {
+            pthread_mutex_unlock(&(reader->mutex));
+            return -1;
+        } else if (reader->scandone) {
+            pthread_mutex_unlock(&(reader->mutex));
+            return 0;
+        }
+        pthread_cond_wait(&(reader->decoded), &(reader->mutex));
+    }
+
+    if (slot->state == AVROBLOCK_SLOT_FAILED) {
+        pthread_mutex_unlock(&(reader->mutex));
+        return -1;
+    }
+
+    reader->delivered = slot;
+    *batch = &(slot->batch);
+    pthread_mutex_unlock(&(reader->mutex));
+    return 1;
+}
+
+void corsaro_destroy_avroblock_reader(corsaro_avroblock_reader_t *reader) {
+
+    uint32_t i;
+    int t;
+
+    if (reader == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(reader->mutex));
+    reader->halt = 1;
+    pthread_cond_broadcast(&(reader->freed));
+    pthread_mutex_unlock(&(reader->mutex));
+
+    for (t = 0; t < reader->threadcount; t++) {
+        pthread_join(reader->threads[t], NULL);
+    }
+
+    for (i = 0; i < reader->slotcount; i++) {
+        free_batch_columns(reader, &(reader->slots[i].batch));
+    }
+
+    pthread_mutex_destroy(&(reader->mutex));
+    pthread_cond_destroy(&(reader->decoded));
+    pthread_cond_destroy(&(reader->freed));
+
+    munmap(reader->map, reader->mapsize);
+    free(reader->slots);
+    free(reader->threads);
+    free(reader);
+}
+
+/** Copies a single record from a batch of decoded flowtuples into a
+ *  flowtuple structure, producing the same result as
+ *  decode_flowtuple_from_avro().
+ */
+void corsaro_avroblock_get_flowtuple(corsaro_avroblock_batch_t *batch,
+        uint32_t index, struct corsaro_flowtuple_data *ft) {
+
+    corsaro_avroblock_ft_columns_t *c = &(batch->cols.ft);
+
+    ft->interval_ts = c->interval_ts[index];
+    ft->src_ip = c->src_ip[index];
+    ft->dst_ip = c->dst_ip[index];
+    ft->src_port = c->src_port[index];
+    ft->dst_port = c->dst_port[index];
+    ft->protocol = c->protocol[index];
+    ft->ttl = c->ttl[index];
+    ft->tcp_flags = c->tcp_flags[index];
+    ft->ip_len = c->ip_len[index];
+    ft->tcp_synlen = c->tcp_synlen[index];
+    ft->tcp_synwinlen = c->tcp_synwinlen[index];
+    ft->packet_cnt = c->packet_cnt[index];
+    ft->is_spoofed = c->is_spoofed[index];
+    ft->is_masscan = c->is_masscan[index];
+    ft->maxmind_continent = c->maxmind_continent[index];
+    ft->maxmind_country = c->maxmind_country[index];
+    ft->netacq_continent = c->netacq_continent[index];
+    ft->netacq_country = c->netacq_country[index];
+    ft->prefixasn = c->prefixasn[index];
+
+    ft->tagproviders = (1 << IPMETA_PROVIDER_MAXMIND) |
+            (1 << IPMETA_PROVIDER_NETACQ_EDGE) |
+            (1 << IPMETA_PROVIDER_PFX2AS);
+    ft->hash_val = 0;
+}
+
+/** Copies a single record from a batch of decoded IPv6 flowtuples into an
+ *  IPv6 flowtuple structure, producing the same result as
+ *  decode_flowtuple6_from_avro().
+ */
+void corsaro_avroblock_get_flowtuple6(corsaro_avroblock_batch_t *batch,
+        uint32_t index, struct corsaro_flowtuple6_data *ft) {
+
+    corsaro_avroblock_ft_columns_t *c = &(batch->cols.ft);
+
+    ft->interval_ts = c->interval_ts[index];
+    memcpy(ft->src_ip, c->src_ip6[index], sizeof(ft->src_ip));
+    memcpy(ft->dst_ip, c->dst_ip6[index], sizeof(ft->dst_ip));
+    ft->src_port = c->src_port[index];
+    ft->dst_port = c->dst_port[index];
+    ft->protocol = c->protocol[index];
+    ft->ttl = c->ttl[index];
+    ft->tcp_flags = c->tcp_flags[index];
+    ft->ip_len = c->ip_len[index];
+    ft->tcp_synlen = c->tcp_synlen[index];
+    ft->tcp_synwinlen = c->tcp_synwinlen[index];
+    ft->packet_cnt = c->packet_cnt[index];
+    ft->is_spoofed = c->is_spoofed[index];
+    ft->is_masscan = c->is_masscan[index];
+    ft->maxmind_continent = c->maxmind_continent[index];
+    ft->maxmind_country = c->maxmind_country[index];
+    ft->netacq_continent = c->netacq_continent[index];
+    ft->netacq_country = c->netacq_country[index];
+    ft->prefixasn = c->prefixasn[index];
+
+    ft->tagproviders = (1 << IPMETA_PROVIDER_MAXMIND) |
+            (1 << IPMETA_PROVIDER_NETACQ_EDGE) |
+            (1 << IPMETA_PROVIDER_PFX2AS);
+    ft->hash_val = 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
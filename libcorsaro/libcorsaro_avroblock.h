@@ -0,0 +1,240 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2021 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#ifndef LIBCORSARO_AVROBLOCK_H_
+#define LIBCORSARO_AVROBLOCK_H_
+
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "libcorsaro.h"
+#include "libcorsaro_flowtuple.h"
+#include "libcorsaro_log.h"
+
+/* Parallel block decoder for corsaro avro files.
+ *
+ * An avro object container file is a header followed by a sequence of
+ * blocks, each of which holds a (compressed) run of encoded records and
+ * ends with the sync marker from the file header. The block reader maps
+ * the file into memory, walks the block headers and hands each block to a
+ * pool of decoding threads. The decoders are specialised for the schemas
+ * that corsaro itself writes and produce one batch of columns per block,
+ * skipping the generic avro value interface entirely.
+ *
+ * Batches are delivered to the caller in file order, regardless of the
+ * order in which the decoding threads finish them. Only a small window of
+ * blocks beyond the one the caller is reading will be decoded in advance,
+ * so memory usage does not depend on the size of the file.
+ *
+ * Files written with any schema other than the requested one, or with a
+ * codec that we cannot decompress, are rejected when the reader is created
+ * so that the caller can fall back to corsaro_create_avro_reader().
+ */
+
+/** The schemas that the block reader has specialised decoders for */
+typedef enum {
+    /** FLOWTUPLE_RESULT_SCHEMA, see libcorsaro_flowtuple.h */
+    CORSARO_AVROBLOCK_FLOWTUPLE,
+    /** REPORT_RESULT_SCHEMA, see plugins/report/corsaro_report.h */
+    CORSARO_AVROBLOCK_REPORT,
+    /** FLOWTUPLE6_RESULT_SCHEMA, see libcorsaro_flowtuple.h */
+    CORSARO_AVROBLOCK_FLOWTUPLE6,
+} corsaro_avroblock_schema_t;
+
+/** Decoded flowtuple records, one array entry per record. The values are
+ *  converted exactly as decode_flowtuple_from_avro() would convert them.
+ *  IPv6 flowtuples use the same columns, except that the addresses are
+ *  in 'src_ip6' and 'dst_ip6' rather than 'src_ip' and 'dst_ip'.
+ */
+typedef struct corsaro_avroblock_ft_columns {
+    uint32_t *interval_ts;
+    uint32_t *src_ip;
+    uint32_t *dst_ip;
+    uint8_t (*src_ip6)[16];
+    uint8_t (*dst_ip6)[16];
+    uint16_t *src_port;
+    uint16_t *dst_port;
+    uint8_t *protocol;
+    uint8_t *ttl;
+    uint8_t *tcp_flags;
+    uint16_t *ip_len;
+    uint16_t *tcp_synlen;
+    uint16_t *tcp_synwinlen;
+    uint32_t *packet_cnt;
+    uint8_t *is_spoofed;
+    uint8_t *is_masscan;
+    uint16_t *maxmind_continent;
+    uint16_t *maxmind_country;
+    uint16_t *netacq_continent;
+    uint16_t *netacq_country;
+    uint32_t *prefixasn;
+} corsaro_avroblock_ft_columns_t;
+
+/** Decoded report records, one array entry per record. Strings are not
+ *  nul-terminated and point into the block data, so they are only valid
+ *  for as long as the batch itself.
+ */
+typedef struct corsaro_avroblock_report_columns {
+    int64_t *bin_timestamp;
+    const char **source_label;
+    uint32_t *source_label_len;
+    const char **metric_name;
+    uint32_t *metric_name_len;
+    const char **metric_value;
+    uint32_t *metric_value_len;
+    int64_t *src_ip_cnt;
+    int64_t *dest_ip_cnt;
+    int64_t *pkt_cnt;
+    int64_t *byte_cnt;
+    int64_t *src_asn_cnt;
+    const char **ip_cnt_method;
+    uint32_t *ip_cnt_method_len;
+} corsaro_avroblock_report_columns_t;
+
+/** The decoded contents of a single avro block */
+typedef struct corsaro_avroblock_batch {
+    /** The number of records in the batch */
+    uint32_t count;
+    /** The offset of the block in the avro file */
+    uint64_t offset;
+
+    union {
+        corsaro_avroblock_ft_columns_t ft;
+        corsaro_avroblock_report_columns_t report;
+    } cols;
+
+    /** The number of records that the column arrays can hold */
+    uint32_t capacity;
+    /** Buffer holding the decompressed block */
+    uint8_t *inflated;
+    /** The size of the inflated buffer */
+    uint64_t inflatedsize;
+} corsaro_avroblock_batch_t;
+
+/** A slot in the window of blocks that are being decoded */
+typedef struct corsaro_avroblock_slot {
+    /** The sequence number of the block assigned to this slot */
+    uint64_t seqno;
+    /** Where the block's (compressed) data begins in the mapped file */
+    const uint8_t *data;
+    /** The length of the block's (compressed) data */
+    uint64_t datalen;
+    /** The number of records that the block header claims to hold */
+    uint64_t records;
+    /** 0 = free, 1 = being decoded, 2 = decoded, 3 = decoding failed */
+    uint8_t state;
+    /** The decoded block */
+    corsaro_avroblock_batch_t batch;
+} corsaro_avroblock_slot_t;
+
+/** State for reading an avro file using the parallel block decoder */
+typedef struct corsaro_avroblock_reader {
+    /** The name of the file being read */
+    char *filename;
+    /** The schema that the file contents are decoded as */
+    corsaro_avroblock_schema_t schematype;
+    /** A corsaro logger instance, used to write log messages */
+    corsaro_logger_t *logger;
+
+    /** The mapped file contents */
+    uint8_t *map;
+    /** The size of the mapped file */
+    uint64_t mapsize;
+    /** The sync marker that follows each block */
+    uint8_t sync[16];
+    /** The codec used to compress the blocks */
+    uint8_t codec;
+
+    /** Protects all of the following fields */
+    pthread_mutex_t mutex;
+    /** Signalled whenever a slot is decoded */
+    pthread_cond_t decoded;
+    /** Signalled whenever a slot is freed */
+    pthread_cond_t freed;
+
+    /** The offset of the next block that has not yet been claimed */
+    uint64_t scanpos;
+    /** The sequence number that will be given to the next block */
+    uint64_t nextseqno;
+    /** The sequence number of the next block to deliver to the caller */
+    uint64_t deliverseqno;
+    /** Set once the last block in the file has been claimed */
+    uint8_t scandone;
+    /** Set if the block headers could not be parsed */
+    uint8_t scanerror;
+    /** Set to tell the decoding threads to exit */
+    uint8_t halt;
+
+    /** The window of blocks that are being (or have been) decoded */
+    corsaro_avroblock_slot_t *slots;
+    /** The number of slots in the window */
+    uint32_t slotcount;
+    /** The slot that was last delivered to the caller, if any */
+    corsaro_avroblock_slot_t *delivered;
+
+    /** The decoding threads */
+    pthread_t *threads;
+    /** The number of decoding threads */
+    int threadcount;
+} corsaro_avroblock_reader_t;
+
+corsaro_avroblock_reader_t *corsaro_create_avroblock_reader(
+        corsaro_logger_t *logger, char *filename,
+        corsaro_avroblock_schema_t schematype, int threads);
+int corsaro_read_next_avroblock_batch(corsaro_avroblock_reader_t *reader,
+        corsaro_avroblock_batch_t **batch);
+void corsaro_destroy_avroblock_reader(corsaro_avroblock_reader_t *reader);
+
+void corsaro_avroblock_get_flowtuple(corsaro_avroblock_batch_t *batch,
+        uint32_t index, struct corsaro_flowtuple_data *ft);
+void corsaro_avroblock_get_flowtuple6(corsaro_avroblock_batch_t *batch,
+        uint32_t index, struct corsaro_flowtuple6_data *ft);
+
+#endif
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
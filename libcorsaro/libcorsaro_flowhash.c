@@ -0,0 +1,183 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <libtrace.h>
+
+#include "libcorsaro_flowhash.h"
+
+/** The symmetric Toeplitz key, repeated to cover every window we need */
+#define FLOWHASH_KEY (0x6d5a6d5a6d5a6d5aULL)
+
+/* Protocol numbers for the transport protocols that have ports */
+#define FLOWHASH_PROTO_TCP (6)
+#define FLOWHASH_PROTO_UDP (17)
+#define FLOWHASH_PROTO_SCTP (132)
+
+void corsaro_init_flowhash(corsaro_flowhash_t *fh) {
+
+    uint32_t windows[16];
+    int i, p, v, bit;
+
+    /* Input bit 'n' selects the 32 bits of the key that start at bit 'n'.
+     * The key repeats every 16 bits, so there are only 16 windows.
+     */
+    for (i = 0; i < 16; i++) {
+        windows[i] = (uint32_t)(FLOWHASH_KEY >> (32 - i));
+    }
+
+    for (p = 0; p < 2; p++) {
+        for (v = 0; v < 256; v++) {
+            uint32_t h = 0;
+            for (bit = 0; bit < 8; bit++) {
+                if (v & (0x80 >> bit)) {
+                    h ^= windows[(p * 8) + bit];
+                }
+            }
+            fh->table[p][v] = h;
+        }
+    }
+}
+
+/** Loads a 32 bit word of the flow tuple, which may not be aligned.
+ *
+ *  @param ptr      A pointer to the next four bytes of the tuple
+ *  @return the word, to be XORed into the other words of the tuple
+ */
+static inline uint32_t load_tuple_word(const uint8_t *ptr) {
+    uint32_t w;
+
+    memcpy(&w, ptr, sizeof(uint32_t));
+    return w;
+}
+
+/** Looks up the Toeplitz hash for a folded flow tuple.
+ *
+ *  @param fh       The flow hasher
+ *  @param folded   The XOR of every 32 bit word in the tuple, as loaded
+ *                  from memory
+ *  @return the hash of the tuple
+ */
+static inline uint32_t hash_folded_tuple(corsaro_flowhash_t *fh,
+        uint32_t folded) {
+
+    uint8_t bytes[4];
+    uint8_t even, odd;
+
+    /* Bytes 0 and 2 of each word are at even offsets within the tuple,
+     * 1 and 3 are at odd offsets */
+    memcpy(bytes, &folded, sizeof(uint32_t));
+    even = bytes[0] ^ bytes[2];
+    odd = bytes[1] ^ bytes[3];
+
+    return fh->table[0][even] ^ fh->table[1][odd];
+}
+
+uint64_t corsaro_flowhash_packet(const libtrace_packet_t *packet,
+        void *data) {
+
+    corsaro_flowhash_t *fh = (corsaro_flowhash_t *)data;
+    uint16_t ethertype;
+    uint32_t rem;
+    uint32_t folded = 0;
+    uint32_t hdrlen;
+    uint8_t proto;
+    uint8_t *l3;
+    int i;
+
+    l3 = (uint8_t *)trace_get_layer3(packet, &ethertype, &rem);
+    if (l3 == NULL) {
+        return 0;
+    }
+
+    if (ethertype == TRACE_ETHERTYPE_IP) {
+        libtrace_ip_t *ip = (libtrace_ip_t *)l3;
+
+        if (rem < sizeof(libtrace_ip_t)) {
+            return 0;
+        }
+        /* Source and destination are adjacent in the header */
+        folded = load_tuple_word(l3 + 12) ^ load_tuple_word(l3 + 16);
+
+        /* Only the first fragment carries the ports, so leave them out
+         * for all fragments to keep the whole datagram on one thread */
+        if ((ntohs(ip->ip_off) & 0x3fff) != 0) {
+            return hash_folded_tuple(fh, folded);
+        }
+        proto = ip->ip_p;
+        hdrlen = ip->ip_hl * 4;
+    } else if (ethertype == TRACE_ETHERTYPE_IPV6) {
+        libtrace_ip6_t *ip6 = (libtrace_ip6_t *)l3;
+
+        if (rem < sizeof(libtrace_ip6_t)) {
+            return 0;
+        }
+        for (i = 0; i < 8; i++) {
+            folded ^= load_tuple_word(l3 + 8 + (i * 4));
+        }
+        /* Don't bother walking extension headers */
+        proto = ip6->nxt;
+        hdrlen = sizeof(libtrace_ip6_t);
+    } else {
+        return 0;
+    }
+
+    if ((proto == FLOWHASH_PROTO_TCP || proto == FLOWHASH_PROTO_UDP ||
+            proto == FLOWHASH_PROTO_SCTP) && rem >= hdrlen + 4) {
+        /* Source and destination ports are the first four bytes of all
+         * of these headers */
+        folded ^= load_tuple_word(l3 + hdrlen);
+    }
+
+    return hash_folded_tuple(fh, folded);
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
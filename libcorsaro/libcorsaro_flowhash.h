@@ -0,0 +1,95 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#ifndef CORSARO_FLOWHASH_H
+#define CORSARO_FLOWHASH_H
+
+#include <stdint.h>
+#include <libtrace.h>
+
+/** A symmetric flow hasher for distributing packets to processing threads.
+ *
+ *  The hash is a Toeplitz hash over the source and destination addresses
+ *  and ports of the packet, using the same repeating 0x6d5a key as the
+ *  libtrace bidirectional hasher. Because that key repeats every 16 bits,
+ *  swapping the source and destination produces the same hash and the
+ *  contribution of each input byte only depends on whether it is at an odd
+ *  or even offset. The Toeplitz hash is linear over XOR, so the whole tuple
+ *  can be folded into a single 16 bit word and hashed with two lookups into
+ *  tables that are computed once, rather than looping over every key bit
+ *  for every packet.
+ */
+typedef struct corsaro_flowhash {
+    /** Hash contributions for each possible byte value, for bytes at even
+     *  (0) and odd (1) offsets within the tuple */
+    uint32_t table[2][256];
+} corsaro_flowhash_t;
+
+/** Computes the lookup tables for a flow hasher.
+ *
+ *  @param fh       The flow hasher to initialise
+ */
+void corsaro_init_flowhash(corsaro_flowhash_t *fh);
+
+/** Hashes the flow tuple of a packet. Non-IP packets hash to zero, and
+ *  only the addresses are used for IP fragments and protocols other than
+ *  TCP, UDP and SCTP.
+ *
+ *  The signature matches the libtrace hasher callback, so this can be
+ *  passed directly to trace_set_hasher() with the flow hasher as the data.
+ *
+ *  @param packet   The packet to hash
+ *  @param data     A pointer to an initialised corsaro_flowhash_t
+ *  @return the hash value for the packet
+ */
+uint64_t corsaro_flowhash_packet(const libtrace_packet_t *packet, void *data);
+
+#endif
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -55,12 +55,98 @@
 #include "libcorsaro_log.h"
 #include <libipmeta.h>
 
-void encode_flowtuple_as_avro(struct corsaro_flowtuple_data *ft,
-        corsaro_avro_writer_t *writer, corsaro_logger_t *logger) {
+/** Encodes the geolocation and ASN fields that end every flowtuple
+ *  record, using placeholder values for any tags that are not valid.
+ *
+ *  @return 0 if successful, -1 if an error occurred.
+ */
+static int encode_flowtuple_tag_fields(corsaro_avro_writer_t *writer,
+        uint16_t tagproviders, uint16_t maxmind_continent,
+        uint16_t maxmind_country, uint16_t netacq_continent,
+        uint16_t netacq_country, uint32_t prefixasn) {
 
     char valspace[128];
     uint32_t zero = 0;
 
+    if (tagproviders & (1 << IPMETA_PROVIDER_MAXMIND)) {
+        valspace[0] = (char)(maxmind_continent & 0xff);
+        valspace[1] = (char)((maxmind_continent >> 8) & 0xff);
+        valspace[2] = '\0';
+
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                    valspace, 2) < 0) {
+            return -1;
+        }
+
+        valspace[0] = (char)(maxmind_country & 0xff);
+        valspace[1] = (char)((maxmind_country >> 8) & 0xff);
+        valspace[2] = '\0';
+
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                    valspace, 2) < 0) {
+            return -1;
+        }
+
+    } else {
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                "??", 2) < 0) {
+            return -1;
+        }
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                "??", 2) < 0) {
+            return -1;
+        }
+    }
+
+
+    if (tagproviders & (1 << IPMETA_PROVIDER_NETACQ_EDGE)) {
+        valspace[0] = (char)(netacq_continent & 0xff);
+        valspace[1] = (char)((netacq_continent >> 8) & 0xff);
+        valspace[2] = '\0';
+
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                    valspace, 2) < 0) {
+            return -1;
+        }
+
+        valspace[0] = (char)(netacq_country & 0xff);
+        valspace[1] = (char)((netacq_country >> 8) & 0xff);
+        valspace[2] = '\0';
+
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                    valspace, 2) < 0) {
+            return -1;
+        }
+
+    } else {
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                "??", 2) < 0) {
+            return -1;
+        }
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                "??", 2) < 0) {
+            return -1;
+        }
+    }
+
+    if (tagproviders & (1 << IPMETA_PROVIDER_PFX2AS)) {
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                    &(prefixasn), sizeof(prefixasn)) < 0) {
+            return -1;
+        }
+
+    } else {
+        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                    &(zero), sizeof(zero)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void encode_flowtuple_as_avro(struct corsaro_flowtuple_data *ft,
+        corsaro_avro_writer_t *writer, corsaro_logger_t *logger) {
+
     if (corsaro_start_avro_encoding(writer) < 0) {
         return;
     }
@@ -137,79 +223,9 @@ void encode_flowtuple_as_avro(struct corsaro_flowtuple_data *ft,
 
     assert(ft->tagproviders != 0);
 
-    if (ft->tagproviders & (1 << IPMETA_PROVIDER_MAXMIND)) {
-        valspace[0] = (char)(ft->maxmind_continent & 0xff);
-        valspace[1] = (char)((ft->maxmind_continent >> 8) & 0xff);
-        valspace[2] = '\0';
-
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
-                    valspace, 2) < 0) {
-            return;
-        }
-
-        valspace[0] = (char)(ft->maxmind_country & 0xff);
-        valspace[1] = (char)((ft->maxmind_country >> 8) & 0xff);
-        valspace[2] = '\0';
-
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
-                    valspace, 2) < 0) {
-            return;
-        }
-
-    } else {
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
-                "??", 2) < 0) {
-            return;
-        }
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
-                "??", 2) < 0) {
-            return;
-        }
-    }
-
-
-    if (ft->tagproviders & (1 << IPMETA_PROVIDER_NETACQ_EDGE)) {
-        valspace[0] = (char)(ft->netacq_continent & 0xff);
-        valspace[1] = (char)((ft->netacq_continent >> 8) & 0xff);
-        valspace[2] = '\0';
-
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
-                    valspace, 2) < 0) {
-            return;
-        }
-
-        valspace[0] = (char)(ft->netacq_country & 0xff);
-        valspace[1] = (char)((ft->netacq_country >> 8) & 0xff);
-        valspace[2] = '\0';
-
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
-                    valspace, 2) < 0) {
-            return;
-        }
-
-    } else {
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
-                "??", 2) < 0) {
-            return;
-        }
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
-                "??", 2) < 0) {
-            return;
-        }
-    }
-
-    if (ft->tagproviders & (1 << IPMETA_PROVIDER_PFX2AS)) {
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
-                    &(ft->prefixasn), sizeof(ft->prefixasn)) < 0) {
-            return;
-        }
-
-    } else {
-        if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
-                    &(zero), sizeof(zero)) < 0) {
-            return;
-        }
-    }
+    encode_flowtuple_tag_fields(writer, ft->tagproviders,
+            ft->maxmind_continent, ft->maxmind_country,
+            ft->netacq_continent, ft->netacq_country, ft->prefixasn);
 }
 
 /** Decodes an avro flowtuple record back into the corsaro flowtuple struct.
@@ -321,4 +337,284 @@ int decode_flowtuple_from_avro(avro_value_t *record,
     ft->hash_val = 0;
 }
 
+#define FT_CMP_FIELD(a, b, field) \
+    if ((a)->field != (b)->field) { \
+        return ((a)->field < (b)->field) ? -1 : 1; \
+    }
+
+/** Compares two flowtuple records using the flowtuple sort order.
+ *
+ *  The order matches the sort key used by the flowtuple plugin, with the
+ *  SYN length and initial TCP window size added as tie-breakers to ensure
+ *  a deterministic result.
+ *
+ *  @return < 0 if a sorts before b, > 0 if a sorts after b, 0 if the
+ *          records are equal.
+ */
+int corsaro_flowtuple_data_cmp(struct corsaro_flowtuple_data *a,
+        struct corsaro_flowtuple_data *b) {
+
+    FT_CMP_FIELD(a, b, interval_ts);
+    FT_CMP_FIELD(a, b, protocol);
+    FT_CMP_FIELD(a, b, ttl);
+    FT_CMP_FIELD(a, b, tcp_flags);
+    FT_CMP_FIELD(a, b, src_ip);
+    FT_CMP_FIELD(a, b, dst_ip);
+    FT_CMP_FIELD(a, b, src_port);
+    FT_CMP_FIELD(a, b, dst_port);
+    FT_CMP_FIELD(a, b, ip_len);
+    FT_CMP_FIELD(a, b, tcp_synlen);
+    FT_CMP_FIELD(a, b, tcp_synwinlen);
+    return 0;
+}
+
+/** Tests if two flowtuple records describe the same flow, i.e. they have
+ *  the same interval and eight-tuple key.
+ *
+ *  Derived properties (ASN, spoofing, geolocation) and statistics such as
+ *  the packet count are ignored.
+ *
+ *  @return 1 if the flowtuples have the same key, 0 if they do not.
+ */
+int corsaro_flowtuple_data_same_key(struct corsaro_flowtuple_data *a,
+        struct corsaro_flowtuple_data *b) {
+
+    return (a->interval_ts == b->interval_ts &&
+            a->protocol == b->protocol &&
+            a->ttl == b->ttl &&
+            a->tcp_flags == b->tcp_flags &&
+            a->src_ip == b->src_ip &&
+            a->dst_ip == b->dst_ip &&
+            a->src_port == b->src_port &&
+            a->dst_port == b->dst_port &&
+            a->ip_len == b->ip_len);
+}
+
+/** Merges two equivalent flowtuple records together. After calling this
+ *  function, 'from' can be discarded.
+ */
+void corsaro_combine_flowtuple_data(struct corsaro_flowtuple_data *into,
+        struct corsaro_flowtuple_data *from) {
+
+    /** Packet count needs to be added together. */
+    into->packet_cnt += from->packet_cnt;
+}
+
+#define FT6_ENCODE_LONG(writer, ft, field) \
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, \
+                &((ft)->field), sizeof((ft)->field)) < 0) { \
+        return; \
+    }
+
+/** Encodes an IPv6 flowtuple as an avro record using the
+ *  FLOWTUPLE6_RESULT_SCHEMA. Unlike the IPv4 encoder, flowtuples without
+ *  any valid tags are permitted (corsarotagger does not necessarily
+ *  geolocate IPv6 sources); their tag fields are written as unknown.
+ */
+void encode_flowtuple6_as_avro(struct corsaro_flowtuple6_data *ft,
+        corsaro_avro_writer_t *writer, corsaro_logger_t *logger) {
+
+    if (corsaro_start_avro_encoding(writer) < 0) {
+        return;
+    }
+
+    FT6_ENCODE_LONG(writer, ft, interval_ts);
+
+    /* "bytes" has the same encoding as "string" */
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                ft->src_ip, sizeof(ft->src_ip)) < 0) {
+        return;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                ft->dst_ip, sizeof(ft->dst_ip)) < 0) {
+        return;
+    }
+
+    FT6_ENCODE_LONG(writer, ft, src_port);
+    FT6_ENCODE_LONG(writer, ft, dst_port);
+    FT6_ENCODE_LONG(writer, ft, protocol);
+    FT6_ENCODE_LONG(writer, ft, ttl);
+    FT6_ENCODE_LONG(writer, ft, tcp_flags);
+    FT6_ENCODE_LONG(writer, ft, ip_len);
+    FT6_ENCODE_LONG(writer, ft, tcp_synlen);
+    FT6_ENCODE_LONG(writer, ft, tcp_synwinlen);
+    FT6_ENCODE_LONG(writer, ft, packet_cnt);
+    FT6_ENCODE_LONG(writer, ft, is_spoofed);
+    FT6_ENCODE_LONG(writer, ft, is_masscan);
+
+    encode_flowtuple_tag_fields(writer, ft->tagproviders,
+            ft->maxmind_continent, ft->maxmind_country,
+            ft->netacq_continent, ft->netacq_country, ft->prefixasn);
+}
+
+/** Decodes an avro IPv6 flowtuple record back into the corsaro IPv6
+ *  flowtuple struct.
+ *
+ *  @param record       The avro record to be decoded
+ *  @param ft           The corsaro flowtuple structure to populate with the
+ *                      decoded field contents.
+ *
+ *  @return 1 on success, -1 if the record has malformed addresses
+ */
+int decode_flowtuple6_from_avro(avro_value_t *record,
+        struct corsaro_flowtuple6_data *ft) {
+
+    avro_value_t av;
+    int32_t tmp32;
+    int64_t tmp64;
+    const void *buf = NULL;
+    const char *str = NULL;
+    size_t size = 0;
+
+    avro_value_get_by_index(record, 0, &av, NULL);
+    avro_value_get_long(&av, &(tmp64));
+    ft->interval_ts = (uint32_t)tmp64;
+
+    avro_value_get_by_index(record, 1, &av, NULL);
+    avro_value_get_bytes(&av, &buf, &size);
+    if (size != sizeof(ft->src_ip)) {
+        return -1;
+    }
+    memcpy(ft->src_ip, buf, size);
+
+    avro_value_get_by_index(record, 2, &av, NULL);
+    avro_value_get_bytes(&av, &buf, &size);
+    if (size != sizeof(ft->dst_ip)) {
+        return -1;
+    }
+    memcpy(ft->dst_ip, buf, size);
+
+    avro_value_get_by_index(record, 3, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->src_port = (uint16_t)tmp32;
+
+    avro_value_get_by_index(record, 4, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->dst_port = (uint16_t)tmp32;
+
+    avro_value_get_by_index(record, 5, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->protocol = (uint8_t)tmp32;
+
+    avro_value_get_by_index(record, 6, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->ttl = (uint8_t)tmp32;
+
+    avro_value_get_by_index(record, 7, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->tcp_flags = (uint8_t)tmp32;
+
+    avro_value_get_by_index(record, 8, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->ip_len = (uint16_t)tmp32;
+
+    avro_value_get_by_index(record, 9, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->tcp_synlen = (uint16_t)tmp32;
+
+    avro_value_get_by_index(record, 10, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->tcp_synwinlen = (uint16_t)tmp32;
+
+    avro_value_get_by_index(record, 11, &av, NULL);
+    avro_value_get_long(&av, &(tmp64));
+    ft->packet_cnt = (uint32_t)tmp64;
+
+    avro_value_get_by_index(record, 12, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->is_spoofed = (uint8_t)tmp32;
+
+    avro_value_get_by_index(record, 13, &av, NULL);
+    avro_value_get_int(&av, &(tmp32));
+    ft->is_masscan = (uint8_t)tmp32;
+
+    avro_value_get_by_index(record, 14, &av, NULL);
+    avro_value_get_string(&av, &str, &size);
+    assert(size == 2);
+    ft->maxmind_continent = (uint16_t)(str[0]) + (((uint16_t)str[1]) << 8);
+
+    avro_value_get_by_index(record, 15, &av, NULL);
+    avro_value_get_string(&av, &str, &size);
+    assert(size == 2);
+    ft->maxmind_country = (uint16_t)(str[0]) + (((uint16_t)str[1]) << 8);
+
+    avro_value_get_by_index(record, 16, &av, NULL);
+    avro_value_get_string(&av, &str, &size);
+    assert(size == 2);
+    ft->netacq_continent = (uint16_t)(str[0]) + (((uint16_t)str[1]) << 8);
+
+    avro_value_get_by_index(record, 17, &av, NULL);
+    avro_value_get_string(&av, &str, &size);
+    assert(size == 2);
+    ft->netacq_country = (uint16_t)(str[0]) + (((uint16_t)str[1]) << 8);
+
+    avro_value_get_by_index(record, 18, &av, NULL);
+    avro_value_get_long(&av, &(tmp64));
+    ft->prefixasn = (uint32_t)tmp64;
+
+    ft->tagproviders = (1 << IPMETA_PROVIDER_MAXMIND) |
+            (1 << IPMETA_PROVIDER_NETACQ_EDGE) |
+            (1 << IPMETA_PROVIDER_PFX2AS);
+
+    ft->hash_val = 0;
+    return 1;
+}
+
+/** Compares two IPv6 flowtuple records, using the same field order as
+ *  corsaro_flowtuple_data_cmp().
+ *
+ *  @return < 0 if a sorts before b, > 0 if a sorts after b, 0 if the
+ *          records are equal.
+ */
+int corsaro_flowtuple6_data_cmp(struct corsaro_flowtuple6_data *a,
+        struct corsaro_flowtuple6_data *b) {
+
+    int r;
+
+    FT_CMP_FIELD(a, b, interval_ts);
+    FT_CMP_FIELD(a, b, protocol);
+    FT_CMP_FIELD(a, b, ttl);
+    FT_CMP_FIELD(a, b, tcp_flags);
+    if ((r = memcmp(a->src_ip, b->src_ip, sizeof(a->src_ip))) != 0) {
+        return r;
+    }
+    if ((r = memcmp(a->dst_ip, b->dst_ip, sizeof(a->dst_ip))) != 0) {
+        return r;
+    }
+    FT_CMP_FIELD(a, b, src_port);
+    FT_CMP_FIELD(a, b, dst_port);
+    FT_CMP_FIELD(a, b, ip_len);
+    FT_CMP_FIELD(a, b, tcp_synlen);
+    FT_CMP_FIELD(a, b, tcp_synwinlen);
+    return 0;
+}
+
+/** Tests if two IPv6 flowtuple records describe the same flow, i.e. they
+ *  have the same interval and eight-tuple key.
+ *
+ *  @return 1 if the flowtuples have the same key, 0 if they do not.
+ */
+int corsaro_flowtuple6_data_same_key(struct corsaro_flowtuple6_data *a,
+        struct corsaro_flowtuple6_data *b) {
+
+    return (a->interval_ts == b->interval_ts &&
+            a->protocol == b->protocol &&
+            a->ttl == b->ttl &&
+            a->tcp_flags == b->tcp_flags &&
+            memcmp(a->src_ip, b->src_ip, sizeof(a->src_ip)) == 0 &&
+            memcmp(a->dst_ip, b->dst_ip, sizeof(a->dst_ip)) == 0 &&
+            a->src_port == b->src_port &&
+            a->dst_port == b->dst_port &&
+            a->ip_len == b->ip_len);
+}
+
+/** Merges two equivalent IPv6 flowtuple records together. After calling
+ *  this function, 'from' can be discarded.
+ */
+void corsaro_combine_flowtuple6_data(struct corsaro_flowtuple6_data *into,
+        struct corsaro_flowtuple6_data *from) {
+
+    into->packet_cnt += from->packet_cnt;
+}
+
 // vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
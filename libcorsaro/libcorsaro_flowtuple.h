@@ -51,6 +51,7 @@
 #define LIBCORSARO_FLOWTUPLE_H_
 
 #include <inttypes.h>
+#include <string.h>
 #include "libcorsaro_avro.h"
 #include "libcorsaro_log.h"
 
@@ -81,6 +82,36 @@ static const char FLOWTUPLE_RESULT_SCHEMA[] =
       {\"name\": \"prefix2asn\", \"type\": \"long\"} \
       ]}";
 
+/** Schema for IPv6 flowtuples. This is identical to FLOWTUPLE_RESULT_SCHEMA
+ *  except that the addresses are 16 byte values in network byte order.
+ */
+static const char FLOWTUPLE6_RESULT_SCHEMA[] =
+"{\"type\": \"record\",\
+  \"namespace\":\"org.caida.corsaro\",\
+  \"name\":\"flowtuple6\",\
+  \"doc\":\"A Corsaro IPv6 FlowTuple record. All byte fields are in network byte order.\",\
+  \"fields\":[\
+      {\"name\": \"time\", \"type\": \"long\"}, \
+      {\"name\": \"src_ip\", \"type\": \"bytes\"}, \
+      {\"name\": \"dst_ip\", \"type\": \"bytes\"}, \
+      {\"name\": \"src_port\", \"type\": \"int\"}, \
+      {\"name\": \"dst_port\", \"type\": \"int\"}, \
+      {\"name\": \"protocol\", \"type\": \"int\"}, \
+      {\"name\": \"ttl\", \"type\": \"int\"}, \
+      {\"name\": \"tcp_flags\", \"type\": \"int\"}, \
+      {\"name\": \"ip_len\", \"type\": \"int\"}, \
+      {\"name\": \"tcp_synlen\", \"type\": \"int\"}, \
+      {\"name\": \"tcp_synwinlen\", \"type\": \"int\"}, \
+      {\"name\": \"packet_cnt\", \"type\": \"long\"}, \
+      {\"name\": \"is_spoofed\", \"type\": \"int\"}, \
+      {\"name\": \"is_masscan\", \"type\": \"int\"}, \
+      {\"name\": \"maxmind_continent\", \"type\": \"string\"}, \
+      {\"name\": \"maxmind_country\", \"type\": \"string\"}, \
+      {\"name\": \"netacq_continent\", \"type\": \"string\"}, \
+      {\"name\": \"netacq_country\", \"type\": \"string\"}, \
+      {\"name\": \"prefix2asn\", \"type\": \"long\"} \
+      ]}";
+
 /**
  * Represents the eight important fields in the ip header that we will use to
  * 'uniquely' identify a packet
@@ -157,6 +188,145 @@ struct corsaro_flowtuple_data {
   uint16_t tagproviders;
 } PACKED;
 
+/**
+ * The IPv6 equivalent of struct corsaro_flowtuple_data.
+ *
+ * IPv6 flowtuples are kept apart from IPv4 ones (in their own tables and
+ * output files) so that the IPv4 key can stay at 32 bits per address. The
+ * addresses are stored as 16 bytes in network byte order, so comparing
+ * them with memcmp() gives numeric order. 'ttl' holds the hop limit and
+ * 'ip_len' is the payload length plus the 40 byte fixed header.
+ */
+struct corsaro_flowtuple6_data {
+  /** The start time for the interval that this flow appeared in */
+  uint32_t interval_ts;
+
+  /** The source IP */
+  uint8_t src_ip[16];
+
+  /** The destination IP */
+  uint8_t dst_ip[16];
+
+  /** The source port (or ICMPv6 type) */
+  uint16_t src_port;
+
+  /** The destination port (or ICMPv6 code) */
+  uint16_t dst_port;
+
+  /** The protocol (i.e. the final next header value) */
+  uint8_t protocol;
+
+  /** The hop limit */
+  uint8_t ttl;
+
+  /** TCP Flags (excluding NS) */
+  uint8_t tcp_flags;
+
+  /** Length of the IP packet, including the fixed IPv6 header */
+  uint16_t ip_len;
+
+  /** Size of the TCP SYN (including options) */
+  uint16_t tcp_synlen;
+
+  /** Announced receive window size in the TCP SYN (including options) */
+  uint16_t tcp_synwinlen;
+
+  /** The number of packets that comprise this flowtuple */
+  uint32_t packet_cnt;
+
+  /** The result of applying the hash function to this flowtuple */
+  uint32_t hash_val;
+
+  /** Flag indicating whether the source address was probably spoofed */
+  uint8_t is_spoofed;
+
+  /** Flag indicating whether the flow appeared to be a TCP Masscan attempt */
+  uint8_t is_masscan;
+
+  /** Country that the source IP corresponds to, according to maxmind */
+  uint16_t maxmind_country;
+  /** Continent that the source IP corresponds to, according to maxmind */
+  uint16_t maxmind_continent;
+  /** Country that the source IP corresponds to, according to netacq-edge */
+  uint16_t netacq_country;
+  /** Continent that the source IP corresponds to, according to netacq-edge */
+  uint16_t netacq_continent;
+  /** ASN that the source IP corresponds to, according to pf2asn data */
+  uint32_t prefixasn;
+  /** Bitmap indicating which libipmeta tags are valid for this flow */
+  uint16_t tagproviders;
+} PACKED;
+
+/** Multiplies two 64-bit values and folds the 128-bit product back into
+ *  64 bits (the mixing step used by wyhash).
+ */
+static inline uint64_t corsaro_flowtuple_mum(uint64_t a, uint64_t b) {
+    __uint128_t r = ((__uint128_t)a) * b;
+    return ((uint64_t)r) ^ ((uint64_t)(r >> 64));
+}
+
+/** Computes a 64-bit hash over all of the fields that make up a flowtuple
+ *  key.
+ *
+ *  This is the flow hash that corsarotagger places in the packet tags
+ *  (see corsaro_flowtuple_fold_hash() below) and that the flowtuple
+ *  plugin uses for its aggregation table, so both must agree on it.
+ *  All parameters are expected to be in host byte order.
+ *
+ *  @return the 64-bit hash of the flowtuple key
+ */
+static inline uint64_t corsaro_flowtuple_key_hash(uint32_t src_ip,
+        uint32_t dst_ip, uint16_t src_port, uint16_t dst_port,
+        uint8_t protocol, uint8_t ttl, uint8_t tcp_flags, uint16_t ip_len) {
+
+    uint64_t a, b, c;
+
+    a = (((uint64_t)src_ip) << 32) | dst_ip;
+    b = (((uint64_t)src_port) << 48) | (((uint64_t)dst_port) << 32) |
+            (((uint64_t)ip_len) << 16) | (((uint64_t)ttl) << 8) | tcp_flags;
+    c = protocol;
+
+    a = corsaro_flowtuple_mum(a ^ 0xa0761d6478bd642fULL,
+            b ^ 0xe7037ed1a0b428dbULL);
+    return corsaro_flowtuple_mum(a ^ c ^ 0x8ebc6af09c88c6e3ULL,
+            0x589965cc75374cc3ULL);
+}
+
+/** Computes a 64-bit hash over all of the fields that make up an IPv6
+ *  flowtuple key. The addresses are given in network byte order, the
+ *  other parameters in host byte order.
+ *
+ *  @return the 64-bit hash of the flowtuple key
+ */
+static inline uint64_t corsaro_flowtuple6_key_hash(const uint8_t *src_ip,
+        const uint8_t *dst_ip, uint16_t src_port, uint16_t dst_port,
+        uint8_t protocol, uint8_t ttl, uint8_t tcp_flags, uint16_t ip_len) {
+
+    uint64_t s[2], d[2], a, b, c;
+
+    memcpy(s, src_ip, 16);
+    memcpy(d, dst_ip, 16);
+
+    a = corsaro_flowtuple_mum(s[0] ^ 0xa0761d6478bd642fULL,
+            s[1] ^ 0xe7037ed1a0b428dbULL);
+    b = corsaro_flowtuple_mum(d[0] ^ 0x8ebc6af09c88c6e3ULL,
+            d[1] ^ 0x589965cc75374cc3ULL);
+    c = (((uint64_t)src_port) << 48) | (((uint64_t)dst_port) << 32) |
+            (((uint64_t)ip_len) << 16) | (((uint64_t)ttl) << 8) | tcp_flags;
+
+    a = corsaro_flowtuple_mum(a ^ c ^ 0xe7037ed1a0b428dbULL,
+            b ^ protocol ^ 0xa0761d6478bd642fULL);
+    return corsaro_flowtuple_mum(a ^ 0x8ebc6af09c88c6e3ULL,
+            0x589965cc75374cc3ULL);
+}
+
+/** Folds a 64-bit flowtuple key hash into the 32 bits that are carried in
+ *  the packet tags and the 'hash_val' field of a flowtuple.
+ */
+static inline uint32_t corsaro_flowtuple_fold_hash(uint64_t h) {
+    return (uint32_t)(h ^ (h >> 32));
+}
+
 /* Utility functions for other programs that want to handle flowtuple
  * objects, e.g. corsaroftmerge
  */
@@ -166,6 +336,26 @@ void encode_flowtuple_as_avro(struct corsaro_flowtuple_data *ft,
 int decode_flowtuple_from_avro(avro_value_t *record,
         struct corsaro_flowtuple_data *ft);
 
+int corsaro_flowtuple_data_cmp(struct corsaro_flowtuple_data *a,
+        struct corsaro_flowtuple_data *b);
+int corsaro_flowtuple_data_same_key(struct corsaro_flowtuple_data *a,
+        struct corsaro_flowtuple_data *b);
+void corsaro_combine_flowtuple_data(struct corsaro_flowtuple_data *into,
+        struct corsaro_flowtuple_data *from);
+
+void encode_flowtuple6_as_avro(struct corsaro_flowtuple6_data *ft,
+        corsaro_avro_writer_t *writer, corsaro_logger_t *logger);
+
+int decode_flowtuple6_from_avro(avro_value_t *record,
+        struct corsaro_flowtuple6_data *ft);
+
+int corsaro_flowtuple6_data_cmp(struct corsaro_flowtuple6_data *a,
+        struct corsaro_flowtuple6_data *b);
+int corsaro_flowtuple6_data_same_key(struct corsaro_flowtuple6_data *a,
+        struct corsaro_flowtuple6_data *b);
+void corsaro_combine_flowtuple6_data(struct corsaro_flowtuple6_data *into,
+        struct corsaro_flowtuple6_data *from);
+
 
 #endif
 // vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
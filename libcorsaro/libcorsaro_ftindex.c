@@ -0,0 +1,713 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2021 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libcorsaro_ftindex.h"
+#include "libcorsaro_avro.h"
+#include "libcorsaro_flowtuple.h"
+#include "libcorsaro_log.h"
+
+/** Gives up on writing an index file, removing whatever has been written
+ *  so far so that readers do not try to use an incomplete index.
+ */
+static void abandon_ftindex(corsaro_ftindex_writer_t *iw) {
+
+    if (iw->f) {
+        fclose(iw->f);
+        iw->f = NULL;
+    }
+
+    if (iw->fname) {
+        corsaro_log(iw->logger, "abandoning flowtuple block index %s",
+                iw->fname);
+        unlink(iw->fname);
+        free(iw->fname);
+        iw->fname = NULL;
+    }
+}
+
+/** Completes the index entry for the current run of records, flushing the
+ *  avro writer so that the run ends on an avro block boundary.
+ */
+static int finish_ftindex_entry(corsaro_ftindex_writer_t *iw,
+        corsaro_avro_writer_t *avwrt) {
+
+    int64_t end;
+
+    if (iw->current.records == 0) {
+        return 0;
+    }
+
+    end = corsaro_flush_avro_writer(avwrt);
+    if (end < 0 || (uint64_t)end < iw->nextoffset) {
+        abandon_ftindex(iw);
+        return -1;
+    }
+
+    iw->current.offset = iw->nextoffset;
+    iw->current.length = (uint64_t)end - iw->nextoffset;
+
+    if (fwrite(&(iw->current), sizeof(corsaro_ftindex_entry_t), 1,
+                iw->f) != 1) {
+        corsaro_log(iw->logger, "error writing to flowtuple block index %s: %s",
+                iw->fname, strerror(errno));
+        abandon_ftindex(iw);
+        return -1;
+    }
+
+    iw->nextoffset = (uint64_t)end;
+    iw->current.records = 0;
+    return 0;
+}
+
+corsaro_ftindex_writer_t *corsaro_create_ftindex_writer(
+        corsaro_logger_t *logger) {
+
+    corsaro_ftindex_writer_t *iw;
+
+    iw = (corsaro_ftindex_writer_t *)calloc(1,
+            sizeof(corsaro_ftindex_writer_t));
+    if (iw == NULL) {
+        corsaro_log(logger,
+                "unable to allocate memory for flowtuple index writer.");
+        return NULL;
+    }
+
+    iw->logger = logger;
+    iw->fname = NULL;
+    iw->f = NULL;
+    return iw;
+}
+
+/** Starts writing an index for an avro file. The avro writer must have
+ *  already been started and nothing may have been appended to it yet.
+ *
+ *  If this fails, the avro file can still be written -- it just won't
+ *  have an index.
+ *
+ *  @param iw       The index writer
+ *  @param avwrt    The avro writer for the file that is being indexed
+ *  @return 0 if successful, -1 if an error occurs.
+ */
+int corsaro_start_ftindex_writer(corsaro_ftindex_writer_t *iw,
+        corsaro_avro_writer_t *avwrt) {
+
+    corsaro_ftindex_header_t hdr;
+    int64_t datastart;
+
+    if (iw->f != NULL) {
+        corsaro_log(iw->logger,
+                "attempting to start a flowtuple index writer when it is already open!");
+        return -1;
+    }
+
+    iw->fname = (char *)malloc(strlen(avwrt->fname) +
+            strlen(CORSARO_FTINDEX_SUFFIX) + 1);
+    if (iw->fname == NULL) {
+        corsaro_log(iw->logger,
+                "unable to allocate memory for flowtuple index file name");
+        return -1;
+    }
+    strcpy(iw->fname, avwrt->fname);
+    strcat(iw->fname, CORSARO_FTINDEX_SUFFIX);
+
+    /* Make sure the avro header is on disk so we know where the first
+     * block will start */
+    datastart = corsaro_flush_avro_writer(avwrt);
+    if (datastart < 0) {
+        abandon_ftindex(iw);
+        return -1;
+    }
+
+    iw->f = fopen(iw->fname, "w");
+    if (iw->f == NULL) {
+        corsaro_log(iw->logger,
+                "unable to open flowtuple block index %s for writing: %s",
+                iw->fname, strerror(errno));
+        abandon_ftindex(iw);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CORSARO_FTINDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = CORSARO_FTINDEX_VERSION;
+    hdr.entrysize = sizeof(corsaro_ftindex_entry_t);
+    hdr.datastart = (uint64_t)datastart;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, iw->f) != 1) {
+        corsaro_log(iw->logger, "error writing to flowtuple block index %s: %s",
+                iw->fname, strerror(errno));
+        abandon_ftindex(iw);
+        return -1;
+    }
+
+    memset(&(iw->current), 0, sizeof(corsaro_ftindex_entry_t));
+    iw->nextoffset = (uint64_t)datastart;
+    return 0;
+}
+
+/** Adds a flowtuple to the index. Must be called after the flowtuple has
+ *  been appended to the avro writer.
+ *
+ *  @param iw       The index writer
+ *  @param avwrt    The avro writer for the file that is being indexed
+ *  @param ft       The flowtuple that was just written
+ *  @return 0 if successful, -1 if an error occurs.
+ */
+int corsaro_ftindex_add_record(corsaro_ftindex_writer_t *iw,
+        corsaro_avro_writer_t *avwrt, struct corsaro_flowtuple_data *ft) {
+
+    corsaro_ftindex_entry_t *e = &(iw->current);
+    uint16_t bit;
+
+    if (iw->f == NULL) {
+        return 0;
+    }
+
+    if (e->records == 0) {
+        memcpy(&(e->minkey), ft, sizeof(struct corsaro_flowtuple_data));
+        memcpy(&(e->maxkey), ft, sizeof(struct corsaro_flowtuple_data));
+        e->min_src_ip = ft->src_ip;
+        e->max_src_ip = ft->src_ip;
+        memset(e->dst_ports, 0, sizeof(e->dst_ports));
+    } else {
+        if (corsaro_flowtuple_data_cmp(ft, &(e->minkey)) < 0) {
+            memcpy(&(e->minkey), ft, sizeof(struct corsaro_flowtuple_data));
+        } else if (corsaro_flowtuple_data_cmp(ft, &(e->maxkey)) > 0) {
+            memcpy(&(e->maxkey), ft, sizeof(struct corsaro_flowtuple_data));
+        }
+
+        if (ft->src_ip < e->min_src_ip) {
+            e->min_src_ip = ft->src_ip;
+        }
+        if (ft->src_ip > e->max_src_ip) {
+            e->max_src_ip = ft->src_ip;
+        }
+    }
+
+    bit = CORSARO_FTINDEX_PORT_BIT(ft->dst_port);
+    e->dst_ports[bit >> 3] |= (1 << (bit & 0x07));
+    e->records ++;
+
+    if (e->records >= CORSARO_FTINDEX_BLOCK_RECORDS) {
+        return finish_ftindex_entry(iw, avwrt);
+    }
+    return 0;
+}
+
+/** Completes the index for an avro file. Must be called before the avro
+ *  writer is closed.
+ *
+ *  @param iw       The index writer
+ *  @param avwrt    The avro writer for the file that is being indexed
+ *  @return 0 if successful, -1 if an error occurs.
+ */
+int corsaro_close_ftindex_writer(corsaro_ftindex_writer_t *iw,
+        corsaro_avro_writer_t *avwrt) {
+
+    if (iw->f == NULL) {
+        return 0;
+    }
+
+    if (finish_ftindex_entry(iw, avwrt) < 0) {
+        return -1;
+    }
+
+    if (fclose(iw->f) != 0) {
+        iw->f = NULL;
+        corsaro_log(iw->logger, "error closing flowtuple block index %s: %s",
+                iw->fname, strerror(errno));
+        abandon_ftindex(iw);
+        return -1;
+    }
+    iw->f = NULL;
+    free(iw->fname);
+    iw->fname = NULL;
+    return 0;
+}
+
+int corsaro_is_ftindex_writer_active(corsaro_ftindex_writer_t *iw) {
+    if (iw->f != NULL) {
+        return 1;
+    }
+    return 0;
+}
+
+void corsaro_destroy_ftindex_writer(corsaro_ftindex_writer_t *iw) {
+
+    /* If the writer is still open, we can't be sure that the index
+     * matches the avro file so get rid of it. */
+    if (iw->f) {
+        abandon_ftindex(iw);
+    }
+    if (iw->fname) {
+        free(iw->fname);
+    }
+    free(iw);
+}
+
+/** Checks if a run of records described by an index entry could contain
+ *  any flowtuples that match a query.
+ *
+ *  @return 1 if the run might contain matching flowtuples, 0 if it
+ *          definitely does not.
+ */
+int corsaro_ftindex_entry_matches(corsaro_ftindex_entry_t *entry,
+        corsaro_ftindex_query_t *query) {
+
+    uint16_t bit;
+
+    if (entry->records == 0) {
+        return 0;
+    }
+
+    if (query->match_time && (entry->maxkey.interval_ts < query->first_ts ||
+                entry->minkey.interval_ts > query->last_ts)) {
+        return 0;
+    }
+
+    if (query->match_src_ip && (entry->max_src_ip < query->first_src_ip ||
+                entry->min_src_ip > query->last_src_ip)) {
+        return 0;
+    }
+
+    if (query->match_dst_port) {
+        bit = CORSARO_FTINDEX_PORT_BIT(query->dst_port);
+        if ((entry->dst_ports[bit >> 3] & (1 << (bit & 0x07))) == 0) {
+            return 0;
+        }
+    }
+
+    /* Protocol is the first field in the sort key after the interval, so
+     * we can only rule it out if the run is within a single interval */
+    if (query->match_protocol &&
+            entry->minkey.interval_ts == entry->maxkey.interval_ts &&
+            (query->protocol < entry->minkey.protocol ||
+             query->protocol > entry->maxkey.protocol)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/** Checks if a flowtuple matches a query.
+ *
+ *  @return 1 if the flowtuple matches, 0 if it does not.
+ */
+int corsaro_ftindex_record_matches(struct corsaro_flowtuple_data *ft,
+        corsaro_ftindex_query_t *query) {
+
+    if (query->match_time && (ft->interval_ts < query->first_ts ||
+                ft->interval_ts > query->last_ts)) {
+        return 0;
+    }
+
+    if (query->match_src_ip && (ft->src_ip < query->first_src_ip ||
+                ft->src_ip > query->last_src_ip)) {
+        return 0;
+    }
+
+    if (query->match_dst_port && ft->dst_port != query->dst_port) {
+        return 0;
+    }
+
+    if (query->match_protocol && ft->protocol != query->protocol) {
+        return 0;
+    }
+    return 1;
+}
+
+/** Adds a range of the avro file to the list of ranges to be read,
+ *  merging it with the previous range if they are adjacent.
+ */
+static int add_ftindex_segment(corsaro_ftindex_reader_t *reader,
+        uint64_t offset, uint64_t length, uint32_t *alloced) {
+
+    corsaro_ftindex_segment_t *last;
+
+    if (reader->segcount > 0) {
+        last = &(reader->segments[reader->segcount - 1]);
+        if (last->offset + last->length == offset) {
+            last->length += length;
+            return 0;
+        }
+    }
+
+    if (reader->segcount == *alloced) {
+        corsaro_ftindex_segment_t *tmp;
+
+        tmp = (corsaro_ftindex_segment_t *)realloc(reader->segments,
+                sizeof(corsaro_ftindex_segment_t) * ((*alloced) + 64));
+        if (tmp == NULL) {
+            return -1;
+        }
+        reader->segments = tmp;
+        (*alloced) += 64;
+    }
+
+    reader->segments[reader->segcount].offset = offset;
+    reader->segments[reader->segcount].length = length;
+    reader->segcount ++;
+    return 0;
+}
+
+/** Reads the index for an avro file and works out which ranges of the
+ *  file need to be read to answer the query.
+ *
+ *  @return 1 if the index was usable, 0 if the index is missing or does
+ *          not match the avro file, -1 if an error occurs.
+ */
+static int load_ftindex(corsaro_ftindex_reader_t *reader, uint64_t filesize) {
+
+    char *idxname;
+    FILE *f;
+    corsaro_ftindex_header_t hdr;
+    corsaro_ftindex_entry_t entry;
+    uint64_t expected;
+    uint32_t alloced = 0;
+    int ret = 0;
+
+    idxname = (char *)malloc(strlen(reader->filename) +
+            strlen(CORSARO_FTINDEX_SUFFIX) + 1);
+    if (idxname == NULL) {
+        return -1;
+    }
+    strcpy(idxname, reader->filename);
+    strcat(idxname, CORSARO_FTINDEX_SUFFIX);
+
+    f = fopen(idxname, "r");
+    if (f == NULL) {
+        free(idxname);
+        return 0;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+            memcmp(hdr.magic, CORSARO_FTINDEX_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != CORSARO_FTINDEX_VERSION ||
+            hdr.entrysize != sizeof(corsaro_ftindex_entry_t)) {
+        corsaro_log(reader->logger,
+                "%s is not a valid flowtuple block index", idxname);
+        goto endload;
+    }
+
+    if (add_ftindex_segment(reader, 0, hdr.datastart, &alloced) < 0) {
+        ret = -1;
+        goto endload;
+    }
+
+    expected = hdr.datastart;
+    while (fread(&entry, sizeof(entry), 1, f) == 1) {
+        if (entry.offset != expected) {
+            break;
+        }
+        expected += entry.length;
+        reader->runs_total ++;
+
+        if (!corsaro_ftindex_entry_matches(&entry, &(reader->query))) {
+            continue;
+        }
+        reader->runs_selected ++;
+        if (add_ftindex_segment(reader, entry.offset, entry.length,
+                    &alloced) < 0) {
+            ret = -1;
+            goto endload;
+        }
+    }
+
+    /* The index must account for every byte of the avro file, otherwise
+     * it is incomplete or belongs to a different version of the file. */
+    if (expected != filesize) {
+        corsaro_log(reader->logger,
+                "flowtuple block index %s does not match %s, ignoring it",
+                idxname, reader->filename);
+        goto endload;
+    }
+    ret = 1;
+
+endload:
+    if (ret != 1) {
+        reader->segcount = 0;
+        reader->runs_total = 0;
+        reader->runs_selected = 0;
+    }
+    fclose(f);
+    free(idxname);
+    return ret;
+}
+
+corsaro_ftindex_reader_t *corsaro_create_ftindex_reader(
+        corsaro_logger_t *logger, char *filename,
+        corsaro_ftindex_query_t *query) {
+
+    corsaro_ftindex_reader_t *r;
+    struct stat st;
+    int ret;
+
+    if (filename == NULL) {
+        corsaro_log(logger, "filename for an Avro reader cannot be NULL!");
+        return NULL;
+    }
+
+    r = (corsaro_ftindex_reader_t *)calloc(1,
+            sizeof(corsaro_ftindex_reader_t));
+    if (r == NULL) {
+        corsaro_log(logger,
+                "unable to allocate memory for flowtuple index reader.");
+        return NULL;
+    }
+
+    r->filename = filename;
+    r->logger = logger;
+    r->fd = -1;
+    r->in = NULL;
+    r->schema = NULL;
+    r->iface = NULL;
+    memcpy(&(r->query), query, sizeof(corsaro_ftindex_query_t));
+
+    r->fd = open(filename, O_RDONLY);
+    if (r->fd < 0 || fstat(r->fd, &st) < 0) {
+        corsaro_log(logger, "unable to open Avro file %s for reading: %s",
+                filename, strerror(errno));
+        corsaro_destroy_ftindex_reader(r);
+        return NULL;
+    }
+
+    ret = load_ftindex(r, (uint64_t)st.st_size);
+    if (ret < 0) {
+        corsaro_log(logger, "unable to load flowtuple block index for %s",
+                filename);
+        corsaro_destroy_ftindex_reader(r);
+        return NULL;
+    }
+
+    if (ret == 0) {
+        /* No usable index, so we'll have to read the whole file */
+        uint32_t alloced = 0;
+        if (add_ftindex_segment(r, 0, (uint64_t)st.st_size, &alloced) < 0) {
+            corsaro_destroy_ftindex_reader(r);
+            return NULL;
+        }
+        r->indexed = 0;
+    } else {
+        r->indexed = 1;
+    }
+
+    return r;
+}
+
+/** Read callback for the stream that presents the selected ranges of the
+ *  avro file to the avro reader as if they were a single file.
+ */
+static ssize_t ftindex_stream_read(void *cookie, char *buf, size_t size) {
+
+    corsaro_ftindex_reader_t *reader = (corsaro_ftindex_reader_t *)cookie;
+    corsaro_ftindex_segment_t *seg;
+    ssize_t total = 0, ret;
+    size_t toread;
+
+    while (size > 0 && reader->segcurrent < reader->segcount) {
+        seg = &(reader->segments[reader->segcurrent]);
+        if (reader->segpos >= seg->length) {
+            reader->segcurrent ++;
+            reader->segpos = 0;
+            continue;
+        }
+
+        toread = seg->length - reader->segpos;
+        if (toread > size) {
+            toread = size;
+        }
+
+        ret = pread(reader->fd, buf, toread, seg->offset + reader->segpos);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (ret == 0) {
+            /* File has been truncated? */
+            break;
+        }
+
+        reader->segpos += ret;
+        buf += ret;
+        size -= ret;
+        total += ret;
+    }
+    return total;
+}
+
+static int open_ftindex_stream(corsaro_ftindex_reader_t *reader) {
+
+    cookie_io_functions_t funcs;
+    FILE *stream;
+
+    memset(&funcs, 0, sizeof(funcs));
+    funcs.read = ftindex_stream_read;
+
+    stream = fopencookie(reader, "r", funcs);
+    if (stream == NULL) {
+        corsaro_log(reader->logger,
+                "unable to create stream for reading %s: %s",
+                reader->filename, strerror(errno));
+        return -1;
+    }
+
+    if (avro_file_reader_fp(stream, reader->filename, 1, &(reader->in))) {
+        corsaro_log(reader->logger,
+                "unable to open Avro file %s for reading: %s",
+                reader->filename, avro_strerror());
+        reader->in = NULL;
+        return -1;
+    }
+
+    reader->schema = avro_file_reader_get_writer_schema(reader->in);
+    if (reader->schema == NULL) {
+        corsaro_log(reader->logger,
+                "had a problem extracting schema from Avro file %s: %s",
+                reader->filename, avro_strerror());
+        return -1;
+    }
+
+    reader->iface = avro_generic_class_from_schema(reader->schema);
+    if (reader->iface == NULL) {
+        corsaro_log(reader->logger,
+                "unable to create generic interface from Avro schema: %s",
+                avro_strerror());
+        return -1;
+    }
+
+    if (avro_generic_value_new(reader->iface, &(reader->value))) {
+        avro_value_iface_decref(reader->iface);
+        reader->iface = NULL;
+        corsaro_log(reader->logger,
+                "unable to create generic value for reading Avro: %s",
+                avro_strerror());
+        return -1;
+    }
+    return 0;
+}
+
+/** Reads the next flowtuple that matches the reader's query.
+ *
+ *  @param reader   The flowtuple index reader
+ *  @param ft       The flowtuple structure to populate with the next
+ *                  matching flowtuple
+ *  @return 1 if a flowtuple was read, 0 if there are no more matching
+ *          flowtuples, -1 if an error occurs.
+ */
+int corsaro_read_next_ftindex_record(corsaro_ftindex_reader_t *reader,
+        struct corsaro_flowtuple_data *ft) {
+
+    int ret;
+
+    if (reader->in == NULL) {
+        if (reader->indexed && reader->runs_selected == 0) {
+            return 0;
+        }
+        if (open_ftindex_stream(reader) < 0) {
+            return -1;
+        }
+    }
+
+    while ((ret = avro_file_reader_read_value(reader->in,
+                    &(reader->value))) == 0) {
+        decode_flowtuple_from_avro(&(reader->value), ft);
+        if (corsaro_ftindex_record_matches(ft, &(reader->query))) {
+            return 1;
+        }
+    }
+
+    if (ret == EOF) {
+        return 0;
+    }
+
+    corsaro_log(reader->logger,
+            "error while reading Avro record from file: %s", avro_strerror());
+    return -1;
+}
+
+void corsaro_destroy_ftindex_reader(corsaro_ftindex_reader_t *reader) {
+
+    if (reader->iface) {
+        avro_value_decref(&(reader->value));
+        avro_value_iface_decref(reader->iface);
+    }
+
+    if (reader->schema) {
+        avro_schema_decref(reader->schema);
+    }
+
+    if (reader->in) {
+        avro_file_reader_close(reader->in);
+    }
+
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+
+    if (reader->segments) {
+        free(reader->segments);
+    }
+    free(reader);
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,237 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2021 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#ifndef LIBCORSARO_FTINDEX_H_
+#define LIBCORSARO_FTINDEX_H_
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <avro.h>
+
+#include "libcorsaro.h"
+#include "libcorsaro_avro.h"
+#include "libcorsaro_flowtuple.h"
+#include "libcorsaro_log.h"
+
+/* Block index sidecar files for flowtuple avro output.
+ *
+ * Whenever a flowtuple avro file is written, a sidecar file with the same
+ * name plus an ".idx" suffix is written alongside it. The sidecar describes
+ * each run of CORSARO_FTINDEX_BLOCK_RECORDS records in the avro file (which
+ * always starts and ends on an avro block boundary): where the run is in the
+ * file, the smallest and largest flowtuple it contains (according to the
+ * flowtuple sort order), the range of source IPs it covers and a bitmap of
+ * the destination ports it contains.
+ *
+ * Readers can use the index to skip over runs that cannot contain any
+ * flowtuples that match their query, instead of decoding the whole file.
+ *
+ * Index files are written in host byte order.
+ */
+
+/** Magic string at the start of every flowtuple index file */
+#define CORSARO_FTINDEX_MAGIC "CFTINDEX"
+
+/** Current version of the flowtuple index file format */
+#define CORSARO_FTINDEX_VERSION (1)
+
+/** Suffix appended to the avro file name to form the index file name */
+#define CORSARO_FTINDEX_SUFFIX ".idx"
+
+/** Number of flowtuple records described by each index entry */
+#define CORSARO_FTINDEX_BLOCK_RECORDS (4096)
+
+/** Number of bits in the destination port bitmap of each index entry */
+#define CORSARO_FTINDEX_PORT_BITS (2048)
+
+/** Maps a destination port onto a bit in the destination port bitmap.
+ *  Ports below CORSARO_FTINDEX_PORT_BITS each get a bit of their own.
+ */
+#define CORSARO_FTINDEX_PORT_BIT(port) \
+    (((port) ^ ((port) >> 11)) & (CORSARO_FTINDEX_PORT_BITS - 1))
+
+/** Header at the start of a flowtuple index file */
+typedef struct corsaro_ftindex_header {
+    /** Always CORSARO_FTINDEX_MAGIC (without the nul terminator) */
+    char magic[8];
+    /** The version of the index file format */
+    uint32_t version;
+    /** The size of each index entry, in bytes */
+    uint32_t entrysize;
+    /** The offset of the first avro block in the avro file, i.e. the
+     *  length of the avro file header */
+    uint64_t datastart;
+} PACKED corsaro_ftindex_header_t;
+
+/** Describes a single run of records in a flowtuple avro file */
+typedef struct corsaro_ftindex_entry {
+    /** The offset of the first avro block in the run */
+    uint64_t offset;
+    /** The number of bytes of avro blocks in the run */
+    uint64_t length;
+    /** The number of flowtuple records in the run */
+    uint32_t records;
+    /** The smallest flowtuple in the run, using the flowtuple sort order */
+    struct corsaro_flowtuple_data minkey;
+    /** The largest flowtuple in the run, using the flowtuple sort order */
+    struct corsaro_flowtuple_data maxkey;
+    /** The smallest source IP address in the run */
+    uint32_t min_src_ip;
+    /** The largest source IP address in the run */
+    uint32_t max_src_ip;
+    /** Bitmap of the destination ports in the run, see
+     *  CORSARO_FTINDEX_PORT_BIT() */
+    uint8_t dst_ports[CORSARO_FTINDEX_PORT_BITS / 8];
+} PACKED corsaro_ftindex_entry_t;
+
+/** Describes which flowtuples a reader is interested in. Each criteria
+ *  is only applied if the corresponding 'match_' flag is set.
+ */
+typedef struct corsaro_ftindex_query {
+    uint8_t match_time;
+    /** The first interval timestamp to match */
+    uint32_t first_ts;
+    /** The last interval timestamp to match */
+    uint32_t last_ts;
+
+    uint8_t match_src_ip;
+    /** The first source IP address to match (host byte order) */
+    uint32_t first_src_ip;
+    /** The last source IP address to match (host byte order) */
+    uint32_t last_src_ip;
+
+    uint8_t match_dst_port;
+    /** The destination port to match */
+    uint16_t dst_port;
+
+    uint8_t match_protocol;
+    /** The IP protocol to match */
+    uint8_t protocol;
+} corsaro_ftindex_query_t;
+
+/** State for writing the index for a flowtuple avro file */
+typedef struct corsaro_ftindex_writer {
+    /** The name of the index file being written */
+    char *fname;
+    /** The file handle for the index file */
+    FILE *f;
+    /** The index entry for the run that is currently being written */
+    corsaro_ftindex_entry_t current;
+    /** The offset where the next run in the avro file will begin */
+    uint64_t nextoffset;
+    /** A corsaro logger instance for reporting errors */
+    corsaro_logger_t *logger;
+} corsaro_ftindex_writer_t;
+
+/** A contiguous range of bytes in the avro file that must be read */
+typedef struct corsaro_ftindex_segment {
+    uint64_t offset;
+    uint64_t length;
+} corsaro_ftindex_segment_t;
+
+/** State for reading the matching flowtuples from an avro file */
+typedef struct corsaro_ftindex_reader {
+    /** The name of the avro file being read */
+    char *filename;
+    /** The query that flowtuples must match */
+    corsaro_ftindex_query_t query;
+    /** A corsaro logger instance for reporting errors */
+    corsaro_logger_t *logger;
+
+    /** The ranges of the avro file that will be read, starting with the
+     *  avro file header */
+    corsaro_ftindex_segment_t *segments;
+    /** The number of ranges in the segments array */
+    uint32_t segcount;
+    /** The range that is currently being read */
+    uint32_t segcurrent;
+    /** The number of bytes already read from the current range */
+    uint64_t segpos;
+
+    /** File descriptor for the avro file */
+    int fd;
+    /** Avro file reader, reading from the selected ranges of the file */
+    avro_file_reader_t in;
+    avro_schema_t schema;
+    avro_value_iface_t *iface;
+    avro_value_t value;
+
+    /** Set if the avro file had a usable index */
+    uint8_t indexed;
+    /** The number of runs described by the index */
+    uint32_t runs_total;
+    /** The number of runs that the query might match */
+    uint32_t runs_selected;
+} corsaro_ftindex_reader_t;
+
+corsaro_ftindex_writer_t *corsaro_create_ftindex_writer(
+        corsaro_logger_t *logger);
+int corsaro_start_ftindex_writer(corsaro_ftindex_writer_t *iw,
+        corsaro_avro_writer_t *avwrt);
+int corsaro_ftindex_add_record(corsaro_ftindex_writer_t *iw,
+        corsaro_avro_writer_t *avwrt, struct corsaro_flowtuple_data *ft);
+int corsaro_close_ftindex_writer(corsaro_ftindex_writer_t *iw,
+        corsaro_avro_writer_t *avwrt);
+int corsaro_is_ftindex_writer_active(corsaro_ftindex_writer_t *iw);
+void corsaro_destroy_ftindex_writer(corsaro_ftindex_writer_t *iw);
+
+int corsaro_ftindex_entry_matches(corsaro_ftindex_entry_t *entry,
+        corsaro_ftindex_query_t *query);
+int corsaro_ftindex_record_matches(struct corsaro_flowtuple_data *ft,
+        corsaro_ftindex_query_t *query);
+
+corsaro_ftindex_reader_t *corsaro_create_ftindex_reader(
+        corsaro_logger_t *logger, char *filename,
+        corsaro_ftindex_query_t *query);
+int corsaro_read_next_ftindex_record(corsaro_ftindex_reader_t *reader,
+        struct corsaro_flowtuple_data *ft);
+void corsaro_destroy_ftindex_reader(corsaro_ftindex_reader_t *reader);
+
+#endif
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,156 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#ifndef CORSARO_HLL_H
+#define CORSARO_HLL_H
+
+#include <math.h>
+#include <stdint.h>
+
+/* HyperLogLog sketches for estimating the number of unique 32 bit values
+ * (e.g. IP addresses) seen, using a fixed amount of memory.
+ *
+ * A sketch is simply an array of (1 << bits) one-byte registers, which the
+ * caller allocates (zeroed) and frees. The number of index bits is passed
+ * to each function so that plugins can choose their own trade-off between
+ * memory and accuracy: the standard error is roughly 1.04 / sqrt(1 << bits).
+ * Two sketches can only be merged if they use the same number of bits.
+ */
+
+/** Mixes a 32 bit value into a well-distributed 64 bit hash, using the
+ *  splitmix64 finaliser. Addresses are far from uniformly distributed so
+ *  they need to be mixed thoroughly.
+ *
+ *  @param val      The value to hash
+ *  @return the 64 bit hash of the value
+ */
+static inline uint64_t corsaro_hll_hash(uint32_t val) {
+    uint64_t h = val;
+
+    h += 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/** Adds a value to a HyperLogLog sketch.
+ *
+ *  @param regs     The registers for the sketch
+ *  @param bits     The number of index bits used by the sketch
+ *  @param val      The value (e.g. an IP address) to add
+ */
+static inline void corsaro_hll_add(uint8_t *regs, int bits, uint32_t val) {
+    uint64_t h = corsaro_hll_hash(val);
+    uint64_t rest;
+    uint8_t rank;
+
+    rest = (h << bits) | (1ULL << (bits - 1));
+    rank = __builtin_clzll(rest) + 1;
+    if (rank > regs[h >> (64 - bits)]) {
+        regs[h >> (64 - bits)] = rank;
+    }
+}
+
+/** Merges one HyperLogLog sketch into another.
+ *
+ *  @param dst      The sketch to merge into
+ *  @param src      The sketch to merge from
+ *  @param bits     The number of index bits used by both sketches
+ */
+static inline void corsaro_hll_merge(uint8_t *dst, const uint8_t *src,
+        int bits) {
+    int i;
+
+    for (i = 0; i < (1 << bits); i++) {
+        if (src[i] > dst[i]) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+/** Estimates the number of unique values added to a HyperLogLog sketch.
+ *
+ *  @param regs     The registers for the sketch
+ *  @param bits     The number of index bits used by the sketch
+ *  @return the estimated number of unique values
+ */
+static inline uint32_t corsaro_hll_estimate(const uint8_t *regs, int bits) {
+    double sum = 0, est, alpha;
+    double m = (1 << bits);
+    int i, zeros = 0;
+
+    for (i = 0; i < (1 << bits); i++) {
+        sum += ldexp(1.0, -regs[i]);
+        if (regs[i] == 0) {
+            zeros ++;
+        }
+    }
+
+    /* The bias correction constant depends on the number of registers */
+    if (bits <= 4) {
+        alpha = 0.673;
+    } else if (bits == 5) {
+        alpha = 0.697;
+    } else if (bits == 6) {
+        alpha = 0.709;
+    } else {
+        alpha = 0.7213 / (1 + 1.079 / m);
+    }
+    est = alpha * m * m / sum;
+
+    /* Small range correction (linear counting) */
+    if (est <= 2.5 * m && zeros > 0) {
+        est = m * log(m / zeros);
+    }
+    return (uint32_t)(est + 0.5);
+}
+
+#endif
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,169 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "libcorsaro_log.h"
+#include "libcorsaro_membudget.h"
+
+/* The counters in a budget are shared by every thread running the plugin,
+ * so they are updated using atomic operations rather than a mutex -- the
+ * charge and release functions are called on the packet processing path.
+ */
+
+corsaro_mem_budget_t *corsaro_create_mem_budget(const char *name,
+        uint64_t limit) {
+
+    corsaro_mem_budget_t *budget;
+
+    budget = (corsaro_mem_budget_t *)calloc(1, sizeof(corsaro_mem_budget_t));
+    if (budget == NULL) {
+        return NULL;
+    }
+
+    budget->name = strdup(name);
+    budget->limit = limit;
+    return budget;
+}
+
+void corsaro_destroy_mem_budget(corsaro_mem_budget_t *budget) {
+    if (budget == NULL) {
+        return;
+    }
+    if (budget->name) {
+        free(budget->name);
+    }
+    free(budget);
+}
+
+int corsaro_mem_budget_charge(corsaro_mem_budget_t *budget, uint64_t bytes) {
+
+    uint64_t now, peak;
+
+    if (budget == NULL) {
+        return 0;
+    }
+
+    now = __sync_add_and_fetch(&(budget->used), bytes);
+
+    peak = budget->peak;
+    while (now > peak) {
+        if (__sync_bool_compare_and_swap(&(budget->peak), peak, now)) {
+            break;
+        }
+        peak = budget->peak;
+    }
+
+    if (budget->limit > 0 && now > budget->limit) {
+        return 1;
+    }
+    return 0;
+}
+
+void corsaro_mem_budget_release(corsaro_mem_budget_t *budget, uint64_t bytes) {
+
+    if (budget == NULL || bytes == 0) {
+        return;
+    }
+    __sync_sub_and_fetch(&(budget->used), bytes);
+}
+
+int corsaro_mem_budget_exceeded(corsaro_mem_budget_t *budget) {
+    if (budget == NULL || budget->limit == 0) {
+        return 0;
+    }
+    return (budget->used > budget->limit);
+}
+
+void corsaro_mem_budget_note_degraded(corsaro_mem_budget_t *budget) {
+    if (budget == NULL) {
+        return;
+    }
+    __sync_add_and_fetch(&(budget->degradations), 1);
+}
+
+void corsaro_mem_budget_mark_interval(corsaro_mem_budget_t *budget,
+        corsaro_logger_t *logger, uint32_t timestamp, const char *policy) {
+
+    if (budget == NULL) {
+        return;
+    }
+
+    if (budget->last_degraded_ts != timestamp) {
+        budget->last_degraded_ts = timestamp;
+        budget->degraded_intervals ++;
+    }
+
+    corsaro_log(logger,
+            "%s plugin: memory budget of %" PRIu64 " MB was exceeded during interval %u, results are approximate (%s)",
+            budget->name, budget->limit / (1024 * 1024), timestamp, policy);
+}
+
+void corsaro_mem_budget_write_stats(corsaro_mem_budget_t *budget, FILE *f,
+        uint32_t timestamp) {
+
+    if (budget == NULL || f == NULL) {
+        return;
+    }
+
+    fprintf(f, "time=%u plugin=%s limit=%" PRIu64 " used=%" PRIu64
+            " peak=%" PRIu64 " degraded=%u degradations=%u degradedintervals=%u\n",
+            timestamp, budget->name, budget->limit, budget->used,
+            budget->peak, (budget->last_degraded_ts == timestamp) ? 1 : 0,
+            budget->degradations, budget->degraded_intervals);
+
+    /* Start tracking the peak again from where we are now */
+    budget->peak = budget->used;
+    __sync_and_and_fetch(&(budget->degradations), 0);
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,175 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#ifndef CORSARO_MEMBUDGET_H
+#define CORSARO_MEMBUDGET_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "libcorsaro_log.h"
+
+/** Memory accounting for a single plugin.
+ *
+ *  Every thread that is running a plugin charges the memory that it
+ *  allocates for its per-interval state against the plugin's budget (and
+ *  refunds it once that state is freed). If the total exceeds the limit,
+ *  the plugin is expected to switch to a cheaper, less precise way of
+ *  tallying its results for the remainder of the interval.
+ *
+ *  The accounting is approximate by design: plugins charge estimates for
+ *  the structures they allocate rather than tracking every byte.
+ */
+typedef struct corsaro_mem_budget {
+
+    /** The name of the plugin that owns this budget */
+    char *name;
+
+    /** The maximum amount of memory (in bytes) that the plugin should use,
+     *  0 means no limit */
+    uint64_t limit;
+
+    /** The amount of memory (in bytes) currently charged to this budget */
+    uint64_t used;
+
+    /** The largest value of 'used' since the statistics were last read */
+    uint64_t peak;
+
+    /** The timestamp of the most recent interval in which the plugin had
+     *  to degrade its precision */
+    uint32_t last_degraded_ts;
+
+    /** Total number of intervals in which the plugin had to degrade its
+     *  precision */
+    uint32_t degraded_intervals;
+
+    /** Number of times a thread has switched to degraded mode since the
+     *  statistics were last read */
+    uint32_t degradations;
+
+} corsaro_mem_budget_t;
+
+/** Creates a new memory budget.
+ *
+ *  @param name         The name of the plugin that will own the budget
+ *  @param limit        The memory limit in bytes (0 = unlimited)
+ *
+ *  @return a pointer to the new budget, or NULL if an error occurred.
+ */
+corsaro_mem_budget_t *corsaro_create_mem_budget(const char *name,
+        uint64_t limit);
+
+/** Destroys a memory budget.
+ *
+ *  @param budget       The budget to destroy
+ */
+void corsaro_destroy_mem_budget(corsaro_mem_budget_t *budget);
+
+/** Charges some memory usage against a budget. Safe to call concurrently
+ *  from multiple threads.
+ *
+ *  @param budget       The budget to charge (may be NULL)
+ *  @param bytes        The amount of memory that has been allocated
+ *
+ *  @return 1 if the budget has now been exceeded, 0 otherwise.
+ */
+int corsaro_mem_budget_charge(corsaro_mem_budget_t *budget, uint64_t bytes);
+
+/** Refunds previously charged memory usage back to a budget. Safe to call
+ *  concurrently from multiple threads.
+ *
+ *  @param budget       The budget to refund (may be NULL)
+ *  @param bytes        The amount of memory that has been released
+ */
+void corsaro_mem_budget_release(corsaro_mem_budget_t *budget, uint64_t bytes);
+
+/** Checks whether a budget has been exceeded.
+ *
+ *  @param budget       The budget to check (may be NULL)
+ *
+ *  @return 1 if the memory charged to the budget is greater than its limit,
+ *          0 otherwise.
+ */
+int corsaro_mem_budget_exceeded(corsaro_mem_budget_t *budget);
+
+/** Records that a thread has switched to a degraded (lower precision)
+ *  mode of operation because the budget has been exceeded.
+ *
+ *  @param budget       The budget that was exceeded
+ */
+void corsaro_mem_budget_note_degraded(corsaro_mem_budget_t *budget);
+
+/** Records that the results for an interval were produced (at least in
+ *  part) in a degraded mode and logs a message saying so. Should be called
+ *  by the plugin when merging the results for the interval.
+ *
+ *  @param budget       The budget that was exceeded
+ *  @param logger       The logger to write the message to
+ *  @param timestamp    The timestamp of the affected interval
+ *  @param policy       A short description of how precision was reduced
+ */
+void corsaro_mem_budget_mark_interval(corsaro_mem_budget_t *budget,
+        corsaro_logger_t *logger, uint32_t timestamp, const char *policy);
+
+/** Writes the current statistics for a budget to a file in the same
+ *  key=value format as the other corsarotrace statistics, then resets the
+ *  per-interval counters.
+ *
+ *  @param budget       The budget to report on
+ *  @param f            The file to write the statistics to
+ *  @param timestamp    The timestamp of the interval that has just been
+ *                      merged
+ */
+void corsaro_mem_budget_write_stats(corsaro_mem_budget_t *budget, FILE *f,
+        uint32_t timestamp);
+
+#endif
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
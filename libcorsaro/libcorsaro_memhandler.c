@@ -155,6 +155,8 @@ static inline corsaro_memsource_t *create_fresh_blob(uint32_t itemcount,
         return NULL;
     }
 
+    corsaro_mem_budget_charge(handler->budget, upsize);
+
     blob->blobsize = upsize;
     blob->itemsize = itemsize;
     blob->alloceditems = itemcount;
@@ -176,6 +178,7 @@ void init_corsaro_memhandler(corsaro_logger_t *logger,
     handler->itemsize = itemsize;
     handler->users = 1;
     handler->pagesize = sysconf(_SC_PAGE_SIZE);
+    handler->budget = NULL;
 
     pthread_mutex_init(&handler->mutex, NULL);
 
@@ -205,6 +208,7 @@ void destroy_corsaro_memhandler(corsaro_memhandler_t *handler) {
     while (blob) {
         tmp = blob;
         blob = blob->nextfree;
+        corsaro_mem_budget_release(handler->budget, tmp->blobsize);
         munmap(tmp->blob, tmp->blobsize);
         free(tmp);
     }
@@ -215,6 +219,8 @@ void destroy_corsaro_memhandler(corsaro_memhandler_t *handler) {
      * memory handler around to use to release them...
      */
     if (handler->current->released >= handler->current->nextavail) {
+        corsaro_mem_budget_release(handler->budget,
+                handler->current->blobsize);
         munmap(handler->current->blob, handler->current->blobsize);
         free(handler->current);
     }
@@ -229,6 +235,26 @@ void add_corsaro_memhandler_user(corsaro_memhandler_t *handler) {
     pthread_mutex_unlock(&handler->mutex);
 }
 
+void set_corsaro_memhandler_budget(corsaro_memhandler_t *handler,
+        corsaro_mem_budget_t *budget) {
+
+    corsaro_memsource_t *blob;
+
+    pthread_mutex_lock(&handler->mutex);
+    handler->budget = budget;
+
+    /* Charge for any blobs that were allocated before we had a budget */
+    if (handler->current) {
+        corsaro_mem_budget_charge(budget, handler->current->blobsize);
+    }
+    blob = handler->freelist;
+    while (blob) {
+        corsaro_mem_budget_charge(budget, blob->blobsize);
+        blob = blob->nextfree;
+    }
+    pthread_mutex_unlock(&handler->mutex);
+}
+
 static inline uint8_t *_get_corsaro_memhandler_item(
         corsaro_memhandler_t *handler, corsaro_memsource_t **itemsource) {
 
@@ -320,6 +346,7 @@ static inline void _release_corsaro_memhandler_item(
         corsaro_memsource_t *tmp = handler->freelist;
         handler->freelist = handler->freelist->nextfree;
         handler->freelistavail --;
+        corsaro_mem_budget_release(handler->budget, tmp->blobsize);
         munmap(tmp->blob, tmp->blobsize);
         free(tmp);
     }
@@ -56,6 +56,7 @@
 #include <pthread.h>
 
 #include "libcorsaro_log.h"
+#include "libcorsaro_membudget.h"
 
 typedef struct corsaro_memblob corsaro_memsource_t;
 
@@ -131,6 +132,11 @@ typedef struct corsaro_memhandler {
      */
     size_t pagesize;
 
+    /** The memory budget that blobs allocated by this handler are charged
+     *  against (NULL if the memory is not being accounted for).
+     */
+    corsaro_mem_budget_t *budget;
+
 } corsaro_memhandler_t;
 
 /** Initialises a new memory handler and allocates the first memory blob.
@@ -165,6 +171,15 @@ void destroy_corsaro_memhandler(corsaro_memhandler_t *handler);
  */
 void add_corsaro_memhandler_user(corsaro_memhandler_t *handler);
 
+/** Charges all memory allocated by a memory handler, now and in the future,
+ *  against a memory budget.
+ *
+ *  @param handler      The memory handler to account for
+ *  @param budget       The budget to charge the handler's memory against
+ */
+void set_corsaro_memhandler_budget(corsaro_memhandler_t *handler,
+        corsaro_mem_budget_t *budget);
+
 /** Requests a reference to a single, unused instance of the structure that is
  *  being bulk allocated by a memory handler.
  *
@@ -51,6 +51,7 @@
 
 #include <assert.h>
 #include "libcorsaro_plugin.h"
+#include "libcorsaro_common.h"
 
 #ifdef WITH_PLUGIN_SIXT
 #include "corsaro_flowtuple.h"
@@ -60,6 +61,10 @@
 #include "corsaro_dos.h"
 #endif
 
+#ifdef WITH_PLUGIN_SCAN
+#include "corsaro_scan.h"
+#endif
+
 #ifdef WITH_PLUGIN_REPORT
 #include "report/corsaro_report.h"
 #endif
@@ -192,6 +197,7 @@ void corsaro_cleanse_plugin_list(corsaro_plugin_t *plist) {
         p = plist;
         plist = p->next;
         p->destroy_self(p);
+        corsaro_destroy_mem_budget(p->budget);
         free(p);
     }
 }
@@ -229,12 +235,62 @@ void corsaro_disable_plugin(corsaro_plugin_t *p) {
     p->enabled = 0;
 }
 
+/** Looks for the options that are common to all plugins (i.e.
+ *  'memorybudget' and 'optional') in a plugin's configuration. These
+ *  are handled here rather than in each plugin's own config parser.
+ */
+static void parse_plugin_common_options(corsaro_plugin_t *p,
+        yaml_document_t *doc, yaml_node_t *options) {
+
+    yaml_node_t *key, *value;
+    yaml_node_pair_t *pair;
+    uint64_t limit;
+
+    if (options->type != YAML_MAPPING_NODE) {
+        return;
+    }
+
+    for (pair = options->data.mapping.pairs.start;
+            pair < options->data.mapping.pairs.top; pair ++) {
+
+        key = yaml_document_get_node(doc, pair->key);
+        value = yaml_document_get_node(doc, pair->value);
+
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value,
+                        "memorybudget") == 0) {
+            /* specified in MB */
+            limit = strtoull((char *)value->data.scalar.value, NULL, 10);
+            if (limit == 0) {
+                continue;
+            }
+            corsaro_destroy_mem_budget(p->budget);
+            p->budget = corsaro_create_mem_budget(p->name,
+                    limit * 1024 * 1024);
+            corsaro_log(p->logger,
+                    "%s plugin: using a memory budget of %" PRIu64 " MB",
+                    p->name, limit);
+        }
+
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value,
+                        "optional") == 0) {
+            if (parse_onoff_option(p->logger,
+                        (char *)value->data.scalar.value, &(p->optional),
+                        "optional output") < 0) {
+                continue;
+            }
+        }
+    }
+}
+
 int corsaro_configure_plugin(corsaro_plugin_t *p, yaml_document_t *doc,
         yaml_node_t *options) {
 
     if (p->config) {
         free(p->config);
     }
+    parse_plugin_common_options(p, doc, options);
     return p->parse_config(p, doc, options);
 }
 
@@ -264,6 +320,7 @@ corsaro_plugin_set_t *corsaro_start_plugins(corsaro_logger_t *logger,
     pset->plugin_state = (void **) malloc(sizeof(void *) * count);
     pset->api = CORSARO_TRACE_API;
     pset->globlogger = logger;
+    pset->shedding = 0;
 
     memset(pset->plugin_state, 0, sizeof(void *) * count);
 
@@ -293,6 +350,7 @@ corsaro_plugin_set_t *corsaro_start_merging_plugins(corsaro_logger_t *logger,
     pset->plugin_state = (void **) malloc(sizeof(void *) * count);
     pset->api = CORSARO_MERGING_API;
     pset->globlogger = logger;
+    pset->shedding = 0;
 
     memset(pset->plugin_state, 0, sizeof(void *) * count);
 
@@ -342,7 +400,9 @@ int corsaro_push_packet_plugins(corsaro_plugin_set_t *pset,
     }
 
     while (p != NULL) {
-        p->process_packet(p, pset->plugin_state[index], packet, tags);
+        if (!pset->shedding || !p->optional) {
+            p->process_packet(p, pset->plugin_state[index], packet, tags);
+        }
         p = p->next;
         index ++;
     }
@@ -458,6 +518,12 @@ int corsaro_merge_plugin_outputs(corsaro_logger_t *logger,
             plugin_state_ptrs[pindex] = fin->thread_plugin_data[pindex][index];
         }
 
+        if (fin->shed && p->optional) {
+            corsaro_log(logger,
+                    "%s plugin: packets were shed during interval %u because the merger fell behind, results are incomplete",
+                    p->name, fin->timestamp);
+        }
+
         if ((r = p->merge_interval_results(p, pset->plugin_state[index],
                 plugin_state_ptrs, fin, tagsock)) == -1) {
 
@@ -57,6 +57,7 @@
 #include "libcorsaro.h"
 #include "libcorsaro_log.h"
 #include "libcorsaro_libtimeseries.h"
+#include "libcorsaro_membudget.h"
 
 /** Convenience macros that define all the function prototypes for the corsaro
  * plugin API
@@ -89,6 +90,7 @@
 typedef enum corsaro_plugin_id {
     CORSARO_PLUGIN_ID_FLOWTUPLE = 20,
     CORSARO_PLUGIN_ID_DOS = 30,
+    CORSARO_PLUGIN_ID_SCAN = 40,
     CORSARO_PLUGIN_ID_REPORT = 100,
     CORSARO_PLUGIN_ID_WDCAP = 200,
     CORSARO_PLUGIN_ID_NULL = 205,
@@ -189,6 +191,10 @@ struct corsaro_plugin {
                             // created specifically for this plugin. If 0,
                             // ->logger points to the global logger.
     corsaro_logger_t *logger;
+    corsaro_mem_budget_t *budget;   // memory accounting for this plugin, NULL
+                                    // if no 'memorybudget' was configured
+    uint8_t optional;   // if 1, the plugin may stop processing packets while
+                        // the merging thread is falling behind
     corsaro_plugin_t *next;
 
 };
@@ -199,6 +205,7 @@ typedef struct corsaro_running_plugins {
     void ** plugin_state;
     corsaro_logger_t *globlogger;
     uint8_t api;
+    uint8_t shedding;   // if 1, packets are not passed to optional plugins
 } corsaro_plugin_set_t;
 
 corsaro_plugin_t *corsaro_load_all_plugins(corsaro_logger_t *logger);
@@ -255,7 +262,7 @@ int corsaro_is_backscatter_packet(libtrace_packet_t *packet,
   plugin##_rotate_output
 
 #define CORSARO_PLUGIN_GENERATE_TAIL                            \
-  NULL, 0, 0, NULL, NULL
+  NULL, 0, 0, NULL, NULL, 0, NULL
 
 #endif
 // vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -56,6 +56,7 @@
 #include "libcorsaro_filtering.h"
 #include "libcorsaro_common.h"
 #include "libcorsaro_tagging.h"
+#include "libcorsaro_flowtuple.h"
 #include "libcorsaro_log.h"
 
 typedef struct hash_fields {
@@ -69,19 +70,10 @@ typedef struct hash_fields {
     uint8_t protocol;
 } hash_fields_t;
 
-#define CORSARO_TAG_SHIFT_AND_XOR(value) \
-  h ^= (h << 5) + (h >> 27) + (value)
-
 static inline uint32_t calc_flow_hash(hash_fields_t *hf) {
-    uint32_t h = hf->src_ip * 59;
-    CORSARO_TAG_SHIFT_AND_XOR(hf->dst_ip);
-    CORSARO_TAG_SHIFT_AND_XOR(((uint32_t)hf->src_port) << 16);
-    CORSARO_TAG_SHIFT_AND_XOR((uint32_t)hf->dst_port);
-    CORSARO_TAG_SHIFT_AND_XOR((((uint32_t)hf->ttl) << 24) |
-            (((uint32_t)hf->tcpflags) << 16));
-    CORSARO_TAG_SHIFT_AND_XOR((((uint32_t)hf->protocol) << 8) |
-            (((uint32_t)hf->ip_len)));
-    return h;
+    return corsaro_flowtuple_fold_hash(corsaro_flowtuple_key_hash(
+            hf->src_ip, hf->dst_ip, hf->src_port, hf->dst_port,
+            hf->protocol, hf->ttl, hf->tcpflags, hf->ip_len));
 }
 
 corsaro_packet_tagger_t *corsaro_create_packet_tagger(corsaro_logger_t *logger,
@@ -103,6 +95,10 @@ corsaro_packet_tagger_t *corsaro_create_packet_tagger(corsaro_logger_t *logger,
      */
     tagger->logger = logger;
     tagger->ipmeta_state = ipmeta;
+    tagger->memo_enabled = 0;
+    tagger->memo.valid = 0;
+    tagger->memo_lookups = 0;
+    tagger->memo_hits = 0;
 
     if (ipmeta) {
         if (ipmeta->pfxipmeta) {
@@ -379,6 +375,16 @@ void corsaro_replace_tagger_ipmeta(corsaro_packet_tagger_t *tagger,
     pthread_mutex_unlock(&(replace->mutex));
 
     tagger->ipmeta_state = replace;
+
+    /* Any memoised results came from the old IPmeta data */
+    tagger->memo.valid = 0;
+}
+
+void corsaro_set_tagger_source_memo(corsaro_packet_tagger_t *tagger,
+        uint8_t enabled) {
+
+    tagger->memo_enabled = enabled;
+    tagger->memo.valid = 0;
 }
 
 void corsaro_destroy_packet_tagger(corsaro_packet_tagger_t *tagger) {
@@ -550,37 +556,63 @@ static inline void update_filter_tags(corsaro_logger_t *logger,
 
 }
 
-static inline int _corsaro_tag_ip_packet(corsaro_packet_tagger_t *tagger,
-        corsaro_packet_tags_t *tags, libtrace_ip_t *ip, uint32_t rem) {
-
-    uint64_t numips = 0;
-    ipmeta_record_t *rec;
+static inline void save_source_memo(corsaro_source_memo_t *memo,
+        corsaro_packet_tags_t *tags, uint32_t src_ip) {
+
+    /* Bit zero belongs to the basic tags, which we always recompute */
+    memo->providers_used = tags->providers_used & (~((uint32_t)1));
+    memo->netacq_region = tags->netacq_region;
+    memcpy(memo->netacq_polygon, tags->netacq_polygon,
+            sizeof(uint32_t) * MAX_NETACQ_POLYGONS);
+    memo->prefixasn = tags->prefixasn;
+    memo->maxmind_country = tags->maxmind_country;
+    memo->netacq_country = tags->netacq_country;
+    memo->maxmind_continent = tags->maxmind_continent;
+    memo->netacq_continent = tags->netacq_continent;
+    memo->src_ip = src_ip;
+    memo->valid = 1;
+}
 
-    update_filter_tags(tagger->logger, ip, rem, tags);
-    if (ip == NULL) {
-        return 0;
-    }
+static inline void apply_source_memo(corsaro_source_memo_t *memo,
+        corsaro_packet_tags_t *tags) {
+
+    tags->providers_used |= memo->providers_used;
+    tags->netacq_region = memo->netacq_region;
+    memcpy(tags->netacq_polygon, memo->netacq_polygon,
+            sizeof(uint32_t) * MAX_NETACQ_POLYGONS);
+    tags->prefixasn = memo->prefixasn;
+    tags->maxmind_country = memo->maxmind_country;
+    tags->netacq_country = memo->netacq_country;
+    tags->maxmind_continent = memo->maxmind_continent;
+    tags->netacq_continent = memo->netacq_continent;
+}
 
-    update_basic_tags(tagger->logger, tags, ip, &rem);
+/** Looks up a source address using libipmeta and updates the provider
+ *  tags accordingly.
+ *
+ *  Note that the providers_used field is left in host byte order, so the
+ *  caller is responsible for converting it once all tagging is complete.
+ */
+static inline int lookup_ipmeta_tags(corsaro_packet_tagger_t *tagger,
+        corsaro_packet_tags_t *tags, struct in_addr *src, uint8_t usememo) {
 
-    if (tagger->providers == 0) {
-        return 0;
-    }
+    uint64_t numips = 0;
+    ipmeta_record_t *rec;
 
-    /* We only care about the source address on the telescope.
-     *
-     * If we want to tag bidirectional traffic in the future then we will
-     * have to expand our tag structure and run the providers against the
-     * dest address too.
-     */
-    if (tagger->records == NULL) {
-        tags->providers_used = htonl(tags->providers_used);
-        return 0;
+    if (usememo) {
+        tagger->memo_lookups ++;
+        if (tagger->memo.valid && tagger->memo.src_ip == src->s_addr) {
+            /* Same source as the previous lookup, so the libipmeta
+             * results will be identical */
+            tagger->memo_hits ++;
+            apply_source_memo(&(tagger->memo), tags);
+            return 0;
+        }
     }
 
     ipmeta_record_set_clear(tagger->records);
     if (ipmeta_lookup_addr(tagger->ipmeta_state->ipmeta, AF_INET,
-            (void *)(&(ip->ip_src)), 0, tagger->records) < 0) {
+            (void *)src, 0, tagger->records) < 0) {
         corsaro_log(tagger->logger, "error while performing ipmeta lookup");
         return -1;
     }
@@ -608,6 +640,76 @@ static inline int _corsaro_tag_ip_packet(corsaro_packet_tagger_t *tagger,
                 printf("???: %u\n", rec->source);
         }
     }
+
+    if (usememo) {
+        save_source_memo(&(tagger->memo), tags, src->s_addr);
+    }
+    return 0;
+}
+
+static inline int _corsaro_tag_ip_packet(corsaro_packet_tagger_t *tagger,
+        corsaro_packet_tags_t *tags, libtrace_ip_t *ip, uint32_t rem,
+        corsaro_ipmeta_batch_t *batch) {
+
+    int ret;
+
+    update_filter_tags(tagger->logger, ip, rem, tags);
+    if (ip == NULL) {
+        return 0;
+    }
+
+    update_basic_tags(tagger->logger, tags, ip, &rem);
+
+    if (tagger->providers == 0) {
+        return 0;
+    }
+
+    /* We only care about the source address on the telescope.
+     *
+     * If we want to tag bidirectional traffic in the future then we will
+     * have to expand our tag structure and run the providers against the
+     * dest address too.
+     */
+    if (tagger->records == NULL) {
+        tags->providers_used = htonl(tags->providers_used);
+        return 0;
+    }
+
+    if (batch) {
+        /* Defer the lookup until corsaro_tag_ipmeta_batch() is called */
+        if (batch->used == batch->size) {
+            corsaro_ipmeta_batch_item_t *items;
+
+            items = realloc(batch->items, (batch->size + 1024) *
+                    sizeof(corsaro_ipmeta_batch_item_t));
+            if (items == NULL) {
+                corsaro_log(tagger->logger,
+                        "OOM while growing ipmeta lookup batch");
+                return -1;
+            }
+            batch->items = items;
+
+            items = realloc(batch->scratch, (batch->size + 1024) *
+                    sizeof(corsaro_ipmeta_batch_item_t));
+            if (items == NULL) {
+                corsaro_log(tagger->logger,
+                        "OOM while growing ipmeta lookup batch");
+                return -1;
+            }
+            batch->scratch = items;
+            batch->size += 1024;
+        }
+        batch->items[batch->used].src_ip = ntohl(ip->ip_src.s_addr);
+        batch->items[batch->used].tags = tags;
+        batch->used ++;
+        return 0;
+    }
+
+    ret = lookup_ipmeta_tags(tagger, tags, &(ip->ip_src),
+            tagger->memo_enabled);
+    if (ret < 0) {
+        return ret;
+    }
     tags->providers_used = htonl(tags->providers_used);
     return 0;
 }
@@ -634,14 +736,154 @@ int corsaro_tag_packet(corsaro_packet_tagger_t *tagger,
         return 0;
     }
 
-    return _corsaro_tag_ip_packet(tagger, tags, ip, rem);
+    return _corsaro_tag_ip_packet(tagger, tags, ip, rem, NULL);
 
 }
 
 int corsaro_tag_ippayload(corsaro_packet_tagger_t *tagger,
         corsaro_packet_tags_t *tags, libtrace_ip_t *ip, uint32_t rem) {
 
-    return _corsaro_tag_ip_packet(tagger, tags, ip, rem);
+    return _corsaro_tag_ip_packet(tagger, tags, ip, rem, NULL);
+}
+
+int corsaro_tag_ippayload_deferred(corsaro_packet_tagger_t *tagger,
+        corsaro_packet_tags_t *tags, libtrace_ip_t *ip, uint32_t rem,
+        corsaro_ipmeta_batch_t *batch) {
+
+    return _corsaro_tag_ip_packet(tagger, tags, ip, rem, batch);
+}
+
+/** Sorts the deferred lookups in a batch by source address.
+ *
+ *  This runs once for every buffer that a tagger thread receives, so it
+ *  uses a radix sort (one pass per address byte) rather than qsort. Passes
+ *  where every address has the same value for that byte are skipped, and
+ *  batches that are already in order (e.g. a buffer that contains a single
+ *  scanner's packet train) are not sorted at all.
+ *
+ *  @param batch        The batch to sort.
+ */
+static void sort_batch_items(corsaro_ipmeta_batch_t *batch) {
+
+    uint32_t counts[256];
+    uint32_t i, offset, n = batch->used;
+    corsaro_ipmeta_batch_item_t *from = batch->items;
+    corsaro_ipmeta_batch_item_t *to = batch->scratch;
+    corsaro_ipmeta_batch_item_t *tmp;
+    int shift;
+
+    for (i = 1; i < n; i++) {
+        if (from[i].src_ip < from[i - 1].src_ip) {
+            break;
+        }
+    }
+    if (i >= n) {
+        return;
+    }
+
+    for (shift = 0; shift < 32; shift += 8) {
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < n; i++) {
+            counts[(from[i].src_ip >> shift) & 0xff] ++;
+        }
+
+        if (counts[(from[0].src_ip >> shift) & 0xff] == n) {
+            continue;
+        }
+
+        offset = 0;
+        for (i = 0; i < 256; i++) {
+            uint32_t c = counts[i];
+            counts[i] = offset;
+            offset += c;
+        }
+
+        for (i = 0; i < n; i++) {
+            to[counts[(from[i].src_ip >> shift) & 0xff] ++] = from[i];
+        }
+
+        tmp = from;
+        from = to;
+        to = tmp;
+    }
+
+    if (from != batch->items) {
+        memcpy(batch->items, from, n * sizeof(corsaro_ipmeta_batch_item_t));
+    }
+}
+
+int corsaro_tag_ipmeta_batch(corsaro_packet_tagger_t *tagger,
+        corsaro_ipmeta_batch_t *batch) {
+
+    uint32_t i;
+    struct in_addr src;
+    int ret = 0;
+
+    if (batch->used == 0) {
+        return 0;
+    }
+
+    /* Walking the prefix trie in address order means that consecutive
+     * lookups mostly touch nodes that are already in cache, and (if the
+     * source memo is enabled) any repeated sources collapse into a single
+     * lookup.
+     */
+    sort_batch_items(batch);
+
+    for (i = 0; i < batch->used; i++) {
+        corsaro_packet_tags_t *tags = batch->items[i].tags;
+
+        if (i + 1 < batch->used) {
+            __builtin_prefetch(batch->items[i + 1].tags, 1, 0);
+        }
+
+        src.s_addr = htonl(batch->items[i].src_ip);
+        if (lookup_ipmeta_tags(tagger, tags, &src,
+                tagger->memo_enabled) < 0) {
+            ret = -1;
+        }
+        tags->providers_used = htonl(tags->providers_used);
+    }
+
+    batch->used = 0;
+    return ret;
+}
+
+corsaro_ipmeta_batch_t *corsaro_create_ipmeta_batch(void) {
+    corsaro_ipmeta_batch_t *batch;
+
+    batch = calloc(1, sizeof(corsaro_ipmeta_batch_t));
+    if (batch == NULL) {
+        return NULL;
+    }
+
+    batch->size = 1024;
+    batch->used = 0;
+    batch->items = calloc(batch->size, sizeof(corsaro_ipmeta_batch_item_t));
+    if (batch->items == NULL) {
+        free(batch);
+        return NULL;
+    }
+    batch->scratch = calloc(batch->size, sizeof(corsaro_ipmeta_batch_item_t));
+    if (batch->scratch == NULL) {
+        free(batch->items);
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+void corsaro_free_ipmeta_batch(corsaro_ipmeta_batch_t *batch) {
+    if (batch == NULL) {
+        return;
+    }
+    if (batch->items) {
+        free(batch->items);
+    }
+    if (batch->scratch) {
+        free(batch->scratch);
+    }
+    free(batch);
 }
 
 corsaro_tagged_loss_tracker_t *corsaro_create_tagged_loss_tracker(
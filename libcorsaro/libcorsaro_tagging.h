@@ -259,6 +259,47 @@ typedef struct corsaro_ipmeta_state {
 
 } corsaro_ipmeta_state_t;
 
+/** Cached libipmeta results for the most recently tagged source address.
+ *
+ *  Scanners tend to emit long trains of packets from the same source, so
+ *  remembering the tags derived for the previous source lets us skip the
+ *  libipmeta lookup for most packets in a train. Only tags that depend
+ *  solely on the source address are stored here -- filters, ports and the
+ *  flow hash are always recomputed.
+ */
+typedef struct corsaro_source_memo {
+
+    /** Flag indicating whether the memo contains a usable result */
+    uint8_t valid;
+
+    /** The source address (network byte order) that the memo refers to */
+    uint32_t src_ip;
+
+    /** The libipmeta provider bits that were set by the lookup */
+    uint32_t providers_used;
+
+    /** Cached netacq-edge region tag (network byte order) */
+    uint16_t netacq_region;
+
+    /** Cached netacq-edge polygon tags (network byte order) */
+    uint32_t netacq_polygon[MAX_NETACQ_POLYGONS];
+
+    /** Cached prefix2asn tag (network byte order) */
+    uint32_t prefixasn;
+
+    /** Cached maxmind country tag */
+    uint16_t maxmind_country;
+
+    /** Cached netacq-edge country tag */
+    uint16_t netacq_country;
+
+    /** Cached maxmind continent tag */
+    uint16_t maxmind_continent;
+
+    /** Cached netacq-edge continent tag */
+    uint16_t netacq_continent;
+} corsaro_source_memo_t;
+
 /** Structure that maintains state required for tagging packets. */
 typedef struct corsaro_packet_tagger {
 
@@ -273,8 +314,46 @@ typedef struct corsaro_packet_tagger {
     /** A record set that is used to store the results of a libipmeta lookup */
     ipmeta_record_set_t *records;
 
+    /** Flag indicating whether libipmeta results should be re-used for
+     *  consecutive packets from the same source address */
+    uint8_t memo_enabled;
+
+    /** The libipmeta results for the previous source address */
+    corsaro_source_memo_t memo;
+
+    /** Number of libipmeta lookups that have been required so far */
+    uint64_t memo_lookups;
+
+    /** Number of libipmeta lookups that were answered using the memo */
+    uint64_t memo_hits;
+
 } corsaro_packet_tagger_t;
 
+/** A packet whose libipmeta lookup has been deferred until the rest of
+ *  its batch has been collected. */
+typedef struct corsaro_ipmeta_batch_item {
+    /** The source address to look up (host byte order, for sorting) */
+    uint32_t src_ip;
+
+    /** The tags that the lookup results should be written into */
+    corsaro_packet_tags_t *tags;
+} corsaro_ipmeta_batch_item_t;
+
+/** A set of deferred libipmeta lookups. */
+typedef struct corsaro_ipmeta_batch {
+    /** The deferred lookups */
+    corsaro_ipmeta_batch_item_t *items;
+
+    /** The number of deferred lookups in the items array */
+    uint32_t used;
+
+    /** The number of lookups that the items array can hold */
+    uint32_t size;
+
+    /** Scratch space for sorting the items array, same size as items */
+    corsaro_ipmeta_batch_item_t *scratch;
+} corsaro_ipmeta_batch_t;
+
 /** Set of configuration options for the libipmeta prefix2asn provider. */
 typedef struct prefix2asn_options {
     /** Name of the data structure to use for storing the data. */
@@ -378,6 +457,15 @@ void corsaro_free_ipmeta_label_map(Pvoid_t labelmap, int dofree);
 void corsaro_replace_tagger_ipmeta(corsaro_packet_tagger_t *tagger,
         corsaro_ipmeta_state_t *replace);
 
+/** Enables or disables re-use of libipmeta results for consecutive
+ *  packets that share the same source address.
+ *
+ *  @param tagger       The corsaro tagger to configure.
+ *  @param enabled      If non-zero, the source memo will be used.
+ */
+void corsaro_set_tagger_source_memo(corsaro_packet_tagger_t *tagger,
+        uint8_t enabled);
+
 /** Destroys a corsaro packet tagger instance, freeing any allocated memory.
  *
  *  @param tagger       The corsaro tagger to be destroyed.
@@ -419,6 +507,55 @@ int corsaro_tag_ippayload(corsaro_packet_tagger_t *tagger,
         corsaro_packet_tags_t *tags, libtrace_ip_t *ip, uint32_t rem);
 
 
+/** Derives the set of tags that should be applied to a given IP packet,
+ *  but defers any libipmeta lookups by adding them to a batch instead.
+ *  The lookups are completed by a subsequent call to
+ *  corsaro_tag_ipmeta_batch().
+ *
+ *  @param tagger       The corsaro tagger to use when doing the tagging.
+ *  @param tags         A pointer to the set of tags that is to be updated by
+ *                      this function. Must remain valid until the batch
+ *                      has been completed.
+ *  @param ip           The IP header of the packet that will be 'tagged'.
+ *  @param rem          The amount of bytes remaining in the packet, starting
+ *                      from the IP header.
+ *  @param batch        The batch to add the libipmeta lookup to.
+ *  @return 0 if successful, -1 if an error occurred.
+ *
+ *  @note Until the batch is completed, the libipmeta tags are not set and
+ *  the providers_used field is NOT in network byte order.
+ */
+int corsaro_tag_ippayload_deferred(corsaro_packet_tagger_t *tagger,
+        corsaro_packet_tags_t *tags, libtrace_ip_t *ip, uint32_t rem,
+        corsaro_ipmeta_batch_t *batch);
+
+/** Performs all of the libipmeta lookups that have been deferred into a
+ *  batch, completing the tags for each packet in the batch.
+ *
+ *  Lookups are performed in source address order so that consecutive
+ *  lookups share as much of the prefix trie as possible. If the tagger's
+ *  source memo is enabled, repeated sources only require a single lookup.
+ *
+ *  @param tagger       The corsaro tagger that created the batch.
+ *  @param batch        The batch of deferred lookups. Will be empty once
+ *                      this function returns.
+ *  @return 0 if successful, -1 if any lookup failed.
+ */
+int corsaro_tag_ipmeta_batch(corsaro_packet_tagger_t *tagger,
+        corsaro_ipmeta_batch_t *batch);
+
+/** Allocates an empty batch for deferred libipmeta lookups.
+ *
+ *  @return a pointer to a new batch, or NULL if an error occurred.
+ */
+corsaro_ipmeta_batch_t *corsaro_create_ipmeta_batch(void);
+
+/** Frees a batch for deferred libipmeta lookups.
+ *
+ *  @param batch        The batch to be freed.
+ */
+void corsaro_free_ipmeta_batch(corsaro_ipmeta_batch_t *batch);
+
 corsaro_tagged_loss_tracker_t *corsaro_create_tagged_loss_tracker(
         uint8_t maxhashbins);
 
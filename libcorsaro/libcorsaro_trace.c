@@ -55,6 +55,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include <aio.h>
 
@@ -70,6 +71,18 @@
 /** Amount of data required in a buffer before scheduling an async write */
 #define MIN_WRITE_TRIGGER (4 * 1024 * 1024)
 
+/** Length of an Ethernet header without any VLAN tags */
+#define ETHERNET_HEADER_LEN 14
+
+/** Alignment required for buffers, offsets and lengths when using O_DIRECT */
+#define FAST_WRITER_ALIGNMENT 4096
+
+/** Rounds a length down to the nearest multiple of FAST_WRITER_ALIGNMENT */
+#define ALIGN_DOWN(x) ((x) & ~(FAST_WRITER_ALIGNMENT - 1))
+
+/** Rounds a length up to the nearest multiple of FAST_WRITER_ALIGNMENT */
+#define ALIGN_UP(x) ALIGN_DOWN((x) + FAST_WRITER_ALIGNMENT - 1)
+
 /** Quick macro for figuring out the index of the buffer that we should
  *  append new packets into.
  */
@@ -222,9 +235,18 @@ corsaro_fast_trace_writer_t *corsaro_create_fast_trace_writer() {
 
     /* To avoid reallocating these buffers for every file, we allow
      * users to re-use a single fast writer.
+     *
+     * Buffers are page-aligned so that they can be handed straight to
+     * the kernel if the writer is later switched to direct I/O.
      */
-    writer->localbuf[0] = malloc(FAST_WRITER_BUFFER_SIZE);
-    writer->localbuf[1] = malloc(FAST_WRITER_BUFFER_SIZE);
+    if (posix_memalign((void **)&(writer->localbuf[0]), FAST_WRITER_ALIGNMENT,
+                FAST_WRITER_BUFFER_SIZE) != 0 ||
+            posix_memalign((void **)&(writer->localbuf[1]),
+                FAST_WRITER_ALIGNMENT, FAST_WRITER_BUFFER_SIZE) != 0) {
+        free(writer->localbuf[0]);
+        free(writer);
+        return NULL;
+    }
     writer->bufsize[0] = FAST_WRITER_BUFFER_SIZE;
     writer->bufsize[1] = FAST_WRITER_BUFFER_SIZE;
 
@@ -233,6 +255,18 @@ corsaro_fast_trace_writer_t *corsaro_create_fast_trace_writer() {
     return writer;
 }
 
+void corsaro_configure_fast_trace_writer(corsaro_fast_trace_writer_t *writer,
+        uint8_t directio, uint64_t prealloc, uint16_t snaplen) {
+
+#ifdef O_DIRECT
+    writer->directio = directio;
+#else
+    writer->directio = 0;
+#endif
+    writer->prealloc = prealloc;
+    writer->snaplen = snaplen;
+}
+
 int corsaro_start_fast_trace_writer(corsaro_logger_t *logger,
         corsaro_fast_trace_writer_t *writer, char *filename) {
 
@@ -241,8 +275,23 @@ int corsaro_start_fast_trace_writer(corsaro_logger_t *logger,
     gid_t groupid = 0;
     char *sudoenv = NULL;
 
-    writer->io_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
-            0666);
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    uint64_t prealloc;
+
+#ifdef O_DIRECT
+    if (writer->directio) {
+        /* Direct writes must land on aligned offsets, so we track the
+         * file offset ourselves rather than relying on O_APPEND.
+         */
+        flags |= O_DIRECT;
+    } else {
+        flags |= O_APPEND;
+    }
+#else
+    flags |= O_APPEND;
+#endif
+
+    writer->io_fd = open(filename, flags, 0666);
     if (writer->io_fd < 0) {
         corsaro_log(logger,
                 "unable to open wdcap output file %s: %s", filename,
@@ -250,6 +299,29 @@ int corsaro_start_fast_trace_writer(corsaro_logger_t *logger,
         return -1;
     }
 
+    /* Reserve space for the whole file up front, so the filesystem can
+     * give us large contiguous extents instead of allocating blocks as
+     * each write arrives. KEEP_SIZE means the file still appears to be
+     * empty; any unused space is released when the file is finished.
+     */
+    prealloc = writer->prealloc;
+    if (prealloc == 0) {
+        prealloc = writer->lastfilesize;
+    }
+    writer->needtrim = writer->directio;
+#ifdef FALLOC_FL_KEEP_SIZE
+    if (prealloc > 0) {
+        if (fallocate(writer->io_fd, FALLOC_FL_KEEP_SIZE, 0,
+                    ALIGN_UP(prealloc)) == 0) {
+            writer->needtrim = 1;
+        } else if (errno != EOPNOTSUPP) {
+            corsaro_log(logger,
+                    "unable to preallocate %lu bytes for fast output file %s: %s",
+                    prealloc, filename, strerror(errno));
+        }
+    }
+#endif
+
     /* If the program calling this function is running as root via sudo,
      * it's nicer if the resulting trace files actually end up being owned
      * by the user who ran the program rather than root. The following code
@@ -283,6 +355,8 @@ int corsaro_start_fast_trace_writer(corsaro_logger_t *logger,
     writer->whichbuf = 0;
     writer->offset[0] = 0;
     writer->offset[1] = 0;
+    writer->fileoff = 0;
+    writer->fadvised = 0;
 
     /* Start our new file with a pcap file header.
      *
@@ -294,7 +368,7 @@ int corsaro_start_fast_trace_writer(corsaro_logger_t *logger,
     filehdr.version_minor = 4;
     filehdr.thiszone = 0;
     filehdr.sigfigs = 0;
-    filehdr.snaplen = 65536;
+    filehdr.snaplen = writer->snaplen ? writer->snaplen : 65536;
     filehdr.network = TRACE_DLT_EN10MB;
 
     memcpy(writer->localbuf[0], &filehdr, sizeof(filehdr));
@@ -305,15 +379,35 @@ int corsaro_start_fast_trace_writer(corsaro_logger_t *logger,
 static inline int schedule_aiowrite(corsaro_fast_trace_writer_t *writer,
         corsaro_logger_t *logger) {
 
+    int towrite = writer->offset[THISBUF(writer)];
+    int tail = 0;
+
+    if (writer->directio) {
+        /* O_DIRECT can only write whole blocks, so hold back any partial
+         * block at the end of the buffer and carry it over into the next
+         * buffer instead.
+         */
+        towrite = ALIGN_DOWN(towrite);
+        tail = writer->offset[THISBUF(writer)] - towrite;
+        if (towrite == 0) {
+            return 1;
+        }
+    }
+
+    /* The carried-over tail goes to the start of the other buffer, so
+     * that buffer must be empty if there is a tail to carry.
+     */
+    assert(tail == 0 || writer->offset[OTHERBUF(writer)] == 0);
+
     /* Prepare our aiocb which will tell the async I/O API what exactly
      * we want to write to disk.
      */
     memset(&(writer->aio[THISBUF(writer)]), 0, sizeof(struct aiocb));
     writer->aio[THISBUF(writer)].aio_buf = writer->localbuf[THISBUF(writer)];
-    writer->aio[THISBUF(writer)].aio_nbytes = writer->offset[THISBUF(writer)];
+    writer->aio[THISBUF(writer)].aio_nbytes = towrite;
     writer->aio[THISBUF(writer)].aio_fildes = writer->io_fd;
-    /* aio_offset = 0 only because we set O_APPEND */
-    writer->aio[THISBUF(writer)].aio_offset = 0;
+    /* For buffered I/O, aio_offset is ignored because we set O_APPEND */
+    writer->aio[THISBUF(writer)].aio_offset = writer->fileoff;
     writer->aio[THISBUF(writer)].aio_reqprio = 1;
 
     if (aio_write(&(writer->aio[THISBUF(writer)])) < 0) {
@@ -323,9 +417,25 @@ static inline int schedule_aiowrite(corsaro_fast_trace_writer_t *writer,
         return -1;
     }
 
-    /* Switch to the other buffer to keep storing incoming packets */
+    /* Switch to the other buffer to keep storing incoming packets.
+     *
+     * Normally the other buffer is empty here. The exception is when
+     * check_aiowrite_status() re-schedules the remainder of a partial
+     * write: the other buffer then already holds the packets that arrived
+     * while the first write was outstanding, and we must append to them
+     * rather than reset its offset. That is safe because the remainder
+     * always starts and ends on a block boundary (anything unaligned is
+     * rejected there), so tail is zero and nothing is copied over them.
+     */
+    writer->offset[THISBUF(writer)] = towrite;
     writer->waiting = 1;
     writer->whichbuf = OTHERBUF(writer);
+
+    if (tail > 0) {
+        memcpy(writer->localbuf[THISBUF(writer)],
+                writer->localbuf[OTHERBUF(writer)] + towrite, tail);
+        writer->offset[THISBUF(writer)] = tail;
+    }
     return 1;
 }
 
@@ -336,6 +446,28 @@ static inline int check_aiowrite_status(corsaro_fast_trace_writer_t *writer,
     if (err == 0) {
         /* Write has completed */
         int r = aio_return(&(writer->aio[OTHERBUF(writer)]));
+        uint64_t prevoff = writer->fileoff;
+
+        if (r < 0) {
+            corsaro_log(logger,
+                    "error while performing async fast write: %s",
+                    strerror(errno));
+            writer->waiting = 0;
+            return -1;
+        }
+        writer->fileoff += r;
+
+        if (!writer->directio) {
+            /* Everything we write is going to be read back exactly once
+             * by the merger, so there is no point letting it crowd
+             * everything else out of the page cache. The first call on
+             * a range starts writeback, the second call (one write later)
+             * drops the now-clean pages.
+             */
+            posix_fadvise(writer->io_fd, writer->fadvised,
+                    writer->fileoff - writer->fadvised, POSIX_FADV_DONTNEED);
+            writer->fadvised = prevoff;
+        }
 
         if (r == writer->offset[OTHERBUF(writer)]) {
             writer->waiting = 0;
@@ -346,6 +478,14 @@ static inline int check_aiowrite_status(corsaro_fast_trace_writer_t *writer,
         /* Partial write (probably due to disk being full?) */
         assert(r < writer->offset[OTHERBUF(writer)]);
 
+        if (writer->directio && ALIGN_DOWN(r) != r) {
+            /* We can't resume from an unaligned offset with O_DIRECT */
+            corsaro_log(logger,
+                    "unaligned partial write in direct I/O fast writer");
+            writer->waiting = 0;
+            return -1;
+        }
+
         writer->whichbuf = OTHERBUF(writer);
 
         /* Try to send the remaining content again */
@@ -370,6 +510,8 @@ int corsaro_reset_fast_trace_writer(corsaro_logger_t *logger,
         corsaro_fast_trace_writer_t *writer) {
 
     int ret;
+    uint64_t filesize;
+
     /* Wait for the current outstanding write to complete */
     while (writer->waiting) {
         /* XXX technically this could block, but has not been a problem
@@ -382,7 +524,20 @@ int corsaro_reset_fast_trace_writer(corsaro_logger_t *logger,
     /* If we have any stored data in our current buffer, schedule that to
      * be written too.
      */
+    filesize = writer->fileoff + writer->offset[THISBUF(writer)];
     if (writer->offset[THISBUF(writer)] > 0) {
+        if (writer->directio) {
+            /* Pad the final partial block out with zeroes so it can be
+             * written directly -- we'll truncate the padding off again
+             * below. Our buffer sizes are always a multiple of the
+             * alignment, so there is always room for this.
+             */
+            int padded = ALIGN_UP(writer->offset[THISBUF(writer)]);
+            memset(writer->localbuf[THISBUF(writer)] +
+                    writer->offset[THISBUF(writer)], 0,
+                    padded - writer->offset[THISBUF(writer)]);
+            writer->offset[THISBUF(writer)] = padded;
+        }
         schedule_aiowrite(writer, logger);
     }
 
@@ -393,6 +548,20 @@ int corsaro_reset_fast_trace_writer(corsaro_logger_t *logger,
         }
     }
 
+    /* Trim the file back to the amount of data we actually wrote. This
+     * removes any direct I/O padding and releases any preallocated space
+     * that we didn't end up using.
+     */
+    if (writer->io_fd != -1) {
+        if (writer->needtrim && ftruncate(writer->io_fd, filesize) < 0) {
+            corsaro_log(logger,
+                    "unable to truncate fast output file to %lu bytes: %s",
+                    filesize, strerror(errno));
+        }
+        writer->lastfilesize = filesize;
+    }
+    writer->needtrim = 0;
+
     /* Save the fd so we can return it to the user */
     ret = writer->io_fd;
 
@@ -456,13 +625,15 @@ int corsaro_write_packet(corsaro_logger_t *logger,
 }
 
 int corsaro_fast_write_erf_packet(corsaro_logger_t *logger,
-        corsaro_fast_trace_writer_t *writer, libtrace_packet_t *packet) {
+        corsaro_fast_trace_writer_t *writer, libtrace_packet_t *packet,
+        uint16_t snaplen, uint16_t l3off, uint16_t ethertype) {
 
     dag_record_t *erfptr;
     pcap_header_t *pcaphdr;
     uint16_t pcapcaplen;
     uint64_t erfts;
     char tmpbuf[200];
+    char *newbuf;
 
     erfptr = (dag_record_t *)packet->header;
     pcaphdr = (pcap_header_t *)tmpbuf;
@@ -494,15 +665,19 @@ int corsaro_fast_write_erf_packet(corsaro_logger_t *logger,
                 "extending fast write buffer (%u not enough)",
                 writer->bufsize[THISBUF(writer)]);
 
-        writer->localbuf[THISBUF(writer)] = realloc(
-                writer->localbuf[THISBUF(writer)],
-                writer->bufsize[THISBUF(writer)] + FAST_WRITER_BUFFER_SIZE);
-        writer->bufsize[THISBUF(writer)] += FAST_WRITER_BUFFER_SIZE;
-        if (writer->localbuf[THISBUF(writer)] == NULL) {
+        /* Can't use realloc() here, as the buffer must remain aligned */
+        if (posix_memalign((void **)&newbuf, FAST_WRITER_ALIGNMENT,
+                    writer->bufsize[THISBUF(writer)] +
+                    FAST_WRITER_BUFFER_SIZE) != 0) {
             corsaro_log(logger,
                     "out of memory when extending fast write buffer");
             return -1;
         }
+        memcpy(newbuf, writer->localbuf[THISBUF(writer)],
+                writer->offset[THISBUF(writer)]);
+        free(writer->localbuf[THISBUF(writer)]);
+        writer->localbuf[THISBUF(writer)] = newbuf;
+        writer->bufsize[THISBUF(writer)] += FAST_WRITER_BUFFER_SIZE;
     }
 
     /* Fill in the pcap header for our converted packet */
@@ -531,12 +706,49 @@ int corsaro_fast_write_erf_packet(corsaro_logger_t *logger,
         pcaphdr->caplen = pcaphdr->wirelen;
     }
 
-    writer->offset[THISBUF(writer)] += sizeof(pcap_header_t);
+    /* Truncate the packet here, rather than beforehand, so that we only
+     * ever copy the bytes we are going to keep. wirelen is left alone so
+     * readers can still tell how big the original packet was.
+     */
+    if (l3off > ETHERNET_HEADER_LEN && l3off <= pcaphdr->caplen &&
+            (snaplen == 0 ||
+                snaplen >= ETHERNET_HEADER_LEN)) {
+        /* Rather than shuffling the packet around in place and then
+         * copying it, we can remove the tags as part of the copy into
+         * our buffer: write the MAC addresses and the inner ethertype,
+         * then skip straight to the network header.
+         */
+        uint8_t *dst;
+        uint16_t removed = l3off - ETHERNET_HEADER_LEN;
+
+        pcaphdr->caplen -= removed;
+        pcaphdr->wirelen -= removed;
+        if (snaplen > 0 && pcaphdr->caplen > snaplen) {
+            pcaphdr->caplen = snaplen;
+        }
 
-    /* Write the packet contents into the buffer, starting from the
-     * Ethernet header */
-    memcpy(writer->localbuf[THISBUF(writer)] + writer->offset[THISBUF(writer)],
-            packet->payload, pcaphdr->caplen);
+        writer->offset[THISBUF(writer)] += sizeof(pcap_header_t);
+        dst = (uint8_t *)writer->localbuf[THISBUF(writer)] +
+                writer->offset[THISBUF(writer)];
+
+        memcpy(dst, packet->payload, 12);
+        ethertype = htons(ethertype);
+        memcpy(dst + 12, &ethertype, sizeof(ethertype));
+        memcpy(dst + ETHERNET_HEADER_LEN, ((uint8_t *)packet->payload) + l3off,
+                pcaphdr->caplen - ETHERNET_HEADER_LEN);
+    } else {
+        if (snaplen > 0 && pcaphdr->caplen > snaplen) {
+            pcaphdr->caplen = snaplen;
+        }
+
+        writer->offset[THISBUF(writer)] += sizeof(pcap_header_t);
+
+        /* Write the packet contents into the buffer, starting from the
+         * Ethernet header */
+        memcpy(writer->localbuf[THISBUF(writer)] +
+                writer->offset[THISBUF(writer)],
+                packet->payload, pcaphdr->caplen);
+    }
 
     writer->offset[THISBUF(writer)] += pcaphdr->caplen;
 
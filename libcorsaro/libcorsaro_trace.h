@@ -99,6 +99,39 @@ typedef struct corsaro_fast_trace_writer {
     /** The size of each buffer */
     int bufsize[2];
 
+    /** Flag that indicates whether files are written using O_DIRECT,
+     *  bypassing the page cache entirely.
+     */
+    uint8_t directio;
+
+    /** Number of bytes to preallocate on disk for each new file. If zero,
+     *  we preallocate based on the size of the previous file instead.
+     */
+    uint64_t prealloc;
+
+    /** The largest number of bytes that will be written for any packet,
+     *  which is recorded as the snap length in the pcap file header. Zero
+     *  if packets are written in full.
+     */
+    uint16_t snaplen;
+
+    /** The file offset that the next scheduled write will begin at */
+    uint64_t fileoff;
+
+    /** The point in the file up to which we have asked the kernel to drop
+     *  cached pages (non-direct I/O only).
+     */
+    uint64_t fadvised;
+
+    /** The final size of the last file written by this writer */
+    uint64_t lastfilesize;
+
+    /** Flag that indicates whether the current file needs to be truncated
+     *  once we are done writing it, i.e. it has been padded for direct I/O
+     *  or has preallocated space beyond the end of our data.
+     */
+    uint8_t needtrim;
+
 } corsaro_fast_trace_writer_t;
 
 /** Creates a standard single-threaded libtrace reader for a trace file.
@@ -139,6 +172,25 @@ libtrace_out_t *corsaro_create_trace_writer(corsaro_logger_t *logger,
  */
 corsaro_fast_trace_writer_t *corsaro_create_fast_trace_writer();
 
+/** Configures how an asynchronous trace file writer does its disk I/O.
+ *
+ *  Must be called before corsaro_start_fast_trace_writer() to have any
+ *  effect on the next file that is opened.
+ *
+ *  @param writer       The fast writer to be configured.
+ *  @param directio     If 1, open files with O_DIRECT so that written data
+ *                      bypasses the page cache. If 0, use buffered I/O but
+ *                      ask the kernel to drop pages once they are written.
+ *  @param prealloc     The number of bytes to preallocate on disk when a new
+ *                      file is opened. Set to 0 to preallocate the size of
+ *                      the previous file written by this writer.
+ *  @param snaplen      The largest snap length that will be passed to
+ *                      corsaro_fast_write_erf_packet(), or 0 if some
+ *                      packets will be written in full.
+ */
+void corsaro_configure_fast_trace_writer(corsaro_fast_trace_writer_t *writer,
+        uint8_t directio, uint64_t prealloc, uint16_t snaplen);
+
 
 /** Destroys a libtrace reader, freeing any resources that it has allocated and
  *  closing the trace file that it was reading from.
@@ -242,11 +294,92 @@ int corsaro_reset_fast_trace_writer(corsaro_logger_t *logger,
  *  @param logger       A corsaro logger instance to use for logging errors.
  *  @param writer       The fast writer to use for writing the packet to disk.
  *  @param packet       The ERF packet to be converted and written.
+ *  @param snaplen      The maximum number of bytes of the packet (starting
+ *                      from the Ethernet header) to write to disk. The
+ *                      original wire length is preserved in the pcap
+ *                      header. Set to 0 to write the whole packet.
+ *  @param l3off        To remove any VLAN (802.1Q / QinQ) and MPLS headers
+ *                      from the packet as it is copied, the offset of the
+ *                      network layer header as returned by
+ *                      corsaro_find_network_header(). The snap length
+ *                      applies to the stripped packet. Set to 0 to write
+ *                      the headers unchanged.
+ *  @param ethertype    The ethertype of the network layer header, as
+ *                      returned by corsaro_find_network_header(). Ignored
+ *                      if l3off is 0.
  *
  *  @return 1 if successful, -1 if an error occurred.
  */
 int corsaro_fast_write_erf_packet(corsaro_logger_t *logger,
-        corsaro_fast_trace_writer_t *writer, libtrace_packet_t *packet);
+        corsaro_fast_trace_writer_t *writer, libtrace_packet_t *packet,
+        uint16_t snaplen, uint16_t l3off, uint16_t ethertype);
+
+/** Finds the network layer header in an Ethernet frame, skipping over any
+ *  802.1Q, QinQ or MPLS headers that precede it.
+ *
+ *  This only handles the encapsulations that we actually see on our
+ *  capture links, so that the tools that look at every captured packet
+ *  can avoid the overhead of trace_get_layer3() and trace_strip_packet().
+ *  The same offset can be used both to read the IP header and to have
+ *  corsaro_fast_write_erf_packet() remove the encapsulation.
+ *
+ *  @param eth          Pointer to the start of the Ethernet header.
+ *  @param caplen       The number of captured bytes available at 'eth'.
+ *  @param ethertype    Set to the ethertype of the network layer header.
+ *
+ *  @return the offset of the network layer header from the start of the
+ *          Ethernet header, or 0 if the headers could not be parsed.
+ */
+static inline uint16_t corsaro_find_network_header(uint8_t *eth,
+        uint32_t caplen, uint16_t *ethertype) {
+
+    uint32_t off = 14;
+    uint16_t etype;
+
+    if (eth == NULL || caplen < 14) {
+        return 0;
+    }
+    etype = ntohs(*((uint16_t *)(eth + 12)));
+
+    while (etype == 0x8100 || etype == 0x88a8 || etype == 0x9100) {
+        if (off + 4 > caplen) {
+            return 0;
+        }
+        etype = ntohs(*((uint16_t *)(eth + off + 2)));
+        off += 4;
+    }
+
+    if (etype == 0x8847 || etype == 0x8848) {
+        /* Walk the label stack until we hit the bottom-of-stack bit */
+        do {
+            if (off + 4 > caplen) {
+                return 0;
+            }
+            off += 4;
+        } while ((eth[off - 2] & 0x01) == 0);
+
+        /* MPLS doesn't tell us what comes next, so guess based on the IP
+         * version. Anything else (e.g. an Ethernet pseudowire) is left
+         * alone.
+         */
+        if (off >= caplen) {
+            return 0;
+        }
+        if ((eth[off] >> 4) == 4) {
+            etype = 0x0800;
+        } else if ((eth[off] >> 4) == 6) {
+            etype = 0x86DD;
+        } else {
+            return 0;
+        }
+    }
+
+    if (off > UINT16_MAX) {
+        return 0;
+    }
+    *ethertype = etype;
+    return (uint16_t)off;
+}
 
 #endif
 
@@ -59,12 +59,13 @@
 #include <libtrace/linked_list.h>
 #include <Judy.h>
 #include <libipmeta.h>
-
 #include "khash.h"
 #include "ksort.h"
 #include "libcorsaro_plugin.h"
 #include "libcorsaro_avro.h"
+#include "libcorsaro_memhandler.h"
 #include "corsaro_dos.h"
+#include "corsaro_dos_avmap.h"
 #include "utils.h"
 
 /** The magic number for this plugin - "EDOS" */
@@ -79,6 +80,98 @@
  */
 KHASH_SET_INIT_INT(32xx)
 
+/** Number of values that a value set can hold before it needs a hash */
+#define DOS_INLINE_SET_SIZE 4
+
+/** A set of 32 bit values (e.g. ports) that belongs to an attack vector.
+ *
+ *  Most vectors only ever see a handful of distinct values, so the first
+ *  few values are stored inline and the hash is only created once the set
+ *  outgrows that.
+ */
+typedef struct dos_value_set {
+    /** Hash containing all of the values in the set, or NULL if the values
+     *  are stored inline */
+    kh_32xx_t *hash;
+    /** Number of values stored inline */
+    uint32_t count;
+    /** Values stored inline */
+    uint32_t vals[DOS_INLINE_SET_SIZE];
+} dos_value_set_t;
+
+static inline uint32_t dos_set_size(dos_value_set_t *set) {
+    if (set->hash) {
+        return kh_size(set->hash);
+    }
+    return set->count;
+}
+
+static inline void dos_set_add(dos_value_set_t *set, uint32_t val) {
+    uint32_t i;
+    int khret;
+
+    if (set->hash) {
+        kh_put(32xx, set->hash, val, &khret);
+        return;
+    }
+
+    for (i = 0; i < set->count; i++) {
+        if (set->vals[i] == val) {
+            return;
+        }
+    }
+
+    if (set->count < DOS_INLINE_SET_SIZE) {
+        set->vals[set->count] = val;
+        set->count ++;
+        return;
+    }
+
+    /* Out of inline space, move everything into a hash */
+    set->hash = kh_init(32xx);
+    for (i = 0; i < set->count; i++) {
+        kh_put(32xx, set->hash, set->vals[i], &khret);
+    }
+    kh_put(32xx, set->hash, val, &khret);
+    set->count = 0;
+}
+
+static void dos_set_combine(dos_value_set_t *dest, dos_value_set_t *src) {
+    khiter_t i;
+    uint32_t j;
+
+    if (src->hash == NULL) {
+        for (j = 0; j < src->count; j++) {
+            dos_set_add(dest, src->vals[j]);
+        }
+        return;
+    }
+
+    for (i = kh_begin(src->hash); i != kh_end(src->hash); ++i) {
+        if (!kh_exist(src->hash, i)) {
+            continue;
+        }
+        /* Just add it -- any duplicates should be silently ignored */
+        dos_set_add(dest, kh_key(src->hash, i));
+    }
+}
+
+/** Empties a value set, keeping the hash (if any) for re-use */
+static inline void dos_set_clear(dos_value_set_t *set) {
+    if (set->hash) {
+        kh_clear(32xx, set->hash);
+    }
+    set->count = 0;
+}
+
+static inline void dos_set_free(dos_value_set_t *set) {
+    if (set->hash) {
+        kh_destroy(32xx, set->hash);
+        set->hash = NULL;
+    }
+    set->count = 0;
+}
+
 /** Default values for the various configurable options */
 
 /** Minimum number of packets before a vector is considered an attack */
@@ -96,6 +189,20 @@ KHASH_SET_INIT_INT(32xx)
 /** The minimum packet rate before a vector can be an attack */
 #define CORSARO_DOS_DEFAULT_VECTOR_MIN_PPM 30
 
+/** The number of bytes of the initial packet to keep for each vector */
+#define CORSARO_DOS_DEFAULT_INITIAL_PACKET_SNAPLEN 256
+
+/** The largest initial packet snap length that we will allow */
+#define CORSARO_DOS_MAX_INITIAL_PACKET_SNAPLEN 10000
+
+/** Number of vectors (or initial packet buffers) in each pooled allocation */
+#define DOS_POOL_ITEMS_PER_ALLOC 10000
+
+/** Approximate memory cost of a live attack vector, charged against the
+ *  plugin's memory budget */
+#define DOS_VECTOR_MEM_ESTIMATE(av) \
+    (sizeof(attack_vector_t) + (av)->initial_packet_len)
+
 static corsaro_plugin_t corsaro_dos_plugin = {
 
     PLUGIN_NAME,
@@ -121,6 +228,8 @@ typedef struct corsaro_dos_config {
     uint16_t ppm_window_size;
     /** The amount of time to slide the PPM window (in seconds) */
     uint16_t ppm_window_slide;
+    /** The number of bytes of the initial packet to keep for each vector */
+    uint16_t initial_packet_snaplen;
 
 } corsaro_dos_config_t;
 
@@ -128,8 +237,9 @@ typedef struct corsaro_dos_config {
 typedef struct ppm_window {
     /** Time of the bottom of the current first window */
     uint32_t window_start;
-    /** The number of packets in each bucket */
-    uint64_t *buckets;
+    /** The number of packets in each bucket -- only the current bucket is
+     *  kept here, expired buckets are moved to the vector's bucket list */
+    uint64_t buckets[1];
     /** The bucket that packets are currently being added to */
     uint8_t current_bucket;
     /** The maximum packet rate observed thus far */
@@ -159,23 +269,6 @@ typedef struct attack_flow {
     uint8_t protocol;
 } attack_flow_t;
 
-#define HASHER_SHIFT_AND_XOR(value) h^=(h << 5) + (h >> 27) + (value)
-static inline khint32_t attack_flow_hash_func(attack_flow_t *ft) {
-
-    khint32_t h = (khint32_t)(ft->attacker_ip * 59);
-    HASHER_SHIFT_AND_XOR(ft->attacker_port << 16);
-    HASHER_SHIFT_AND_XOR(ft->target_port);
-    return h;
-}
-
-#define attack_flow_hash_equal(a,b) \
-    ((a)->attacker_ip == (b)->attacker_ip && (a)->pkt_len == (b)->pkt_len && \
-     (a)->attacker_port == (b)->attacker_port && \
-     (a)->target_port == (b)->target_port)
-
-KHASH_INIT(ft, attack_flow_t *, char, 0, attack_flow_hash_func,
-        attack_flow_hash_equal);
-
 /** A record for a potential attack vector
  *
  * All values are in HOST byte order
@@ -229,14 +322,14 @@ typedef struct attack_vector {
     /** The time of the last packet */
     struct timeval latest_time;
 
-    /** Map of all IP addresses the alleged attack has originated from */
-    kh_32xx_t *attack_ip_hash;
+    /** Set of all IP addresses the alleged attack has originated from */
+    dos_value_set_t attack_ip_hash;
 
-    /** Map of all ports that alleged attack packets have originated from */
-    kh_32xx_t *attack_port_hash;
+    /** Set of all ports that alleged attack packets have originated from */
+    dos_value_set_t attack_port_hash;
 
-    /** Map of all ports that alleged attack packets were directed to */
-    kh_32xx_t *target_port_hash;
+    /** Set of all ports that alleged attack packets were directed to */
+    dos_value_set_t target_port_hash;
 
     /** List containing all expired PPM buckets */
     Pvoid_t ppm_bucket_list;
@@ -261,44 +354,56 @@ typedef struct attack_vector {
 
     corsaro_dos_config_t *config;
 
+    /** The pool that this vector was allocated from (NULL if the vector
+     *  was allocated using malloc) */
+    corsaro_memhandler_t *handler;
+    corsaro_memsource_t *memsrc;
 
-} attack_vector_t;
-
-/** Compare two attack vectors for equality */
-#define attack_vector_hash_equal(a, b) ((a)->target_ip == (b)->target_ip)
-
-/** Hash an attack vector
- *
- * @param av         The attack vector to be hashed
- */
-static inline khint32_t attack_vector_hash_func(attack_vector_t *av)
-{
-    return (khint32_t)av->target_ip * 59;
-}
-
+    /** The pool that the initial packet buffer was allocated from (NULL if
+     *  the buffer was allocated using malloc) */
+    corsaro_memhandler_t *pkthandler;
+    corsaro_memsource_t *pktsrc;
 
-/** Initialize the hash functions and datatypes */
-KHASH_INIT(av, attack_vector_t *, char, 0, attack_vector_hash_func,
-           attack_vector_hash_equal);
+} attack_vector_t;
 
 /** Thread-local state for the DOS plugin */
 struct corsaro_dos_state_t {
     /** Timestamp of the last time that we rotated the output file */
     uint32_t last_rotation;
     /** Hash tables for storing the possible attack vectors */
-    khash_t(av) *attack_hash_tcp;
-    khash_t(av) *attack_hash_udp;
-    khash_t(av) *attack_hash_icmp;
+    attack_vector_map_t *attack_hash_tcp;
+    attack_vector_map_t *attack_hash_udp;
+    attack_vector_map_t *attack_hash_icmp;
     /** ID of the processing thread */
     int threadid;
     /** Timestamp of the most recently processed packet */
     uint32_t lastpktts;
+    /** The memory budget for this plugin (NULL if there is no budget) */
+    corsaro_mem_budget_t *budget;
+    /** Memory charged to the budget for the vectors in this state */
+    uint64_t memcharged;
+    /** Set if the memory budget was exceeded during this interval, in
+     *  which case small vectors have been discarded and no new vectors
+     *  will be created until the interval ends */
+    uint8_t degraded;
+    /** Pools for allocating vectors and initial packet buffers (NULL if
+     *  we are using malloc instead) */
+    corsaro_memhandler_t *vechandler;
+    corsaro_memhandler_t *pkthandler;
+    /** Set once the merging thread has become a user of our pools */
+    uint8_t pools_shared;
 };
 
 
 typedef struct corsaro_dos_merge_state {
     corsaro_avro_writer_t *mainwriter;
     struct corsaro_dos_state_t *combined;
+    /** Pools belonging to the processing threads -- the merging thread
+     *  holds a reference to each so that it can release the vectors that
+     *  it has been given */
+    corsaro_memhandler_t **handlers;
+    int handlercount;
+    int handleralloc;
 } corsaro_dos_merge_state_t;
 
 static const char DOS_RESULT_SCHEMA[] =
@@ -404,11 +509,11 @@ static int dos_to_avro(corsaro_logger_t *logger, avro_value_t *av,
     CORSARO_AVRO_SET_FIELD(int, av, field, 3, "target_protocol", "dos",
             vec->protocol);
     CORSARO_AVRO_SET_FIELD(long, av, field, 4, "attacker_ip_cnt", "dos",
-            kh_size(vec->attack_ip_hash));
+            dos_set_size(&(vec->attack_ip_hash)));
     CORSARO_AVRO_SET_FIELD(long, av, field, 5, "attack_port_cnt", "dos",
-            kh_size(vec->attack_port_hash));
+            dos_set_size(&(vec->attack_port_hash)));
     CORSARO_AVRO_SET_FIELD(long, av, field, 6, "target_port_cnt", "dos",
-            kh_size(vec->target_port_hash));
+            dos_set_size(&(vec->target_port_hash)));
     CORSARO_AVRO_SET_FIELD(long, av, field, 7, "packet_cnt", "dos",
             vec->packet_cnt);
     CORSARO_AVRO_SET_FIELD(long, av, field, 8, "icmp_mismatches", "dos",
@@ -474,36 +579,90 @@ static int dos_to_avro(corsaro_logger_t *logger, avro_value_t *av,
 
 }
 
-#define AV_INIT_SUCCESS(av) \
-    (av->attack_ip_hash && av->attack_port_hash && av->target_port_hash)
-
-static attack_vector_t *attack_vector_init(int ppmbuckets) {
+/** Allocates a new, empty attack vector.
+ *
+ *  @param handler      The pool to allocate the vector from (NULL to use
+ *                      malloc instead).
+ */
+static attack_vector_t *attack_vector_init(corsaro_memhandler_t *handler) {
     attack_vector_t *av = NULL;
+    corsaro_memsource_t *memsrc = NULL;
 
-    av = calloc(1, sizeof(attack_vector_t));
+    if (handler) {
+        av = (attack_vector_t *)get_corsaro_memhandler_item(handler, &memsrc);
+    } else {
+        av = (attack_vector_t *)malloc(sizeof(attack_vector_t));
+    }
     if (av == NULL) {
         return NULL;
     }
 
+    memset(av, 0, sizeof(attack_vector_t));
+    av->handler = handler;
+    av->memsrc = memsrc;
     av->thread_cnt = 1;
-    av->attack_ip_hash = kh_init(32xx);
-    av->attack_port_hash = kh_init(32xx);
-    av->target_port_hash = kh_init(32xx);
     av->ppm_bucket_list = NULL;
-    av->ppm_window.buckets = (uint64_t *)calloc(ppmbuckets, sizeof(uint64_t));
     av->config = NULL;
 
-    /* don't init here, since we'll often be assigning an already existing
-     * instance to this pointer */
+    /* packet_timestamps are never used, so don't bother creating a list */
     av->packet_timestamps = NULL;
 
     return av;
 }
 
+/** Stores a copy of (up to 'snaplen' bytes of) the initial packet for an
+ *  attack vector.
+ *
+ *  @param av           The vector to store the packet in.
+ *  @param handler      The pool to allocate the packet buffer from (NULL to
+ *                      use malloc instead). Buffers from the pool are
+ *                      'snaplen' bytes long.
+ *  @param snaplen      The maximum number of bytes to keep.
+ *  @param pkt          The packet contents.
+ *  @param len          The length of the packet contents.
+ *  @return 0 if successful, -1 if a buffer could not be allocated.
+ */
+static int attack_vector_save_packet(attack_vector_t *av,
+        corsaro_memhandler_t *handler, uint16_t snaplen, uint8_t *pkt,
+        uint32_t len) {
+
+    if (len > snaplen) {
+        len = snaplen;
+    }
+
+    if (handler) {
+        av->initial_packet = get_corsaro_memhandler_item(handler,
+                &(av->pktsrc));
+    } else {
+        av->initial_packet = (uint8_t *)malloc(len);
+        av->pktsrc = NULL;
+    }
+    if (av->initial_packet == NULL) {
+        return -1;
+    }
+    av->pkthandler = handler;
+    av->initial_packet_len = len;
+    memcpy(av->initial_packet, pkt, len);
+    return 0;
+}
+
+static void attack_vector_release_packet(attack_vector_t *av) {
+
+    if (av->initial_packet == NULL) {
+        return;
+    }
+    if (av->pkthandler) {
+        release_corsaro_memhandler_item(av->pkthandler, av->pktsrc);
+    } else {
+        free(av->initial_packet);
+    }
+    av->initial_packet = NULL;
+    av->pkthandler = NULL;
+    av->pktsrc = NULL;
+}
+
 static void attack_vector_free(attack_vector_t *av) {
 
-    attack_flow_t *f;
-    khiter_t i;
     int rcint;
 
     if (av == NULL) {
@@ -518,24 +677,17 @@ static void attack_vector_free(attack_vector_t *av) {
         JLFA(rcint, av->ppm_bucket_list);
     }
 
-    if (av->ppm_window.buckets) {
-        free(av->ppm_window.buckets);
-    }
+    attack_vector_release_packet(av);
 
-    if (av->initial_packet != NULL) {
-        free(av->initial_packet);
-    }
+    dos_set_free(&(av->attack_ip_hash));
+    dos_set_free(&(av->attack_port_hash));
+    dos_set_free(&(av->target_port_hash));
 
-    if (av->attack_ip_hash) {
-        kh_destroy(32xx, av->attack_ip_hash);
-    }
-    if (av->attack_port_hash) {
-        kh_destroy(32xx, av->attack_port_hash);
-    }
-    if (av->target_port_hash) {
-        kh_destroy(32xx, av->target_port_hash);
+    if (av->handler) {
+        release_corsaro_memhandler_item(av->handler, av->memsrc);
+    } else {
+        free(av);
     }
-    free(av);
 }
 
 
@@ -560,6 +712,7 @@ int corsaro_dos_parse_config(corsaro_plugin_t *p, yaml_document_t *doc,
     conf->attack_min_ppm = CORSARO_DOS_DEFAULT_VECTOR_MIN_PPM;
     conf->ppm_window_size = CORSARO_DOS_DEFAULT_PPM_WINDOW_SIZE;
     conf->ppm_window_slide = CORSARO_DOS_DEFAULT_PPM_WINDOW_PRECISION;
+    conf->initial_packet_snaplen = CORSARO_DOS_DEFAULT_INITIAL_PACKET_SNAPLEN;
 
     if (options->type != YAML_MAPPING_NODE) {
         corsaro_log(p->logger,
@@ -606,6 +759,16 @@ int corsaro_dos_parse_config(corsaro_plugin_t *p, yaml_document_t *doc,
             conf->ppm_window_slide = strtoul(val, NULL, 0);
         }
 
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value,
+                    "initial_packet_snaplen") == 0) {
+            unsigned long snaplen = strtoul(val, NULL, 0);
+            if (snaplen > CORSARO_DOS_MAX_INITIAL_PACKET_SNAPLEN) {
+                snaplen = CORSARO_DOS_MAX_INITIAL_PACKET_SNAPLEN;
+            }
+            conf->initial_packet_snaplen = snaplen;
+        }
+
     }
 
     p->config = conf;
@@ -648,6 +811,14 @@ int corsaro_dos_finalise_config(corsaro_plugin_t *p,
         conf->ppm_window_slide = conf->ppm_window_size;
     }
 
+    if (conf->initial_packet_snaplen == 0) {
+        corsaro_log(p->logger,
+                "'initial_packet_snaplen' must be larger than zero, using the default of %u",
+                CORSARO_DOS_DEFAULT_INITIAL_PACKET_SNAPLEN);
+        conf->initial_packet_snaplen =
+                CORSARO_DOS_DEFAULT_INITIAL_PACKET_SNAPLEN;
+    }
+
     /* Log our configuration so people know what options we are using. */
     corsaro_log(p->logger,
             "dos plugin: minimum number of packets for an attack vector is %u",
@@ -663,6 +834,9 @@ int corsaro_dos_finalise_config(corsaro_plugin_t *p,
     corsaro_log(p->logger,
             "dos plugin: window slides in increments of %u seconds",
             conf->ppm_window_slide);
+    corsaro_log(p->logger,
+            "dos plugin: keeping the first %u bytes of each initial packet",
+            conf->initial_packet_snaplen);
     return 0;
 }
 
@@ -679,6 +853,7 @@ void corsaro_dos_destroy_self(corsaro_plugin_t *p) {
  */
 void *corsaro_dos_init_processing(corsaro_plugin_t *p, int threadid) {
 
+    corsaro_dos_config_t *conf = (corsaro_dos_config_t *)(p->config);
     struct corsaro_dos_state_t *state;
 
     state = (struct corsaro_dos_state_t *)malloc(
@@ -690,11 +865,31 @@ void *corsaro_dos_init_processing(corsaro_plugin_t *p, int threadid) {
     }
 
     state->lastpktts = 0;
-    state->attack_hash_tcp = kh_init(av);
-    state->attack_hash_udp = kh_init(av);
-    state->attack_hash_icmp = kh_init(av);
+    state->attack_hash_tcp = avmap_create(0);
+    state->attack_hash_udp = avmap_create(0);
+    state->attack_hash_icmp = avmap_create(0);
     state->threadid = threadid;
     state->last_rotation = 0;
+    state->budget = p->budget;
+    state->memcharged = 0;
+    state->degraded = 0;
+    state->pools_shared = 0;
+
+#ifdef HAVE_TCMALLOC
+    state->vechandler = NULL;
+    state->pkthandler = NULL;
+#else
+    /* Most vectors only ever see a single packet, so pool the vectors and
+     * their initial packet buffers rather than allocating them one by one */
+    state->vechandler = (corsaro_memhandler_t *)malloc(
+            sizeof(corsaro_memhandler_t));
+    init_corsaro_memhandler(p->logger, state->vechandler,
+            sizeof(attack_vector_t), DOS_POOL_ITEMS_PER_ALLOC);
+    state->pkthandler = (corsaro_memhandler_t *)malloc(
+            sizeof(corsaro_memhandler_t));
+    init_corsaro_memhandler(p->logger, state->pkthandler,
+            conf->initial_packet_snaplen, DOS_POOL_ITEMS_PER_ALLOC);
+#endif
     return state;
 }
 
@@ -712,12 +907,19 @@ int corsaro_dos_halt_processing(corsaro_plugin_t *p, void *local) {
         return 0;
     }
 
-    kh_free(av, state->attack_hash_tcp, &attack_vector_free);
-    kh_free(av, state->attack_hash_udp, &attack_vector_free);
-    kh_free(av, state->attack_hash_icmp, &attack_vector_free);
-    kh_destroy(av, state->attack_hash_tcp);
-    kh_destroy(av, state->attack_hash_udp);
-    kh_destroy(av, state->attack_hash_icmp);
+    avmap_destroy(state->attack_hash_tcp, &attack_vector_free);
+    avmap_destroy(state->attack_hash_udp, &attack_vector_free);
+    avmap_destroy(state->attack_hash_icmp, &attack_vector_free);
+    corsaro_mem_budget_release(state->budget, state->memcharged);
+
+    /* The merging thread may still be holding vectors from our pools, in
+     * which case it will destroy the pools once it is done with them */
+    if (state->vechandler) {
+        destroy_corsaro_memhandler(state->vechandler);
+    }
+    if (state->pkthandler) {
+        destroy_corsaro_memhandler(state->pkthandler);
+    }
     free(state);
     return 0;
 }
@@ -793,54 +995,53 @@ static void attack_vector_update_ppm_window(corsaro_dos_config_t *conf,
     }
 }
 
-static void copy_32hash(kh_32xx_t *orig, kh_32xx_t *copy) {
-
-    khiter_t i;
-    int khret;
-    uint32_t newval;
-
-    for (i = kh_begin(orig); i != kh_end(orig); ++i) {
-        if (!kh_exist(orig, i)) {
-            continue;
-        }
-        newval = kh_key(orig, i);
-        kh_put(32xx, copy, newval, &khret);
-    }
-}
-
-static kh_av_t *copy_attack_hash_table(corsaro_dos_config_t *conf,
-        corsaro_logger_t *logger,
-        kh_av_t *origmap, uint32_t lastrot, uint32_t endts) {
+static attack_vector_map_t *copy_attack_hash_table(corsaro_dos_config_t *conf,
+        corsaro_logger_t *logger, struct corsaro_dos_state_t *orig,
+        attack_vector_map_t *origmap, uint32_t lastrot, uint32_t endts) {
 
-    kh_av_t *newmap = NULL;
-    khiter_t i;
-    int khret;
+    attack_vector_map_t *newmap = NULL;
+    uint32_t i;
     attack_vector_t *origav, *newav;
     struct timeval endtv;
 
     endtv.tv_sec = endts;
     endtv.tv_usec = 0;
 
-    newmap = kh_init(av);
+    newmap = avmap_create(origmap->size);
+    if (newmap == NULL) {
+        corsaro_log(logger, "OOM while copying attack vector map in dos plugin");
+        return NULL;
+    }
 
-    for (i = kh_begin(origmap); i != kh_end(origmap); ++i) {
-        if (!kh_exist(origmap, i)) {
+    AVMAP_FOREACH_SLOT(origmap, i) {
+        if (!AVMAP_SLOT_FULL(origmap, i)) {
             continue;
         }
 
-        origav = kh_key(origmap, i);
+        origav = AVMAP_SLOT_VEC(origmap, i);
 
         /* If this vector was inactive for the entire interval,
          * skip it and remove it from the original vector map.
          */
         if (origav->latest_time.tv_sec < lastrot) {
-            kh_del(av, origmap, i);
+            avmap_delete_slot(origmap, i);
+            corsaro_mem_budget_release(orig->budget,
+                    DOS_VECTOR_MEM_ESTIMATE(origav));
+            orig->memcharged -= DOS_VECTOR_MEM_ESTIMATE(origav);
             attack_vector_free(origav);
             continue;
         }
-        newav = attack_vector_init(1);
+        newav = attack_vector_init(orig->vechandler);
+        if (newav == NULL || attack_vector_save_packet(newav,
+                    orig->pkthandler, conf->initial_packet_snaplen,
+                    origav->initial_packet,
+                    origav->initial_packet_len) < 0) {
+            corsaro_log(logger,
+                    "OOM while copying attack vector in dos plugin");
+            attack_vector_free(newav);
+            continue;
+        }
 
-        newav->initial_packet_len = origav->initial_packet_len;
         newav->protocol = origav->protocol;
         newav->attacker_ip = origav->attacker_ip;
         newav->responder_ip = origav->responder_ip;
@@ -850,26 +1051,25 @@ static kh_av_t *copy_attack_hash_table(corsaro_dos_config_t *conf,
         newav->mismatches = origav->mismatches;
         newav->start_time = origav->start_time;
         newav->latest_time = origav->latest_time;
-        newav->packet_timestamps = origav->packet_timestamps;
         newav->first_attack_port = origav->first_attack_port;
         newav->first_target_port = origav->first_target_port;
         newav->maxmind_continent = origav->maxmind_continent;
         newav->maxmind_country = origav->maxmind_country;
 
-        newav->initial_packet = (uint8_t *)malloc(origav->initial_packet_len);
-        memcpy(newav->initial_packet, origav->initial_packet,
-                origav->initial_packet_len);
-
         attack_vector_update_ppm_window(conf, origav, &endtv, 1);
         newav->ppm_bucket_list = origav->ppm_bucket_list;
 
-        copy_32hash(origav->attack_ip_hash, newav->attack_ip_hash);
-        copy_32hash(origav->attack_port_hash, newav->attack_port_hash);
-        copy_32hash(origav->target_port_hash, newav->target_port_hash);
+        /* The sets are about to be emptied anyway, so just hand them over
+         * to the copy */
+        newav->attack_ip_hash = origav->attack_ip_hash;
+        newav->attack_port_hash = origav->attack_port_hash;
+        newav->target_port_hash = origav->target_port_hash;
+        memset(&(origav->attack_ip_hash), 0, sizeof(dos_value_set_t));
+        memset(&(origav->attack_port_hash), 0, sizeof(dos_value_set_t));
+        memset(&(origav->target_port_hash), 0, sizeof(dos_value_set_t));
 
         /* Clear the ppm bucket list */
         origav->ppm_bucket_list = NULL;
-        origav->packet_timestamps = libtrace_list_init(sizeof(double));
         origav->ppm_window.window_start = endts;
         origav->ppm_window.buckets[0] = 0;
 
@@ -877,11 +1077,11 @@ static kh_av_t *copy_attack_hash_table(corsaro_dos_config_t *conf,
         origav->packet_cnt = 0;
         origav->mismatches = 0;
 
-        kh_clear(32xx, origav->attack_ip_hash);
-        kh_clear(32xx, origav->attack_port_hash);
-        kh_clear(32xx, origav->target_port_hash);
-
-        kh_put(av, newmap, newav, &khret);
+        if (avmap_put(newmap, newav->target_ip, newav) < 0) {
+            corsaro_log(logger,
+                    "OOM while copying attack vector map in dos plugin");
+            attack_vector_free(newav);
+        }
     }
 
     return newmap;
@@ -905,13 +1105,53 @@ static struct corsaro_dos_state_t *copy_attack_state(corsaro_plugin_t *p,
     copy->threadid = orig->threadid;
     copy->lastpktts = orig->lastpktts;
 
-    copy->attack_hash_tcp = copy_attack_hash_table(conf, p->logger,
+    /* The merging thread will need to release the copied vectors back to
+     * our pools, so make sure the pools outlive this thread if need be */
+    copy->vechandler = orig->vechandler;
+    copy->pkthandler = orig->pkthandler;
+    if (!orig->pools_shared) {
+        if (orig->vechandler) {
+            add_corsaro_memhandler_user(orig->vechandler);
+        }
+        if (orig->pkthandler) {
+            add_corsaro_memhandler_user(orig->pkthandler);
+        }
+        orig->pools_shared = 1;
+        copy->pools_shared = 1;
+    }
+
+    /* The copy is owned by the merging thread and is not charged to the
+     * budget, but it needs to say whether this interval was degraded */
+    copy->degraded = orig->degraded;
+    orig->degraded = 0;
+
+    copy->attack_hash_tcp = copy_attack_hash_table(conf, p->logger, orig,
             orig->attack_hash_tcp, orig->last_rotation, endts);
-    copy->attack_hash_udp = copy_attack_hash_table(conf, p->logger,
+    copy->attack_hash_udp = copy_attack_hash_table(conf, p->logger, orig,
             orig->attack_hash_udp, orig->last_rotation, endts);
-    copy->attack_hash_icmp = copy_attack_hash_table(conf, p->logger,
+    copy->attack_hash_icmp = copy_attack_hash_table(conf, p->logger, orig,
             orig->attack_hash_icmp, orig->last_rotation, endts);
 
+    if (copy->attack_hash_tcp == NULL || copy->attack_hash_udp == NULL ||
+            copy->attack_hash_icmp == NULL) {
+        avmap_destroy(copy->attack_hash_tcp, &attack_vector_free);
+        avmap_destroy(copy->attack_hash_udp, &attack_vector_free);
+        avmap_destroy(copy->attack_hash_icmp, &attack_vector_free);
+        if (copy->pools_shared) {
+            /* The merging thread will never see this copy, so drop the
+             * reference that we took on its behalf */
+            if (orig->vechandler) {
+                destroy_corsaro_memhandler(orig->vechandler);
+            }
+            if (orig->pkthandler) {
+                destroy_corsaro_memhandler(orig->pkthandler);
+            }
+            orig->pools_shared = 0;
+        }
+        free(copy);
+        return NULL;
+    }
+
     return copy;
 }
 
@@ -938,6 +1178,54 @@ void *corsaro_dos_end_interval(corsaro_plugin_t *p, void *local,
     return (void *)deepcopy;
 }
 
+/** Discards every vector in an attack hash table that has seen fewer than
+ *  the minimum number of packets for an attack during this interval.
+ */
+static void prune_attack_hash_table(struct corsaro_dos_state_t *state,
+        attack_vector_map_t *attack_hash, uint16_t minpackets) {
+
+    uint32_t i;
+    attack_vector_t *av;
+
+    AVMAP_FOREACH_SLOT(attack_hash, i) {
+        if (!AVMAP_SLOT_FULL(attack_hash, i)) {
+            continue;
+        }
+        av = AVMAP_SLOT_VEC(attack_hash, i);
+        if (av->packet_cnt >= minpackets) {
+            continue;
+        }
+        avmap_delete_slot(attack_hash, i);
+        corsaro_mem_budget_release(state->budget,
+                DOS_VECTOR_MEM_ESTIMATE(av));
+        state->memcharged -= DOS_VECTOR_MEM_ESTIMATE(av);
+        attack_vector_free(av);
+    }
+}
+
+/** Reduces the memory used by a thread that has exceeded the plugin's
+ *  memory budget: vectors that are too small to be reported as attacks
+ *  are dropped and no new vectors will be created for the rest of the
+ *  interval.
+ */
+static void degrade_attack_state(corsaro_logger_t *logger,
+        struct corsaro_dos_state_t *state, corsaro_dos_config_t *conf) {
+
+    corsaro_log(logger,
+            "dos plugin: thread %d exceeded the memory budget, dropping vectors with fewer than %u packets",
+            state->threadid, conf->attack_min_packets);
+
+    prune_attack_hash_table(state, state->attack_hash_tcp,
+            conf->attack_min_packets);
+    prune_attack_hash_table(state, state->attack_hash_udp,
+            conf->attack_min_packets);
+    prune_attack_hash_table(state, state->attack_hash_icmp,
+            conf->attack_min_packets);
+
+    state->degraded = 1;
+    corsaro_mem_budget_note_degraded(state->budget);
+}
+
 static inline void process_icmp_packet(libtrace_icmp_t *icmp_hdr,
         uint32_t remaining, uint32_t *targetip, uint16_t *attackport,
         uint16_t *targetport, uint32_t *inner_icmp_src, uint8_t *srcproto) {
@@ -1015,14 +1303,13 @@ static attack_vector_t *match_packet_to_vector(
         corsaro_logger_t *logger, libtrace_packet_t *packet,
         struct corsaro_dos_state_t *state, uint8_t srcproto,
         attack_vector_t *findme, struct timeval *tv,
-        corsaro_packet_tags_t *tags) {
+        corsaro_packet_tags_t *tags, uint16_t snaplen) {
 
-    int khret, rem;
-    khiter_t khiter;
+    int rem;
     attack_vector_t *vector = NULL;
     uint8_t *pkt_buf = NULL;
     libtrace_linktype_t linktype;
-    kh_av_t *attack_hash;
+    attack_vector_map_t *attack_hash;
 
     if (srcproto == TRACE_IPPROTO_ICMP) {
         attack_hash = state->attack_hash_icmp;
@@ -1034,19 +1321,13 @@ static attack_vector_t *match_packet_to_vector(
         return NULL;
     }
 
-    if ((khiter = kh_get(av, attack_hash, findme)) != kh_end(attack_hash)) {
+    if ((vector = avmap_get(attack_hash, findme->target_ip)) != NULL) {
         /* the vector is in the hash */
-        vector = kh_key(attack_hash, khiter);
         return vector;
     }
 
-    vector = attack_vector_init(1);
-    if (vector == NULL || !AV_INIT_SUCCESS(vector)) {
-        if (vector) {
-            attack_vector_free(vector);
-        }
-        corsaro_log(logger,
-                "unable to allocate space for new dos attack vector");
+    if (state->degraded) {
+        /* Over our memory budget, only track existing vectors */
         return NULL;
     }
 
@@ -1054,30 +1335,32 @@ static attack_vector_t *match_packet_to_vector(
     if (pkt_buf == NULL) {
         corsaro_log(logger,
                 "dos plugin: error while extracting packet buffer");
-        attack_vector_free(vector);
         return NULL;
     }
 
-    vector->initial_packet_len = rem;
-    if (vector->initial_packet_len > 10000) {
+    if (rem > CORSARO_DOS_MAX_INITIAL_PACKET_SNAPLEN) {
         corsaro_log(logger,
                 "dos plugin: bogus packet capture length %u\n", rem);
-        attack_vector_free(vector);
         return NULL;
     }
 
-    vector->initial_packet = (uint8_t *)malloc(vector->initial_packet_len);
-    if (vector->initial_packet == NULL) {
+    vector = attack_vector_init(state->vechandler);
+    if (vector == NULL) {
+        corsaro_log(logger,
+                "unable to allocate space for new dos attack vector");
+        return NULL;
+    }
+
+    if (attack_vector_save_packet(vector, state->pkthandler, snaplen,
+                pkt_buf, rem) < 0) {
         corsaro_log(logger,
                 "unable to allocate space for packet inside new dos attack vector");
         attack_vector_free(vector);
         return NULL;
     }
 
-    memcpy(vector->initial_packet, pkt_buf, rem);
     vector->target_ip = findme->target_ip;
     vector->protocol = srcproto;
-    vector->packet_timestamps = libtrace_list_init(sizeof(double));
 
     /* Will get populated on return */
     vector->attacker_ip = 0;
@@ -1095,8 +1378,12 @@ static attack_vector_t *match_packet_to_vector(
         }
     }
 
-    khiter = kh_put(av, attack_hash, vector, &khret);
-    assert(khret != 0);
+    if (avmap_put(attack_hash, vector->target_ip, vector) < 0) {
+        corsaro_log(logger,
+                "unable to grow dos attack vector map");
+        attack_vector_free(vector);
+        return NULL;
+    }
     return vector;
 }
 
@@ -1119,7 +1406,7 @@ int corsaro_dos_process_packet(corsaro_plugin_t *p, void *local,
     attack_flow_t thisflow;
     struct timeval tv;
     double tssecs;
-    int khret;
+    uint8_t overbudget = 0;
 
     conf = (corsaro_dos_config_t *)(p->config);
     state = (struct corsaro_dos_state_t *)local;
@@ -1178,7 +1465,7 @@ int corsaro_dos_process_packet(corsaro_plugin_t *p, void *local,
     tv = trace_get_timeval(packet);
     state->lastpktts = tv.tv_sec;
     vector = match_packet_to_vector(p->logger, packet, state, srcproto,
-            &findme, &tv, tags);
+            &findme, &tv, tags, conf->initial_packet_snaplen);
 
     if (!vector) {
         return 0;
@@ -1196,6 +1483,10 @@ int corsaro_dos_process_packet(corsaro_plugin_t *p, void *local,
         /* Ensure our windows are aligned to the nearest "slide" interval */
         vector->ppm_window.window_start = state->last_rotation -
                 (state->last_rotation % conf->ppm_window_slide);
+
+        state->memcharged += DOS_VECTOR_MEM_ESTIMATE(vector);
+        overbudget = corsaro_mem_budget_charge(state->budget,
+                DOS_VECTOR_MEM_ESTIMATE(vector));
     }
 
     if (proto == TRACE_IPPROTO_ICMP) {
@@ -1216,12 +1507,15 @@ int corsaro_dos_process_packet(corsaro_plugin_t *p, void *local,
     /* The range of attacker IPs is now counted as unique /16s to limit the
      * memory requirements when storing vectors for massive DDOS
      * attacks that try to spoof the entire telescope address space */
-    kh_put(32xx, vector->attack_ip_hash, thisflow.attacker_ip & 0xffff0000,
-            &khret);
+    dos_set_add(&(vector->attack_ip_hash), thisflow.attacker_ip & 0xffff0000);
 
     /* add the ports to the hashes */
-    kh_put(32xx, vector->attack_port_hash, attacker_port, &khret);
-    kh_put(32xx, vector->target_port_hash, target_port, &khret);
+    dos_set_add(&(vector->attack_port_hash), attacker_port);
+    dos_set_add(&(vector->target_port_hash), target_port);
+
+    if (overbudget) {
+        degrade_attack_state(p->logger, state, conf);
+    }
 
     return 0;
 }
@@ -1230,27 +1524,27 @@ int corsaro_dos_process_packet(corsaro_plugin_t *p, void *local,
 /** ------------- MERGING API -------------------- */
 
 static int write_attack_vectors(corsaro_logger_t *logger,
-        corsaro_dos_merge_state_t *mstate, kh_av_t *attack_hash,
+        corsaro_dos_merge_state_t *mstate, attack_vector_map_t *attack_hash,
         uint32_t ts, corsaro_dos_config_t *conf) {
 
 
-    khiter_t i;
+    uint32_t i;
     attack_vector_t *vec;
     avro_value_t *avro;
     double duration;
     struct timeval tvdiff;
     uint32_t thismaxppm = 0;
 
-    for (i = kh_begin(attack_hash); i != kh_end(attack_hash); ++i) {
-        if (!kh_exist(attack_hash, i)) {
+    AVMAP_FOREACH_SLOT(attack_hash, i) {
+        if (!AVMAP_SLOT_FULL(attack_hash, i)) {
             continue;
         }
 
-        vec = kh_key(attack_hash, i);
+        vec = AVMAP_SLOT_VEC(attack_hash, i);
 
         if (vec->latest_time.tv_sec < ts) {
             /* vector was inactive, delete it */
-            kh_del(av, attack_hash, i);
+            avmap_delete_slot(attack_hash, i);
             attack_vector_free(vec);
             continue;
         }
@@ -1315,15 +1609,16 @@ void *corsaro_dos_init_merging(corsaro_plugin_t *p, int sources) {
 
     m->combined = calloc(1, sizeof(struct corsaro_dos_state_t));
 
-    m->combined->attack_hash_tcp = kh_init(av);
-    m->combined->attack_hash_udp = kh_init(av);
-    m->combined->attack_hash_icmp = kh_init(av);
+    m->combined->attack_hash_tcp = avmap_create(0);
+    m->combined->attack_hash_udp = avmap_create(0);
+    m->combined->attack_hash_icmp = avmap_create(0);
     return m;
 }
 
 int corsaro_dos_halt_merging(corsaro_plugin_t *p, void *local) {
 
     corsaro_dos_merge_state_t *m;
+    int i;
 
     m = (corsaro_dos_merge_state_t *)(local);
     if (m == NULL) {
@@ -1335,92 +1630,22 @@ int corsaro_dos_halt_merging(corsaro_plugin_t *p, void *local) {
     }
 
     if (m->combined) {
-        kh_free(av, m->combined->attack_hash_tcp, &attack_vector_free);
-        kh_free(av, m->combined->attack_hash_udp, &attack_vector_free);
-        kh_free(av, m->combined->attack_hash_icmp, &attack_vector_free);
-        kh_destroy(av, m->combined->attack_hash_tcp);
-        kh_destroy(av, m->combined->attack_hash_udp);
-        kh_destroy(av, m->combined->attack_hash_icmp);
+        avmap_destroy(m->combined->attack_hash_tcp, &attack_vector_free);
+        avmap_destroy(m->combined->attack_hash_udp, &attack_vector_free);
+        avmap_destroy(m->combined->attack_hash_icmp, &attack_vector_free);
         free(m->combined);
     }
 
-    free(m);
-    return 0;
-}
-
-static int combine_32_hash(kh_32xx_t *dest, kh_32xx_t *src) {
-
-    khiter_t i;
-    uint32_t toadd;
-    int khret;
-
-    for (i = kh_begin(src); i != kh_end(src); ++i) {
-        if (!kh_exist(src, i)) {
-            continue;
-        }
-
-        toadd = kh_key(src, i);
-        /* Just add it -- any duplicates should be silently ignored */
-        kh_put(32xx, dest, toadd, &khret);
+    /* All of our vectors have been released, so we can let go of the
+     * processing threads' pools */
+    for (i = 0; i < m->handlercount; i++) {
+        destroy_corsaro_memhandler(m->handlers[i]);
     }
-    return 0;
-}
-
-static int combine_ft_set(kh_ft_t *dest, kh_ft_t *src) {
-
-    khiter_t i, find;
-    attack_flow_t *toadd, *existing;
-    int khret;
-
-    for (i = kh_begin(src); i != kh_end(src); ++i) {
-        if (!kh_exist(src, i)) {
-            continue;
-        }
-
-        toadd = kh_key(src, i);
-        find = kh_get(ft, dest, toadd);
-        if (find == kh_end(dest)) {
-            /* This flow doesn't exist, so just insert it */
-            find = kh_put(ft, dest, toadd, &khret);
-
-            /* Remove toadd from src so it persists once we
-             * clear src later on.
-             */
-            kh_del(ft, src, i);
-            continue;
-        }
-
-        existing = kh_key(dest, find);
-        /* Flow already exists, so try to combine */
-        existing->total_packet_count += toadd->total_packet_count;
-
-        if (toadd->ts_sec < existing->ts_sec ||
-                (toadd->ts_sec == existing->ts_sec &&
-                 toadd->ts_usec < existing->ts_usec)) {
-
-            /* toadd has the earliest packet, so use that timestamp
-             * instead...
-             */
-            existing->ts_sec = toadd->ts_sec;
-            existing->ts_usec = toadd->ts_usec;
-        }
-
-        if (toadd->latest_sec > existing->latest_sec ||
-                (toadd->latest_sec == existing->latest_sec &&
-                 toadd->latest_usec > existing->latest_usec)) {
-
-            /* toadd has the most recent packet, so use that timestamp
-             * instead...
-             */
-            existing->latest_sec = toadd->latest_sec;
-            existing->latest_usec = toadd->latest_usec;
-        }
-
-        /* Don't need to remove toadd, as it'll get cleaned up when its
-         * parent attack vector is freed.
-         */
+    if (m->handlers) {
+        free(m->handlers);
     }
 
+    free(m);
     return 0;
 }
 
@@ -1490,36 +1715,38 @@ static int combine_timestamp_lists(libtrace_list_t **dest, libtrace_list_t *src,
     return 0;
 }
 
-static int combine_attack_vectors(kh_av_t *destmap, kh_av_t *srcmap,
-        corsaro_logger_t *logger) {
+static int combine_attack_vectors(attack_vector_map_t *destmap,
+        attack_vector_map_t *srcmap, corsaro_logger_t *logger) {
 
-    khiter_t i, find;
+    uint32_t i;
     attack_vector_t *existing, *toadd;
-    int khret;
 
-    for (i = kh_begin(srcmap); i != kh_end(srcmap); ++i) {
-        if (!kh_exist(srcmap, i)) {
+    AVMAP_FOREACH_SLOT(srcmap, i) {
+        if (!AVMAP_SLOT_FULL(srcmap, i)) {
             continue;
         }
 
-        toadd = kh_key(srcmap, i);
-        find = kh_get(av, destmap, toadd);
+        toadd = AVMAP_SLOT_VEC(srcmap, i);
+        existing = avmap_get(destmap, toadd->target_ip);
 
-        if (find == kh_end(destmap)) {
+        if (existing == NULL) {
             /* Target is not already present, so we can just add it */
-            find = kh_put(av, destmap, toadd, &khret);
+            if (avmap_put(destmap, toadd->target_ip, toadd) < 0) {
+                corsaro_log(logger,
+                        "unable to grow combined dos attack vector map");
+                return -1;
+            }
 
             /* Remove toadd from srcmap so it doesn't get deleted when
              * we clear srcmap afterwards.
              */
-            kh_del(av, srcmap, i);
+            avmap_delete_slot(srcmap, i);
             continue;
         }
 
         /* Target already exists in destmap, so we need to merge the
          * two results.
          */
-        existing = kh_key(destmap, find);
         existing->thread_cnt ++;
         existing->packet_cnt += toadd->packet_cnt;
         existing->mismatches += toadd->mismatches;
@@ -1528,8 +1755,6 @@ static int combine_attack_vectors(kh_av_t *destmap, kh_av_t *srcmap,
         if (toadd->start_time.tv_sec < existing->start_time.tv_sec ||
                 (toadd->start_time.tv_sec == existing->start_time.tv_sec &&
                  toadd->start_time.tv_usec < existing->start_time.tv_usec)) {
-            uint8_t *tmp;
-
             existing->start_time.tv_sec = toadd->start_time.tv_sec;
             existing->start_time.tv_usec = toadd->start_time.tv_usec;
             existing->first_attack_port = toadd->first_attack_port;
@@ -1537,11 +1762,12 @@ static int combine_attack_vectors(kh_av_t *destmap, kh_av_t *srcmap,
 
             /* Replace initial packet too, since the "new" vector started
              * before the one we've already got. */
-            tmp = existing->initial_packet;
+            attack_vector_release_packet(existing);
             existing->initial_packet = toadd->initial_packet;
             existing->initial_packet_len = toadd->initial_packet_len;
+            existing->pkthandler = toadd->pkthandler;
+            existing->pktsrc = toadd->pktsrc;
             toadd->initial_packet = NULL;
-            free(tmp);
         }
 
         if (toadd->latest_time.tv_sec > existing->latest_time.tv_sec ||
@@ -1553,9 +1779,12 @@ static int combine_attack_vectors(kh_av_t *destmap, kh_av_t *srcmap,
 
         if (toadd->packet_cnt > 0) {
 
-            combine_32_hash(existing->attack_ip_hash, toadd->attack_ip_hash);
-            combine_32_hash(existing->attack_port_hash, toadd->attack_port_hash);
-            combine_32_hash(existing->target_port_hash, toadd->target_port_hash);
+            dos_set_combine(&(existing->attack_ip_hash),
+                    &(toadd->attack_ip_hash));
+            dos_set_combine(&(existing->attack_port_hash),
+                    &(toadd->attack_port_hash));
+            dos_set_combine(&(existing->target_port_hash),
+                    &(toadd->target_port_hash));
 
             if (existing->ppm_bucket_list == NULL) {
                 existing->ppm_bucket_list = toadd->ppm_bucket_list;
@@ -1572,7 +1801,7 @@ static int combine_attack_vectors(kh_av_t *destmap, kh_av_t *srcmap,
             */
         }
 
-        kh_del(av, srcmap, i);
+        avmap_delete_slot(srcmap, i);
         attack_vector_free(toadd);
     }
 
@@ -1580,6 +1809,31 @@ static int combine_attack_vectors(kh_av_t *destmap, kh_av_t *srcmap,
 
 }
 
+/** Takes over the processing thread's extra reference to its pools when
+ *  we see the first results from that thread.
+ */
+static void adopt_vector_pools(corsaro_dos_merge_state_t *m,
+        struct corsaro_dos_state_t *next) {
+
+    if (!next->pools_shared) {
+        return;
+    }
+
+    if (m->handlercount + 2 > m->handleralloc) {
+        m->handleralloc += 16;
+        m->handlers = (corsaro_memhandler_t **)realloc(m->handlers,
+                m->handleralloc * sizeof(corsaro_memhandler_t *));
+    }
+    if (next->vechandler) {
+        m->handlers[m->handlercount] = next->vechandler;
+        m->handlercount ++;
+    }
+    if (next->pkthandler) {
+        m->handlers[m->handlercount] = next->pkthandler;
+        m->handlercount ++;
+    }
+}
+
 static int update_combined_result(struct corsaro_dos_state_t *combined,
         struct corsaro_dos_state_t *next, corsaro_logger_t *logger) {
 
@@ -1616,12 +1870,9 @@ static int update_combined_result(struct corsaro_dos_state_t *combined,
 
 endcombine:
     /* Free 'next' and everything in it */
-    kh_free(av, next->attack_hash_tcp, &attack_vector_free);
-    kh_free(av, next->attack_hash_udp, &attack_vector_free);
-    kh_free(av, next->attack_hash_icmp, &attack_vector_free);
-    kh_destroy(av, next->attack_hash_tcp);
-    kh_destroy(av, next->attack_hash_udp);
-    kh_destroy(av, next->attack_hash_icmp);
+    avmap_destroy(next->attack_hash_tcp, &attack_vector_free);
+    avmap_destroy(next->attack_hash_udp, &attack_vector_free);
+    avmap_destroy(next->attack_hash_icmp, &attack_vector_free);
     free(next);
 
     return ret;
@@ -1636,6 +1887,7 @@ int corsaro_dos_merge_interval_results(corsaro_plugin_t *p, void *local,
     int i;
     int ret = 0;
     char *outname;
+    uint8_t degraded = 0;
 
     m = (corsaro_dos_merge_state_t *)(local);
     if (m == NULL) {
@@ -1658,6 +1910,13 @@ int corsaro_dos_merge_interval_results(corsaro_plugin_t *p, void *local,
     }
 
     for (i = 0; i < fin->threads_ended; i++) {
+        if (tomerge[i] == NULL) {
+            continue;
+        }
+        if (((struct corsaro_dos_state_t *)(tomerge[i]))->degraded) {
+            degraded = 1;
+        }
+        adopt_vector_pools(m, (struct corsaro_dos_state_t *)(tomerge[i]));
         if (update_combined_result(m->combined,
                 (struct corsaro_dos_state_t *)(tomerge[i]),
                 p->logger) < 0) {
@@ -1667,6 +1926,11 @@ int corsaro_dos_merge_interval_results(corsaro_plugin_t *p, void *local,
         }
     }
 
+    if (degraded) {
+        corsaro_mem_budget_mark_interval(p->budget, p->logger, fin->timestamp,
+                "vectors below the minimum attack packet count were dropped");
+    }
+
     /* Dump combined to our avro file */
     if (write_attack_vectors(p->logger, m,
             m->combined->attack_hash_tcp, fin->timestamp, config) < 0) {
@@ -0,0 +1,346 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#ifndef CORSARO_DOS_AVMAP_H
+#define CORSARO_DOS_AVMAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Only pointers to attack vectors are stored in the map, so the map does
+ * not need to know what is in them. Keeping the map in its own header lets
+ * tests/bench_dos_avmap exercise it without the rest of the plugin.
+ */
+struct attack_vector;
+
+/** Maps the target IP of each attack vector to the vector itself.
+ *
+ *  This is an open-addressing table where each slot has a one byte
+ *  control (metadata) entry: either empty or the low 7 bits of the hash of
+ *  the key stored in the slot. Lookups compare all of the control bytes in
+ *  a chunk against the hash at once (using SSE2 where available), so only
+ *  slots with a matching hash need to be inspected.
+ *
+ *  Slots are grouped into 128 byte chunks that hold the control bytes,
+ *  keys and vector pointers for eight slots together, so a lookup in a
+ *  large map usually only touches one chunk rather than a separate control
+ *  array and slot array. Each chunk also counts the keys that had to
+ *  probe past it because it was full; a lookup can stop as soon as it
+ *  reaches a chunk where that count is zero, without needing tombstones.
+ */
+
+/** Chunk arrays at least this large are backed by huge pages if possible */
+#define AVMAP_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/** Number of slots in each chunk */
+#define AVMAP_CHUNK_SLOTS 8
+
+/** Control byte value for slots that do not contain a vector */
+#define AVMAP_CTRL_EMPTY ((uint8_t)0x80)
+
+/** Number of slot indexes in an attack vector map */
+#define AVMAP_SLOT_COUNT(map) (((map)->mask + 1) * AVMAP_CHUNK_SLOTS)
+
+/** True if the slot at the given index contains a vector */
+#define AVMAP_SLOT_FULL(map, i) \
+    ((map)->chunks[(i) / AVMAP_CHUNK_SLOTS].ctrl[(i) % AVMAP_CHUNK_SLOTS] \
+        < 0x80)
+
+/** The vector in the slot at the given index */
+#define AVMAP_SLOT_VEC(map, i) \
+    ((map)->chunks[(i) / AVMAP_CHUNK_SLOTS].vec[(i) % AVMAP_CHUNK_SLOTS])
+
+/** Iterates over every slot index in an attack vector map */
+#define AVMAP_FOREACH_SLOT(map, i) \
+    for ((i) = 0; (i) < AVMAP_SLOT_COUNT(map); (i)++)
+
+typedef struct avmap_chunk {
+    uint8_t ctrl[AVMAP_CHUNK_SLOTS];
+    /** Number of keys whose probe sequence passed this chunk because it
+     *  was full (saturating at 255) */
+    uint8_t overflow;
+    uint8_t pad[7];
+    uint32_t target_ip[AVMAP_CHUNK_SLOTS];
+    /* Keep the vectors on their own cache line, right after the keys */
+    struct attack_vector *vec[AVMAP_CHUNK_SLOTS] __attribute__((aligned(64)));
+} __attribute__((aligned(128))) avmap_chunk_t;
+
+typedef struct attack_vector_map {
+    avmap_chunk_t *chunks;
+    /** Number of chunks in the table, minus one */
+    uint32_t mask;
+    /** Number of vectors in the table */
+    uint32_t size;
+    /** Number of vectors that the table can hold before we must resize */
+    uint32_t limit;
+} attack_vector_map_t;
+
+static inline uint64_t avmap_hash(uint32_t target_ip) {
+    /* murmur3 64 bit finaliser */
+    uint64_t h = target_ip;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/** Returns a bitmask of the control bytes in a chunk that equal 'val' */
+static inline uint32_t avmap_match_chunk(const avmap_chunk_t *chunk,
+        uint8_t val) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadl_epi64((const __m128i *)chunk->ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl,
+                _mm_set1_epi8((char)val))) & 0xff;
+#else
+    uint32_t bits = 0;
+    int i;
+
+    for (i = 0; i < AVMAP_CHUNK_SLOTS; i++) {
+        if (chunk->ctrl[i] == val) {
+            bits |= (1U << i);
+        }
+    }
+    return bits;
+#endif
+}
+
+static inline int avmap_alloc_chunks(attack_vector_map_t *map,
+        uint32_t chunks) {
+    uint32_t i;
+    size_t bytes = (size_t)chunks * sizeof(avmap_chunk_t);
+
+    /* Large maps are looked up at random, so most lookups would otherwise
+     * miss in the TLB as well as the cache -- ask for huge pages */
+    if (posix_memalign((void **)&(map->chunks),
+            bytes >= AVMAP_HUGEPAGE_SIZE ? AVMAP_HUGEPAGE_SIZE :
+            sizeof(avmap_chunk_t), bytes) != 0) {
+        map->chunks = NULL;
+        return -1;
+    }
+#ifdef MADV_HUGEPAGE
+    if (bytes >= AVMAP_HUGEPAGE_SIZE) {
+        madvise(map->chunks, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    memset(map->chunks, 0, chunks * sizeof(avmap_chunk_t));
+    for (i = 0; i < chunks; i++) {
+        memset(map->chunks[i].ctrl, AVMAP_CTRL_EMPTY, AVMAP_CHUNK_SLOTS);
+    }
+    map->mask = chunks - 1;
+    map->size = 0;
+    /* Keep the table at most 7/8 full */
+    map->limit = chunks * (AVMAP_CHUNK_SLOTS - (AVMAP_CHUNK_SLOTS / 8));
+    return 0;
+}
+
+/** Creates an attack vector map that can hold at least 'expected' vectors
+ *  without needing to be resized.
+ */
+static inline attack_vector_map_t *avmap_create(uint32_t expected) {
+    attack_vector_map_t *map;
+    uint64_t chunks = 1;
+
+    while (chunks * (AVMAP_CHUNK_SLOTS - (AVMAP_CHUNK_SLOTS / 8)) <=
+            expected) {
+        chunks <<= 1;
+    }
+
+    map = (attack_vector_map_t *)calloc(1, sizeof(attack_vector_map_t));
+    if (map == NULL) {
+        return NULL;
+    }
+    if (avmap_alloc_chunks(map, chunks) < 0) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+/** Destroys an attack vector map, along with all of the vectors in it */
+static inline void avmap_destroy(attack_vector_map_t *map,
+        void (*freefunc)(struct attack_vector *)) {
+
+    uint32_t i;
+
+    if (map == NULL) {
+        return;
+    }
+    AVMAP_FOREACH_SLOT(map, i) {
+        if (AVMAP_SLOT_FULL(map, i)) {
+            freefunc(AVMAP_SLOT_VEC(map, i));
+        }
+    }
+    free(map->chunks);
+    free(map);
+}
+
+/** Finds the attack vector for a target IP, or returns NULL if there is
+ *  no vector for that target.
+ */
+static inline struct attack_vector *avmap_get(attack_vector_map_t *map,
+        uint32_t target_ip) {
+
+    uint64_t h = avmap_hash(target_ip);
+    uint32_t pos = (uint32_t)(h >> 7) & map->mask;
+    uint32_t bits;
+    uint8_t h2 = (uint8_t)(h & 0x7f);
+    avmap_chunk_t *chunk;
+
+    while (1) {
+        chunk = &(map->chunks[pos]);
+        bits = avmap_match_chunk(chunk, h2);
+        while (bits) {
+            if (chunk->target_ip[__builtin_ctz(bits)] == target_ip) {
+                return chunk->vec[__builtin_ctz(bits)];
+            }
+            bits &= (bits - 1);
+        }
+        if (chunk->overflow == 0) {
+            return NULL;
+        }
+        pos = (pos + 1) & map->mask;
+    }
+}
+
+/** Places a vector in the first free slot along its probe sequence,
+ *  without checking whether the target is already present.
+ */
+static inline void avmap_place(attack_vector_map_t *map,
+        uint32_t target_ip, struct attack_vector *vec) {
+
+    uint64_t h = avmap_hash(target_ip);
+    uint32_t pos = (uint32_t)(h >> 7) & map->mask;
+    uint32_t bits, i;
+    avmap_chunk_t *chunk;
+
+    while (1) {
+        chunk = &(map->chunks[pos]);
+        bits = avmap_match_chunk(chunk, AVMAP_CTRL_EMPTY);
+        if (bits) {
+            i = __builtin_ctz(bits);
+            chunk->ctrl[i] = (uint8_t)(h & 0x7f);
+            chunk->target_ip[i] = target_ip;
+            chunk->vec[i] = vec;
+            map->size ++;
+            return;
+        }
+        if (chunk->overflow < 255) {
+            chunk->overflow ++;
+        }
+        pos = (pos + 1) & map->mask;
+    }
+}
+
+/** Rebuilds an attack vector map with the given number of chunks */
+static inline int avmap_rehash(attack_vector_map_t *map, uint32_t chunks) {
+
+    attack_vector_map_t old = *map;
+    uint32_t i;
+
+    if (avmap_alloc_chunks(map, chunks) < 0) {
+        *map = old;
+        return -1;
+    }
+
+    AVMAP_FOREACH_SLOT(&old, i) {
+        if (AVMAP_SLOT_FULL(&old, i)) {
+            avmap_place(map, old.chunks[i / AVMAP_CHUNK_SLOTS].target_ip[
+                    i % AVMAP_CHUNK_SLOTS], AVMAP_SLOT_VEC(&old, i));
+        }
+    }
+    free(old.chunks);
+    return 0;
+}
+
+/** Adds a vector to an attack vector map. The caller must have already
+ *  checked that there is no vector for the same target in the map.
+ *
+ *  @return 0 if successful, -1 if the map could not be resized.
+ */
+static inline int avmap_put(attack_vector_map_t *map, uint32_t target_ip,
+        struct attack_vector *vec) {
+
+    if (map->size >= map->limit &&
+            avmap_rehash(map, (map->mask + 1) * 2) < 0) {
+        return -1;
+    }
+    avmap_place(map, target_ip, vec);
+    return 0;
+}
+
+/** Removes the vector in the slot at index 'i' from the map (but does not
+ *  free it). Safe to call while iterating over the map.
+ */
+static inline void avmap_delete_slot(attack_vector_map_t *map, uint32_t i) {
+    avmap_chunk_t *chunk = &(map->chunks[i / AVMAP_CHUNK_SLOTS]);
+    uint64_t h = avmap_hash(chunk->target_ip[i % AVMAP_CHUNK_SLOTS]);
+    uint32_t pos = (uint32_t)(h >> 7) & map->mask;
+
+    /* Undo the overflow counts that placing this key added along the way */
+    while (pos != i / AVMAP_CHUNK_SLOTS) {
+        if (map->chunks[pos].overflow < 255) {
+            map->chunks[pos].overflow --;
+        }
+        pos = (pos + 1) & map->mask;
+    }
+    chunk->ctrl[i % AVMAP_CHUNK_SLOTS] = AVMAP_CTRL_EMPTY;
+    map->size --;
+}
+
+#endif
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
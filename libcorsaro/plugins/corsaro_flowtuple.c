@@ -69,6 +69,7 @@
 #include "libcorsaro_plugin.h"
 #include "libcorsaro_common.h"
 #include "libcorsaro_avro.h"
+#include "libcorsaro_ftindex.h"
 #include "libcorsaro_filtering.h"
 #include "corsaro_flowtuple.h"
 #include "utils.h"
@@ -91,9 +92,56 @@ typedef enum corsaro_flowtuple_sort {
 
 } corsaro_flowtuple_sort_t;
 
+/** Initial number of slots in a flowtuple hash table (must be a power of
+ *  two) */
+#define FT_HASHTABLE_INIT_SLOTS (1 << 16)
+
+/** Rough per-record memory cost of an aggregated flowtuple, including the
+ *  share of the hash table slot or Judy map entries that index it. Used to
+ *  convert the configured memory limit into a record count.
+ */
+#define FT_RECORD_MEM_ESTIMATE (sizeof(struct corsaro_flowtuple) + 32)
+
+/** Rough per-record memory cost of an aggregated IPv6 flowtuple */
+#define FT6_RECORD_MEM_ESTIMATE (sizeof(struct corsaro_flowtuple6_data) + 16)
+
+/** Open-addressed (linear probing) hash table of flowtuple records, used
+ *  to aggregate flowtuples when sorting is disabled. Unlike a map keyed
+ *  on the 32-bit hash value alone, every candidate slot is compared
+ *  against the full flowtuple key so hash collisions cannot merge
+ *  different flows together.
+ */
+typedef struct corsaro_ft_hashtable {
+    /** The slots in the table, NULL if empty */
+    struct corsaro_flowtuple **slots;
+
+    /** Number of slots in the table -- always a power of two */
+    uint64_t capacity;
+
+    /** Number of slots that are currently occupied */
+    uint64_t used;
+} corsaro_ft_hashtable_t;
+
+/** Open-addressed hash table of IPv6 flowtuple records. IPv6 flowtuples
+ *  are always aggregated in a table of their own (regardless of whether
+ *  sorting is enabled) so that the IPv4 key, sort key and table layout
+ *  do not need to grow to accommodate 128-bit addresses. The table is
+ *  only sorted when it is written out.
+ */
+typedef struct corsaro_ft6_hashtable {
+    /** The slots in the table, NULL if empty */
+    struct corsaro_flowtuple6_data **slots;
+
+    /** Number of slots in the table -- always a power of two */
+    uint64_t capacity;
+
+    /** Number of slots that are currently occupied */
+    uint64_t used;
+} corsaro_ft6_hashtable_t;
+
 /** Holds the state for an instance of this plugin */
 struct corsaro_flowtuple_state_t {
-    Pvoid_t  st_hash;
+    corsaro_ft_hashtable_t *st_hash;
 
     /** Timestamp of the start of the current interval */
     uint32_t last_interval_start;
@@ -110,6 +158,45 @@ struct corsaro_flowtuple_state_t {
 
     Pvoid_t keysort_levelone;
 
+    /** Number of distinct flowtuples currently aggregated in memory */
+    uint64_t ftcount;
+
+    /** Memory (in bytes, as charged in memcharged and memcharged6) that
+     *  the aggregated flowtuples may use before the IPv4 flowtuples are
+     *  spilled to disk (0 = no limit) */
+    uint64_t memlimit;
+
+    /** Paths of the sorted run files spilled during the current interval */
+    char **runfiles;
+
+    /** Number of run files spilled during the current interval */
+    int runcount;
+
+    /** Number of entries allocated for the runfiles array */
+    int runalloc;
+
+    /** The memory budget for this plugin (NULL if there is no budget) */
+    corsaro_mem_budget_t *budget;
+
+    /** Memory charged to the budget for the flowtuples aggregated so far */
+    uint64_t memcharged;
+
+    /** Set if the memory budget has been exceeded during this interval,
+     *  in which case flowtuple keys are coarsened until the interval ends */
+    uint8_t coarsen;
+
+    /** The IPv6 flowtuples aggregated so far (NULL if none) */
+    corsaro_ft6_hashtable_t *st_hash6;
+
+    /** Memory charged to the budget for the IPv6 flowtuples. IPv6
+     *  flowtuples are never spilled, so this is tracked separately and
+     *  may not grow beyond half of the memory limit. */
+    uint64_t memcharged6;
+
+    /** Number of new IPv6 flowtuples discarded during this interval
+     *  because the IPv6 flowtuples had used their share of the memory
+     *  limit */
+    uint64_t dropped6;
 };
 
 enum {
@@ -117,6 +204,7 @@ enum {
     CORSARO_FT_MSG_ROTATE,
     CORSARO_FT_MSG_MERGE_SORTED,
     CORSARO_FT_MSG_MERGE_UNSORTED,
+    CORSARO_FT_MSG_MERGE_RUNS,
 };
 
 /** Enum describing the different compression methods we support for avro
@@ -138,9 +226,15 @@ typedef struct corsaro_ft_merge_msg {
 } PACKED corsaro_ft_write_msg_t;
 
 typedef struct corsaro_flowtuple_interim {
-    Pvoid_t hmap;
+    corsaro_ft_hashtable_t *hmap;
+    corsaro_ft6_hashtable_t *hmap6;
     uint64_t hsize;
     Pvoid_t sorted_keys;
+    char **runfiles;
+    int runcount;
+    uint64_t memcharged;
+    uint64_t dropped6;
+    uint8_t degraded;
     corsaro_logger_t *logger;
     pthread_mutex_t mutex;
     pthread_t tid;
@@ -151,7 +245,8 @@ typedef struct corsaro_flowtuple_iterator {
     corsaro_memhandler_t *handler;
     int sortiter;
     uint64_t hsize;
-    Pvoid_t hmap;
+    corsaro_ft_hashtable_t *hmap;
+    corsaro_ft6_hashtable_t *hmap6;
     struct corsaro_flowtuple *nextft;
     Word_t sortindex_top;
     Word_t sortindex_bot;
@@ -160,6 +255,10 @@ typedef struct corsaro_flowtuple_iterator {
     Pvoid_t sorted_keys;
     Pvoid_t current_subkeys;
 
+    char **runfiles;
+    int runcount;
+    uint64_t memcharged;
+
     corsaro_flowtuple_interim_t *parent;
 } corsaro_flowtuple_iterator_t;
 
@@ -207,6 +306,17 @@ typedef struct corsaro_flowtuple_merger {
      */
     Pvoid_t writers;
 
+    /** A hash map of block index writers, keyed in the same way as
+     *  'writers'. Each index writer describes the avro file being written
+     *  by the corresponding avro writer.
+     */
+    Pvoid_t indexes;
+
+    /** A hash map of corsaro avro writers for IPv6 flowtuples, keyed in
+     *  the same way as 'writers'.
+     */
+    Pvoid_t writers6;
+
     /** A kafka instance for publishing flowtuple records */
     rd_kafka_t *rdk;
     /** A kafka topic that flowtuple records can be published to */
@@ -226,9 +336,16 @@ typedef struct corsaro_flowtuple_merger {
     uint8_t maxmergeworkers;
     /** The compression method to use when writing avro output */
     uint8_t avrooutput;
+    /** Whether to write a block index alongside each avro file */
+    uint8_t blockindex;
+    /** Whether to sort IPv6 flowtuples before writing them */
+    uint8_t sortipv6;
     /** The kafka configuration options for this plugin */
     corsaro_ft_kafka_options_t *kafkaopts;
 
+    /** The memory budget that written flowtuples are refunded to */
+    corsaro_mem_budget_t *budget;
+
     /** A buffer for constructing messages to publish to kafka */
     uint8_t *buf;
 
@@ -254,7 +371,18 @@ typedef struct corsaro_flowtuple_config {
     void *zmq_ctxt;
     uint8_t maxmergeworkers;
     uint8_t avrooutput;
+    uint8_t blockindex;
     corsaro_ft_kafka_options_t kafkaopts;
+
+    /** Memory limit (in bytes) for the flowtuples aggregated by each
+     *  processing thread, 0 = unlimited */
+    uint64_t memorylimit;
+
+    /** Directory to write spilled flowtuple runs into */
+    char *spilldir;
+
+    /** Whether to produce flowtuples for IPv6 packets */
+    uint8_t ipv6;
 } corsaro_flowtuple_config_t;
 
 /** The name of this plugin */
@@ -297,11 +425,15 @@ int corsaro_flowtuple_parse_config(corsaro_plugin_t *p, yaml_document_t *doc,
     conf->sort_enabled = CORSARO_FLOWTUPLE_SORT_DEFAULT;
     conf->maxmergeworkers = 4;
     conf->avrooutput = CORSARO_AVRO_OUTPUT_DEFLATE;
+    conf->blockindex = 1;
     conf->kafkaopts.brokeruri = NULL;
     conf->kafkaopts.topicprefix = NULL;
     conf->kafkaopts.lingerms = 500;
     conf->kafkaopts.batchsize = 50;
     conf->kafkaopts.sampling = 10000;
+    conf->memorylimit = 0;
+    conf->spilldir = NULL;
+    conf->ipv6 = 0;
 
     if (options->type != YAML_MAPPING_NODE) {
         corsaro_log(p->logger,
@@ -350,6 +482,18 @@ int corsaro_flowtuple_parse_config(corsaro_plugin_t *p, yaml_document_t *doc,
             }
         }
 
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value, "blockindex") == 0) {
+            parse_onoff_option(p->logger, (char *)value->data.scalar.value,
+                    &(conf->blockindex), "blockindex");
+        }
+
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value, "ipv6") == 0) {
+            parse_onoff_option(p->logger, (char *)value->data.scalar.value,
+                    &(conf->ipv6), "ipv6");
+        }
+
         if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
                 && strcmp((char *)key->data.scalar.value,
                         "mergethreads") == 0) {
@@ -389,6 +533,23 @@ int corsaro_flowtuple_parse_config(corsaro_plugin_t *p, yaml_document_t *doc,
                         "kafkabrokers") == 0) {
             conf->kafkaopts.brokeruri = strdup((char *)value->data.scalar.value);
         }
+
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value,
+                        "memorylimit") == 0) {
+            /* specified in MB */
+            conf->memorylimit = strtoull((char *)value->data.scalar.value,
+                    NULL, 10) * 1024 * 1024;
+        }
+
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value,
+                        "spilldir") == 0) {
+            if (conf->spilldir) {
+                free(conf->spilldir);
+            }
+            conf->spilldir = strdup((char *)value->data.scalar.value);
+        }
     }
 
     p->config = conf;
@@ -441,6 +602,16 @@ int corsaro_flowtuple_finalise_config(corsaro_plugin_t *p,
                 "flowtuple plugin: not writing any avro output");
     }
 
+    if (conf->ipv6) {
+        corsaro_log(p->logger,
+                "flowtuple plugin: writing IPv6 flowtuples to separate 'flowtuple6' avro files");
+    }
+
+    if (conf->avrooutput != CORSARO_AVRO_OUTPUT_NONE && conf->blockindex) {
+        corsaro_log(p->logger,
+                "flowtuple plugin: writing block index files alongside avro output");
+    }
+
     if (conf->kafkaopts.brokeruri != NULL) {
         corsaro_log(p->logger,
                 "flowtuple plugin: writing flowtuples to kafka broker: %s, using topic prefix '%s'",
@@ -452,6 +623,16 @@ int corsaro_flowtuple_finalise_config(corsaro_plugin_t *p,
                 conf->kafkaopts.sampling);
     }
 
+    if (conf->spilldir == NULL) {
+        conf->spilldir = strdup("/tmp");
+    }
+
+    if (conf->memorylimit > 0) {
+        corsaro_log(p->logger,
+                "flowtuple plugin: limiting each processing thread to %" PRIu64 " MB of flowtuples, spilling excess to %s",
+                conf->memorylimit / (1024 * 1024), conf->spilldir);
+    }
+
     return 0;
 }
 
@@ -469,12 +650,41 @@ void corsaro_flowtuple_destroy_self(corsaro_plugin_t *p) {
         free(conf->kafkaopts.topicprefix);
     }
 
+    if (conf && conf->spilldir) {
+        free(conf->spilldir);
+    }
+
     if (p->config) {
         free(p->config);
     }
     p->config = NULL;
 }
 
+static int spill_flowtuple_run(corsaro_logger_t *logger,
+        struct corsaro_flowtuple_state_t *state,
+        corsaro_flowtuple_config_t *conf);
+static void destroy_ft6_hashtable(corsaro_ft6_hashtable_t *table,
+        uint8_t freerecords);
+
+/** Removes a set of spilled flowtuple run files and frees the list of
+ *  their names.
+ *
+ *  @param runfiles     The paths of the run files
+ *  @param runcount     The number of run files
+ */
+static void discard_flowtuple_runs(char **runfiles, int runcount) {
+    int i;
+
+    if (runfiles == NULL) {
+        return;
+    }
+    for (i = 0; i < runcount; i++) {
+        unlink(runfiles[i]);
+        free(runfiles[i]);
+    }
+    free(runfiles);
+}
+
 void *corsaro_flowtuple_init_processing(corsaro_plugin_t *p, int threadid) {
 
     struct corsaro_flowtuple_state_t *state;
@@ -501,6 +711,18 @@ void *corsaro_flowtuple_init_processing(corsaro_plugin_t *p, int threadid) {
 
     state->st_hash = NULL;
     state->keysort_levelone = NULL;
+    state->ftcount = 0;
+    state->memlimit = ((corsaro_flowtuple_config_t *)(p->config))->
+            memorylimit;
+    state->runfiles = NULL;
+    state->runcount = 0;
+    state->runalloc = 0;
+    state->budget = p->budget;
+    state->memcharged = 0;
+    state->coarsen = 0;
+    state->st_hash6 = NULL;
+    state->memcharged6 = 0;
+    state->dropped6 = 0;
 
     return state;
 }
@@ -514,6 +736,12 @@ int corsaro_flowtuple_halt_processing(corsaro_plugin_t *p, void *local) {
         return 0;
     }
 
+    /* Runs left over from an interval that never ended are useless now */
+    discard_flowtuple_runs(state->runfiles, state->runcount);
+    corsaro_mem_budget_release(state->budget, state->memcharged);
+    destroy_ft6_hashtable(state->st_hash6, 1);
+    corsaro_mem_budget_release(state->budget, state->memcharged6);
+
     if (state->fthandler) {
         destroy_corsaro_memhandler(state->fthandler);
     }
@@ -523,11 +751,11 @@ int corsaro_flowtuple_halt_processing(corsaro_plugin_t *p, void *local) {
 }
 
 static inline char * _flowtuple_derive_output_name(corsaro_logger_t *logger,
-        corsaro_plugin_proc_options_t *baseconf, uint32_t timestamp,
-        int threadid) {
+        corsaro_plugin_proc_options_t *baseconf, const char *label,
+        uint32_t timestamp, int threadid) {
 
     char *outname = NULL;
-    outname = corsaro_generate_avro_file_name(baseconf->template, "flowtuple",
+    outname = corsaro_generate_avro_file_name(baseconf->template, label,
             baseconf->monitorid, timestamp, threadid);
 
     if (outname == NULL) {
@@ -545,7 +773,7 @@ char *corsaro_flowtuple_derive_output_name(corsaro_plugin_t *p,
 
     conf = (corsaro_flowtuple_config_t *)(p->config);
     return _flowtuple_derive_output_name(p->logger, &(conf->basic),
-            timestamp, threadid);
+            PLUGIN_NAME, timestamp, threadid);
 }
 
 int corsaro_flowtuple_start_interval(corsaro_plugin_t *p, void *local,
@@ -567,7 +795,6 @@ void *corsaro_flowtuple_end_interval(corsaro_plugin_t *p, void *local,
     corsaro_flowtuple_config_t *conf;
     struct corsaro_flowtuple_state_t *state;
     corsaro_flowtuple_interim_t *interim = NULL;
-    Word_t hashsize;
 
     FLOWTUPLE_PROC_FUNC_START("corsaro_flowtuple_end_interval", NULL);
 
@@ -577,15 +804,57 @@ void *corsaro_flowtuple_end_interval(corsaro_plugin_t *p, void *local,
         add_corsaro_memhandler_user(state->fthandler);
     }
     interim->hmap = state->st_hash;
-    JLC(hashsize, state->st_hash, 0, -1);
-    interim->hsize = hashsize;
+    if (state->st_hash) {
+        interim->hsize = state->st_hash->used;
+    } else {
+        interim->hsize = 0;
+    }
     interim->usable = 0;
     interim->sorted_keys = NULL;
+    interim->runfiles = NULL;
+    interim->runcount = 0;
+    interim->degraded = state->coarsen;
     interim->logger = p->logger;
 
+    if (state->runcount > 0) {
+        /* Part of this interval has already been spilled to disk, so put
+         * whatever is left in memory into a final run and hand all of the
+         * runs over to be merged instead.
+         */
+        if (state->ftcount > 0 && spill_flowtuple_run(p->logger, state,
+                    conf) < 0) {
+            corsaro_log(p->logger,
+                    "flowtuple plugin: failed to spill final run for interval %u",
+                    int_end->time);
+        }
+        interim->hmap = NULL;
+        interim->hsize = 0;
+        interim->runfiles = state->runfiles;
+        interim->runcount = state->runcount;
+        state->runfiles = NULL;
+        state->runcount = 0;
+        state->runalloc = 0;
+    }
+    state->ftcount = 0;
+
+    /* IPv6 flowtuples are never spilled, so they are handed over as they
+     * are regardless of what happened to the IPv4 ones */
+    interim->hmap6 = state->st_hash6;
+    interim->dropped6 = state->dropped6;
+    state->st_hash6 = NULL;
+    state->dropped6 = 0;
+
+    /* The merging thread refunds the budget once it has written out the
+     * flowtuples */
+    interim->memcharged = state->memcharged + state->memcharged6;
+    state->memcharged = 0;
+    state->memcharged6 = 0;
+    state->coarsen = 0;
+
     pthread_mutex_init(&(interim->mutex), NULL);
 
-    if (conf->sort_enabled == CORSARO_FLOWTUPLE_SORT_ENABLED) {
+    if (conf->sort_enabled == CORSARO_FLOWTUPLE_SORT_ENABLED &&
+            interim->runcount == 0) {
         interim->sorted_keys = state->keysort_levelone;
         interim->usable = 1;
     } else {
@@ -636,13 +905,388 @@ static struct corsaro_flowtuple *insert_sorted_key(Pvoid_t *topmap,
     return newft;
 }
 
+/** Computes the 64-bit hash of a flowtuple's key fields */
+static inline uint64_t flowtuple_key_hash(struct corsaro_flowtuple *ft) {
+    return corsaro_flowtuple_key_hash(ft->ftdata.src_ip, ft->ftdata.dst_ip,
+            ft->ftdata.src_port, ft->ftdata.dst_port, ft->ftdata.protocol,
+            ft->ftdata.ttl, ft->ftdata.tcp_flags, ft->ftdata.ip_len);
+}
+
+static corsaro_ft_hashtable_t *create_ft_hashtable(uint64_t capacity) {
+    corsaro_ft_hashtable_t *table;
+
+    table = (corsaro_ft_hashtable_t *)malloc(sizeof(corsaro_ft_hashtable_t));
+    if (table == NULL) {
+        return NULL;
+    }
+    table->slots = (struct corsaro_flowtuple **)calloc(capacity,
+            sizeof(struct corsaro_flowtuple *));
+    if (table->slots == NULL) {
+        free(table);
+        return NULL;
+    }
+    table->capacity = capacity;
+    table->used = 0;
+    return table;
+}
+
+/** Frees a flowtuple hash table. The flowtuple records themselves are
+ *  freed separately by whoever consumed them. */
+static void destroy_ft_hashtable(corsaro_ft_hashtable_t *table) {
+    if (table == NULL) {
+        return;
+    }
+    free(table->slots);
+    free(table);
+}
+
+static int grow_ft_hashtable(corsaro_ft_hashtable_t *table) {
+    struct corsaro_flowtuple **newslots;
+    uint64_t newcap = table->capacity * 2;
+    uint64_t i, slot;
+
+    newslots = (struct corsaro_flowtuple **)calloc(newcap,
+            sizeof(struct corsaro_flowtuple *));
+    if (newslots == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < table->capacity; i++) {
+        if (table->slots[i] == NULL) {
+            continue;
+        }
+        slot = table->slots[i]->keyhash & (newcap - 1);
+        while (newslots[slot] != NULL) {
+            slot = (slot + 1) & (newcap - 1);
+        }
+        newslots[slot] = table->slots[i];
+    }
+
+    free(table->slots);
+    table->slots = newslots;
+    table->capacity = newcap;
+    return 0;
+}
+
+/** Finds the record in the hash table that matches the key of the given
+ *  flowtuple, creating a new (zero count) record if there is no match.
+ */
+static struct corsaro_flowtuple *find_hashed_flowtuple(
+        corsaro_ft_hashtable_t *table, struct corsaro_flowtuple *ft,
+        corsaro_logger_t *logger) {
+
+    struct corsaro_flowtuple *found;
+    uint64_t slot;
+
+    /* keep the load factor below 0.75 so probe sequences stay short */
+    if ((table->used + 1) * 4 > table->capacity * 3) {
+        if (grow_ft_hashtable(table) < 0) {
+            corsaro_log(logger, "unable to grow flowtuple hash table");
+            return NULL;
+        }
+    }
+
+    slot = ft->keyhash & (table->capacity - 1);
+    while ((found = table->slots[slot]) != NULL) {
+        if (found->keyhash == ft->keyhash &&
+                corsaro_flowtuple_hash_equal(found, ft)) {
+            return found;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    found = calloc(1, sizeof(struct corsaro_flowtuple));
+    if (found == NULL) {
+        corsaro_log(logger, "malloc of flowtuple failed");
+        return NULL;
+    }
+
+    /* fill it */
+    memcpy(found, ft, sizeof(struct corsaro_flowtuple));
+    found->memsrc = NULL;
+    found->ftdata.packet_cnt = 0;
+    found->sort_key_top = 0;
+    found->sort_key_bot = 0;
+
+    table->slots[slot] = found;
+    table->used ++;
+    return found;
+}
+
+static corsaro_ft6_hashtable_t *create_ft6_hashtable(uint64_t capacity) {
+    corsaro_ft6_hashtable_t *table;
+
+    table = (corsaro_ft6_hashtable_t *)malloc(sizeof(corsaro_ft6_hashtable_t));
+    if (table == NULL) {
+        return NULL;
+    }
+    table->slots = (struct corsaro_flowtuple6_data **)calloc(capacity,
+            sizeof(struct corsaro_flowtuple6_data *));
+    if (table->slots == NULL) {
+        free(table);
+        return NULL;
+    }
+    table->capacity = capacity;
+    table->used = 0;
+    return table;
+}
+
+/** Frees an IPv6 flowtuple hash table, and optionally the records in it */
+static void destroy_ft6_hashtable(corsaro_ft6_hashtable_t *table,
+        uint8_t freerecords) {
+    uint64_t i;
+
+    if (table == NULL) {
+        return;
+    }
+    if (freerecords) {
+        for (i = 0; i < table->capacity; i++) {
+            free(table->slots[i]);
+        }
+    }
+    free(table->slots);
+    free(table);
+}
+
+static int grow_ft6_hashtable(corsaro_ft6_hashtable_t *table) {
+    struct corsaro_flowtuple6_data **newslots;
+    uint64_t newcap = table->capacity * 2;
+    uint64_t i, slot;
+
+    newslots = (struct corsaro_flowtuple6_data **)calloc(newcap,
+            sizeof(struct corsaro_flowtuple6_data *));
+    if (newslots == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < table->capacity; i++) {
+        if (table->slots[i] == NULL) {
+            continue;
+        }
+        slot = table->slots[i]->hash_val & (newcap - 1);
+        while (newslots[slot] != NULL) {
+            slot = (slot + 1) & (newcap - 1);
+        }
+        newslots[slot] = table->slots[i];
+    }
+
+    free(table->slots);
+    table->slots = newslots;
+    table->capacity = newcap;
+    return 0;
+}
+
+/** Finds the record in the IPv6 hash table that matches the key of the
+ *  given flowtuple, creating a new (zero count) record if there is no
+ *  match and 'create' is set.
+ *
+ *  @return the matching record, or NULL if there is no match and 'create'
+ *          is not set or the new record could not be allocated.
+ */
+static struct corsaro_flowtuple6_data *find_hashed_flowtuple6(
+        corsaro_ft6_hashtable_t *table, struct corsaro_flowtuple6_data *ft,
+        uint8_t create, corsaro_logger_t *logger) {
+
+    struct corsaro_flowtuple6_data *found;
+    uint64_t slot;
+
+    if (create && (table->used + 1) * 4 > table->capacity * 3) {
+        if (grow_ft6_hashtable(table) < 0) {
+            corsaro_log(logger, "unable to grow IPv6 flowtuple hash table");
+            return NULL;
+        }
+    }
+
+    slot = ft->hash_val & (table->capacity - 1);
+    while ((found = table->slots[slot]) != NULL) {
+        if (found->hash_val == ft->hash_val &&
+                corsaro_flowtuple6_data_same_key(found, ft)) {
+            return found;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    found = malloc(sizeof(struct corsaro_flowtuple6_data));
+    if (found == NULL) {
+        corsaro_log(logger, "malloc of IPv6 flowtuple failed");
+        return NULL;
+    }
+
+    memcpy(found, ft, sizeof(struct corsaro_flowtuple6_data));
+    found->packet_cnt = 0;
+
+    table->slots[slot] = found;
+    table->used ++;
+    return found;
+}
+
+static int compare_spilled_flowtuples(const void *a, const void *b) {
+    struct corsaro_flowtuple *fta = *(struct corsaro_flowtuple **)a;
+    struct corsaro_flowtuple *ftb = *(struct corsaro_flowtuple **)b;
+
+    return corsaro_flowtuple_data_cmp(&(fta->ftdata), &(ftb->ftdata));
+}
+
+/** Writes every flowtuple currently aggregated in memory to a new run file
+ *  (sorted by corsaro_flowtuple_data_cmp()) and empties the in-memory
+ *  aggregation so the thread can carry on within its memory budget.
+ *
+ *  Each run is a sequence of raw struct corsaro_flowtuple_data records;
+ *  the files only ever live for the duration of an interval and are read
+ *  back by the same process, so no portable encoding is required.
+ *
+ *  @param logger       The logger to write error messages to
+ *  @param state        The processing thread state for the plugin
+ *  @param conf         The plugin configuration
+ *
+ *  @return 0 if the run was written successfully, -1 if an error occurred.
+ */
+static int spill_flowtuple_run(corsaro_logger_t *logger,
+        struct corsaro_flowtuple_state_t *state,
+        corsaro_flowtuple_config_t *conf) {
+
+    struct corsaro_flowtuple **fts = NULL;
+    struct corsaro_flowtuple *ft;
+    uint64_t found = 0, i;
+    PWord_t pval, bval;
+    Word_t topind, botind, rc;
+    Pvoid_t botmap;
+    char *runname = NULL;
+    FILE *f = NULL;
+    int fd, ret = 0;
+
+    fts = (struct corsaro_flowtuple **)malloc(
+            (state->ftcount + 1) * sizeof(struct corsaro_flowtuple *));
+    if (fts == NULL) {
+        corsaro_log(logger, "flowtuple plugin: OOM while spilling flowtuples");
+        return -1;
+    }
+
+    /* Pull every record out of the in-memory aggregation */
+    if (state->keysort_levelone) {
+        topind = 0;
+        JLF(pval, state->keysort_levelone, topind);
+        while (pval) {
+            botmap = (Pvoid_t)(*pval);
+            botind = 0;
+            JLF(bval, botmap, botind);
+            while (bval) {
+                if (found <= state->ftcount) {
+                    fts[found++] = (struct corsaro_flowtuple *)(*bval);
+                }
+                JLN(bval, botmap, botind);
+            }
+            JLFA(rc, botmap);
+            JLN(pval, state->keysort_levelone, topind);
+        }
+        JLFA(rc, state->keysort_levelone);
+        state->keysort_levelone = NULL;
+    }
+
+    if (state->st_hash) {
+        for (i = 0; i < state->st_hash->capacity; i++) {
+            if (state->st_hash->slots[i] && found <= state->ftcount) {
+                fts[found++] = state->st_hash->slots[i];
+            }
+        }
+        destroy_ft_hashtable(state->st_hash);
+        state->st_hash = NULL;
+    }
+    state->ftcount = 0;
+    corsaro_mem_budget_release(state->budget, state->memcharged);
+    state->memcharged = 0;
+
+    if (found == 0) {
+        free(fts);
+        return 0;
+    }
+
+    qsort(fts, found, sizeof(struct corsaro_flowtuple *),
+            compare_spilled_flowtuples);
+
+    if (state->runcount == state->runalloc) {
+        char **newruns = (char **)realloc(state->runfiles,
+                (state->runalloc + 8) * sizeof(char *));
+        if (newruns == NULL) {
+            corsaro_log(logger,
+                    "flowtuple plugin: OOM while spilling flowtuples");
+            ret = -1;
+            goto spillend;
+        }
+        state->runfiles = newruns;
+        state->runalloc += 8;
+    }
+
+    runname = (char *)malloc(strlen(conf->spilldir) + 32);
+    if (runname == NULL) {
+        corsaro_log(logger, "flowtuple plugin: OOM while spilling flowtuples");
+        ret = -1;
+        goto spillend;
+    }
+    sprintf(runname, "%s/corsaroft-t%02d-XXXXXX", conf->spilldir,
+            state->threadid);
+
+    fd = mkstemp(runname);
+    if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+        corsaro_log(logger,
+                "flowtuple plugin: unable to create spill file %s: %s",
+                runname, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(runname);
+        }
+        free(runname);
+        ret = -1;
+        goto spillend;
+    }
+    setvbuf(f, NULL, _IOFBF, 1024 * 1024);
+
+    for (i = 0; i < found; i++) {
+        if (fwrite(&(fts[i]->ftdata), sizeof(struct corsaro_flowtuple_data),
+                    1, f) != 1) {
+            corsaro_log(logger,
+                    "flowtuple plugin: error writing spill file %s: %s",
+                    runname, strerror(errno));
+            ret = -1;
+            break;
+        }
+    }
+
+    if (fclose(f) != 0 && ret == 0) {
+        corsaro_log(logger,
+                "flowtuple plugin: error writing spill file %s: %s",
+                runname, strerror(errno));
+        ret = -1;
+    }
+
+    if (ret < 0) {
+        unlink(runname);
+        free(runname);
+    } else {
+        state->runfiles[state->runcount] = runname;
+        state->runcount ++;
+    }
+
+spillend:
+    /* If the spill failed, these flowtuples are lost -- but holding onto
+     * them would only push us further past the memory limit. */
+    for (i = 0; i < found; i++) {
+        free(fts[i]);
+    }
+    free(fts);
+    return ret;
+}
+
 /** Either add the given flowtuple to the hash, or increment the current count
  */
 static int corsaro_flowtuple_add_inc(corsaro_logger_t *logger,
         struct corsaro_flowtuple_state_t *state, struct corsaro_flowtuple *t,
         uint32_t increment, corsaro_flowtuple_config_t *conf) {
   struct corsaro_flowtuple *new_6t = NULL;
-  PWord_t pval;
 
   if (conf->sort_enabled == CORSARO_FLOWTUPLE_SORT_ENABLED) {
     new_6t = insert_sorted_key(&(state->keysort_levelone), t, logger);
@@ -651,37 +1295,225 @@ static int corsaro_flowtuple_add_inc(corsaro_logger_t *logger,
         return -1;
     }
   } else {
-    JLI(pval, state->st_hash, t->ftdata.hash_val);
-    if (*pval == 0) {
-      new_6t = calloc(1, sizeof(struct corsaro_flowtuple));
-      if (new_6t == NULL) {
-          corsaro_log(logger, "malloc of flowtuple failed");
+    if (state->st_hash == NULL) {
+      state->st_hash = create_ft_hashtable(FT_HASHTABLE_INIT_SLOTS);
+      if (state->st_hash == NULL) {
+          corsaro_log(logger, "unable to create flowtuple hash table");
           return -1;
       }
+    }
 
-      /* fill it */
-      memcpy(new_6t, t, sizeof(struct corsaro_flowtuple));
-      new_6t->memsrc = NULL;
-      new_6t->ftdata.packet_cnt = 0;
-      new_6t->sort_key_top = 0;
-      new_6t->sort_key_bot = 0;
-      *pval = (Word_t)new_6t;
-    } else {
-      new_6t =(struct corsaro_flowtuple *)(*pval);
+    new_6t = find_hashed_flowtuple(state->st_hash, t, logger);
+    if (new_6t == NULL) {
+        return -1;
     }
   }
 
   assert(new_6t != NULL);
 
+  if (new_6t->ftdata.packet_cnt == 0) {
+    state->ftcount ++;
+    state->memcharged += FT_RECORD_MEM_ESTIMATE;
+    if (corsaro_mem_budget_charge(state->budget, FT_RECORD_MEM_ESTIMATE)
+            && !state->coarsen) {
+        corsaro_log(logger,
+                "flowtuple plugin: thread %d exceeded the memory budget, coarsening flowtuple keys for the rest of the interval",
+                state->threadid);
+        state->coarsen = 1;
+        corsaro_mem_budget_note_degraded(state->budget);
+    }
+  }
+
   /* will this cause a wrap? */
   assert((UINT32_MAX - new_6t->ftdata.packet_cnt) > increment);
 
   new_6t->ftdata.packet_cnt = (new_6t->ftdata.packet_cnt) + increment;
+
+  if (state->memlimit > 0 &&
+          state->memcharged + state->memcharged6 >= state->memlimit) {
+    if (spill_flowtuple_run(logger, state, conf) < 0) {
+        return -1;
+    }
+  }
   return 0;
 }
 
 
 
+/** Adds an IPv6 flowtuple to the IPv6 hash table, or increments the count
+ *  for the matching flowtuple if it is already there.
+ *
+ *  IPv6 flowtuples are charged to the memory budget (and so can trigger
+ *  key coarsening) and count towards the memory limit. They are never
+ *  spilled to disk, so once they have used half of the memory limit, new
+ *  IPv6 flowtuples are dropped for the rest of the interval; existing
+ *  ones continue to be counted. The IPv4 flowtuples are spilled whenever
+ *  the two together reach the limit, so each IPv4 run still gets at least
+ *  half of it.
+ */
+static int corsaro_flowtuple6_add_inc(corsaro_logger_t *logger,
+        struct corsaro_flowtuple_state_t *state,
+        struct corsaro_flowtuple6_data *t, uint32_t increment,
+        corsaro_flowtuple_config_t *conf) {
+
+    struct corsaro_flowtuple6_data *found;
+    uint8_t create = 1;
+
+    if (state->st_hash6 == NULL) {
+        state->st_hash6 = create_ft6_hashtable(FT_HASHTABLE_INIT_SLOTS);
+        if (state->st_hash6 == NULL) {
+            corsaro_log(logger, "unable to create IPv6 flowtuple hash table");
+            return -1;
+        }
+    }
+
+    if (state->memlimit > 0 && state->memcharged6 +
+            FT6_RECORD_MEM_ESTIMATE > state->memlimit / 2) {
+        create = 0;
+    }
+
+    found = find_hashed_flowtuple6(state->st_hash6, t, create, logger);
+    if (found == NULL) {
+        if (create) {
+            return -1;
+        }
+        if (state->dropped6 == 0) {
+            corsaro_log(logger,
+                    "flowtuple plugin: thread %d reached the IPv6 share of the memory limit, dropping new IPv6 flowtuples for the rest of the interval",
+                    state->threadid);
+        }
+        state->dropped6 ++;
+        return 0;
+    }
+
+    if (found->packet_cnt == 0) {
+        state->memcharged6 += FT6_RECORD_MEM_ESTIMATE;
+        if (corsaro_mem_budget_charge(state->budget, FT6_RECORD_MEM_ESTIMATE)
+                && !state->coarsen) {
+            corsaro_log(logger,
+                    "flowtuple plugin: thread %d exceeded the memory budget, coarsening flowtuple keys for the rest of the interval",
+                    state->threadid);
+            state->coarsen = 1;
+            corsaro_mem_budget_note_degraded(state->budget);
+        }
+    }
+
+    assert((UINT32_MAX - found->packet_cnt) > increment);
+    found->packet_cnt += increment;
+
+    if (state->memlimit > 0 && state->ftcount > 0 &&
+            state->memcharged + state->memcharged6 >= state->memlimit) {
+        if (spill_flowtuple_run(logger, state, conf) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/** Produces an IPv6 flowtuple for a packet and adds it to the IPv6 hash
+ *  table. This is only ever called for packets that the IPv4 path has
+ *  already rejected, so enabling IPv6 support costs IPv4 packets nothing.
+ *
+ *  @return 0 if successful, -1 if an error occurred.
+ */
+static int process_ipv6_packet(corsaro_logger_t *logger,
+        struct corsaro_flowtuple_state_t *state, libtrace_packet_t *packet,
+        libtrace_ip6_t *ip6_hdr, uint32_t rem, corsaro_packet_tags_t *tags,
+        corsaro_flowtuple_config_t *conf) {
+
+    struct corsaro_flowtuple6_data t;
+    void *transport;
+    uint8_t proto = 0;
+
+    if (rem < sizeof(libtrace_ip6_t)) {
+        return 0;
+    }
+
+    memset(&t, 0, sizeof(t));
+    memcpy(t.src_ip, &(ip6_hdr->ip_src), sizeof(t.src_ip));
+    memcpy(t.dst_ip, &(ip6_hdr->ip_dst), sizeof(t.dst_ip));
+    t.interval_ts = state->last_interval_start;
+    t.ip_len = ntohs(ip6_hdr->plen) + sizeof(libtrace_ip6_t);
+    t.ttl = ip6_hdr->hlim;
+
+    /* Skips over any extension headers */
+    transport = trace_get_payload_from_ip6(ip6_hdr, &proto, &rem);
+    t.protocol = proto;
+
+    if (transport && proto == TRACE_IPPROTO_TCP &&
+            rem >= sizeof(libtrace_tcp_t)) {
+        libtrace_tcp_t *tcp_hdr = (libtrace_tcp_t *)transport;
+
+        t.src_port = ntohs(tcp_hdr->source);
+        t.dst_port = ntohs(tcp_hdr->dest);
+        t.tcp_flags =
+            ((tcp_hdr->cwr << 7) | (tcp_hdr->ece << 6) |
+             (tcp_hdr->urg << 5) | (tcp_hdr->ack << 4) |
+             (tcp_hdr->psh << 3) | (tcp_hdr->rst << 2) |
+             (tcp_hdr->syn << 1) | (tcp_hdr->fin << 0));
+        if (t.tcp_flags == (1 << 1)) {
+            t.tcp_synlen = tcp_hdr->doff * 4;
+            t.tcp_synwinlen = ntohs(tcp_hdr->window);
+        }
+    } else if (transport && proto == TRACE_IPPROTO_UDP &&
+            rem >= sizeof(libtrace_udp_t)) {
+        libtrace_udp_t *udp_hdr = (libtrace_udp_t *)transport;
+
+        t.src_port = ntohs(udp_hdr->source);
+        t.dst_port = ntohs(udp_hdr->dest);
+    } else if (transport && proto == TRACE_IPPROTO_ICMPV6 &&
+            rem >= sizeof(libtrace_icmp6_t)) {
+        libtrace_icmp6_t *icmp_hdr = (libtrace_icmp6_t *)transport;
+
+        t.src_port = icmp_hdr->type;
+        t.dst_port = icmp_hdr->code;
+    }
+
+    if (tags) {
+        uint64_t filterbits = bswap_be_to_host64(tags->filterbits);
+
+        t.tagproviders = ntohl(tags->providers_used);
+
+        if (t.tagproviders & (1 << IPMETA_PROVIDER_MAXMIND)) {
+            t.maxmind_continent = tags->maxmind_continent;
+            t.maxmind_country = tags->maxmind_country;
+        }
+        if (t.tagproviders & (1 << IPMETA_PROVIDER_NETACQ_EDGE)) {
+            t.netacq_continent = tags->netacq_continent;
+            t.netacq_country = tags->netacq_country;
+        }
+        if (t.tagproviders & (1 << IPMETA_PROVIDER_PFX2AS)) {
+            t.prefixasn = ntohl(tags->prefixasn);
+        }
+        if (filterbits & (1 << CORSARO_FILTERID_SPOOFED)) {
+            t.is_spoofed = 1;
+        }
+        if (filterbits & (1 << CORSARO_FILTERID_LARGE_SCALE_SCAN)) {
+            t.is_masscan = 1;
+        }
+    }
+
+    if (state->coarsen) {
+        t.ttl = 0;
+        t.ip_len = 0;
+        t.src_port = 0;
+        t.tcp_synlen = 0;
+        t.tcp_synwinlen = 0;
+    }
+
+    /* The flow hash in the packet tags only covers IPv4 keys */
+    t.hash_val = corsaro_flowtuple_fold_hash(corsaro_flowtuple6_key_hash(
+            t.src_ip, t.dst_ip, t.src_port, t.dst_port, t.protocol, t.ttl,
+            t.tcp_flags, t.ip_len));
+
+    if (corsaro_flowtuple6_add_inc(logger, state, &t, 1, conf) != 0) {
+        corsaro_log(logger, "could not increment value for IPv6 flowtuple");
+        return -1;
+    }
+    state->pkt_cnt ++;
+    return 0;
+}
+
 int corsaro_flowtuple_process_packet(corsaro_plugin_t *p, void *local,
         libtrace_packet_t *packet, corsaro_packet_tags_t *tags) {
     libtrace_ip_t *ip_hdr = NULL;
@@ -698,6 +1530,11 @@ int corsaro_flowtuple_process_packet(corsaro_plugin_t *p, void *local,
     ip_hdr = (libtrace_ip_t *)(trace_get_layer3(packet, &ethertype, &rem));
     if (ip_hdr == NULL || ethertype != TRACE_ETHERTYPE_IP ||
             rem < sizeof(libtrace_ip_t)) {
+        if (conf->ipv6 && ip_hdr != NULL &&
+                ethertype == TRACE_ETHERTYPE_IPV6) {
+            return process_ipv6_packet(p->logger, state, packet,
+                    (libtrace_ip6_t *)ip_hdr, rem, tags, conf);
+        }
         /* non-ipv4 packet or truncated */
         return 0;
     }
@@ -766,12 +1603,29 @@ int corsaro_flowtuple_process_packet(corsaro_plugin_t *p, void *local,
             t.ftdata.is_masscan = 1;
         }
 
-        t.ftdata.hash_val = ntohl(tags->ft_hash);
     } else {
         t.ftdata.tagproviders = 0;
-        t.ftdata.hash_val = corsaro_flowtuple_hash_func(&t);
     }
 
+    if (state->coarsen) {
+        /* Over budget: drop the fields that vary most between packets
+         * from the same source so that far fewer distinct flowtuples are
+         * created */
+        t.ftdata.ttl = 0;
+        t.ftdata.ip_len = 0;
+        t.ftdata.src_port = 0;
+        t.ftdata.tcp_synlen = 0;
+        t.ftdata.tcp_synwinlen = 0;
+    }
+
+    /* Always hash the key ourselves rather than using the ft_hash tag, as
+     * the tag is only 32 bits (and taggers older than this plugin used a
+     * weaker hash) whereas the aggregation table is placed by the full
+     * 64-bit key hash.
+     */
+    t.keyhash = flowtuple_key_hash(&t);
+    t.ftdata.hash_val = corsaro_flowtuple_fold_hash(t.keyhash);
+
     if (corsaro_flowtuple_add_inc(p->logger, state, &t, 1, conf) != 0) {
         corsaro_log(p->logger, "could not increment value for flowtuple");
         return -1;
@@ -875,8 +1729,26 @@ static void kafka_publish_flowtuple(corsaro_flowtuple_merger_t *m,
     }
 }
 
+/** Writes a single flowtuple to an avro file, adding it to the block
+ *  index for that file as well (if there is one).
+ */
+static inline void write_flowtuple_avro(corsaro_flowtuple_merger_t *m,
+        corsaro_avro_writer_t *writer, corsaro_ftindex_writer_t *idx,
+        struct corsaro_flowtuple_data *ftdata) {
+
+    encode_flowtuple_as_avro(ftdata, writer, m->logger);
+    if (corsaro_append_avro_writer(writer, NULL) < 0) {
+        /* what shall we do? */
+        return;
+    }
+    if (idx) {
+        corsaro_ftindex_add_record(idx, writer, ftdata);
+    }
+}
+
 static void write_sorted_interim_flowtuples(corsaro_flowtuple_merger_t *m,
-        corsaro_avro_writer_t *writer, corsaro_flowtuple_iterator_t *input) {
+        corsaro_avro_writer_t *writer, corsaro_ftindex_writer_t *idx,
+        corsaro_flowtuple_iterator_t *input) {
 
     PWord_t pval;
     Word_t ret;
@@ -896,10 +1768,7 @@ static void write_sorted_interim_flowtuples(corsaro_flowtuple_merger_t *m,
             nextft = (struct corsaro_flowtuple *)(*pval);
 
             if (writer) {
-                encode_flowtuple_as_avro(&(nextft->ftdata), writer, m->logger);
-                if (corsaro_append_avro_writer(writer, NULL) < 0) {
-                    /* what shall we do? */
-                }
+                write_flowtuple_avro(m, writer, idx, &(nextft->ftdata));
             }
 
             if (m->rdk) {
@@ -917,32 +1786,257 @@ static void write_sorted_interim_flowtuples(corsaro_flowtuple_merger_t *m,
 }
 
 static void write_unsorted_interim_flowtuples(corsaro_flowtuple_merger_t *m,
-        corsaro_avro_writer_t *writer, corsaro_flowtuple_iterator_t *input) {
+        corsaro_avro_writer_t *writer, corsaro_ftindex_writer_t *idx,
+        corsaro_flowtuple_iterator_t *input) {
 
     struct corsaro_flowtuple *nextft;
-    PWord_t pval;
-    Word_t index = 0;
+    uint64_t i;
 
     uint64_t count = 0;
 
-    JLF(pval, input->hmap, index);
-    while (pval) {
-        nextft = (struct corsaro_flowtuple *)(*pval);
+    if (input->hmap == NULL) {
+        return;
+    }
+
+    for (i = 0; i < input->hmap->capacity; i++) {
+        nextft = input->hmap->slots[i];
+        if (nextft == NULL) {
+            continue;
+        }
 
         if (writer) {
-            encode_flowtuple_as_avro(&(nextft->ftdata), writer, m->logger);
-            if (corsaro_append_avro_writer(writer, NULL) < 0) {
-                /* shall we do something? */
-            }
+            write_flowtuple_avro(m, writer, idx, &(nextft->ftdata));
         }
         if (m->rdk) {
             kafka_publish_flowtuple(m, nextft);
         }
         free(nextft);
         count ++;
+    }
+}
+
+static int ft_run_cmp_pri(void *next, void *curr) {
+    struct corsaro_flowtuple *nextft = (struct corsaro_flowtuple *)next;
+    struct corsaro_flowtuple *currft = (struct corsaro_flowtuple *)curr;
+
+    return (corsaro_flowtuple_data_cmp(&(currft->ftdata),
+                &(nextft->ftdata)) <= 0);
+}
+
+static size_t ft_run_get_pos(void *a) {
+    return ((struct corsaro_flowtuple *)a)->pqueue_pos;
+}
+
+static void ft_run_set_pos(void *a, size_t pos) {
+    ((struct corsaro_flowtuple *)a)->pqueue_pos = pos;
+}
+
+static inline void emit_merged_flowtuple(corsaro_flowtuple_merger_t *m,
+        corsaro_avro_writer_t *writer, corsaro_ftindex_writer_t *idx,
+        struct corsaro_flowtuple *ft) {
+
+    if (writer) {
+        write_flowtuple_avro(m, writer, idx, &(ft->ftdata));
+    }
+    if (m->rdk) {
+        kafka_publish_flowtuple(m, ft);
+    }
+}
+
+/** Performs a k-way merge of the sorted runs that a processing thread
+ *  spilled to disk during an interval, combining any flowtuples that
+ *  appear in more than one run, and writes the result. The run files are
+ *  removed once they have been consumed.
+ *
+ *  @param m        The merging thread that has received the runs
+ *  @param writer   The avro writer to write the merged flowtuples to
+ *  @param idx      The block index writer for the avro output file
+ *  @param input    The iterator containing the list of run files
+ */
+static void write_spilled_flowtuple_runs(corsaro_flowtuple_merger_t *m,
+        corsaro_avro_writer_t *writer, corsaro_ftindex_writer_t *idx,
+        corsaro_flowtuple_iterator_t *input) {
+
+    FILE **runs = NULL;
+    struct corsaro_flowtuple *heads = NULL;
+    struct corsaro_flowtuple *nextft;
+    struct corsaro_flowtuple prev;
+    pqueue_t *pq = NULL;
+    int i, haveprev = 0;
+
+    runs = (FILE **)calloc(input->runcount, sizeof(FILE *));
+    heads = (struct corsaro_flowtuple *)calloc(input->runcount,
+            sizeof(struct corsaro_flowtuple));
+    pq = pqueue_init(input->runcount, ft_run_cmp_pri, ft_run_get_pos,
+            ft_run_set_pos);
+
+    if (runs == NULL || heads == NULL || pq == NULL) {
+        corsaro_log(m->logger,
+                "flowtuple merging thread %d: OOM while merging spilled runs",
+                m->thread_num);
+        goto runmergeend;
+    }
+
+    for (i = 0; i < input->runcount; i++) {
+        runs[i] = fopen(input->runfiles[i], "r");
+        if (runs[i] == NULL) {
+            corsaro_log(m->logger,
+                    "flowtuple merging thread %d: unable to open spill file %s: %s",
+                    m->thread_num, input->runfiles[i], strerror(errno));
+            continue;
+        }
+        setvbuf(runs[i], NULL, _IOFBF, 1024 * 1024);
+        heads[i].fromind = i;
+        if (fread(&(heads[i].ftdata), sizeof(struct corsaro_flowtuple_data),
+                    1, runs[i]) == 1) {
+            pqueue_insert(pq, &(heads[i]));
+        }
+    }
+
+    while ((nextft = (struct corsaro_flowtuple *)pqueue_pop(pq)) != NULL) {
+        if (haveprev && corsaro_flowtuple_data_same_key(&(prev.ftdata),
+                    &(nextft->ftdata))) {
+            corsaro_combine_flowtuple_data(&(prev.ftdata), &(nextft->ftdata));
+        } else {
+            if (haveprev) {
+                emit_merged_flowtuple(m, writer, idx, &prev);
+            }
+            memcpy(&prev, nextft, sizeof(struct corsaro_flowtuple));
+            haveprev = 1;
+        }
+
+        /* Replace the popped record with the next one from the same run */
+        i = nextft->fromind;
+        if (fread(&(nextft->ftdata), sizeof(struct corsaro_flowtuple_data),
+                    1, runs[i]) == 1) {
+            pqueue_insert(pq, nextft);
+        }
+    }
+
+    if (haveprev) {
+        emit_merged_flowtuple(m, writer, idx, &prev);
+    }
+
+runmergeend:
+    if (runs) {
+        for (i = 0; i < input->runcount; i++) {
+            if (runs[i]) {
+                fclose(runs[i]);
+            }
+        }
+        free(runs);
+    }
+    if (heads) {
+        free(heads);
+    }
+    if (pq) {
+        pqueue_free(pq);
+    }
+    discard_flowtuple_runs(input->runfiles, input->runcount);
+    input->runfiles = NULL;
+    input->runcount = 0;
+}
+
+static int compare_flowtuple6_ptrs(const void *a, const void *b) {
+    return corsaro_flowtuple6_data_cmp(*(struct corsaro_flowtuple6_data **)a,
+            *(struct corsaro_flowtuple6_data **)b);
+}
+
+/** Finds (or creates) the avro writer for the IPv6 flowtuples from a
+ *  given processing thread, making sure that it has an open output file.
+ *
+ *  @return the avro writer, or NULL if no output file could be opened.
+ */
+static corsaro_avro_writer_t *get_flowtuple6_writer(
+        corsaro_flowtuple_merger_t *m, corsaro_ft_write_msg_t *msg) {
+
+    corsaro_avro_writer_t *w;
+    PWord_t pval;
+    char *outname;
+
+    JLG(pval, m->writers6, msg->input_source);
+    if (!pval) {
+        w = corsaro_create_avro_writer(m->logger, FLOWTUPLE6_RESULT_SCHEMA);
+        JLI(pval, m->writers6, msg->input_source);
+        *pval = (Word_t)w;
+    } else {
+        w = (corsaro_avro_writer_t *)(*pval);
+    }
+
+    if (w == NULL) {
+        return NULL;
+    }
+
+    if (!corsaro_is_avro_writer_active(w)) {
+        outname = _flowtuple_derive_output_name(m->logger, m->baseconf,
+                PLUGIN_NAME "6", msg->rotate_ts, m->thread_num);
+        if (outname == NULL) {
+            return NULL;
+        }
+        if (corsaro_start_avro_writer(w, outname,
+                    (m->avrooutput == CORSARO_AVRO_OUTPUT_SNAPPY)) == -1) {
+            free(outname);
+            return NULL;
+        }
+        free(outname);
+    }
+    return w;
+}
+
+/** Writes the IPv6 flowtuples for an interval to their own avro file,
+ *  sorting them first if sorting is enabled. The flowtuples are freed
+ *  regardless of whether they could be written.
+ *
+ *  IPv6 flowtuples are not published to kafka and do not have block
+ *  indexes, as neither format can represent a 128-bit address.
+ */
+static void write_interim_flowtuples6(corsaro_flowtuple_merger_t *m,
+        corsaro_flowtuple_iterator_t *input, corsaro_ft_write_msg_t *msg) {
 
-        JLN(pval, input->hmap, index);
+    struct corsaro_flowtuple6_data **fts;
+    corsaro_avro_writer_t *w = NULL;
+    uint64_t i, found = 0;
+
+    if (input->hmap6 == NULL || input->hmap6->used == 0) {
+        return;
     }
+
+    fts = (struct corsaro_flowtuple6_data **)malloc(input->hmap6->used *
+            sizeof(struct corsaro_flowtuple6_data *));
+    if (fts == NULL) {
+        corsaro_log(m->logger,
+                "flowtuple merging thread %d: OOM while writing IPv6 flowtuples",
+                m->thread_num);
+        destroy_ft6_hashtable(input->hmap6, 1);
+        input->hmap6 = NULL;
+        return;
+    }
+
+    for (i = 0; i < input->hmap6->capacity; i++) {
+        if (input->hmap6->slots[i]) {
+            fts[found++] = input->hmap6->slots[i];
+        }
+    }
+
+    if (m->sortipv6) {
+        qsort(fts, found, sizeof(struct corsaro_flowtuple6_data *),
+                compare_flowtuple6_ptrs);
+    }
+
+    if (m->avrooutput != CORSARO_AVRO_OUTPUT_NONE) {
+        w = get_flowtuple6_writer(m, msg);
+    }
+
+    for (i = 0; i < found; i++) {
+        if (w) {
+            encode_flowtuple6_as_avro(fts[i], w, m->logger);
+            corsaro_append_avro_writer(w, NULL);
+        }
+        free(fts[i]);
+    }
+    free(fts);
+    destroy_ft6_hashtable(input->hmap6, 0);
+    input->hmap6 = NULL;
 }
 
 /** Assigns a given flowtuple record to a kafka partition
@@ -1076,7 +2170,8 @@ static void *start_ftmerge_worker(void *tdata) {
     corsaro_ft_write_msg_t msg;
     corsaro_flowtuple_iterator_t *input;
     corsaro_avro_writer_t *w = NULL;
-    PWord_t pval;
+    corsaro_ftindex_writer_t *idx = NULL;
+    PWord_t pval, ipval;
     Word_t rc, index;
 
     /* Create a kafka producer for this thread if we are doing kafka output */
@@ -1111,10 +2206,27 @@ static void *start_ftmerge_worker(void *tdata) {
             while (pval) {
                 w = (corsaro_avro_writer_t *)(*pval);
                 if (w) {
+                    /* The index must be completed before the avro file
+                     * is closed */
+                    JLG(ipval, m->indexes, index);
+                    if (ipval && *ipval) {
+                        corsaro_close_ftindex_writer(
+                                (corsaro_ftindex_writer_t *)(*ipval), w);
+                    }
                     corsaro_close_avro_writer(w);
                 }
                 JLN(pval, m->writers, index);
             }
+
+            index = 0;
+            JLF(pval, m->writers6, index);
+            while (pval) {
+                w = (corsaro_avro_writer_t *)(*pval);
+                if (w) {
+                    corsaro_close_avro_writer(w);
+                }
+                JLN(pval, m->writers6, index);
+            }
             continue;
         }
 
@@ -1125,7 +2237,19 @@ static void *start_ftmerge_worker(void *tdata) {
         /* If we're doing avro output, make sure we have a writer instance
          * available.
          */
+        idx = NULL;
         if (m->avrooutput != CORSARO_AVRO_OUTPUT_NONE) {
+            if (m->blockindex) {
+                JLG(pval, m->indexes, msg.input_source);
+                if (!pval) {
+                    idx = corsaro_create_ftindex_writer(m->logger);
+                    JLI(pval, m->indexes, msg.input_source);
+                    *pval = (Word_t)idx;
+                } else {
+                    idx = (corsaro_ftindex_writer_t *)(*pval);
+                }
+            }
+
             JLG(pval, m->writers, msg.input_source);
             if (!pval) {
                 w = corsaro_create_avro_writer(m->logger,
@@ -1139,7 +2263,7 @@ static void *start_ftmerge_worker(void *tdata) {
 
             if (!corsaro_is_avro_writer_active(w)) {
                 char *outname = _flowtuple_derive_output_name(
-                        m->logger, m->baseconf, msg.rotate_ts,
+                        m->logger, m->baseconf, PLUGIN_NAME, msg.rotate_ts,
                         m->thread_num);
                 if (outname == NULL) {
                     continue;
@@ -1151,18 +2275,26 @@ static void *start_ftmerge_worker(void *tdata) {
                     continue;
                 }
                 free(outname);
+
+                if (idx) {
+                    corsaro_start_ftindex_writer(idx, w);
+                }
             }
         }
 
         input = (corsaro_flowtuple_iterator_t *)msg.content;
 
-        if (msg.type == CORSARO_FT_MSG_MERGE_UNSORTED) {
-            write_unsorted_interim_flowtuples(m, w, input);
+        if (msg.type == CORSARO_FT_MSG_MERGE_RUNS) {
+            write_spilled_flowtuple_runs(m, w, idx, input);
+        } else if (msg.type == CORSARO_FT_MSG_MERGE_UNSORTED) {
+            write_unsorted_interim_flowtuples(m, w, idx, input);
         } else if (msg.type == CORSARO_FT_MSG_MERGE_SORTED) {
-            write_sorted_interim_flowtuples(m, w, input);
+            write_sorted_interim_flowtuples(m, w, idx, input);
         }
+        write_interim_flowtuples6(m, input, &msg);
 
-        JLFA(rc, input->hmap);
+        corsaro_mem_budget_release(m->budget, input->memcharged);
+        destroy_ft_hashtable(input->hmap);
         JLFA(rc, input->sorted_keys);
         pthread_mutex_destroy(&(input->parent->mutex));
         free(input->parent);
@@ -1186,17 +2318,40 @@ static void *start_ftmerge_worker(void *tdata) {
         free(m->buf);
     }
 
-    /* Close any avro writer instances that we were using */
+    /* Close any avro writer instances that we were using, finishing off
+     * their block indexes first */
     index = 0;
     JLF(pval, m->writers, index);
     while (pval) {
         w = (corsaro_avro_writer_t *)(*pval);
+        JLG(ipval, m->indexes, index);
+        if (ipval) {
+            idx = (corsaro_ftindex_writer_t *)(*ipval);
+            if (idx && w) {
+                corsaro_close_ftindex_writer(idx, w);
+            }
+            if (idx) {
+                corsaro_destroy_ftindex_writer(idx);
+            }
+        }
         if (w) {
             corsaro_destroy_avro_writer(w);
         }
         JLN(pval, m->writers, index);
     }
     JLFA(rc, m->writers);
+    JLFA(rc, m->indexes);
+
+    index = 0;
+    JLF(pval, m->writers6, index);
+    while (pval) {
+        w = (corsaro_avro_writer_t *)(*pval);
+        if (w) {
+            corsaro_destroy_avro_writer(w);
+        }
+        JLN(pval, m->writers6, index);
+    }
+    JLFA(rc, m->writers6);
     pthread_exit(NULL);
 }
 
@@ -1245,6 +2400,11 @@ void *corsaro_flowtuple_init_merging(corsaro_plugin_t *p, int sources) {
         m->writerthreads[i].logger = p->logger;
         m->writerthreads[i].baseconf = &(conf->basic);
         m->writerthreads[i].writers = NULL;
+        m->writerthreads[i].indexes = NULL;
+        m->writerthreads[i].writers6 = NULL;
+        m->writerthreads[i].blockindex = conf->blockindex;
+        m->writerthreads[i].sortipv6 = (conf->sort_enabled ==
+                CORSARO_FLOWTUPLE_SORT_ENABLED);
 
         m->writerthreads[i].thread_num = i;
         m->writerthreads[i].inqueue = zmq_socket(conf->zmq_ctxt, ZMQ_SUB);
@@ -1253,6 +2413,7 @@ void *corsaro_flowtuple_init_merging(corsaro_plugin_t *p, int sources) {
         m->writerthreads[i].rdk = NULL;
         m->writerthreads[i].rdktopic = NULL;
         m->writerthreads[i].kafkaopts = &(conf->kafkaopts);
+        m->writerthreads[i].budget = p->budget;
         m->writerthreads[i].buf = calloc(1024 * 1024 * 2, sizeof(uint8_t));
         m->writerthreads[i].writeptr = m->writerthreads[i].buf;
         m->writerthreads[i].partkey.ts = 0;
@@ -1327,6 +2488,8 @@ int corsaro_flowtuple_merge_interval_results(corsaro_plugin_t *p, void *local,
     corsaro_ft_write_msg_t msg;
     int i, inputsready;
     uint8_t *donethreads;
+    uint8_t degraded = 0;
+    uint64_t dropped6 = 0;
 
     conf = (corsaro_flowtuple_config_t *)(p->config);
     m = (struct corsaro_flowtuple_merge_state_t *)local;
@@ -1361,8 +2524,16 @@ int corsaro_flowtuple_merge_interval_results(corsaro_plugin_t *p, void *local,
                 input = calloc(1, sizeof(corsaro_flowtuple_iterator_t));
 
                 input->hmap = interim->hmap;
+                input->hmap6 = interim->hmap6;
                 input->hsize = interim->hsize;
+                input->runfiles = interim->runfiles;
+                input->runcount = interim->runcount;
+                input->memcharged = interim->memcharged;
                 input->nextft = NULL;
+                if (interim->degraded) {
+                    degraded = 1;
+                }
+                dropped6 += interim->dropped6;
 
                 if (interim->usable == 1) {
                     input->state = CORSARO_RESULT_TYPE_DATA;
@@ -1396,7 +2567,10 @@ int corsaro_flowtuple_merge_interval_results(corsaro_plugin_t *p, void *local,
 
                 m->nextworker = (m->nextworker + 1) % m->maxworkers;
 
-                if (conf->sort_enabled == CORSARO_FLOWTUPLE_SORT_ENABLED) {
+                if (input->runcount > 0) {
+                    msg.type = CORSARO_FT_MSG_MERGE_RUNS;
+                } else if (conf->sort_enabled ==
+                        CORSARO_FLOWTUPLE_SORT_ENABLED) {
                     msg.type = CORSARO_FT_MSG_MERGE_SORTED;
                 } else {
                     msg.type = CORSARO_FT_MSG_MERGE_UNSORTED;
@@ -1417,6 +2591,16 @@ int corsaro_flowtuple_merge_interval_results(corsaro_plugin_t *p, void *local,
         }
     }
 
+    if (degraded) {
+        corsaro_mem_budget_mark_interval(p->budget, p->logger, fin->timestamp,
+                "ttl, ip_len, source port and SYN fields of some flowtuples were zeroed");
+    }
+    if (dropped6 > 0) {
+        corsaro_log(p->logger,
+                "flowtuple plugin: %" PRIu64 " new IPv6 flowtuples were dropped during interval %u to stay within the memory limit",
+                dropped6, fin->timestamp);
+    }
+    free(donethreads);
 
     return 0;
 }
@@ -1448,28 +2632,9 @@ int corsaro_flowtuple_rotate_output(corsaro_plugin_t *p, void *local) {
     return 0;
 }
 
-/*
- * Hashes the flowtuple based on the following table
- *
- *         --------------------------------
- *         |           SRC_IP * 59        |
- *         --------------------------------
- *         |            DST_IP            |
- *         --------------------------------
- *         | SRC_PORT <<16 |   DST_PORT   |
- *         --------------------------------
- *         |  TTL  |TCP_FLG|PROTO|  LEN   |
- *         --------------------------------
- */
 uint32_t corsaro_flowtuple_hash_func(struct corsaro_flowtuple *ft)
 {
-  uint32_t h = (uint32_t)ft->ftdata.src_ip * 59;
-  CORSARO_FLOWTUPLE_SHIFT_AND_XOR(ft->ftdata.dst_ip);
-  CORSARO_FLOWTUPLE_SHIFT_AND_XOR(ft->ftdata.src_port << 16);
-  CORSARO_FLOWTUPLE_SHIFT_AND_XOR(ft->ftdata.dst_port);
-  CORSARO_FLOWTUPLE_SHIFT_AND_XOR((ft->ftdata.ttl << 24) | (ft->ftdata.tcp_flags << 16));
-  CORSARO_FLOWTUPLE_SHIFT_AND_XOR((ft->ftdata.protocol << 8) | (ft->ftdata.ip_len));
-  return h;
+  return corsaro_flowtuple_fold_hash(flowtuple_key_hash(ft));
 }
 
 
@@ -138,6 +138,10 @@ struct corsaro_flowtuple {
   uint64_t sort_key_top;
   uint64_t sort_key_bot;
 
+  /** The 64-bit corsaro_flowtuple_key_hash() of the flowtuple key, which
+   *  places the flowtuple in the unsorted aggregation table */
+  uint64_t keyhash;
+
   /** Local variables used for merging sorted flowtuple maps */
   size_t pqueue_pos;
   pqueue_pri_t pqueue_pri;
@@ -160,26 +164,14 @@ CORSARO_PLUGIN_GENERATE_PROTOTYPES(corsaro_flowtuple)
 #define CORSARO_FLOWTUPLE_BYTECNT                                              \
   (sizeof(struct corsaro_flowtuple)) /* (4+3+2+2+1+1+1+2)+4*/
 
-/** Convenience macro to help with the hashing function */
-#define CORSARO_FLOWTUPLE_SHIFT_AND_XOR(value)                                 \
-  h ^= (h << 5) + (h >> 27) + (value)
-
 /** Hash the given flowtuple into a 32bit value
  *
  * @param ft            Pointer to the flowtuple record to hash
  * @return the hashed value
  *
- * The flowtuple is hashed based on the following table:
- *
- *         --------------------------------
- *         |           SRC_IP * 59        |
- *         --------------------------------
- *         |            DST_IP            |
- *         --------------------------------
- *         | SRC_PORT <<16 |   DST_PORT   |
- *         --------------------------------
- *         |  TTL  |TCP_FLG|PROTO|  LEN   |
- *         --------------------------------
+ * This is the 64-bit corsaro_flowtuple_key_hash() of the flowtuple key
+ * folded into 32 bits, i.e. the same value that corsarotagger places in
+ * the ft_hash field of the packet tags.
  */
 uint32_t corsaro_flowtuple_hash_func(struct corsaro_flowtuple *ft);
 
@@ -0,0 +1,924 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <yaml.h>
+
+#include "libcorsaro_plugin.h"
+#include "libcorsaro_avro.h"
+#include "libcorsaro_hll.h"
+#include "corsaro_scan.h"
+
+/** The magic number for this plugin - "SCAN" */
+#define CORSARO_SCAN_MAGIC 0x5343414E
+#define PLUGIN_NAME "scan"
+
+/** Default values for the various configurable options */
+
+/** Maximum number of sources that each processing thread will track */
+#define CORSARO_SCAN_DEFAULT_MAX_SOURCES 50000
+
+/** Minimum number of packets before a source can be reported */
+#define CORSARO_SCAN_DEFAULT_MIN_PACKETS 25
+
+/** Minimum (estimated) number of destination IPs before a source is
+ *  considered to be scanning */
+#define CORSARO_SCAN_DEFAULT_MIN_DEST_IPS 25
+
+/** Minimum (estimated) number of destination ports before a source is
+ *  considered to be scanning */
+#define CORSARO_SCAN_DEFAULT_MIN_DEST_PORTS 25
+
+/** Number of bits of the hash used to select a sketch register */
+#define SCAN_HLL_BITS (6)
+
+/** Number of registers in each sketch */
+#define SCAN_HLL_REGISTERS (1 << SCAN_HLL_BITS)
+
+static corsaro_plugin_t corsaro_scan_plugin = {
+
+    PLUGIN_NAME,
+    CORSARO_PLUGIN_ID_SCAN,
+    CORSARO_SCAN_MAGIC,
+    CORSARO_PLUGIN_GENERATE_BASE_PTRS(corsaro_scan),
+    CORSARO_PLUGIN_GENERATE_TRACE_PTRS(corsaro_scan),
+    CORSARO_PLUGIN_GENERATE_MERGE_PTRS(corsaro_scan),
+    CORSARO_PLUGIN_GENERATE_TAIL
+};
+
+/** Configuration options for this plugin */
+typedef struct corsaro_scan_config {
+    /** Standard options, e.g. template */
+    corsaro_plugin_proc_options_t basic;
+    /** Maximum number of sources that each processing thread will track */
+    uint32_t max_sources;
+    /** Minimum number of packets before a source can be reported */
+    uint32_t min_packets;
+    /** Minimum number of destination IPs before a source is reported */
+    uint32_t min_dest_ips;
+    /** Minimum number of destination ports before a source is reported */
+    uint32_t min_dest_ports;
+} corsaro_scan_config_t;
+
+/** Activity observed for a single source IP address during an interval.
+ *
+ *  All values are in HOST byte order.
+ */
+typedef struct scan_source {
+    /** The source IP address */
+    uint32_t src_ip;
+    /** Timestamp of the first packet seen from this source */
+    uint32_t first_seen;
+    /** Timestamp of the most recent packet seen from this source */
+    uint32_t last_seen;
+    /** Number of packets seen from this source -- a slot in a source table
+     *  is empty if this is zero */
+    uint64_t pkt_cnt;
+    /** Number of bytes seen from this source */
+    uint64_t byte_cnt;
+    /** Sketch of the destination IP addresses contacted by this source */
+    uint8_t dsthll[SCAN_HLL_REGISTERS];
+    /** Sketch of the destination TCP / UDP ports contacted by this source */
+    uint8_t porthll[SCAN_HLL_REGISTERS];
+} scan_source_t;
+
+/** An open-addressing (linear probing) table of sources */
+typedef struct scan_table {
+    /** The slots in the table */
+    scan_source_t *slots;
+    /** The number of slots in the table, minus one */
+    uint32_t mask;
+    /** The number of slots that are occupied */
+    uint32_t used;
+    /** The number of occupied slots that will trigger an eviction */
+    uint32_t limit;
+} scan_table_t;
+
+/** Thread-local state for the scan plugin */
+typedef struct corsaro_scan_state {
+    /** The sources observed by this thread during the current interval */
+    scan_table_t table;
+    /** ID of the processing thread */
+    int threadid;
+    /** Number of sources evicted during the current interval */
+    uint64_t evicted;
+} corsaro_scan_state_t;
+
+/** The sources observed by a single processing thread during an interval,
+ *  passed to the merging thread at the end of the interval.
+ */
+typedef struct corsaro_scan_interim {
+    /** The observed sources, packed into a contiguous array */
+    scan_source_t *sources;
+    /** The number of sources in the array */
+    uint32_t count;
+    /** Number of sources that were evicted during the interval */
+    uint64_t evicted;
+} corsaro_scan_interim_t;
+
+/** State for the merging thread */
+typedef struct corsaro_scan_merge_state {
+    corsaro_avro_writer_t *mainwriter;
+} corsaro_scan_merge_state_t;
+
+static const char SCAN_RESULT_SCHEMA[] =
+"{\"type\": \"record\",\
+  \"namespace\": \"org.caida.corsaro\",\
+  \"name\": \"scan\",\
+  \"doc\": \"A Corsaro scan record. Destination IP and port counts are \
+             estimates. All fields are in host byte order.\",\
+  \"fields\": [\
+        {\"name\":\"bin_timestamp\", \"type\": \"long\"}, \
+        {\"name\":\"source_ip\", \"type\": \"long\"}, \
+        {\"name\":\"packet_cnt\", \"type\": \"long\"}, \
+        {\"name\":\"byte_cnt\", \"type\": \"long\"}, \
+        {\"name\":\"dest_ip_cnt\", \"type\": \"long\"}, \
+        {\"name\":\"dest_port_cnt\", \"type\": \"long\"}, \
+        {\"name\":\"first_seen\", \"type\": \"long\"}, \
+        {\"name\":\"last_seen\", \"type\": \"long\"}, \
+        {\"name\":\"packet_rate\", \"type\": \"long\"} \
+        ]}";
+
+corsaro_plugin_t *corsaro_scan_alloc(void) {
+    return &(corsaro_scan_plugin);
+}
+
+/** Allocates the slots for a source table that can hold at least
+ *  'limit' sources while staying no more than 3/4 full.
+ */
+static int init_scan_table(scan_table_t *table, uint32_t limit) {
+    uint64_t size = 16;
+
+    while (size < ((uint64_t)limit * 4) / 3 + 1) {
+        size <<= 1;
+    }
+
+    table->slots = (scan_source_t *)calloc(size, sizeof(scan_source_t));
+    if (table->slots == NULL) {
+        return -1;
+    }
+    table->mask = size - 1;
+    table->used = 0;
+    table->limit = limit;
+    return 0;
+}
+
+static void free_scan_table(scan_table_t *table) {
+    if (table->slots) {
+        free(table->slots);
+    }
+    table->slots = NULL;
+    table->used = 0;
+}
+
+/** Finds the slot for a source in a source table. If the source is not
+ *  present, the empty slot where it should be inserted is returned instead
+ *  (and it is up to the caller to fill it in).
+ */
+static inline scan_source_t *lookup_scan_source(scan_table_t *table,
+        uint32_t srcip) {
+
+    uint32_t i = (uint32_t)corsaro_hll_hash(srcip) & table->mask;
+
+    while (table->slots[i].pkt_cnt != 0 && table->slots[i].src_ip != srcip) {
+        i = (i + 1) & table->mask;
+    }
+    return &(table->slots[i]);
+}
+
+static int cmp_last_seen(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    if (x == y) {
+        return 0;
+    }
+    return (x < y) ? -1 : 1;
+}
+
+/** Frees up space in a full source table by evicting the sources that
+ *  have sent the fewest packets this interval.
+ *
+ *  Sources are grouped by the magnitude of their packet count and the
+ *  least active groups are removed until a quarter of the table has been
+ *  freed. Within the group where that quarter is reached, the sources
+ *  that were seen least recently are evicted first, so no more than a
+ *  quarter of the table is ever evicted (even if every source is in the
+ *  same group).
+ *
+ *  @return the number of sources that were evicted.
+ */
+static uint32_t evict_quiet_sources(corsaro_logger_t *logger,
+        scan_table_t *table) {
+
+    uint32_t hist[64];
+    uint32_t i, below = 0, kept = 0, evicted, target, need;
+    uint32_t *seen = NULL, seencount = 0, lastts = 0, tied = 0;
+    uint8_t partial;
+    int cutoff, bucket;
+    scan_source_t *keep, *s;
+
+    target = table->used / 4;
+    if (target == 0) {
+        target = 1;
+    }
+
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i <= table->mask; i++) {
+        if (table->slots[i].pkt_cnt == 0) {
+            continue;
+        }
+        hist[63 - __builtin_clzll(table->slots[i].pkt_cnt)] ++;
+    }
+
+    for (cutoff = 0; cutoff < 63; cutoff++) {
+        if (below + hist[cutoff] >= target) {
+            break;
+        }
+        below += hist[cutoff];
+    }
+
+    /* Work out how recently a source in the cutoff group must have been
+     * seen to survive */
+    need = target - below;
+    partial = (need < hist[cutoff]);
+    if (partial) {
+        seen = (uint32_t *)malloc(sizeof(uint32_t) * hist[cutoff]);
+    }
+    keep = (scan_source_t *)malloc(sizeof(scan_source_t) *
+            (table->used - target + 1));
+    if (keep == NULL || (partial && seen == NULL)) {
+        corsaro_log(logger,
+                "scan plugin: OOM while evicting sources, discarding all sources");
+        free(keep);
+        free(seen);
+        evicted = table->used;
+        memset(table->slots, 0, sizeof(scan_source_t) * (table->mask + 1));
+        table->used = 0;
+        return evicted;
+    }
+
+    if (seen) {
+        for (i = 0; i <= table->mask; i++) {
+            s = &(table->slots[i]);
+            if (s->pkt_cnt != 0 &&
+                    63 - __builtin_clzll(s->pkt_cnt) == cutoff) {
+                seen[seencount] = s->last_seen;
+                seencount ++;
+            }
+        }
+        qsort(seen, seencount, sizeof(uint32_t), cmp_last_seen);
+        lastts = seen[need - 1];
+
+        /* Sources seen at exactly 'lastts' are only partly evicted */
+        for (i = 0; i < need; i++) {
+            if (seen[i] == lastts) {
+                tied ++;
+            }
+        }
+        free(seen);
+    }
+
+    for (i = 0; i <= table->mask; i++) {
+        s = &(table->slots[i]);
+        if (s->pkt_cnt == 0) {
+            continue;
+        }
+        bucket = 63 - __builtin_clzll(s->pkt_cnt);
+        if (bucket < cutoff) {
+            continue;
+        }
+        if (bucket == cutoff) {
+            if (!partial || s->last_seen < lastts) {
+                continue;
+            }
+            if (s->last_seen == lastts && tied > 0) {
+                tied --;
+                continue;
+            }
+        }
+        memcpy(&(keep[kept]), s, sizeof(scan_source_t));
+        kept ++;
+    }
+
+    evicted = table->used - kept;
+    memset(table->slots, 0, sizeof(scan_source_t) * (table->mask + 1));
+    table->used = kept;
+
+    for (i = 0; i < kept; i++) {
+        s = lookup_scan_source(table, keep[i].src_ip);
+        memcpy(s, &(keep[i]), sizeof(scan_source_t));
+    }
+    free(keep);
+    return evicted;
+}
+
+/** Parses the scan plugin-specific configuration options */
+int corsaro_scan_parse_config(corsaro_plugin_t *p, yaml_document_t *doc,
+        yaml_node_t *options) {
+
+    corsaro_scan_config_t *conf;
+    yaml_node_t *key, *value;
+    yaml_node_pair_t *pair;
+
+    conf = (corsaro_scan_config_t *)malloc(sizeof(corsaro_scan_config_t));
+    if (conf == NULL) {
+        corsaro_log(p->logger,
+                "unable to allocate memory to store scan plugin config.");
+        return -1;
+    }
+
+    CORSARO_INIT_PLUGIN_PROC_OPTS(conf->basic);
+    conf->max_sources = CORSARO_SCAN_DEFAULT_MAX_SOURCES;
+    conf->min_packets = CORSARO_SCAN_DEFAULT_MIN_PACKETS;
+    conf->min_dest_ips = CORSARO_SCAN_DEFAULT_MIN_DEST_IPS;
+    conf->min_dest_ports = CORSARO_SCAN_DEFAULT_MIN_DEST_PORTS;
+
+    if (options->type != YAML_MAPPING_NODE) {
+        corsaro_log(p->logger,
+                "Scan plugin config should be a map.");
+        free(conf);
+        return -1;
+    }
+
+    for (pair = options->data.mapping.pairs.start;
+            pair < options->data.mapping.pairs.top; pair ++) {
+
+        char *val;
+        key = yaml_document_get_node(doc, pair->key);
+        value = yaml_document_get_node(doc, pair->value);
+        val = (char *)value->data.scalar.value;
+
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value,
+                    "max_sources") == 0) {
+            conf->max_sources = strtoul(val, NULL, 0);
+        }
+
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value,
+                    "min_packets") == 0) {
+            conf->min_packets = strtoul(val, NULL, 0);
+        }
+
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value,
+                    "min_dest_ips") == 0) {
+            conf->min_dest_ips = strtoul(val, NULL, 0);
+        }
+
+        if (key->type == YAML_SCALAR_NODE && value->type == YAML_SCALAR_NODE
+                && strcmp((char *)key->data.scalar.value,
+                    "min_dest_ports") == 0) {
+            conf->min_dest_ports = strtoul(val, NULL, 0);
+        }
+    }
+
+    p->config = conf;
+    return 0;
+}
+
+/** Fills in any remaining unset configuration options and ensures that
+ *  all user-specified values are within suitable bounds.
+ */
+int corsaro_scan_finalise_config(corsaro_plugin_t *p,
+        corsaro_plugin_proc_options_t *stdopts, void *zmq_ctxt) {
+
+    corsaro_scan_config_t *conf;
+
+    conf = (corsaro_scan_config_t *)(p->config);
+
+    conf->basic.template = stdopts->template;
+    conf->basic.monitorid = stdopts->monitorid;
+
+    if (conf->max_sources < 16) {
+        corsaro_log(p->logger,
+                "'max_sources' must be at least 16, using 16 instead.");
+        conf->max_sources = 16;
+    }
+
+    if (conf->min_dest_ips == 0 && conf->min_dest_ports == 0) {
+        corsaro_log(p->logger,
+                "scan plugin: 'min_dest_ips' and 'min_dest_ports' are both zero, all sources with at least %u packets will be reported",
+                conf->min_packets);
+    }
+
+    /* Log our configuration so people know what options we are using. */
+    corsaro_log(p->logger,
+            "scan plugin: tracking at most %u sources per thread",
+            conf->max_sources);
+    corsaro_log(p->logger,
+            "scan plugin: minimum number of packets for a scanner is %u",
+            conf->min_packets);
+    corsaro_log(p->logger,
+            "scan plugin: minimum number of destination IPs for a scanner is %u",
+            conf->min_dest_ips);
+    corsaro_log(p->logger,
+            "scan plugin: minimum number of destination ports for a scanner is %u",
+            conf->min_dest_ports);
+    return 0;
+}
+
+/** Tidies up any memory that has been allocated for this plugin */
+void corsaro_scan_destroy_self(corsaro_plugin_t *p) {
+    if (p->config) {
+        free(p->config);
+    }
+    p->config = NULL;
+}
+
+/** Initialises thread-local state for using this plugin in packet
+ *  processing mode.
+ */
+void *corsaro_scan_init_processing(corsaro_plugin_t *p, int threadid) {
+
+    corsaro_scan_config_t *conf = (corsaro_scan_config_t *)(p->config);
+    corsaro_scan_state_t *state;
+
+    state = (corsaro_scan_state_t *)calloc(1, sizeof(corsaro_scan_state_t));
+    if (state == NULL) {
+        corsaro_log(p->logger,
+                "failed to allocate thread-local state within scan plugin.");
+        return NULL;
+    }
+
+    if (init_scan_table(&(state->table), conf->max_sources) < 0) {
+        corsaro_log(p->logger,
+                "failed to allocate source table within scan plugin.");
+        free(state);
+        return NULL;
+    }
+
+    state->threadid = threadid;
+    state->evicted = 0;
+    return state;
+}
+
+/** Destroys any thread-local state that was allocated by the init_processing
+ *  function.
+ */
+int corsaro_scan_halt_processing(corsaro_plugin_t *p, void *local) {
+
+    corsaro_scan_state_t *state;
+
+    state = (corsaro_scan_state_t *)local;
+    if (state == NULL) {
+        return 0;
+    }
+
+    free_scan_table(&(state->table));
+    free(state);
+    return 0;
+}
+
+char *corsaro_scan_derive_output_name(corsaro_plugin_t *p,
+        void *local, uint32_t timestamp, int threadid) {
+
+    corsaro_scan_config_t *conf;
+    char *outname = NULL;
+
+    conf = (corsaro_scan_config_t *)(p->config);
+
+    outname = corsaro_generate_avro_file_name(conf->basic.template, p->name,
+            conf->basic.monitorid, timestamp, threadid);
+    if (outname == NULL) {
+        corsaro_log(p->logger,
+                "failed to generate suitable filename for scan output");
+        return NULL;
+    }
+    return outname;
+}
+
+int corsaro_scan_start_interval(corsaro_plugin_t *p, void *local,
+        corsaro_interval_t *int_start) {
+
+    corsaro_scan_state_t *state;
+
+    state = (corsaro_scan_state_t *)local;
+    if (state == NULL) {
+        corsaro_log(p->logger,
+                "corsaro_scan_start_interval: scan thread-local state is NULL!");
+        return -1;
+    }
+    return 0;
+}
+
+void *corsaro_scan_end_interval(corsaro_plugin_t *p, void *local,
+        corsaro_interval_t *int_end, uint8_t complete) {
+
+    corsaro_scan_state_t *state;
+    corsaro_scan_interim_t *interim;
+    uint32_t i;
+
+    state = (corsaro_scan_state_t *)local;
+    if (state == NULL) {
+        corsaro_log(p->logger,
+                "corsaro_scan_end_interval: scan thread-local state is NULL!");
+        return NULL;
+    }
+
+    interim = (corsaro_scan_interim_t *)calloc(1,
+            sizeof(corsaro_scan_interim_t));
+    if (interim == NULL) {
+        corsaro_log(p->logger,
+                "corsaro_scan_end_interval: OOM while allocating interim result");
+        return NULL;
+    }
+
+    interim->evicted = state->evicted;
+    if (state->table.used > 0) {
+        /* Pack the occupied slots so the merging thread only has to
+         * deal with the sources that we actually saw */
+        interim->sources = (scan_source_t *)malloc(sizeof(scan_source_t) *
+                state->table.used);
+        if (interim->sources == NULL) {
+            corsaro_log(p->logger,
+                    "corsaro_scan_end_interval: OOM while copying sources");
+            free(interim);
+            return NULL;
+        }
+
+        for (i = 0; i <= state->table.mask; i++) {
+            if (state->table.slots[i].pkt_cnt == 0) {
+                continue;
+            }
+            memcpy(&(interim->sources[interim->count]),
+                    &(state->table.slots[i]), sizeof(scan_source_t));
+            interim->count ++;
+        }
+
+        memset(state->table.slots, 0, sizeof(scan_source_t) *
+                (state->table.mask + 1));
+        state->table.used = 0;
+    }
+
+    state->evicted = 0;
+    return interim;
+}
+
+int corsaro_scan_process_packet(corsaro_plugin_t *p, void *local,
+        libtrace_packet_t *packet, corsaro_packet_tags_t *tags) {
+
+    corsaro_scan_state_t *state;
+    libtrace_ip_t *ip_hdr;
+    uint16_t ethertype;
+    uint32_t rem, srcip, ts;
+    uint16_t dstport;
+    scan_source_t *src;
+
+    state = (corsaro_scan_state_t *)local;
+    if (state == NULL) {
+        corsaro_log(p->logger,
+                "corsaro_scan_process_packet: scan thread-local state is NULL!");
+        return -1;
+    }
+
+    ip_hdr = (libtrace_ip_t *)(trace_get_layer3(packet, &ethertype, &rem));
+    if (ip_hdr == NULL || ethertype != TRACE_ETHERTYPE_IP ||
+            rem < sizeof(libtrace_ip_t)) {
+        /* non-ipv4 packet or truncated */
+        return 0;
+    }
+
+    /* Backscatter is a response to someone else's traffic, not a probe */
+    if (corsaro_is_backscatter_packet(packet, tags)) {
+        return 0;
+    }
+
+    srcip = ntohl(ip_hdr->ip_src.s_addr);
+    ts = trace_get_timeval(packet).tv_sec;
+
+    src = lookup_scan_source(&(state->table), srcip);
+    if (src->pkt_cnt == 0) {
+        if (state->table.used >= state->table.limit) {
+            state->evicted += evict_quiet_sources(p->logger, &(state->table));
+            src = lookup_scan_source(&(state->table), srcip);
+        }
+        memset(src, 0, sizeof(scan_source_t));
+        src->src_ip = srcip;
+        src->first_seen = ts;
+        state->table.used ++;
+    }
+
+    src->pkt_cnt ++;
+    src->byte_cnt += ntohs(ip_hdr->ip_len);
+    src->last_seen = ts;
+
+    corsaro_hll_add(src->dsthll, SCAN_HLL_BITS,
+            ntohl(ip_hdr->ip_dst.s_addr));
+
+    if (ip_hdr->ip_p == TRACE_IPPROTO_TCP ||
+            ip_hdr->ip_p == TRACE_IPPROTO_UDP) {
+        if (tags) {
+            dstport = ntohs(tags->dest_port);
+        } else {
+            dstport = trace_get_destination_port(packet);
+        }
+        /* Count TCP and UDP ports separately */
+        corsaro_hll_add(src->porthll, SCAN_HLL_BITS,
+                (((uint32_t)ip_hdr->ip_p) << 16) | dstport);
+    }
+    return 0;
+}
+
+/** ------------- MERGING API -------------------- */
+
+void *corsaro_scan_init_merging(corsaro_plugin_t *p, int sources) {
+
+    corsaro_scan_merge_state_t *m;
+
+    m = (corsaro_scan_merge_state_t *)calloc(1,
+            sizeof(corsaro_scan_merge_state_t));
+    if (m == NULL) {
+        return NULL;
+    }
+
+    m->mainwriter = corsaro_create_avro_writer(p->logger, SCAN_RESULT_SCHEMA);
+    if (m->mainwriter == NULL) {
+        corsaro_log(p->logger,
+                "error while creating main avro writer for scan plugin!");
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+int corsaro_scan_halt_merging(corsaro_plugin_t *p, void *local) {
+
+    corsaro_scan_merge_state_t *m;
+
+    m = (corsaro_scan_merge_state_t *)(local);
+    if (m == NULL) {
+        return 0;
+    }
+
+    if (m->mainwriter) {
+        corsaro_destroy_avro_writer(m->mainwriter);
+    }
+    free(m);
+    return 0;
+}
+
+/** Writes a single source that has exceeded the scanning thresholds to
+ *  the output file.
+ */
+static int write_scan_source(corsaro_avro_writer_t *writer, uint32_t ts,
+        scan_source_t *src, uint32_t dstips, uint32_t dstports) {
+
+    uint32_t duration;
+    uint64_t rate;
+
+    /* Packets per minute, over the period that the source was active */
+    duration = src->last_seen - src->first_seen + 1;
+    rate = (src->pkt_cnt * 60) / duration;
+
+    if (corsaro_start_avro_encoding(writer) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, &ts,
+                sizeof(ts)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, &(src->src_ip),
+                sizeof(src->src_ip)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, &(src->pkt_cnt),
+                sizeof(src->pkt_cnt)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, &(src->byte_cnt),
+                sizeof(src->byte_cnt)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, &dstips,
+                sizeof(dstips)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, &dstports,
+                sizeof(dstports)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(src->first_seen), sizeof(src->first_seen)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(src->last_seen), sizeof(src->last_seen)) < 0) {
+        return -1;
+    }
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG, &rate,
+                sizeof(rate)) < 0) {
+        return -1;
+    }
+
+    return corsaro_append_avro_writer(writer, NULL);
+}
+
+/** Combines the sources seen by one processing thread into a table of
+ *  sources seen by all threads.
+ */
+static void combine_scan_sources(scan_table_t *combined,
+        corsaro_scan_interim_t *interim) {
+
+    uint32_t i;
+    scan_source_t *toadd, *existing;
+
+    for (i = 0; i < interim->count; i++) {
+        toadd = &(interim->sources[i]);
+        existing = lookup_scan_source(combined, toadd->src_ip);
+
+        if (existing->pkt_cnt == 0) {
+            memcpy(existing, toadd, sizeof(scan_source_t));
+            combined->used ++;
+            continue;
+        }
+
+        existing->pkt_cnt += toadd->pkt_cnt;
+        existing->byte_cnt += toadd->byte_cnt;
+        if (toadd->first_seen < existing->first_seen) {
+            existing->first_seen = toadd->first_seen;
+        }
+        if (toadd->last_seen > existing->last_seen) {
+            existing->last_seen = toadd->last_seen;
+        }
+        corsaro_hll_merge(existing->dsthll, toadd->dsthll, SCAN_HLL_BITS);
+        corsaro_hll_merge(existing->porthll, toadd->porthll, SCAN_HLL_BITS);
+    }
+}
+
+static void free_scan_interim(corsaro_scan_interim_t *interim) {
+    if (interim == NULL) {
+        return;
+    }
+    if (interim->sources) {
+        free(interim->sources);
+    }
+    free(interim);
+}
+
+int corsaro_scan_merge_interval_results(corsaro_plugin_t *p, void *local,
+        void **tomerge, corsaro_fin_interval_t *fin, void *tagsock) {
+
+    corsaro_scan_merge_state_t *m;
+    corsaro_scan_config_t *conf;
+    corsaro_scan_interim_t *interim;
+    scan_table_t combined;
+    scan_source_t *src;
+    uint64_t total = 0, evicted = 0;
+    uint32_t i, dstips, dstports;
+    char *outname;
+    int ret = 0;
+
+    m = (corsaro_scan_merge_state_t *)(local);
+    if (m == NULL) {
+        return -1;
+    }
+
+    conf = (corsaro_scan_config_t *)(p->config);
+
+    /* First step, open an output file if we need one */
+    if (!corsaro_is_avro_writer_active(m->mainwriter)) {
+        outname = p->derive_output_name(p, local, fin->timestamp, -1);
+        if (outname == NULL) {
+            return -1;
+        }
+        if (corsaro_start_avro_writer(m->mainwriter, outname, 0) == -1) {
+            free(outname);
+            return -1;
+        }
+        free(outname);
+    }
+
+    for (i = 0; i < fin->threads_ended; i++) {
+        interim = (corsaro_scan_interim_t *)(tomerge[i]);
+        if (interim == NULL) {
+            continue;
+        }
+        total += interim->count;
+        evicted += interim->evicted;
+    }
+
+    memset(&combined, 0, sizeof(combined));
+    if (init_scan_table(&combined, total) < 0) {
+        corsaro_log(p->logger,
+                "OOM while allocating combined source table in scan plugin");
+        ret = -1;
+        goto endmerge;
+    }
+
+    for (i = 0; i < fin->threads_ended; i++) {
+        interim = (corsaro_scan_interim_t *)(tomerge[i]);
+        if (interim == NULL) {
+            continue;
+        }
+        combine_scan_sources(&combined, interim);
+    }
+
+    for (i = 0; i <= combined.mask; i++) {
+        src = &(combined.slots[i]);
+        if (src->pkt_cnt == 0 || src->pkt_cnt < conf->min_packets) {
+            continue;
+        }
+
+        dstips = corsaro_hll_estimate(src->dsthll, SCAN_HLL_BITS);
+        dstports = corsaro_hll_estimate(src->porthll, SCAN_HLL_BITS);
+
+        if ((conf->min_dest_ips != 0 || conf->min_dest_ports != 0) &&
+                (conf->min_dest_ips == 0 || dstips < conf->min_dest_ips) &&
+                (conf->min_dest_ports == 0 ||
+                 dstports < conf->min_dest_ports)) {
+            continue;
+        }
+
+        if (write_scan_source(m->mainwriter, fin->timestamp, src, dstips,
+                    dstports) < 0) {
+            corsaro_log(p->logger,
+                    "could not write scan source to Avro output file.");
+            ret = -1;
+            goto endmerge;
+        }
+    }
+
+    if (evicted > 0) {
+        corsaro_log(p->logger,
+                "scan plugin: evicted %lu low-activity sources during interval %u (max_sources is %u per thread)",
+                evicted, fin->timestamp, conf->max_sources);
+    }
+
+endmerge:
+    free_scan_table(&combined);
+    for (i = 0; i < fin->threads_ended; i++) {
+        free_scan_interim((corsaro_scan_interim_t *)(tomerge[i]));
+    }
+    return ret;
+}
+
+int corsaro_scan_rotate_output(corsaro_plugin_t *p, void *local) {
+    corsaro_scan_merge_state_t *m;
+
+    m = (corsaro_scan_merge_state_t *)(local);
+    if (m == NULL) {
+        return -1;
+    }
+
+    if (m->mainwriter == NULL || corsaro_close_avro_writer(m->mainwriter) < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -141,6 +141,11 @@ corsaro_plugin_t *corsaro_report_alloc(void) {
 
 #define INVALID_PORT 0xFFFFFFFF
 
+/** Number of report plugin instances that have started IP tracker threads,
+ *  used to give each instance's tracker sockets a unique name.
+ */
+static int tracker_instances = 0;
+
 static inline unsigned long int strtoport(char *ptr, bool capmax,
         corsaro_logger_t *logger) {
 
@@ -576,7 +581,7 @@ int corsaro_report_finalise_config(corsaro_plugin_t *p,
         corsaro_plugin_proc_options_t *stdopts, void *zmq_ctxt) {
 
     corsaro_report_config_t *conf;
-    int i, j, ret = 0, rto=10, hwm=50, inchwm;
+    int i, j, ret = 0, rto=10, hwm=50, inchwm, instance;
     char sockname[40];
 
     conf = (corsaro_report_config_t *)(p->config);
@@ -586,6 +591,7 @@ int corsaro_report_finalise_config(corsaro_plugin_t *p,
     conf->basic.libtsascii = stdopts->libtsascii;
     conf->basic.libtskafka = stdopts->libtskafka;
     conf->basic.libtsdbats = stdopts->libtsdbats;
+    conf->budget = p->budget;
 
     if (conf->outlabel == NULL) {
         conf->outlabel = strdup("unlabeled");
@@ -710,6 +716,7 @@ int corsaro_report_finalise_config(corsaro_plugin_t *p,
 
     hwm = conf->internalhwm;
     inchwm = hwm * conf->basic.procthreads;
+    instance = __sync_fetch_and_add(&tracker_instances, 1);
 
     corsaro_log(p->logger, "report plugin: using internal queue HWM of %u",
             conf->internalhwm);
@@ -728,13 +735,15 @@ int corsaro_report_finalise_config(corsaro_plugin_t *p,
     for (i = 0; i < conf->tracker_count; i++) {
 
         pthread_mutex_init(&(conf->iptrackers[i].mutex), NULL);
+        pthread_cond_init(&(conf->iptrackers[i].collected), NULL);
         conf->iptrackers[i].lastresultts = 0;
         conf->iptrackers[i].conf = conf;
         conf->iptrackers[i].srcip_sample_index = 0;
         conf->iptrackers[i].dstip_sample_index = 0;
         conf->iptrackers[i].inbuf = NULL;
         conf->iptrackers[i].inbuflen = 0;
-        conf->iptrackers[i].prev_maps = NULL;
+        conf->iptrackers[i].completed = libtrace_list_init(
+                sizeof(corsaro_report_tracker_result_t));
         conf->iptrackers[i].curr_maps = NULL;
         conf->iptrackers[i].next_maps = NULL;
         conf->iptrackers[i].logger = p->logger;
@@ -748,7 +757,7 @@ int corsaro_report_finalise_config(corsaro_plugin_t *p,
         conf->iptrackers[i].sourcetrack = calloc(stdopts->procthreads,
                 sizeof(corsaro_report_iptracker_source_t));
 
-        snprintf(sockname, 40, "inproc://reporttracker%d", i);
+        snprintf(sockname, 40, "inproc://reporttracker%d-%d", instance, i);
 
         conf->iptrackers[i].incoming = zmq_socket(zmq_ctxt, ZMQ_PULL);
         if (zmq_setsockopt(conf->iptrackers[i].incoming, ZMQ_RCVTIMEO, &rto,
@@ -825,6 +834,7 @@ void corsaro_report_destroy_self(corsaro_plugin_t *p) {
         if (conf->iptrackers) {
             for (i = 0; i < conf->tracker_count; i++) {
                 pthread_mutex_destroy(&(conf->iptrackers[i].mutex));
+                pthread_cond_destroy(&(conf->iptrackers[i].collected));
 
                 zmq_close(conf->iptrackers[i].incoming);
                 for (j = 0; j < conf->basic.procthreads; j++) {
@@ -836,6 +846,7 @@ void corsaro_report_destroy_self(corsaro_plugin_t *p) {
                 }
                 free(conf->iptrackers[i].sourcetrack);
                 libtrace_list_deinit(conf->iptrackers[i].outstanding);
+                free_uncollected_tallies(&(conf->iptrackers[i]));
             }
             free(conf->iptrackers);
             free(conf->tracker_queues);
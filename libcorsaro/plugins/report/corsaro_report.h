@@ -54,6 +54,38 @@
 #include "libcorsaro.h"
 #include "libcorsaro_plugin.h"
 
+/** Avro schema for report plugin results */
+static const char REPORT_RESULT_SCHEMA[] =
+"{\"type\": \"record\",\
+  \"namespace\": \"org.caida.corsaro\",\
+  \"name\": \"report\",\
+  \"doc\":  \"A Corsaro report result containing statistics describing the \
+              range of traffic that was assigned to each supported tag by \
+              corsarotrace.\",\
+  \"fields\": [\
+        {\"name\": \"bin_timestamp\", \"type\": \"long\"}, \
+        {\"name\": \"source_label\", \"type\": \"string\"}, \
+        {\"name\": \"metric_name\", \"type\": \"string\"}, \
+        {\"name\": \"metric_value\", \"type\": \"string\"}, \
+        {\"name\": \"src_ip_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"dest_ip_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"pkt_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"byte_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"src_asn_cnt\", \"type\": \"long\"}, \
+        {\"name\": \"ip_cnt_method\", \"type\": \"string\", \
+         \"default\": \"exact\", \
+         \"doc\": \"How src_ip_cnt and dest_ip_cnt were counted: 'exact', \
+                  or 'hll' if some of the unique IPs were estimated using \
+                  HyperLogLog because the memory budget was exceeded.\"} \
+        ]}";
+
+/** Value of the ip_cnt_method field for exact unique IP counts */
+#define REPORT_IP_CNT_EXACT "exact"
+
+/** Value of the ip_cnt_method field for unique IP counts that were at
+ *  least partly estimated using HyperLogLog */
+#define REPORT_IP_CNT_HLL "hll"
+
 corsaro_plugin_t *corsaro_report_alloc(void);
 CORSARO_PLUGIN_GENERATE_PROTOTYPES(corsaro_report)
 
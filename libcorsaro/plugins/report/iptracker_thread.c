@@ -102,6 +102,99 @@ static inline bool should_count_address(uint32_t ipaddr, uint32_t *tocount,
 
 }
 
+/** Folds the addresses in an exact unique IP set into a new HyperLogLog
+ *  sketch and releases the exact set.
+ *
+ *  The sketch is charged against the plugin's memory budget and the
+ *  estimated cost of the exact set is released from it.
+ *
+ *  @param track        The state for this IP tracker thread
+ *  @param maps         The map set that the metric belongs to
+ *  @param set          The exact set of IPs for the metric
+ *  @param hll          Updated to point to the new sketch
+ *  @param count        The number of addresses in the exact set
+ */
+static void migrate_set_to_sketch(corsaro_report_iptracker_t *track,
+        corsaro_report_iptracker_maps_t *maps, Pvoid_t *set, uint8_t **hll,
+        Word_t count) {
+
+    int ret;
+    Word_t index = 0;
+
+    *hll = calloc(REPORT_HLL_REGISTERS, sizeof(uint8_t));
+    J1F(ret, *set, index);
+    while (ret) {
+        corsaro_hll_add(*hll, REPORT_HLL_BITS, (uint32_t)index);
+        J1N(ret, *set, index);
+    }
+    J1FA(ret, *set);
+
+    count *= REPORT_IP_MEM_ESTIMATE;
+    if (count > maps->memcharged) {
+        count = maps->memcharged;
+    }
+    maps->memcharged -= count;
+    corsaro_mem_budget_release(track->conf->budget, count);
+
+    maps->memcharged += REPORT_HLL_REGISTERS;
+    corsaro_mem_budget_charge(track->conf->budget, REPORT_HLL_REGISTERS);
+    maps->sketches ++;
+}
+
+/** Adds an IP address to a unique IP set for a metric, falling back to a
+ *  HyperLogLog sketch for large sets if the plugin has exceeded its memory
+ *  budget.
+ *
+ *  Once the budget is exceeded, any set that grows beyond
+ *  REPORT_HLL_DEGRADE_THRESHOLD addresses is folded into a sketch and the
+ *  exact set is released. Smaller sets stay exact, as a sketch would cost
+ *  more memory than it saves.
+ *
+ *  @param track        The state for this IP tracker thread
+ *  @param maps         The map set that the metric belongs to
+ *  @param set          The exact set of IPs for the metric
+ *  @param hll          The sketch of IPs for the metric
+ *  @param val          The IP address to add
+ *
+ *  @return 1 if the address may not have been seen before, 0 if it was
+ *          definitely already in the set.
+ */
+static int count_tracked_ip(corsaro_report_iptracker_t *track,
+        corsaro_report_iptracker_maps_t *maps, Pvoid_t *set, uint8_t **hll,
+        uint32_t val) {
+
+    int ret;
+    Word_t count;
+
+    if (*hll) {
+        corsaro_hll_add(*hll, REPORT_HLL_BITS, val);
+        return 1;
+    }
+
+    J1S(ret, *set, (Word_t)val);
+    if (ret == 0 || track->conf->budget == NULL) {
+        return ret;
+    }
+
+    maps->memcharged += REPORT_IP_MEM_ESTIMATE;
+    if (corsaro_mem_budget_charge(track->conf->budget,
+                REPORT_IP_MEM_ESTIMATE) && !maps->degraded) {
+        corsaro_log(track->logger,
+                "memory budget exceeded, estimating unique IP counts for sets larger than %u addresses for the rest of this interval",
+                REPORT_HLL_DEGRADE_THRESHOLD);
+        maps->degraded = 1;
+        corsaro_mem_budget_note_degraded(track->conf->budget);
+    }
+
+    if (maps->degraded) {
+        J1C(count, *set, 0, -1);
+        if (count > REPORT_HLL_DEGRADE_THRESHOLD) {
+            migrate_set_to_sketch(track, maps, set, hll, count);
+        }
+    }
+    return ret;
+}
+
 /** Updates the tallies for a single observed IP + metric combination.
  *
  *  @param track        The state for this IP tracker thread
@@ -189,6 +282,11 @@ static void update_knownip_metric(corsaro_report_iptracker_t *track,
                     sizeof(corsaro_metric_ip_hash_t));
 
             JLI(pval, maps->general, (Word_t)metricid);
+            if (track->conf->budget) {
+                maps->memcharged += sizeof(corsaro_metric_ip_hash_t);
+                corsaro_mem_budget_charge(track->conf->budget,
+                        sizeof(corsaro_metric_ip_hash_t));
+            }
             m->metricid = metricid;
             m->srcips = NULL;
             m->destips = NULL;
@@ -208,7 +306,8 @@ static void update_knownip_metric(corsaro_report_iptracker_t *track,
         if (should_count_address(ipaddr, &tocount,
                 &(track->conf->src_ipcount_conf), track->srcip_sample_index)) {
 
-            J1S(ret, m->srcips, (Word_t)tocount);
+            ret = count_tracked_ip(track, maps, &(m->srcips), &(m->srchll),
+                    tocount);
             if (asn != 0 && ret == 1) {
                 J1S(ret, m->srcasns, (Word_t)asn);
             }
@@ -216,7 +315,8 @@ static void update_knownip_metric(corsaro_report_iptracker_t *track,
     } else {
         if (should_count_address(ipaddr, &tocount,
                 &(track->conf->dst_ipcount_conf), track->dstip_sample_index)) {
-            J1S(ret, m->destips, (Word_t)tocount);
+            count_tracked_ip(track, maps, &(m->destips), &(m->dsthll),
+                    tocount);
         }
     }
 }
@@ -241,6 +341,11 @@ static void update_knownip_metric_saved(corsaro_report_iptracker_t *track,
         m = (corsaro_metric_ip_hash_t *)calloc(1,
                     sizeof(corsaro_metric_ip_hash_t));
         JLI(pval, maps->general, (Word_t)metricid);
+        if (track->conf->budget) {
+            maps->memcharged += sizeof(corsaro_metric_ip_hash_t);
+            corsaro_mem_budget_charge(track->conf->budget,
+                    sizeof(corsaro_metric_ip_hash_t));
+        }
         m->metricid = metricid;
         memcpy(m->associated_metricids, saved->associated_metricids,
                 MAX_ASSOCIATED_METRICS * sizeof(uint64_t));
@@ -259,12 +364,14 @@ static void update_knownip_metric_saved(corsaro_report_iptracker_t *track,
     if (saved->destip != 0) {
         if (should_count_address(saved->destip, &tocount,
                 &(track->conf->dst_ipcount_conf), track->dstip_sample_index)) {
-            J1S(ret, m->destips, (Word_t)tocount);
+            count_tracked_ip(track, maps, &(m->destips), &(m->dsthll),
+                    tocount);
         }
     } else {
         if (should_count_address(saved->srcip, &tocount,
                 &(track->conf->src_ipcount_conf), track->srcip_sample_index)) {
-            J1S(ret, m->srcips, (Word_t)saved->srcip);
+            count_tracked_ip(track, maps, &(m->srcips), &(m->srchll),
+                    saved->srcip);
             if (saved->srcasn != 0) {
                 J1S(ret, m->srcasns, (Word_t)saved->srcasn);
             }
@@ -282,15 +389,20 @@ static inline void free_metrichash(corsaro_metric_ip_hash_t *ipiter) {
     J1FA(ret, ipiter->srcips);
     J1FA(ret, ipiter->destips);
     J1FA(ret, ipiter->srcasns);
+    free(ipiter->srchll);
+    free(ipiter->dsthll);
 }
 
-static void free_map_set(corsaro_report_iptracker_maps_t *maps) {
+void free_map_set(corsaro_report_iptracker_maps_t *maps,
+        corsaro_mem_budget_t *budget) {
     int i;
 
     if (maps == NULL) {
         return;
     }
 
+    corsaro_mem_budget_release(budget, maps->memcharged);
+
     if (maps->general) {
         corsaro_metric_ip_hash_t *ipiter;
         Word_t index = 0, ret;
@@ -324,6 +436,26 @@ static void free_map_set(corsaro_report_iptracker_maps_t *maps) {
     free(maps);
 }
 
+/** Frees any completed tallies that an IP tracker thread has produced but
+ *  which were never collected by the merging thread.
+ *
+ *  @param track        The IP tracker thread to tidy up after.
+ */
+void free_uncollected_tallies(corsaro_report_iptracker_t *track) {
+
+    corsaro_report_tracker_result_t res;
+
+    if (track->completed == NULL) {
+        return;
+    }
+
+    while (libtrace_list_pop_front(track->completed, (void *)(&res)) > 0) {
+        free_map_set(res.maps, track->conf->budget);
+    }
+    libtrace_list_deinit(track->completed);
+    track->completed = NULL;
+}
+
 /** Checks if a packet processing thread has already sent us an interval end
  *  message for the current interval.
  *
@@ -474,25 +606,24 @@ static void process_interval_reset_message(corsaro_report_iptracker_t *track,
         return;
     }
 
- 	pthread_mutex_unlock(&(track->mutex));
-
     /* End of interval, take final tally and update lastresults */
+    if (msg->msgtype == CORSARO_IP_MESSAGE_INTERVAL) {
+        corsaro_report_tracker_result_t res;
 
-    /* First, make sure that the merging thread has finished with the
-     * previous result we gave it...
-     */
-    do {
-        pthread_mutex_lock(&(track->mutex));
-        if (track->prev_maps == NULL) {
-            break;
+        /* Queue the tally for the merging thread rather than waiting for
+         * it to collect the previous one -- when corsarotrace is running
+         * several offline inputs at once, the merger may not get to this
+         * interval until an earlier input has caught up. The queue is
+         * bounded though, so wait if the merger is too far behind.
+         */
+        while (libtrace_list_get_size(track->completed) >=
+                REPORT_MAX_QUEUED_TALLIES) {
+            pthread_cond_wait(&(track->collected), &(track->mutex));
         }
-        pthread_mutex_unlock(&(track->mutex));
-        /* TODO use a proper condition variable here */
-        sleep(1);
-    } while (1);
 
-    if (msg->msgtype == CORSARO_IP_MESSAGE_INTERVAL) {
-        track->prev_maps = track->curr_maps;
+        res.interval_ts = complete;
+        res.maps = track->curr_maps;
+        libtrace_list_push_back(track->completed, (void *)(&res));
         track->lastresultts = complete;
         track->srcip_sample_index ++;
 
@@ -507,7 +638,7 @@ static void process_interval_reset_message(corsaro_report_iptracker_t *track,
             track->dstip_sample_index = 0;
         }
     } else {
-        free_map_set(track->curr_maps);
+        free_map_set(track->curr_maps, track->conf->budget);
     }
 
     if (track->haltphase == 1) {
@@ -731,8 +862,8 @@ void *start_iptracker(void *tdata) {
     }
 
     /* Thread is ending, tidy up everything */
-    free_map_set(track->curr_maps);
-    free_map_set(track->next_maps);
+    free_map_set(track->curr_maps, track->conf->budget);
+    free_map_set(track->next_maps, track->conf->budget);
     pthread_exit(NULL);
 }
 
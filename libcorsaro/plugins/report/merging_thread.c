@@ -100,12 +100,15 @@
         return -1; \
     }
 
-#define ADD_EMPTY_RESULT(metricclass, metricval) \
+/** An upper bound on the value of any metric that has a dense result slot.
+ *  Ports, IP protocols and two-character geo codes all fit within 16 bits.
+ */
+#define REPORT_DENSE_VALUE_MAX (65536)
+
+#define ADD_DENSE_METRIC(metricclass, metricval) \
     if (IS_METRIC_ALLOWED(conf->allowedmetricclasses, metricclass)) { \
-        metricid = GEN_METRICID(metricclass, metricval); \
-        r = new_result(metricid, conf->outlabel, ts); \
-        JLI(pval, *results, (Word_t)metricid); \
-        *pval = (Word_t)r; \
+        metricids[count] = GEN_METRICID(metricclass, metricval); \
+        count ++; \
     }
 
 /** Merge thread state for the report plugin */
@@ -139,28 +142,71 @@ typedef struct corsaro_report_merge_state {
     /** Map of polygon IDs to FQ polygon labels -- note that polygons can
     */
     Pvoid_t polygon_labels;
+
+    /** Map of metric IDs to their interned metric name and value strings */
+    Pvoid_t metric_names;
+
+    /** Set if any geo-tagging labels have changed since the metric names
+     *  were last interned */
+    uint8_t labels_changed;
+
+    /** Results for the bounded metric classes that we always report, even
+     *  if they are not observed (protocols, ports, continents and
+     *  countries). Allocated once, sorted by metric ID and reset at the
+     *  start of each interval.
+     */
+    corsaro_report_result_t *dense;
+
+    /** The metric ID for each slot in the dense result array */
+    uint64_t *densemetricids;
+
+    /** The number of slots in the dense result array */
+    uint32_t densecount;
+
+    /** For each metric class, maps a metric value to its slot in the dense
+     *  result array (or -1 if it has no slot). NULL for classes that only
+     *  have sparse results.
+     */
+    int32_t *denseindex[CORSARO_METRIC_CLASS_LAST];
 } corsaro_report_merge_state_t;
 
+/** Iterator over the combined results for an interval, returning both the
+ *  dense and the sparse results in metric ID order.
+ */
+typedef struct corsaro_report_result_iter {
+    /** The merge thread state that owns the dense results */
+    corsaro_report_merge_state_t *m;
+
+    /** The Judy array containing the sparse results */
+    Pvoid_t *sparse;
+
+    /** The next sparse result to return, or NULL if there are none left */
+    PWord_t pval;
+
+    /** The metric ID of the next sparse result */
+    Word_t index;
+
+    /** The next dense result slot to return */
+    uint32_t nextdense;
+} corsaro_report_result_iter_t;
+
+/** The printable metric class and metric value for a single metric ID,
+ *  formatted once and then re-used for every interval.
+ */
+typedef struct corsaro_report_metric_name {
+    /** A string representation of the metric class */
+    char *metrictype;
+
+    /** A string representation of the metric value */
+    char *metricval;
+
+    /** Length of the metric class string */
+    uint32_t typelen;
+
+    /** Length of the metric value string */
+    uint32_t vallen;
+} corsaro_report_metric_name_t;
 
-/** Avro schema for report plugin results */
-static const char REPORT_RESULT_SCHEMA[] =
-"{\"type\": \"record\",\
-  \"namespace\": \"org.caida.corsaro\",\
-  \"name\": \"report\",\
-  \"doc\":  \"A Corsaro report result containing statistics describing the \
-              range of traffic that was assigned to each supported tag by \
-              corsarotrace.\",\
-  \"fields\": [\
-        {\"name\": \"bin_timestamp\", \"type\": \"long\"}, \
-        {\"name\": \"source_label\", \"type\": \"string\"}, \
-        {\"name\": \"metric_name\", \"type\": \"string\"}, \
-        {\"name\": \"metric_value\", \"type\": \"string\"}, \
-        {\"name\": \"src_ip_cnt\", \"type\": \"long\"}, \
-        {\"name\": \"dest_ip_cnt\", \"type\": \"long\"}, \
-        {\"name\": \"pkt_cnt\", \"type\": \"long\"}, \
-        {\"name\": \"byte_cnt\", \"type\": \"long\"}, \
-        {\"name\": \"src_asn_cnt\", \"type\": \"long\"} \
-        ]}";
 
 /* Pre-defined alpha-2 codes for continents */
 #define CORSAROTRACE_NUM_CONTINENTS (8)
@@ -255,11 +301,18 @@ static inline const char * get_filter_stringname(int fbit) {
 }
 
 /** Produce fully-qualified labels for both the metric class and the
- *  metric value for a given result.
+ *  metric value for a given metric ID.
  *
+ *  @param m            The local state for the merging thread.
+ *  @param metricid     The metric ID to produce labels for.
+ *  @param metrictype   A buffer of at least 256 bytes to write the metric
+ *                      class label into.
+ *  @param metricval    A buffer of at least 128 bytes to write the metric
+ *                      value label into.
+ *  @return 0 if successful, -1 if a required geo-tagging label is missing.
  */
 static inline int metric_to_strings(corsaro_report_merge_state_t *m,
-        corsaro_report_result_t *res) {
+        uint64_t metricid, char *metrictype, char *metricval) {
 
     Word_t *pval;
     const char *contkey = NULL;
@@ -273,83 +326,86 @@ static inline int metric_to_strings(corsaro_report_merge_state_t *m,
      * Hopefully, these will match the strings that were used by
      * previous instances of this plugin...
      */
-    switch(res->metricid >> 32) {
+    metrictype[0] = '\0';
+    metricval[0] = '\0';
+
+    switch(metricid >> 32) {
         case CORSARO_METRIC_CLASS_COMBINED:
-            strncpy(res->metrictype, "overall", 128);
-            res->metricval[0] = '\0';
+            strncpy(metrictype, "overall", 128);
+            metricval[0] = '\0';
             break;
         case CORSARO_METRIC_CLASS_IP_PROTOCOL:
-            strncpy(res->metrictype, "traffic.protocol", 128);
-            snprintf(res->metricval, 128, "%lu", res->metricid & 0xffffffff);
+            strncpy(metrictype, "traffic.protocol", 128);
+            snprintf(metricval, 128, "%lu", metricid & 0xffffffff);
             break;
         case CORSARO_METRIC_CLASS_ICMP_TYPECODE:
-            strncpy(res->metrictype, "traffic.icmp", 128);
-            snprintf(res->metricval, 128, "type.%u.code.%u",
-                     (uint8_t)((res->metricid >> 8) & 0xff),
-                     (uint8_t)(res->metricid & 0xff));
+            strncpy(metrictype, "traffic.icmp", 128);
+            snprintf(metricval, 128, "type.%u.code.%u",
+                     (uint8_t)((metricid >> 8) & 0xff),
+                     (uint8_t)(metricid & 0xff));
             break;
         case CORSARO_METRIC_CLASS_TCP_SOURCE_PORT:
-            strncpy(res->metrictype, "traffic.port.tcp.src_port", 128);
-            snprintf(res->metricval, 128, "%lu", res->metricid & 0xffffffff);
+            strncpy(metrictype, "traffic.port.tcp.src_port", 128);
+            snprintf(metricval, 128, "%lu", metricid & 0xffffffff);
             break;
         case CORSARO_METRIC_CLASS_TCP_DEST_PORT:
-            strncpy(res->metrictype, "traffic.port.tcp.dst_port", 128);
-            snprintf(res->metricval, 128, "%lu", res->metricid & 0xffffffff);
+            strncpy(metrictype, "traffic.port.tcp.dst_port", 128);
+            snprintf(metricval, 128, "%lu", metricid & 0xffffffff);
             break;
         case CORSARO_METRIC_CLASS_UDP_SOURCE_PORT:
-            strncpy(res->metrictype, "traffic.port.udp.src_port", 128);
-            snprintf(res->metricval, 128, "%lu", res->metricid & 0xffffffff);
+            strncpy(metrictype, "traffic.port.udp.src_port", 128);
+            snprintf(metricval, 128, "%lu", metricid & 0xffffffff);
             break;
         case CORSARO_METRIC_CLASS_UDP_DEST_PORT:
-            strncpy(res->metrictype, "traffic.port.udp.dst_port", 128);
-            snprintf(res->metricval, 128, "%lu", res->metricid & 0xffffffff);
+            strncpy(metrictype, "traffic.port.udp.dst_port", 128);
+            snprintf(metricval, 128, "%lu", metricid & 0xffffffff);
             break;
         case CORSARO_METRIC_CLASS_MAXMIND_CONTINENT:
-            strncpy(res->metrictype, "geo.maxmind", 128);
-            snprintf(res->metricval, 128, "%c%c", (int)(res->metricid & 0xff),
-                    (int)((res->metricid >> 8) & 0xff));
+            strncpy(metrictype, "geo.maxmind", 128);
+            snprintf(metricval, 128, "%c%c", (int)(metricid & 0xff),
+                    (int)((metricid >> 8) & 0xff));
             break;
         case CORSARO_METRIC_CLASS_MAXMIND_COUNTRY:
-            LOOKUP_GEOTAG_LABEL(m->country_labels, res->metricid)
+            LOOKUP_GEOTAG_LABEL(m->country_labels, metricid)
             STRIP_METRIC_VALUE(contkey, metrickey, remain, 128);
-            snprintf(res->metrictype, 256, "geo.maxmind.%s", metrickey);
-            snprintf(res->metricval, 128, "%c%c", (int)(res->metricid & 0xff),
-                    (int)((res->metricid >> 8) & 0xff));
+            snprintf(metrictype, 256, "geo.maxmind.%s", metrickey);
+            snprintf(metricval, 128, "%c%c", (int)(metricid & 0xff),
+                    (int)((metricid >> 8) & 0xff));
             break;
         case CORSARO_METRIC_CLASS_NETACQ_CONTINENT:
-            strncpy(res->metrictype, "geo.netacuity", 128);
-            snprintf(res->metricval, 128, "%c%c", (int)(res->metricid & 0xff),
-                    (int)((res->metricid >> 8) & 0xff));
+            strncpy(metrictype, "geo.netacuity", 128);
+            snprintf(metricval, 128, "%c%c", (int)(metricid & 0xff),
+                    (int)((metricid >> 8) & 0xff));
             break;
         case CORSARO_METRIC_CLASS_NETACQ_COUNTRY:
-            LOOKUP_GEOTAG_LABEL(m->country_labels, res->metricid)
+            LOOKUP_GEOTAG_LABEL(m->country_labels, metricid)
             STRIP_METRIC_VALUE(contkey, metrickey, remain, 128);
-            snprintf(res->metrictype, 256, "geo.netacuity.%s", metrickey);
-            snprintf(res->metricval, 128, "%c%c", (int)(res->metricid & 0xff),
-                    (int)((res->metricid >> 8) & 0xff));
+            snprintf(metrictype, 256, "geo.netacuity.%s", metrickey);
+            snprintf(metricval, 128, "%c%c", (int)(metricid & 0xff),
+                    (int)((metricid >> 8) & 0xff));
             break;
         case CORSARO_METRIC_CLASS_NETACQ_REGION:
-            LOOKUP_GEOTAG_LABEL(m->region_labels, res->metricid)
+            LOOKUP_GEOTAG_LABEL(m->region_labels, metricid)
             STRIP_METRIC_VALUE(contkey, metrickey, remain, 128);
-            snprintf(res->metrictype, 256, "geo.netacuity.%s", metrickey);
-            snprintf(res->metricval, 128, "%s", remain);
+            snprintf(metrictype, 256, "geo.netacuity.%s", metrickey);
+            snprintf(metricval, 128, "%s", remain);
             break;
         case CORSARO_METRIC_CLASS_NETACQ_POLYGON:
-            LOOKUP_GEOTAG_LABEL(m->polygon_labels, res->metricid)
+            LOOKUP_GEOTAG_LABEL(m->polygon_labels, metricid)
             STRIP_METRIC_VALUE(contkey, metrickey, remain, 128);
-            snprintf(res->metrictype, 256, "geo.netacuity.%s", metrickey);
-            snprintf(res->metricval, 128, "%s", remain);
+            snprintf(metrictype, 256, "geo.netacuity.%s", metrickey);
+            snprintf(metricval, 128, "%s", remain);
             break;
         case CORSARO_METRIC_CLASS_PREFIX_ASN:
-            strncpy(res->metrictype , "routing.asn", 128);
-            snprintf(res->metricval, 128, "%lu", res->metricid & 0xffffffff);
+            strncpy(metrictype , "routing.asn", 128);
+            snprintf(metricval, 128, "%lu", metricid & 0xffffffff);
             break;
         case CORSARO_METRIC_CLASS_FILTER_CRITERIA:
-            if ((res->metricid & 0xffffffff) >=
+            if ((metricid & 0xffffffff) >=
                     CORSARO_FILTERID_ABNORMAL_PROTOCOL) {
-                snprintf(res->metrictype, 256, "filter-criteria");
-                snprintf(res->metricval, 128, "%s",
-                        get_filter_stringname(res->metricid & 0xffffffff));
+                snprintf(metrictype, 256, "filter-criteria");
+                snprintf(metricval, 128, "%s",
+                        get_filter_stringname(metricid & 0xffffffff));
             }
             break;
     }
@@ -357,35 +413,270 @@ static inline int metric_to_strings(corsaro_report_merge_state_t *m,
 }
 
 
-/** Converts a report result into an Avro value
+/** Frees an interned metric name.
+ */
+static inline void free_metric_name(corsaro_report_metric_name_t *name) {
+    free(name->metrictype);
+    free(name->metricval);
+    free(name);
+}
+
+/** Frees all of the interned metric names in a map.
+ *
+ *  @param names        The map of interned metric names to be freed.
+ */
+static void free_metric_names(Pvoid_t *names) {
+    Word_t index = 0, judyret;
+    PWord_t pval;
+
+    JLF(pval, *names, index);
+    while (pval) {
+        free_metric_name((corsaro_report_metric_name_t *)(*pval));
+        JLN(pval, *names, index);
+    }
+    JLFA(judyret, *names);
+}
+
+/** Removes the interned names for every metric in the given metric class,
+ *  so that they will be re-formatted the next time they are needed.
+ *
+ *  @param names        The map of interned metric names.
+ *  @param metricclass  The metric class to remove names for.
+ */
+static void forget_metric_class_names(Pvoid_t *names, uint32_t metricclass) {
+    Word_t index = GEN_METRICID(metricclass, 0);
+    Word_t last = GEN_METRICID(metricclass, 0xffffffff);
+    PWord_t pval;
+    int rc;
+
+    JLF(pval, *names, index);
+    while (pval && index <= last) {
+        free_metric_name((corsaro_report_metric_name_t *)(*pval));
+        JLD(rc, *names, index);
+        JLN(pval, *names, index);
+    }
+}
+
+/** Returns the interned metric class and value strings for a metric ID,
+ *  formatting and interning them if this is the first time that we have
+ *  needed them.
+ *
+ *  @param m            The local state for the merging thread.
+ *  @param logger       A reference to a corsaro logger for error reporting
+ *  @param metricid     The metric ID to get the strings for.
+ *  @return a pointer to the interned metric name, or NULL if the name
+ *          could not be derived (e.g. a geo-tagging label is missing) or
+ *          we ran out of memory while interning it.
+ */
+static corsaro_report_metric_name_t *get_metric_name(
+        corsaro_report_merge_state_t *m, corsaro_logger_t *logger,
+        uint64_t metricid) {
+
+    corsaro_report_metric_name_t *name;
+    char metrictype[256];
+    char metricval[128];
+    PWord_t pval;
+
+    JLG(pval, m->metric_names, metricid);
+    if (pval) {
+        return (corsaro_report_metric_name_t *)(*pval);
+    }
+
+    /* Don't intern anything if a label is missing -- it may arrive with
+     * a later label update from the tagger.
+     */
+    if (metric_to_strings(m, metricid, metrictype, metricval) < 0) {
+        return NULL;
+    }
+
+    name = (corsaro_report_metric_name_t *)calloc(1,
+            sizeof(corsaro_report_metric_name_t));
+    if (name == NULL) {
+        corsaro_log(logger,
+                "out of memory while interning report metric name.");
+        return NULL;
+    }
+    name->metrictype = strdup(metrictype);
+    name->metricval = strdup(metricval);
+    if (name->metrictype == NULL || name->metricval == NULL) {
+        corsaro_log(logger,
+                "out of memory while interning report metric name.");
+        free(name->metrictype);
+        free(name->metricval);
+        free(name);
+        return NULL;
+    }
+    name->typelen = strlen(metrictype);
+    name->vallen = strlen(metricval);
+
+    JLI(pval, m->metric_names, metricid);
+    *pval = (Word_t)name;
+    return name;
+}
+
+/** Frees any unique IP sketches that belong to a report plugin result.
+ *
+ *  @param r        The result to free the sketches for
+ */
+static inline void free_result_sketches(corsaro_report_result_t *r) {
+    free(r->src_hll);
+    free(r->dst_hll);
+}
+
+/** Checks whether a result lives in the dense result array, in which case
+ *  it is owned by the merge state and must not be freed after writing.
+ *
+ *  @param m        The merge thread state for this plugin
+ *  @param r        The result to check
+ *  @return true if the result is a dense result, false otherwise.
+ */
+static inline bool is_dense_result(corsaro_report_merge_state_t *m,
+        corsaro_report_result_t *r) {
+    return (m->dense && r >= m->dense && r < m->dense + m->densecount);
+}
+
+/** Frees a sparse result once it has been written. Dense results are
+ *  left alone, as they are reset at the start of the next interval.
+ *
+ *  @param m        The merge thread state for this plugin
+ *  @param r        The result to free
+ */
+static inline void release_written_result(corsaro_report_merge_state_t *m,
+        corsaro_report_result_t *r) {
+    Word_t judyret;
+
+    if (is_dense_result(m, r)) {
+        return;
+    }
+    J1FA(judyret, r->uniq_src_asns);
+    J1FA(judyret, r->uniq_src_ipset);
+    J1FA(judyret, r->uniq_dst_ipset);
+    free_result_sketches(r);
+    free(r);
+}
+
+/** Returns the next result for an interval in metric ID order.
+ *
+ *  @param it       The result iterator
+ *  @return the next result, or NULL if all results have been returned.
+ */
+static corsaro_report_result_t *next_interval_result(
+        corsaro_report_result_iter_t *it) {
+
+    corsaro_report_result_t *dense = NULL, *r;
+
+    if (it->nextdense < it->m->densecount) {
+        dense = &(it->m->dense[it->nextdense]);
+    }
+
+    /* Dense and sparse metric IDs never overlap, so whichever is lower
+     * comes next */
+    if (dense && (it->pval == NULL || dense->metricid < it->index)) {
+        it->nextdense ++;
+        return dense;
+    }
+
+    if (it->pval == NULL) {
+        return NULL;
+    }
+
+    r = (corsaro_report_result_t *)(*(it->pval));
+    JLN(it->pval, *(it->sparse), it->index);
+    return r;
+}
+
+/** Starts iterating over the results for an interval.
+ *
+ *  @param it       The result iterator to initialise
+ *  @param m        The merge thread state for this plugin
+ *  @param results  The Judy array containing the sparse results
+ *  @return the first result, or NULL if there are no results.
+ */
+static corsaro_report_result_t *first_interval_result(
+        corsaro_report_result_iter_t *it, corsaro_report_merge_state_t *m,
+        Pvoid_t *results) {
+
+    it->m = m;
+    it->sparse = results;
+    it->index = 0;
+    it->nextdense = 0;
+    JLF(it->pval, *results, it->index);
+    return next_interval_result(it);
+}
+
+/** Encodes a report result directly into an Avro record and appends it
+ *  to the Avro output file.
  *
- *  @return a populated avro_value_t that contains the labels, tallies, etc.
- *          from the given result structure.
+ *  @param writer       The corsaro Avro writer that will be writing the output
+ *  @param res          The report plugin result to be written.
+ *  @param name         The interned metric name for the result.
+ *  @param labellen     The length of the result's source label.
+ *  @return 0 if successful, -1 if the result could not be encoded.
  */
-static inline int report_result_to_avro(corsaro_logger_t *logger,
-        avro_value_t *av, void *repres) {
-
-    avro_value_t field;
-    corsaro_report_result_t *res = (corsaro_report_result_t *)repres;
-
-    CORSARO_AVRO_SET_FIELD(long, av, field, 0, "bin_timestamp", "report",
-            res->attimestamp);
-    CORSARO_AVRO_SET_FIELD(string, av, field, 1, "source_label", "report",
-            res->label);
-    CORSARO_AVRO_SET_FIELD(string, av, field, 2, "metric_name", "report",
-            res->metrictype);
-    CORSARO_AVRO_SET_FIELD(string, av, field, 3, "metric_value", "report",
-            res->metricval);
-    CORSARO_AVRO_SET_FIELD(long, av, field, 4, "src_ip_cnt", "report",
-            res->uniq_src_ips);
-    CORSARO_AVRO_SET_FIELD(long, av, field, 5, "dest_ip_cnt", "report",
-            res->uniq_dst_ips);
-    CORSARO_AVRO_SET_FIELD(long, av, field, 6, "pkt_cnt", "report",
-            res->pkt_cnt);
-    CORSARO_AVRO_SET_FIELD(long, av, field, 7, "byte_cnt", "report",
-            res->bytes);
-    CORSARO_AVRO_SET_FIELD(long, av, field, 8, "src_asn_cnt", "report",
-            res->uniq_src_asn_count);
+static inline int encode_report_result_avro(corsaro_avro_writer_t *writer,
+        corsaro_report_result_t *res, corsaro_report_metric_name_t *name,
+        uint32_t labellen) {
+
+    const char *method = REPORT_IP_CNT_EXACT;
+
+    if (res->src_hll || res->dst_hll) {
+        method = REPORT_IP_CNT_HLL;
+    }
+
+    if (corsaro_start_avro_encoding(writer) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(res->attimestamp), sizeof(res->attimestamp)) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                res->label, labellen) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                name->metrictype, name->typelen) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                name->metricval, name->vallen) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(res->uniq_src_ips), sizeof(res->uniq_src_ips)) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(res->uniq_dst_ips), sizeof(res->uniq_dst_ips)) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(res->pkt_cnt), sizeof(res->pkt_cnt)) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(res->bytes), sizeof(res->bytes)) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_LONG,
+                &(res->uniq_src_asn_count),
+                sizeof(res->uniq_src_asn_count)) < 0) {
+        return -1;
+    }
+
+    if (corsaro_encode_avro_field(writer, CORSARO_AVRO_STRING,
+                (void *)method, strlen(method)) < 0) {
+        return -1;
+    }
     return 0;
 }
 
@@ -407,20 +698,22 @@ static inline int derive_libts_keyname(corsaro_plugin_t *p,
 
     int ret;
     corsaro_report_config_t *config = (corsaro_report_config_t *)p->config;
+    corsaro_report_metric_name_t *name;
 
-    if (metric_to_strings(m, res) < 0) {
+    name = get_metric_name(m, p->logger, res->metricid);
+    if (name == NULL) {
         return -1;
     }
 
     /* 'overall' metrics have no suitable metric value, so we need to
      * account for this case.
      */
-    if (strlen(res->metricval) > 0) {
+    if (name->vallen > 0) {
         ret = snprintf(keyspace, keylen, "%s.%s.%s",
-                config->outlabel, res->metrictype, res->metricval);
+                config->outlabel, name->metrictype, name->metricval);
     } else {
         ret = snprintf(keyspace, keylen, "%s.%s",
-                config->outlabel, res->metrictype);
+                config->outlabel, name->metrictype);
     }
 
     if (ret >= keylen) {
@@ -438,28 +731,32 @@ static inline int derive_libts_keyname(corsaro_plugin_t *p,
 /** Convert a report result into an Avro record and write it to the Avro
  *  output file.
  *
+ *  @param m            The local state for the merging thread.
  *  @param logger       A reference to a corsaro logger for error reporting
  *  @param writer       The corsaro Avro writer that will be writing the output
  *  @param res          The report plugin result to be written.
+ *  @param labellen     The length of the result's source label.
  *  @return 0 if the write is successful, < 0 if an error occurs.
  */
 static int write_single_metric_avro(corsaro_report_merge_state_t *m,
         corsaro_logger_t *logger,
-        corsaro_avro_writer_t *writer, corsaro_report_result_t *res) {
+        corsaro_avro_writer_t *writer, corsaro_report_result_t *res,
+        uint32_t labellen) {
 
-    avro_value_t *avro;
+    corsaro_report_metric_name_t *name;
 
-    if (metric_to_strings(m, res) < 0) {
+    name = get_metric_name(m, logger, res->metricid);
+    if (name == NULL) {
         return AVRO_MISSING_LABEL;
     }
-    avro = corsaro_populate_avro_item(writer, res, report_result_to_avro);
-    if (avro == NULL) {
+
+    if (encode_report_result_avro(writer, res, name, labellen) < 0) {
         corsaro_log(logger,
                 "could not convert report result to Avro record");
         return AVRO_CONVERSION_FAILURE;
     }
 
-    if (corsaro_append_avro_writer(writer, avro) < 0) {
+    if (corsaro_append_avro_writer(writer, NULL) < 0) {
         corsaro_log(logger,
                 "could not write report result to Avro output file");
         return AVRO_WRITE_FAILURE;
@@ -483,15 +780,19 @@ static int write_all_metrics_avro(corsaro_logger_t *logger,
         corsaro_report_merge_state_t *m, uint32_t subtreemask) {
 
     corsaro_report_result_t *r;
+    corsaro_report_result_iter_t it;
     int writeret = 0;
     int stopwriting = 0;
     int haderror = 0;
-    Word_t index = 0, judyret;
-    PWord_t pval;
+    Word_t judyret;
+    uint32_t labellen = 0;
 
-    JLF(pval, *resultmap, index);
-    while (pval) {
-        r = (corsaro_report_result_t *)(*pval);
+    for (r = first_interval_result(&it, m, resultmap); r != NULL;
+            r = next_interval_result(&it)) {
+
+        if (labellen == 0 && r->label) {
+            labellen = strlen(r->label);
+        }
 
         /* Don't write metrics for sub-trees that have never been
          * looked at by the upstream tagger, e.g. if we have no
@@ -499,8 +800,7 @@ static int write_all_metrics_avro(corsaro_logger_t *logger,
          * country.
          */
         if ((subtreemask & (1 << (r->metricid >> 32))) == 0) {
-            free(r);
-            JLN(pval, *resultmap, index);
+            release_written_result(m, r);
             continue;
         }
 
@@ -508,7 +808,8 @@ static int write_all_metrics_avro(corsaro_logger_t *logger,
          * anymore.
          */
         if (!stopwriting) {
-            writeret = write_single_metric_avro(m, logger, writer, r);
+            writeret = write_single_metric_avro(m, logger, writer, r,
+                    labellen);
             if (writeret == AVRO_WRITE_FAILURE) {
                 stopwriting = 1;
             }
@@ -516,10 +817,7 @@ static int write_all_metrics_avro(corsaro_logger_t *logger,
                 haderror = 1;
             }
         }
-        J1FA(judyret, r->uniq_src_asns);
-        free(r);
-
-        JLN(pval, *resultmap, index);
+        release_written_result(m, r);
     }
 
     JLFA(judyret, *resultmap);
@@ -544,14 +842,13 @@ static int report_write_libtimeseries(corsaro_plugin_t *p,
         uint32_t subtreemask)
 {
     corsaro_report_result_t *r;
-    Word_t index = 0, judyret;
+    corsaro_report_result_iter_t it;
+    Word_t judyret;
     PWord_t pval;
 
-    JLF(pval, *results, index);
-
     /* Iterate over all of the metrics in our array */
-    while (pval) {
-        r = (corsaro_report_result_t *)(*pval);
+    for (r = first_interval_result(&it, m, results); r != NULL;
+            r = next_interval_result(&it)) {
 
         /* Don't write metrics for sub-trees that have never been
          * looked at by the upstream tagger, e.g. if we have no
@@ -559,9 +856,7 @@ static int report_write_libtimeseries(corsaro_plugin_t *p,
          * country.
          */
         if ((subtreemask & (1 << (r->metricid >> 32))) == 0) {
-            J1FA(judyret, r->uniq_src_asns);
-            free(r);
-            JLN(pval, *results, index);
+            release_written_result(m, r);
             continue;
         }
 
@@ -575,11 +870,7 @@ static int report_write_libtimeseries(corsaro_plugin_t *p,
             int keyid = -1;
 
             if (derive_libts_keyname(p, m, keyname, 4096, r) <= 0) {
-                J1FA(judyret, r->uniq_src_asns);
-                J1FA(judyret, r->uniq_src_ipset);
-                J1FA(judyret, r->uniq_dst_ipset);
-                free(r);
-                JLN(pval, *results, index);
+                release_written_result(m, r);
                 continue;
             }
 
@@ -618,11 +909,7 @@ static int report_write_libtimeseries(corsaro_plugin_t *p,
         }
 
 
-        J1FA(judyret, r->uniq_src_asns);
-        J1FA(judyret, r->uniq_src_ipset);
-        J1FA(judyret, r->uniq_dst_ipset);
-        free(r);
-        JLN(pval, *results, index);
+        release_written_result(m, r);
     }
 
     /* Flush all of our results for this interval to the backends */
@@ -683,6 +970,7 @@ static void clean_result_map(Pvoid_t *resultmap) {
         J1FA(judyret, r->uniq_src_asns);
         J1FA(judyret, r->uniq_src_ipset);
         J1FA(judyret, r->uniq_dst_ipset);
+        free_result_sketches(r);
         free(r);
         JLN(pval, *resultmap, index);
     }
@@ -713,10 +1001,10 @@ static inline corsaro_report_result_t *new_result(uint64_t metricid,
     r->uniq_src_asns = NULL;
     r->uniq_src_ipset = NULL;
     r->uniq_dst_ipset = NULL;
+    r->src_hll = NULL;
+    r->dst_hll = NULL;
     r->attimestamp = ts;
     r->label = outlabel;
-    r->metrictype[0] = '\0';
-    r->metricval[0] = '\0';
     return r;
 }
 
@@ -733,52 +1021,76 @@ static inline bool is_port_allowed(uint8_t *portarray, uint16_t portnum) {
 }
 
 
-/** Initialises a results array with zeroes for as many metrics as
- *  we can, so we are still able to write a valid value even if the metric
- *  is not observed within an interval.
+static int compare_metricids(const void *a, const void *b) {
+    uint64_t x = *((const uint64_t *)a);
+    uint64_t y = *((const uint64_t *)b);
+
+    if (x < y) {
+        return -1;
+    }
+    if (x > y) {
+        return 1;
+    }
+    return 0;
+}
+
+/** Creates the dense result array, which holds a result for each metric
+ *  that we always want to report so we are still able to write a valid
+ *  value even if the metric is not observed within an interval.
+ *
+ *  The array is sorted by metric ID and is re-used for every interval,
+ *  rather than re-creating all of these empty results each time.
  *
  *  @param p            A reference to the running instance of the report plugin
- *  @param results      The Judy array that will be used to store the tallies
- *  @param ts           The timestamp for the current interval
+ *  @param m            The merge thread state for this plugin
  *
  *  @return -1 if an error occurs, 0 otherwise.
  */
-static int initialise_results(corsaro_plugin_t *p, Pvoid_t *results,
-        uint32_t ts) {
+static int build_dense_results(corsaro_plugin_t *p,
+        corsaro_report_merge_state_t *m) {
 
-    uint64_t metricid, i;
-    Word_t *pval;
-    corsaro_report_result_t *r;
+    uint64_t *metricids;
+    uint64_t i, metricclass, metricval;
+    uint32_t count = 0, maxcount, j;
     corsaro_report_config_t *conf;
 
     conf = (corsaro_report_config_t *)(p->config);
 
-    ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_COMBINED, 0);
+    maxcount = 1 + METRIC_IPPROTOS_MAX + (4 * METRIC_PORT_MAX) +
+            (2 * CORSAROTRACE_NUM_CONTINENTS) +
+            (2 * CORSAROTRACE_NUM_COUNTRIES);
+    metricids = (uint64_t *)calloc(maxcount, sizeof(uint64_t));
+    if (metricids == NULL) {
+        corsaro_log(p->logger,
+                "out of memory while allocating dense report results.");
+        return -1;
+    }
+
+    ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_COMBINED, 0);
 
     /* IP protocols */
     for (i = 0; i < METRIC_IPPROTOS_MAX; i++) {
-        ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_IP_PROTOCOL, i);
+        ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_IP_PROTOCOL, i);
     }
 
-    /* TCP and UDP ports, ICMP type+code */
+    /* TCP and UDP ports */
     for (i = 0; i < METRIC_PORT_MAX; i++) {
         if (is_port_allowed(conf->allowedports.tcp_sources, i)) {
-            ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_TCP_SOURCE_PORT, i);
+            ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_TCP_SOURCE_PORT, i);
         }
 
         if (is_port_allowed(conf->allowedports.tcp_dests, i)) {
-            ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_TCP_DEST_PORT, i);
+            ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_TCP_DEST_PORT, i);
         }
 
         if (is_port_allowed(conf->allowedports.udp_sources, i)) {
-            ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_UDP_SOURCE_PORT, i);
+            ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_UDP_SOURCE_PORT, i);
         }
 
         if (is_port_allowed(conf->allowedports.udp_dests, i)) {
-            ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_UDP_DEST_PORT, i);
+            ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_UDP_DEST_PORT, i);
         }
         // AK: only create ICMP metrics when they are seen
-        // ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_ICMP_TYPECODE, i);
     }
 
     /* XXX Do NOT add empty results for filters, as they may or
@@ -788,68 +1100,228 @@ static int initialise_results(corsaro_plugin_t *p, Pvoid_t *results,
 
     /* Continents */
     for (i = 0; i < CORSAROTRACE_NUM_CONTINENTS; i++) {
-        ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_MAXMIND_CONTINENT,
+        ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_MAXMIND_CONTINENT,
                 (((uint64_t)alpha2_continents[i][0]) |
                  ((uint64_t)alpha2_continents[i][1]) << 8));
-        ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_NETACQ_CONTINENT,
+        ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_NETACQ_CONTINENT,
                 (((uint64_t)alpha2_continents[i][0]) |
                  ((uint64_t)alpha2_continents[i][1]) << 8));
     }
 
     /* Countries */
     for (i = 0; i < CORSAROTRACE_NUM_COUNTRIES; i++) {
-        ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_MAXMIND_COUNTRY,
+        ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_MAXMIND_COUNTRY,
                 (((uint64_t)alpha2_countries[i][0]) |
                  ((uint64_t)alpha2_countries[i][1]) << 8));
-        ADD_EMPTY_RESULT(CORSARO_METRIC_CLASS_NETACQ_COUNTRY,
+        ADD_DENSE_METRIC(CORSARO_METRIC_CLASS_NETACQ_COUNTRY,
                 (((uint64_t)alpha2_countries[i][0]) |
                  ((uint64_t)alpha2_countries[i][1]) << 8));
     }
 
+    /* Results are written in metric ID order, so keep the dense array
+     * in that order too */
+    qsort(metricids, count, sizeof(uint64_t), compare_metricids);
+
+    m->densemetricids = metricids;
+    m->densecount = 0;
+    m->dense = (corsaro_report_result_t *)calloc(count > 0 ? count : 1,
+            sizeof(corsaro_report_result_t));
+    if (m->dense == NULL) {
+        corsaro_log(p->logger,
+                "out of memory while allocating dense report results.");
+        return -1;
+    }
+
+    for (j = 0; j < count; j++) {
+        if (m->densecount > 0 &&
+                metricids[m->densecount - 1] == metricids[j]) {
+            continue;
+        }
+        metricids[m->densecount] = metricids[j];
+
+        metricclass = metricids[j] >> 32;
+        metricval = metricids[j] & 0xffffffff;
+        if (m->denseindex[metricclass] == NULL) {
+            m->denseindex[metricclass] = (int32_t *)malloc(
+                    REPORT_DENSE_VALUE_MAX * sizeof(int32_t));
+            if (m->denseindex[metricclass] == NULL) {
+                corsaro_log(p->logger,
+                        "out of memory while allocating dense report results.");
+                return -1;
+            }
+            memset(m->denseindex[metricclass], 0xff,
+                    REPORT_DENSE_VALUE_MAX * sizeof(int32_t));
+        }
+        assert(metricval < REPORT_DENSE_VALUE_MAX);
+        m->denseindex[metricclass][metricval] = m->densecount;
+        m->densecount ++;
+    }
 
     return 0;
 }
 
-static void update_merged_metric(Pvoid_t *results,
-        corsaro_metric_ip_hash_t *iphash, corsaro_report_config_t *conf,
-        uint64_t metricid, uint32_t ts, uint32_t *subtrees_seen,
-        int freereq) {
-
+/** Frees any IP sets and sketches that were attached to the dense results
+ *  while tallying an interval.
+ *
+ *  @param m            The merge thread state for this plugin
+ */
+static void clear_dense_results(corsaro_report_merge_state_t *m) {
     corsaro_report_result_t *r;
-    PWord_t pval;
-    Word_t index = 0, ret;
+    Word_t judyret;
+    uint32_t i;
+
+    for (i = 0; i < m->densecount; i++) {
+        r = &(m->dense[i]);
+        J1FA(judyret, r->uniq_src_asns);
+        J1FA(judyret, r->uniq_src_ipset);
+        J1FA(judyret, r->uniq_dst_ipset);
+        free_result_sketches(r);
+        r->src_hll = NULL;
+        r->dst_hll = NULL;
+    }
+}
+
+/** Resets the dense results so they can be used to tally a new interval.
+ *
+ *  @param m            The merge thread state for this plugin
+ *  @param outlabel     The additional label to append to each result.
+ *  @param ts           The timestamp for the new interval
+ */
+static void reset_dense_results(corsaro_report_merge_state_t *m,
+        char *outlabel, uint32_t ts) {
+
+    uint32_t i;
+
+    clear_dense_results(m);
+    memset(m->dense, 0, m->densecount * sizeof(corsaro_report_result_t));
+
+    for (i = 0; i < m->densecount; i++) {
+        m->dense[i].metricid = m->densemetricids[i];
+        m->dense[i].attimestamp = ts;
+        m->dense[i].label = outlabel;
+    }
+}
+
+/** Finds the dense result slot for a metric.
+ *
+ *  @param m            The merge thread state for this plugin
+ *  @param metricid     The ID of the metric to look up
+ *  @return a pointer to the dense result for the metric, or NULL if the
+ *          metric does not have a dense result.
+ */
+static inline corsaro_report_result_t *lookup_dense_result(
+        corsaro_report_merge_state_t *m, uint64_t metricid) {
+
+    uint64_t metricclass = metricid >> 32;
+    uint64_t metricval = metricid & 0xffffffff;
+    int32_t slot;
+
+    if (metricclass >= CORSARO_METRIC_CLASS_LAST ||
+            m->denseindex[metricclass] == NULL ||
+            metricval >= REPORT_DENSE_VALUE_MAX) {
+        return NULL;
+    }
+
+    slot = m->denseindex[metricclass][metricval];
+    if (slot < 0) {
+        return NULL;
+    }
+    return &(m->dense[slot]);
+}
+
+/** Merges the unique IPs that one IP tracker saw for a metric into the
+ *  combined unique IP count for that metric.
+ *
+ *  Once any tracker has fallen back to a sketch for the metric, every
+ *  exact address is also added to a combined sketch and the count becomes
+ *  the estimate of that sketch. Adding a sketch estimate to the exact
+ *  count instead would count an address twice whenever it was tracked
+ *  exactly by one tracker and sketched by another, which happens as soon
+ *  as several inputs are merged into the same interval.
+ *
+ *  @param resset       The set of exact unique IPs for the merged result
+ *  @param reshll       The combined sketch for the merged result, which
+ *                      is created the first time a tracker sketch arrives
+ *  @param rescount     The unique IP count for the merged result
+ *  @param trkset       The set of exact unique IPs from the tracker
+ *  @param trkhll       The sketch of unique IPs from the tracker (may be
+ *                      NULL if the tracker counted the metric exactly)
+ *  @return 0 if successful, -1 if the combined sketch could not be
+ *          allocated.
+ */
+static int merge_unique_ips(Pvoid_t *resset, uint8_t **reshll,
+        uint32_t *rescount, Pvoid_t trkset, uint8_t *trkhll) {
+
+    Word_t index = 0;
     int x;
 
-    *subtrees_seen = (*subtrees_seen) | (1 << (metricid >> 32));
+    if (trkhll && *reshll == NULL) {
+        *reshll = calloc(REPORT_HLL_REGISTERS, sizeof(uint8_t));
+        if (*reshll == NULL) {
+            return -1;
+        }
 
-    JLG(pval, *results, metricid);
-    if (pval == NULL) {
-        /* This is a new metric, add it to our result hash map */
-        r = new_result(metricid, conf->outlabel, ts);
-        JLI(pval, *results, metricid);
-        *pval = (Word_t)r;
-    } else {
-        r = (corsaro_report_result_t *)(*pval);
+        /* Fold in the exact addresses we have already counted */
+        J1F(x, *resset, index);
+        while (x) {
+            corsaro_hll_add(*reshll, REPORT_HLL_BITS, (uint32_t)index);
+            J1N(x, *resset, index);
+        }
     }
 
     index = 0;
-    J1F(x, iphash->srcips, index);
+    J1F(x, trkset, index);
     while (x) {
-        J1S(x, r->uniq_src_ipset, (Word_t)index);
+        J1S(x, *resset, (Word_t)index);
         if (x != 0) {
-            r->uniq_src_ips ++;
+            (*rescount) ++;
+            if (*reshll) {
+                corsaro_hll_add(*reshll, REPORT_HLL_BITS, (uint32_t)index);
+            }
         }
-        J1N(x, iphash->srcips, index);
+        J1N(x, trkset, index);
     }
 
-    index = 0;
-    J1F(x, iphash->destips, index);
-    while (x) {
-        J1S(x, r->uniq_dst_ipset, (Word_t)index);
-        if (x != 0) {
-            r->uniq_dst_ips ++;
+    if (*reshll) {
+        if (trkhll) {
+            corsaro_hll_merge(*reshll, trkhll, REPORT_HLL_BITS);
         }
-        J1N(x, iphash->destips, index);
+        *rescount = corsaro_hll_estimate(*reshll, REPORT_HLL_BITS);
+    }
+    return 0;
+}
+
+static void update_merged_metric(corsaro_report_merge_state_t *m,
+        Pvoid_t *results, corsaro_metric_ip_hash_t *iphash, corsaro_report_config_t *conf,
+        uint64_t metricid, uint32_t ts, uint32_t *subtrees_seen,
+        int freereq, corsaro_logger_t *logger) {
+
+    corsaro_report_result_t *r;
+    PWord_t pval;
+    Word_t index = 0, ret;
+    int x;
+
+    *subtrees_seen = (*subtrees_seen) | (1 << (metricid >> 32));
+
+    r = lookup_dense_result(m, metricid);
+    if (r == NULL) {
+        JLG(pval, *results, metricid);
+        if (pval == NULL) {
+            /* This is a new metric, add it to our result hash map */
+            r = new_result(metricid, conf->outlabel, ts);
+            JLI(pval, *results, metricid);
+            *pval = (Word_t)r;
+        } else {
+            r = (corsaro_report_result_t *)(*pval);
+        }
+    }
+
+    if (merge_unique_ips(&(r->uniq_src_ipset), &(r->src_hll),
+                &(r->uniq_src_ips), iphash->srcips, iphash->srchll) < 0 ||
+            merge_unique_ips(&(r->uniq_dst_ipset), &(r->dst_hll),
+                &(r->uniq_dst_ips), iphash->destips, iphash->dsthll) < 0) {
+        corsaro_log(logger,
+                "out of memory while merging unique IP sketches, unique IP counts for this interval will be too low");
     }
 
     /* Consider limiting this to only certain metrics if processing
@@ -876,6 +1348,10 @@ static void update_merged_metric(Pvoid_t *results,
     if (freereq) {
         J1FA(ret, iphash->srcips);
         J1FA(ret, iphash->destips);
+        free(iphash->srchll);
+        free(iphash->dsthll);
+        iphash->srchll = NULL;
+        iphash->dsthll = NULL;
     }
 }
 
@@ -885,15 +1361,21 @@ static void update_merged_metric(Pvoid_t *results,
  *  @param results          The hash map containing the combined metric tallies.
  *  @param tracker          The IP tracker thread which is providing new
  *                          tallies for our merged result.
+ *  @param maps             The completed tallies, which are freed once they
+ *                          have been merged.
  *  @param ts               The timestamp of the interval which this tally
  *                          applies to.
  *  @param conf             The global configuration for this report plugin.
+ *  @param degraded         Set to 1 if the tracker had to estimate any
+ *                          of its unique IP counts for this interval.
  *  @param logger       A reference to a corsaro logger for error reporting.
  */
-static void update_tracker_results(Pvoid_t *results,
-        corsaro_report_iptracker_t *tracker, uint32_t ts,
+static void update_tracker_results(corsaro_report_merge_state_t *m,
+        Pvoid_t *results,
+        corsaro_report_iptracker_t *tracker,
+        corsaro_report_iptracker_maps_t *maps, uint32_t ts,
         corsaro_report_config_t *conf,  uint32_t *subtrees_seen,
-        corsaro_logger_t *logger) {
+        uint8_t *degraded, corsaro_logger_t *logger) {
 
     corsaro_metric_ip_hash_t *iter;
     PWord_t pval;
@@ -905,38 +1387,38 @@ static void update_tracker_results(Pvoid_t *results,
      * combined metric map.
      */
 
-    assert(tracker->prev_maps != NULL);
+    assert(maps != NULL);
     if (IS_METRIC_ALLOWED(tracker->allowedmetricclasses,
             CORSARO_METRIC_CLASS_COMBINED)) {
         metid = CORSARO_METRIC_CLASS_COMBINED;
         metid = (metid << 32);
-        update_merged_metric(results, &(tracker->prev_maps->combined), conf,
-                metid, ts, subtrees_seen, 1);
+        update_merged_metric(m, results, &(maps->combined), conf,
+                metid, ts, subtrees_seen, 1, logger);
     }
 
-    if (tracker->prev_maps->ipprotocols) {
+    if (maps->ipprotocols) {
         metid = CORSARO_METRIC_CLASS_IP_PROTOCOL;
         metid = (metid << 32);
         for (i = 0; i < 256; i++) {
-            update_merged_metric(results, &(tracker->prev_maps->ipprotocols[i]),
-                    conf, (metid | i), ts, subtrees_seen, 1);
+            update_merged_metric(m, results, &(maps->ipprotocols[i]),
+                    conf, (metid | i), ts, subtrees_seen, 1, logger);
         }
-        free(tracker->prev_maps->ipprotocols);
+        free(maps->ipprotocols);
     }
 
-    if (tracker->prev_maps->filters) {
+    if (maps->filters) {
         metid = CORSARO_METRIC_CLASS_FILTER_CRITERIA;
         metid = (metid << 32);
         for (i = CORSARO_FILTERID_ABNORMAL_PROTOCOL; i < CORSARO_FILTERID_MAX;
                 i++) {
-            update_merged_metric(results,
-                    &(tracker->prev_maps->filters[i]), conf, (metid | i), ts,
-                    subtrees_seen, 1);
+            update_merged_metric(m, results,
+                    &(maps->filters[i]), conf, (metid | i), ts,
+                    subtrees_seen, 1, logger);
         }
-        free(tracker->prev_maps->filters);
+        free(maps->filters);
     }
 
-    JLF(pval, tracker->prev_maps->general, index);
+    JLF(pval, maps->general, index);
     while (pval) {
         iter = (corsaro_metric_ip_hash_t *)(*pval);
 
@@ -946,22 +1428,81 @@ static void update_tracker_results(Pvoid_t *results,
                 break;
             }
 
-            update_merged_metric(results, iter, conf,
-                    iter->associated_metricids[i], ts, subtrees_seen, 0);
+            update_merged_metric(m, results, iter, conf,
+                    iter->associated_metricids[i], ts, subtrees_seen, 0, logger);
         }
 
-        update_merged_metric(results, iter, conf, iter->metricid, ts,
-                subtrees_seen, 1);
+        update_merged_metric(m, results, iter, conf, iter->metricid, ts,
+                subtrees_seen, 1, logger);
         free(iter);
 
-        JLN(pval, tracker->prev_maps->general, index);
+        JLN(pval, maps->general, index);
     }
 
-    JLFA(ret, tracker->prev_maps->general);
-    free(tracker->prev_maps);
-    tracker->prev_maps = NULL;
+    JLFA(ret, maps->general);
+    if (maps->sketches > 0) {
+        *degraded = 1;
+    }
+    corsaro_mem_budget_release(tracker->conf->budget,
+            maps->memcharged);
+    free(maps);
 }
 
+/** Collects the completed tallies for an interval from an IP tracker
+ *  thread, if the tracker has finished with that interval.
+ *
+ *  The caller must be holding the tracker's mutex.
+ *
+ *  @param results          The hash map containing the combined metric tallies.
+ *  @param tracker          The IP tracker thread to collect tallies from.
+ *  @param ts               The timestamp of the interval being merged.
+ *  @param conf             The global configuration for this report plugin.
+ *  @param subtrees_seen    Updated to include any IPmeta subtrees that
+ *                          appear in the collected tallies.
+ *  @param degraded         Set to 1 if the tracker had to estimate any
+ *                          of its unique IP counts for this interval.
+ *  @param logger           A reference to a corsaro logger for error reporting.
+ *  @return 1 if the tallies were collected, 0 if the tracker has not finished
+ *          the interval yet, -1 if the tracker will never produce tallies
+ *          for this interval.
+ */
+static int collect_tracker_tallies(corsaro_report_merge_state_t *m,
+        Pvoid_t *results,
+        corsaro_report_iptracker_t *tracker, uint32_t ts,
+        corsaro_report_config_t *conf, uint32_t *subtrees_seen,
+        uint8_t *degraded, corsaro_logger_t *logger) {
+
+    corsaro_report_tracker_result_t *head, popped;
+
+    while (tracker->completed->head) {
+        head = (corsaro_report_tracker_result_t *)
+                (tracker->completed->head->data);
+        if (head->interval_ts > ts) {
+            /* Tracker has already moved on to a later interval */
+            return -1;
+        }
+
+        libtrace_list_pop_front(tracker->completed, (void *)(&popped));
+        pthread_cond_signal(&(tracker->collected));
+        if (popped.interval_ts == ts) {
+            update_tracker_results(m, results, tracker, popped.maps, ts, conf,
+                    subtrees_seen, degraded, logger);
+            return 1;
+        }
+
+        /* Tally for an earlier interval that we are never going to merge */
+        free_map_set(popped.maps, tracker->conf->budget);
+    }
+
+    if (tracker->lastresultts >= ts || tracker->haltphase == 2) {
+        /* Either the tracker was interrupted, or it has been halted and
+         * no new results are coming... */
+        return -1;
+    }
+    return 0;
+}
+
+
 
 /** Creates and initialises the internal state required by the merging thread
  *  when using the report plugin.
@@ -1042,6 +1583,13 @@ void *corsaro_report_init_merging(corsaro_plugin_t *p, int sources) {
     m->country_labels = (Pvoid_t) NULL;
     m->region_labels = (Pvoid_t) NULL;
     m->polygon_labels = (Pvoid_t) NULL;
+    m->metric_names = (Pvoid_t) NULL;
+    m->labels_changed = 0;
+
+    if (build_dense_results(p, m) < 0) {
+        corsaro_report_halt_merging(p, m);
+        return NULL;
+    }
 
     return m;
 }
@@ -1056,6 +1604,7 @@ void *corsaro_report_init_merging(corsaro_plugin_t *p, int sources) {
 int corsaro_report_halt_merging(corsaro_plugin_t *p, void *local) {
     corsaro_report_merge_state_t *m;
     Word_t judyret;
+    int i;
 
     m = (corsaro_report_merge_state_t *)local;
     if (m == NULL) {
@@ -1078,6 +1627,16 @@ int corsaro_report_halt_merging(corsaro_plugin_t *p, void *local) {
     corsaro_free_ipmeta_label_map(m->country_labels, 1);
     corsaro_free_ipmeta_label_map(m->region_labels, 1);
     corsaro_free_ipmeta_label_map(m->polygon_labels, 1);
+    free_metric_names(&(m->metric_names));
+
+    if (m->dense) {
+        clear_dense_results(m);
+        free(m->dense);
+    }
+    free(m->densemetricids);
+    for (i = 0; i < CORSARO_METRIC_CLASS_LAST; i++) {
+        free(m->denseindex[i]);
+    }
 
     free(m);
     return 0;
@@ -1129,6 +1688,7 @@ static uint16_t process_single_label_update(
 			labellen);
 
 	index = ntohl(hdr->subject_id);
+	state->labels_changed = 1;
 
 	if (hdr->subject_type == TAGGER_LABEL_COUNTRY) {
 		INSERT_IPMETA_LABEL(state->country_labels, index, labelstr);
@@ -1265,11 +1825,12 @@ int corsaro_report_merge_interval_results(corsaro_plugin_t *p, void *local,
         void **tomerge, corsaro_fin_interval_t *fin, void *tagsock) {
 
     corsaro_report_config_t *conf, *procconf;
+    corsaro_report_config_t **procconfs;
     corsaro_report_merge_state_t *m;
-    int i, reloadsock = 0;
+    int i, j, c, confcount = 0, collected, reloadsock = 0;
     Pvoid_t results = NULL;
     uint8_t *trackers_done;
-    uint8_t totaldone = 0, skipresult = 0;
+    uint8_t totaldone = 0, skipresult = 0, degraded = 0;
     int mergeret;
 
     uint32_t subtrees_seen = 0;
@@ -1279,8 +1840,39 @@ int corsaro_report_merge_interval_results(corsaro_plugin_t *p, void *local,
         return CORSARO_MERGE_BAD_ARGUMENTS;
     }
 
-    /* Plugin result data is NULL, must be a partial interval */
-    if (tomerge[0] == NULL) {
+    /* Interim results from processing threads that were reading the same
+     * input all point at the same config, and therefore the same IP tracker
+     * threads. corsarotrace can run several offline inputs in parallel,
+     * each with its own plugin instance, so find every distinct config
+     * that contributed to this interval.
+     *
+     * Note that we can't use p->config to get at the IP trackers because
+     * the plugin instance 'p' does NOT point at the same plugin instance
+     * that was used to run the processing threads.
+     */
+    procconfs = (corsaro_report_config_t **)calloc(fin->threads_ended,
+            sizeof(corsaro_report_config_t *));
+    for (i = 0; i < fin->threads_ended; i++) {
+        corsaro_report_interim_t *interim;
+
+        /* Plugin result data is NULL, must be a partial interval */
+        if (tomerge[i] == NULL) {
+            continue;
+        }
+        interim = (corsaro_report_interim_t *)(tomerge[i]);
+        for (j = 0; j < confcount; j++) {
+            if (procconfs[j] == interim->baseconf) {
+                break;
+            }
+        }
+        if (j == confcount) {
+            procconfs[confcount] = interim->baseconf;
+            confcount ++;
+        }
+    }
+
+    if (confcount == 0) {
+        free(procconfs);
         return CORSARO_MERGE_NO_ACTION;
     }
 
@@ -1294,63 +1886,76 @@ int corsaro_report_merge_interval_results(corsaro_plugin_t *p, void *local,
         reloadsock = 1;
     }
 
-    /* All of the interim results should point at the same config, so we
-     * only care about tomerge[0].
-     *
-     * Note that we can't use p->config to get at the IP trackers because
-     * the plugin instance 'p' does NOT point at the same plugin instance
-     * that was used to run the processing threads.
+    /* Any geo-tagging metric names that we have interned may now be using
+     * stale labels, so re-derive them as they are needed.
      */
-    procconf = ((corsaro_report_interim_t *)(tomerge[0]))->baseconf;
+    if (m->labels_changed) {
+        forget_metric_class_names(&(m->metric_names),
+                CORSARO_METRIC_CLASS_MAXMIND_COUNTRY);
+        forget_metric_class_names(&(m->metric_names),
+                CORSARO_METRIC_CLASS_NETACQ_COUNTRY);
+        forget_metric_class_names(&(m->metric_names),
+                CORSARO_METRIC_CLASS_NETACQ_REGION);
+        forget_metric_class_names(&(m->metric_names),
+                CORSARO_METRIC_CLASS_NETACQ_POLYGON);
+        m->labels_changed = 0;
+    }
 
-    trackers_done = (uint8_t *)calloc(procconf->tracker_count, sizeof(uint8_t));
+    reset_dense_results(m, conf->outlabel, fin->timestamp);
 
-    if (initialise_results(p, &results, fin->timestamp) < 0) {
-        return CORSARO_MERGE_BAD_ARGUMENTS;
-    }
+    for (c = 0; c < confcount; c++) {
+        procconf = procconfs[c];
+        trackers_done = (uint8_t *)calloc(procconf->tracker_count,
+                sizeof(uint8_t));
+        totaldone = 0;
+        degraded = 0;
 
-    do {
-        /* The IP tracker threads may not have finished processing all of their
-         * outstanding updates for the interval just yet, so we need to
-         * keep polling until all of the trackers have finalised their
-         * results for this interval.
-         */
-        for (i = 0; i < procconf->tracker_count; i++) {
-            if (trackers_done[i]) {
-                continue;
-            }
+        do {
+            /* The IP tracker threads may not have finished processing all
+             * of their outstanding updates for the interval just yet, so we
+             * need to keep polling until all of the trackers have finalised
+             * their results for this interval.
+             */
+            for (i = 0; i < procconf->tracker_count; i++) {
+                if (trackers_done[i]) {
+                    continue;
+                }
 
-            /* If we can't get the lock, try another tracker thread */
-            if (pthread_mutex_trylock(&(procconf->iptrackers[i].mutex)) == 0) {
-                if (procconf->iptrackers[i].lastresultts > fin->timestamp) {
-                    trackers_done[i] = 1;
-                    totaldone ++;
-                    skipresult = 1;
-                } else if (procconf->iptrackers[i].lastresultts ==
-                        fin->timestamp) {
-                    update_tracker_results(&results, &(procconf->iptrackers[i]),
-                            fin->timestamp, conf, &subtrees_seen, p->logger);
-                    trackers_done[i] = 1;
-                    totaldone ++;
-                } else if (procconf->iptrackers[i].haltphase == 2) {
-                    /* Tracker thread has been halted, no new results are
-                     * coming... */
+                /* If we can't get the lock, try another tracker thread */
+                if (pthread_mutex_trylock(&(procconf->iptrackers[i].mutex))
+                        != 0) {
+                    continue;
+                }
+                collected = collect_tracker_tallies(m, &results,
+                        &(procconf->iptrackers[i]), fin->timestamp, conf,
+                        &subtrees_seen, &degraded, p->logger);
+                pthread_mutex_unlock(&(procconf->iptrackers[i].mutex));
+
+                if (collected != 0) {
                     trackers_done[i] = 1;
                     totaldone ++;
+                }
+                if (collected < 0) {
                     skipresult = 1;
                 }
-                pthread_mutex_unlock(&(procconf->iptrackers[i].mutex));
             }
-        }
-        /* Some tracker threads were either busy or still waiting for
-         * an interval end message, take a quick break then try again.
-         */
-        if (totaldone < procconf->tracker_count) {
-            usleep(100);
-        }
-    } while (totaldone < procconf->tracker_count);
+            /* Some tracker threads were either busy or still waiting for
+             * an interval end message, take a quick break then try again.
+             */
+            if (totaldone < procconf->tracker_count) {
+                usleep(100);
+            }
+        } while (totaldone < procconf->tracker_count);
 
-    free(trackers_done);
+        free(trackers_done);
+
+        if (degraded) {
+            corsaro_mem_budget_mark_interval(procconf->budget, p->logger,
+                    fin->timestamp,
+                    "unique IP counts for large sets were estimated using HyperLogLog");
+        }
+    }
+    free(procconfs);
 
     if (skipresult) {
         /* This result is invalid because not all of the tracker threads
@@ -1381,6 +1986,10 @@ int corsaro_report_merge_interval_results(corsaro_plugin_t *p, void *local,
         mergeret = CORSARO_MERGE_SUCCESS;
     }
 
+    /* Don't hang on to the IP sets for the dense results until the next
+     * interval begins */
+    clear_dense_results(m);
+
     for (i = 0; i < fin->threads_ended; i++) {
         free(tomerge[i]);
     }
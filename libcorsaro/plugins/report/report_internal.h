@@ -58,11 +58,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <math.h>
 #include <libipmeta.h>
 #include <zmq.h>
 
 #include <Judy.h>
 #include "libcorsaro_plugin.h"
+#include "libcorsaro_hll.h"
 
 /* XXX could make this configurable? */
 /** The number of IP tag updates to include in a single enqueued message
@@ -89,6 +91,29 @@
 /** Maximum number of IP tracker threads allowed */
 #define CORSARO_REPORT_MAX_IPTRACKERS (32)
 
+/** Maximum number of complete tallies that an IP tracker thread may have
+ *  waiting for the merging thread before it stops to wait for the merger */
+#define REPORT_MAX_QUEUED_TALLIES (4)
+
+/** Number of index bits used by the HyperLogLog sketches that replace exact
+ *  unique IP counting once the plugin exceeds its memory budget. 2^8
+ *  registers gives a standard error of roughly 6.5%.
+ */
+#define REPORT_HLL_BITS (8)
+
+/** Number of registers in each HyperLogLog sketch */
+#define REPORT_HLL_REGISTERS (1 << REPORT_HLL_BITS)
+
+/** Approximate memory cost of adding an address to an exact IP set, charged
+ *  against the plugin's memory budget */
+#define REPORT_IP_MEM_ESTIMATE (8)
+
+/** Once the memory budget has been exceeded, only unique IP sets that are
+ *  larger than this are replaced with sketches. A sketch costs about as
+ *  much as 32 exact addresses, so smaller sets are cheaper to keep exact.
+ */
+#define REPORT_HLL_DEGRADE_THRESHOLD (1024)
+
 /** Maximum depth of sub-classification for hierarchical metrics, e.g. geolocation metrics
  *  have a hierarchy of continent, country, region, county, ... etc
  */
@@ -173,6 +198,14 @@ typedef struct corsaro_metric_ip_hash_t {
     /** Unique source ASNs associated with this metric */
     Pvoid_t srcasns;
 
+    /** Sketch of the unique source IPs, used instead of srcips once the
+     *  memory budget has been exceeded and the set has grown too large */
+    uint8_t *srchll;
+
+    /** Sketch of the unique destination IPs, used instead of destips once
+     *  the memory budget has been exceeded and the set has grown too large */
+    uint8_t *dsthll;
+
     /** Number of packets that were tagged with this metric */
     uint32_t packets;
 
@@ -211,8 +244,30 @@ typedef struct corsaro_report_iptracker_maps {
     corsaro_metric_ip_hash_t *filters;
 
     Pvoid_t general;
+
+    /** Memory charged to the plugin's budget for this set of maps */
+    uint64_t memcharged;
+
+    /** Number of unique IP sets that have been replaced with sketches */
+    uint32_t sketches;
+
+    /** Set if the memory budget was exceeded while these maps were being
+     *  updated, in which case large unique IP sets are replaced with
+     *  sketches */
+    uint8_t degraded;
 } corsaro_report_iptracker_maps_t;
 
+/** A complete tally for an interval that is waiting to be collected by
+ *  the merging thread.
+ */
+typedef struct corsaro_report_tracker_result {
+    /** The timestamp of the interval that the tally belongs to */
+    uint32_t interval_ts;
+
+    /** The tally itself */
+    corsaro_report_iptracker_maps_t *maps;
+} corsaro_report_tracker_result_t;
+
 typedef struct corsaro_report_savedtags {
     uint64_t associated_metricids[MAX_ASSOCIATED_METRICS];
     uint64_t next_saved;
@@ -256,10 +311,18 @@ typedef struct corsaro_report_iptracker {
     /** Thread ID for this IP tracker thread */
     pthread_t tid;
 
-    /** Mutex used to protect the most recent complete tally */
+    /** Mutex used to protect the queue of complete tallies */
     pthread_mutex_t mutex;
 
-    corsaro_report_iptracker_maps_t *prev_maps;
+    /** Signalled by the merging thread whenever it takes a tally from the
+     *  queue of complete tallies */
+    pthread_cond_t collected;
+
+    /** Complete tallies that have not yet been collected by the merging
+     *  thread, oldest first.
+     */
+    libtrace_list_t *completed;
+
     corsaro_report_iptracker_maps_t *curr_maps;
     corsaro_report_iptracker_maps_t *next_maps;
 
@@ -382,6 +445,9 @@ struct corsaro_report_config {
      */
     corsaro_report_ipcount_conf_t src_ipcount_conf;
     corsaro_report_ipcount_conf_t dst_ipcount_conf;
+
+    /** The memory budget for this plugin (NULL if there is no budget) */
+    corsaro_mem_budget_t *budget;
 };
 
 
@@ -487,6 +553,12 @@ typedef struct corsaro_report_result {
     Pvoid_t uniq_src_ipset;
     Pvoid_t uniq_dst_ipset;
 
+    /** Sketches of all of the unique IPs for this metric, created once an
+     *  IP tracker that exceeded the memory budget reports a sketch. While
+     *  a sketch exists, the unique IP count is its estimate. */
+    uint8_t *src_hll;
+    uint8_t *dst_hll;
+
     uint32_t uniq_src_asn_count;
 
     /** The timestamp of the interval that this tally applies to */
@@ -495,15 +567,12 @@ typedef struct corsaro_report_result {
     /** An user-defined identifying label to include with this result */
     char *label;
 
-    /** A string representation of the metric class */
-    char metrictype[256];
-
-    /** A string representation of the metric value */
-    char metricval[128];
-
 } PACKED corsaro_report_result_t;
 
 void *start_iptracker(void *tdata);
+void free_map_set(corsaro_report_iptracker_maps_t *maps,
+        corsaro_mem_budget_t *budget);
+void free_uncollected_tallies(corsaro_report_iptracker_t *track);
 
 #endif
 // vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
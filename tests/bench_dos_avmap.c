@@ -0,0 +1,271 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "khash.h"
+#include "benchutil.h"
+
+/** A stand-in for the dos plugin's attack vector; the maps only look at
+ *  the target IP */
+struct attack_vector {
+    uint32_t target_ip;
+    uint64_t packet_cnt;
+};
+
+#include "plugins/corsaro_dos_avmap.h"
+
+/** Compares the dos plugin's attack vector map against the khash set that
+ *  it replaced (with its target_ip * 59 hash) for victim sets of the sizes
+ *  seen during large reflection events.
+ *
+ *  Victims are either allocated in runs of consecutive addresses within a
+ *  /8, as they are when a hosting provider or ISP is attacked, or spread
+ *  uniformly across the address space. Lookups follow a skewed
+ *  distribution, with one lookup in eight for an address that has no
+ *  vector.
+ *
+ *  Usage: bench_dos_avmap [lookups]
+ */
+
+#define old_vector_hash_func(av) ((khint32_t)(av)->target_ip * 59)
+#define old_vector_hash_equal(a, b) ((a)->target_ip == (b)->target_ip)
+
+KHASH_INIT(oldav, struct attack_vector *, char, 0, old_vector_hash_func,
+        old_vector_hash_equal);
+
+static uint64_t rngstate = 0x853c49e6748fea9bULL;
+
+static uint32_t next_rand(void) {
+    rngstate ^= rngstate << 13;
+    rngstate ^= rngstate >> 7;
+    rngstate ^= rngstate << 17;
+    return (uint32_t)(rngstate >> 16);
+}
+
+/** Creates 'count' victims, either in runs of up to 256 consecutive
+ *  addresses within a /8 or at random addresses */
+static struct attack_vector *make_victims(uint32_t count, int clustered) {
+    struct attack_vector *vecs;
+    uint32_t i = 0, run, base = 0;
+
+    vecs = calloc(count, sizeof(struct attack_vector));
+    if (vecs == NULL) {
+        return NULL;
+    }
+    while (i < count) {
+        if (!clustered) {
+            vecs[i].target_ip = next_rand();
+            i ++;
+            continue;
+        }
+        run = 1 + (next_rand() % 256);
+        base = 0x67000000 | ((base + 256 + (next_rand() % 1024)) & 0xffffff);
+        while (run > 0 && i < count) {
+            vecs[i].target_ip = base + run;
+            run --;
+            i ++;
+        }
+    }
+    return vecs;
+}
+
+/** Builds the sequence of target IPs to look up */
+static uint32_t *make_lookups(struct attack_vector *vecs, uint32_t count,
+        uint32_t lookups) {
+    uint32_t *targets, i, r;
+
+    targets = malloc(lookups * sizeof(uint32_t));
+    if (targets == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < lookups; i++) {
+        r = next_rand();
+        if ((r & 7) == 0) {
+            /* Backscatter to something that isn't (yet) a vector */
+            targets[i] = next_rand();
+        } else {
+            /* Squaring a uniform value skews lookups towards the first
+             * victims, which are the busiest */
+            uint64_t u = next_rand() % count;
+            targets[i] = vecs[(u * u) / count].target_ip;
+        }
+    }
+    return targets;
+}
+
+static void keep_vector(struct attack_vector *vec) {
+    (void)vec;
+}
+
+static void bench_avmap(struct attack_vector *vecs, uint32_t count,
+        uint32_t *targets, uint32_t lookups, double *insns, double *lookns,
+        uint64_t *found) {
+
+    attack_vector_map_t *map;
+    struct attack_vector *av;
+    struct timespec start;
+    uint32_t i;
+
+    bench_start(&start);
+    map = avmap_create(0);
+    for (i = 0; i < count; i++) {
+        if (avmap_get(map, vecs[i].target_ip) == NULL) {
+            avmap_put(map, vecs[i].target_ip, &(vecs[i]));
+        }
+    }
+    *insns = bench_elapsed(&start) * 1000000000.0 / count;
+
+    *found = 0;
+    bench_start(&start);
+    for (i = 0; i < lookups; i++) {
+        if ((av = avmap_get(map, targets[i])) != NULL) {
+            av->packet_cnt ++;
+            (*found) ++;
+        }
+    }
+    *lookns = bench_elapsed(&start) * 1000000000.0 / lookups;
+
+    /* The vectors belong to the caller */
+    avmap_destroy(map, keep_vector);
+}
+
+static void bench_khash(struct attack_vector *vecs, uint32_t count,
+        uint32_t *targets, uint32_t lookups, double *insns, double *lookns,
+        uint64_t *found) {
+
+    kh_oldav_t *hash;
+    struct attack_vector findme;
+    struct timespec start;
+    khiter_t k;
+    uint32_t i;
+    int khret;
+
+    bench_start(&start);
+    hash = kh_init(oldav);
+    for (i = 0; i < count; i++) {
+        k = kh_get(oldav, hash, &(vecs[i]));
+        if (k == kh_end(hash)) {
+            kh_put(oldav, hash, &(vecs[i]), &khret);
+        }
+    }
+    *insns = bench_elapsed(&start) * 1000000000.0 / count;
+
+    *found = 0;
+    bench_start(&start);
+    for (i = 0; i < lookups; i++) {
+        findme.target_ip = targets[i];
+        k = kh_get(oldav, hash, &findme);
+        if (k != kh_end(hash)) {
+            kh_key(hash, k)->packet_cnt ++;
+            (*found) ++;
+        }
+    }
+    *lookns = bench_elapsed(&start) * 1000000000.0 / lookups;
+
+    kh_destroy(oldav, hash);
+}
+
+static const uint32_t sizes[] = {1000, 10000, 100000, 1000000, 4000000};
+
+/** Runs both maps over each victim set size for one victim pattern */
+static int run_pattern(int clustered, uint32_t lookups) {
+    struct attack_vector *vecs;
+    uint32_t *targets;
+    double ains, alook, kins, klook;
+    uint64_t afound, kfound;
+    unsigned int s;
+
+    printf("%s victims:\n", clustered ? "clustered" : "random");
+    printf("%10s %14s %14s %14s %14s\n", "victims", "avmap insert",
+            "khash insert", "avmap lookup", "khash lookup");
+
+    for (s = 0; s < sizeof(sizes) / sizeof(uint32_t); s++) {
+        vecs = make_victims(sizes[s], clustered);
+        targets = vecs ? make_lookups(vecs, sizes[s], lookups) : NULL;
+        if (targets == NULL) {
+            fprintf(stderr, "unable to allocate %u victims\n", sizes[s]);
+            free(vecs);
+            return -1;
+        }
+
+        bench_avmap(vecs, sizes[s], targets, lookups, &ains, &alook,
+                &afound);
+        bench_khash(vecs, sizes[s], targets, lookups, &kins, &klook,
+                &kfound);
+        free(vecs);
+        free(targets);
+        if (afound != kfound) {
+            fprintf(stderr, "maps disagree: %lu vs %lu lookups found\n",
+                    afound, kfound);
+            return -1;
+        }
+
+        printf("%10u %11.1f ns %11.1f ns %11.1f ns %11.1f ns\n", sizes[s],
+                ains, kins, alook, klook);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t lookups = 20000000;
+
+    if (argc > 1) {
+        lookups = strtoul(argv[1], NULL, 0);
+    }
+
+    if (run_pattern(1, lookups) < 0 || run_pattern(0, lookups) < 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,237 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libtrace.h>
+
+#include "libcorsaro.h"
+#include "libcorsaro_trace.h"
+#include "benchutil.h"
+
+/** Compares the ways that the fast trace writer can do its disk I/O, by
+ *  writing the same packets through corsaro_fast_write_erf_packet() with
+ *  buffered I/O, with O_DIRECT, and with each of those preallocating the
+ *  whole file up front.
+ *
+ *  The packets are converted to ERF records before anything is timed, as
+ *  corsarowdcap would receive them from a DAG card. Each file is timed
+ *  until corsaro_reset_fast_trace_writer() returns, which is as long as
+ *  a processing thread would be held up, and then again until an fsync()
+ *  completes, so that buffered writes are charged for reaching the disk.
+ *
+ *  Usage: bench_fast_writer <trace uri> [output dir] [packets] [repeats]
+ *                           [files] [snaplen]
+ */
+
+typedef struct bench_mode {
+    const char *name;
+    uint8_t directio;
+    uint8_t prealloc;
+} bench_mode_t;
+
+static bench_mode_t modes[] = {
+    {"buffered", 0, 0},
+    {"buffered+prealloc", 0, 1},
+    {"direct", 1, 0},
+    {"direct+prealloc", 1, 1},
+    {NULL, 0, 0}
+};
+
+/** Works out how big each output file will be, so that the preallocating
+ *  modes can reserve exactly that much */
+static uint64_t expected_file_size(bench_packets_t *bp, int repeats,
+        uint16_t snaplen) {
+
+    uint64_t size = 0;
+    uint32_t i, caplen;
+
+    for (i = 0; i < bp->count; i++) {
+        caplen = trace_get_capture_length(bp->pkts[i]);
+        if (snaplen > 0 && caplen > snaplen) {
+            caplen = snaplen;
+        }
+        /* Each packet gets a 16 byte pcap record header */
+        size += 16 + caplen;
+    }
+    /* Allow for the 24 byte pcap file header */
+    return size * repeats + 24;
+}
+
+/** Writes one file through a fresh fast writer, so that no mode gets to
+ *  preallocate based on the size of an earlier file.
+ */
+static int write_file(bench_mode_t *mode, char *filename,
+        bench_erf_packets_t *ep, int repeats, uint16_t snaplen,
+        uint64_t prealloc, double *writesecs, double *syncsecs) {
+
+    corsaro_fast_trace_writer_t *writer;
+    struct timespec start;
+    uint32_t i;
+    int r, fd;
+
+    writer = corsaro_create_fast_trace_writer();
+    if (writer == NULL) {
+        fprintf(stderr, "unable to create fast writer\n");
+        return -1;
+    }
+    corsaro_configure_fast_trace_writer(writer, mode->directio,
+            mode->prealloc ? prealloc : 0, snaplen);
+
+    bench_start(&start);
+    if (corsaro_start_fast_trace_writer(NULL, writer, filename) < 0) {
+        corsaro_destroy_fast_trace_writer(NULL, writer);
+        return -1;
+    }
+    for (r = 0; r < repeats; r++) {
+        for (i = 0; i < ep->count; i++) {
+            if (corsaro_fast_write_erf_packet(NULL, writer, ep->pkts[i],
+                        snaplen, 0, 0) < 0) {
+                fd = corsaro_reset_fast_trace_writer(NULL, writer);
+                close(fd);
+                corsaro_destroy_fast_trace_writer(NULL, writer);
+                return -1;
+            }
+        }
+    }
+    fd = corsaro_reset_fast_trace_writer(NULL, writer);
+    *writesecs += bench_elapsed(&start);
+
+    if (fsync(fd) < 0) {
+        perror("fsync");
+    }
+    *syncsecs += bench_elapsed(&start);
+
+    close(fd);
+    corsaro_destroy_fast_trace_writer(NULL, writer);
+    unlink(filename);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bench_packets_t bp;
+    bench_erf_packets_t ep;
+    char filename[4096];
+    char *outdir = "/tmp";
+    uint32_t maxpkts = 1000000;
+    int repeats = 4, files = 3, m, f;
+    uint16_t snaplen = 0;
+    uint64_t filesize;
+    double writesecs, syncsecs, mbytes;
+
+    if (argc < 2) {
+        fprintf(stderr,
+                "Usage: %s <trace uri> [output dir] [packets] [repeats] [files] [snaplen]\n",
+                argv[0]);
+        return 1;
+    }
+    if (argc > 2) {
+        outdir = argv[2];
+    }
+    if (argc > 3) {
+        maxpkts = strtoul(argv[3], NULL, 0);
+    }
+    if (argc > 4) {
+        repeats = strtoul(argv[4], NULL, 0);
+    }
+    if (argc > 5) {
+        files = strtoul(argv[5], NULL, 0);
+    }
+    if (argc > 6) {
+        snaplen = strtoul(argv[6], NULL, 0);
+    }
+
+    if (bench_load_packets(&bp, argv[1], maxpkts) < 0) {
+        bench_free_packets(&bp);
+        return 1;
+    }
+    if (bench_make_erf_packets(&ep, &bp, NULL, 0, 1) < 0) {
+        bench_free_erf_packets(&ep);
+        bench_free_packets(&bp);
+        return 1;
+    }
+
+    filesize = expected_file_size(&bp, repeats, snaplen);
+    mbytes = filesize / 1000000.0;
+    snprintf(filename, sizeof(filename), "%s/bench_fast_writer.%d.pcap",
+            outdir, (int)getpid());
+
+    printf("writing %u packets x %d repeats (%.1f MB) to %d files per mode, snaplen %u\n",
+            bp.count, repeats, mbytes, files, snaplen);
+    printf("%-18s %10s %10s %10s %10s\n", "mode", "write ms", "write MB/s",
+            "+fsync ms", "+fsync MB/s");
+
+    for (m = 0; modes[m].name != NULL; m++) {
+        writesecs = 0;
+        syncsecs = 0;
+        for (f = 0; f < files; f++) {
+            if (write_file(&(modes[m]), filename, &ep, repeats, snaplen,
+                        filesize, &writesecs, &syncsecs) < 0) {
+                fprintf(stderr, "%s: unable to write %s\n", modes[m].name,
+                        filename);
+                break;
+            }
+        }
+        if (f < files) {
+            continue;
+        }
+        printf("%-18s %10.1f %10.1f %10.1f %10.1f\n", modes[m].name,
+                writesecs * 1000.0 / files, mbytes * files / writesecs,
+                syncsecs * 1000.0 / files, mbytes * files / syncsecs);
+    }
+
+    bench_free_erf_packets(&ep);
+    bench_free_packets(&bp);
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,148 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <libtrace.h>
+#include <libtrace/hash_toeplitz.h>
+
+#include "libcorsaro_flowhash.h"
+#include "benchutil.h"
+
+/** Compares the packet rate of the table-driven flow hasher against the
+ *  libtrace software Toeplitz hasher that corsarotagger used before, and
+ *  checks that both spread the packets evenly across threads.
+ *
+ *  Usage: bench_flowhash <trace uri> [packets] [rounds] [threads]
+ */
+
+typedef uint64_t (*bench_hasher)(const libtrace_packet_t *, void *);
+
+static void run_hasher(const char *name, bench_hasher fn, void *data,
+        bench_packets_t *bp, int rounds, int threads) {
+
+    struct timespec start;
+    uint64_t *perthread, acc = 0, most = 0;
+    double secs;
+    uint32_t i;
+    int r;
+
+    bench_start(&start);
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < bp->count; i++) {
+            acc += fn(bp->pkts[i], data);
+        }
+    }
+    secs = bench_elapsed(&start);
+
+    perthread = calloc(threads, sizeof(uint64_t));
+    for (i = 0; i < bp->count; i++) {
+        perthread[fn(bp->pkts[i], data) % threads] ++;
+    }
+    for (r = 0; r < threads; r++) {
+        if (perthread[r] > most) {
+            most = perthread[r];
+        }
+    }
+    free(perthread);
+
+    printf("%-10s %8.2f Mpps  busiest thread %5.1f%% of packets (ideal %5.1f%%)  [%lu]\n",
+            name, ((double)bp->count * rounds) / secs / 1000000.0,
+            most * 100.0 / bp->count, 100.0 / threads, acc & 0xff);
+}
+
+int main(int argc, char *argv[]) {
+    bench_packets_t bp;
+    corsaro_flowhash_t *fh;
+    toeplitz_conf_t *tconf;
+    uint32_t maxpkts = 1000000;
+    int rounds = 10, threads = 8;
+
+    if (argc < 2) {
+        fprintf(stderr,
+                "Usage: %s <trace uri> [packets] [rounds] [threads]\n",
+                argv[0]);
+        return 1;
+    }
+    if (argc > 2) {
+        maxpkts = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3) {
+        rounds = strtoul(argv[3], NULL, 0);
+    }
+    if (argc > 4) {
+        threads = strtoul(argv[4], NULL, 0);
+    }
+
+    if (bench_load_packets(&bp, argv[1], maxpkts) < 0) {
+        bench_free_packets(&bp);
+        return 1;
+    }
+    printf("hashing %u packets x %d rounds\n", bp.count, rounds);
+
+    fh = calloc(1, sizeof(corsaro_flowhash_t));
+    tconf = calloc(1, sizeof(toeplitz_conf_t));
+    if (fh == NULL || tconf == NULL) {
+        fprintf(stderr, "unable to allocate hashers\n");
+        return 1;
+    }
+    corsaro_init_flowhash(fh);
+    toeplitz_init_config(tconf, 1);
+
+    run_hasher("table", corsaro_flowhash_packet, fh, &bp, rounds, threads);
+    run_hasher("libtrace", toeplitz_hash_packet, tconf, &bp, rounds,
+            threads);
+
+    free(fh);
+    free(tconf);
+    bench_free_packets(&bp);
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
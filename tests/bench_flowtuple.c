@@ -0,0 +1,230 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <yaml.h>
+#include <libtrace.h>
+
+#include "libcorsaro_plugin.h"
+#include "benchutil.h"
+
+/** Measures the packet rate of the flowtuple plugin with and without the
+ *  'ipv6' option, for both sorted and unsorted aggregation. On a trace
+ *  that holds only IPv4 traffic the rates should be the same whether or
+ *  not 'ipv6' is enabled, as the IPv6 path is only reached after the IPv4
+ *  check has rejected a packet.
+ *
+ *  The first pass over the packets creates most of the flowtuples, while
+ *  the remaining passes only update existing ones, so the two are
+ *  reported separately. Packets are passed to the plugin without tags, as
+ *  they are when corsarotrace is not fed by corsarotagger.
+ *
+ *  The last two configurations set a small 'memorylimit', so that IPv4
+ *  flowtuples are spilled to disk and IPv6 flowtuples are capped at half
+ *  of the limit; the first pass of these includes writing the runs.
+ *
+ *  This only uses the public plugin API, so it can also be linked against
+ *  a libcorsaro built from before IPv6 flowtuples were added (where the
+ *  'ipv6' option is ignored) to compare the IPv4 rates across that change.
+ *
+ *  Usage: bench_flowtuple <trace uri> [packets] [rounds]
+ */
+
+static const char *configs[] = {
+    "{sorttuples: yes, ipv6: no}",
+    "{sorttuples: yes, ipv6: yes}",
+    "{sorttuples: no, ipv6: no}",
+    "{sorttuples: no, ipv6: yes}",
+    "{sorttuples: no, ipv6: no, memorylimit: 8}",
+    "{sorttuples: no, ipv6: yes, memorylimit: 8}",
+};
+
+/** Creates a flowtuple plugin instance using the given options, which
+ *  are written as a YAML mapping.
+ */
+static corsaro_plugin_t *configure_flowtuple(corsaro_plugin_t *all,
+        const char *options) {
+
+    corsaro_plugin_proc_options_t stdopts;
+    corsaro_plugin_t *orig, *p;
+    yaml_parser_t parser;
+    yaml_document_t doc;
+    int ret;
+
+    if ((orig = corsaro_find_plugin(all, "flowtuple")) == NULL) {
+        fprintf(stderr, "libcorsaro was built without the flowtuple plugin\n");
+        return NULL;
+    }
+
+    yaml_parser_initialize(&parser);
+    yaml_parser_set_input_string(&parser, (const unsigned char *)options,
+            strlen(options));
+    if (!yaml_parser_load(&parser, &doc)) {
+        fprintf(stderr, "unable to parse plugin options '%s'\n", options);
+        yaml_parser_delete(&parser);
+        return NULL;
+    }
+
+    p = corsaro_enable_plugin(NULL, NULL, orig);
+    ret = corsaro_configure_plugin(p, &doc,
+            yaml_document_get_root_node(&doc));
+    yaml_document_delete(&doc);
+    yaml_parser_delete(&parser);
+
+    if (ret < 0) {
+        fprintf(stderr, "unable to configure plugin with '%s'\n", options);
+        corsaro_cleanse_plugin_list(p);
+        return NULL;
+    }
+
+    memset(&stdopts, 0, sizeof(stdopts));
+    stdopts.template = "/tmp/bench-%P-%N.avro";
+    stdopts.monitorid = "bench";
+    stdopts.procthreads = 1;
+    corsaro_finish_plugin_config(p, &stdopts, NULL);
+    return p;
+}
+
+/** Passes every packet to a single processing instance of the plugin
+ *  'rounds' times within one interval, returning the time taken by the
+ *  first pass in 'firstsecs' and by the rest in 'restsecs'.
+ */
+static void run_flowtuple(corsaro_plugin_t *p, bench_packets_t *bp,
+        int rounds, double *firstsecs, double *restsecs) {
+
+    corsaro_plugin_set_t *pset;
+    struct timespec start;
+    uint32_t i;
+    int r;
+
+    pset = corsaro_start_plugins(NULL, p, 1, 0);
+    corsaro_push_start_plugins(pset, 0, trace_get_seconds(bp->pkts[0]));
+
+    *restsecs = 0;
+    for (r = 0; r < rounds; r++) {
+        bench_start(&start);
+        for (i = 0; i < bp->count; i++) {
+            corsaro_push_packet_plugins(pset, bp->pkts[i], NULL);
+        }
+        if (r == 0) {
+            *firstsecs = bench_elapsed(&start);
+        } else {
+            *restsecs += bench_elapsed(&start);
+        }
+    }
+
+    corsaro_stop_plugins(pset);
+}
+
+int main(int argc, char *argv[]) {
+    bench_packets_t bp;
+    corsaro_plugin_t *all, *p;
+    uint32_t maxpkts = 1000000, v4 = 0, v6 = 0, i, rem;
+    uint16_t ethertype;
+    int rounds = 5;
+    unsigned int c;
+    double firstsecs, restsecs;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace uri> [packets] [rounds]\n",
+                argv[0]);
+        return 1;
+    }
+    if (argc > 2) {
+        maxpkts = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3) {
+        rounds = strtoul(argv[3], NULL, 0);
+    }
+    if (rounds < 2) {
+        rounds = 2;
+    }
+
+    if (bench_load_packets(&bp, argv[1], maxpkts) < 0) {
+        bench_free_packets(&bp);
+        return 1;
+    }
+    for (i = 0; i < bp.count; i++) {
+        if (trace_get_layer3(bp.pkts[i], &ethertype, &rem) == NULL) {
+            continue;
+        }
+        if (ethertype == TRACE_ETHERTYPE_IP) {
+            v4 ++;
+        } else if (ethertype == TRACE_ETHERTYPE_IPV6) {
+            v6 ++;
+        }
+    }
+    printf("%u packets (%u IPv4, %u IPv6) x %d rounds\n", bp.count, v4, v6,
+            rounds);
+
+    if ((all = corsaro_load_all_plugins(NULL)) == NULL) {
+        fprintf(stderr, "unable to load the corsaro plugins\n");
+        bench_free_packets(&bp);
+        return 1;
+    }
+
+    for (c = 0; c < sizeof(configs) / sizeof(char *); c++) {
+        if ((p = configure_flowtuple(all, configs[c])) == NULL) {
+            continue;
+        }
+        run_flowtuple(p, &bp, rounds, &firstsecs, &restsecs);
+        printf("%-44s first pass %8.2f Mpps, later passes %8.2f Mpps\n",
+                configs[c], bp.count / firstsecs / 1000000.0,
+                ((double)bp.count * (rounds - 1)) / restsecs / 1000000.0);
+        corsaro_cleanse_plugin_list(p);
+    }
+
+    corsaro_cleanse_plugin_list(all);
+    bench_free_packets(&bp);
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
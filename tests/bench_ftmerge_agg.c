@@ -0,0 +1,246 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "corsaroftmerge/ftagg.h"
+#include "benchutil.h"
+
+/** Compares the two ways that corsaroftmerge can combine duplicate
+ *  flowtuples, using the same code that corsaroftmerge runs.
+ *
+ *  "sort" stands in for the sorted merge of unsorted inputs: sort every
+ *  record, then combine adjacent records with the same key. "hash" is the
+ *  aggregation mode (-a): add every record to an aggregation table, then
+ *  sort the (smaller) table as a final run. "hash, no sort" is the
+ *  aggregation mode with unsorted output (-u). The hash and sort results
+ *  are checked to be identical.
+ *
+ *  The records are random keys, each repeated 'duplicates' times on
+ *  average, with a copy's tags occasionally disagreeing with the others
+ *  so that ftdata_combine() has to pick between them.
+ *
+ *  Usage: bench_ftmerge_agg [flowtuples] [duplicates] [rounds] [ipv6]
+ */
+
+/** Fills in the flowtuple with key number 'k'. The same 'k' always gives
+ *  the same key. */
+static void make_flowtuple(merge_ftdata_t *ft, uint64_t k, uint8_t oddtags) {
+    uint64_t r = corsaro_flowtuple_mum(k ^ 0x2d358dccaa6c78a5ULL,
+            0x8bb84b93962eacc9ULL);
+    uint64_t s = corsaro_flowtuple_mum(r ^ 0x4b33a62ed433d4a3ULL,
+            0x4d5a2da51de1aa47ULL);
+
+    memset(ft, 0, sizeof(merge_ftdata_t));
+    if (mergeipv6) {
+        struct corsaro_flowtuple6_data *f6 = &(ft->v6);
+
+        f6->interval_ts = 1600000000 + ((r >> 60) & 0x01) * 60;
+        f6->src_ip[0] = 0x20;
+        f6->src_ip[1] = 0x01;
+        memcpy(f6->src_ip + 8, &s, sizeof(s));
+        f6->dst_ip[0] = 0x20;
+        f6->dst_ip[1] = 0x01;
+        f6->dst_ip[2] = 0x0d;
+        f6->dst_ip[3] = 0xb8;
+        memcpy(f6->dst_ip + 12, &r, 4);
+        f6->src_port = (r >> 32) & 0xffff;
+        f6->dst_port = (s >> 48) & 0x3ff;
+        f6->protocol = (r & 0x10) ? 6 : 17;
+        f6->ttl = 32 + ((s >> 40) & 0x1f);
+        f6->tcp_flags = f6->protocol == 6 ? 0x02 : 0;
+        f6->ip_len = 60 + ((r >> 48) & 0x0f);
+        f6->packet_cnt = 1;
+        f6->maxmind_country = (s & 0xff) + oddtags;
+        f6->tagproviders = 0x03;
+        return;
+    }
+
+    ft->v4.interval_ts = 1600000000 + ((r >> 60) & 0x01) * 60;
+    ft->v4.src_ip = (uint32_t)s;
+    ft->v4.dst_ip = 0x2c000000 | (r & 0x00ffffff);
+    ft->v4.src_port = (r >> 32) & 0xffff;
+    ft->v4.dst_port = (s >> 48) & 0x3ff;
+    ft->v4.protocol = (r & 0x10) ? 6 : 17;
+    ft->v4.ttl = 32 + ((s >> 40) & 0x1f);
+    ft->v4.tcp_flags = ft->v4.protocol == 6 ? 0x02 : 0;
+    ft->v4.ip_len = 40 + ((r >> 48) & 0x0f);
+    ft->v4.packet_cnt = 1;
+    ft->v4.maxmind_country = ((s >> 32) & 0xff) + oddtags;
+    ft->v4.tagproviders = 0x03;
+}
+
+/** Sorts 'count' records and combines adjacent duplicates in place,
+ *  returning the number of records left. */
+static uint64_t sort_and_combine(uint8_t *recs, uint64_t count,
+        size_t recsize) {
+
+    uint64_t i, j;
+
+    if (count == 0) {
+        return 0;
+    }
+    qsort(recs, count, recsize, ftdata_cmp_qsort);
+    for (i = 1, j = 0; i < count; i++) {
+        merge_ftdata_t *prev = (merge_ftdata_t *)(recs + j * recsize);
+        merge_ftdata_t *next = (merge_ftdata_t *)(recs + i * recsize);
+
+        if (ftdata_cmp(prev, next) == 0) {
+            ftdata_combine(prev, next);
+            continue;
+        }
+        j++;
+        if (i != j) {
+            memcpy(recs + j * recsize, next, recsize);
+        }
+    }
+    return j + 1;
+}
+
+int main(int argc, char *argv[]) {
+    ftagg_table_t table;
+    struct timespec start;
+    uint64_t count = 4000000, uniq, seed = 1, i, sorted = 0, hashed = 0;
+    uint8_t *input, *work;
+    size_t recsize;
+    double dups = 4, sortsecs = 0, addsecs = 0, tsortsecs = 0;
+    int rounds = 5, r;
+
+    if (argc > 1) {
+        count = strtoull(argv[1], NULL, 0);
+    }
+    if (argc > 2) {
+        dups = strtod(argv[2], NULL);
+    }
+    if (argc > 3) {
+        rounds = strtoul(argv[3], NULL, 0);
+    }
+    if (argc > 4) {
+        mergeipv6 = (strtoul(argv[4], NULL, 0) != 0);
+    }
+    if (count == 0 || dups < 1 || rounds < 1) {
+        fprintf(stderr,
+                "Usage: %s [flowtuples] [duplicates] [rounds] [ipv6]\n",
+                argv[0]);
+        return 1;
+    }
+    uniq = count / dups;
+    if (uniq == 0) {
+        uniq = 1;
+    }
+
+    recsize = mergeipv6 ? sizeof(struct corsaro_flowtuple6_data) :
+            sizeof(struct corsaro_flowtuple_data);
+    input = malloc(count * recsize);
+    work = malloc(count * recsize);
+    if (input == NULL || work == NULL ||
+            ftagg_table_init(&table, uniq) < 0) {
+        fprintf(stderr, "unable to allocate %lu flowtuples\n", count);
+        free(input);
+        free(work);
+        return 1;
+    }
+
+    /* Draw each record's key at random, and give one copy in eight
+     * different tags */
+    for (i = 0; i < count; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        make_flowtuple((merge_ftdata_t *)(input + i * recsize), seed % uniq,
+                (seed >> 40) % 8 == 0);
+    }
+
+    printf("combining %lu %s flowtuples (%lu keys) x %d rounds\n", count,
+            mergeipv6 ? "IPv6" : "IPv4", uniq, rounds);
+
+    for (r = 0; r < rounds; r++) {
+        memcpy(work, input, count * recsize);
+        bench_start(&start);
+        sorted = sort_and_combine(work, count, recsize);
+        sortsecs += bench_elapsed(&start);
+
+        ftagg_table_clear(&table);
+        bench_start(&start);
+        for (i = 0; i < count; i++) {
+            ftagg_table_add(&table, (merge_ftdata_t *)(input + i * recsize));
+        }
+        addsecs += bench_elapsed(&start);
+
+        bench_start(&start);
+        hashed = ftagg_table_sort(&table);
+        tsortsecs += bench_elapsed(&start);
+    }
+
+    if (sorted != hashed || memcmp(work, table.slots, sorted * recsize)) {
+        fprintf(stderr, "hash aggregation (%lu flowtuples) does not match "
+                "sort and combine (%lu flowtuples)\n", hashed, sorted);
+        ftagg_table_free(&table);
+        free(input);
+        free(work);
+        return 1;
+    }
+
+    printf("%lu flowtuples after combining, results identical\n", sorted);
+    printf("sort + combine    %8.2f ns/ft\n",
+            sortsecs * 1000000000.0 / count / rounds);
+    printf("hash + sort       %8.2f ns/ft\n",
+            (addsecs + tsortsecs) * 1000000000.0 / count / rounds);
+    printf("hash, no sort     %8.2f ns/ft\n",
+            addsecs * 1000000000.0 / count / rounds);
+
+    ftagg_table_free(&table);
+    free(input);
+    free(work);
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,253 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Judy.h>
+
+#include "plugins/report/report_internal.h"
+#include "benchutil.h"
+
+/** Times the work that the report plugin's merging thread does at each
+ *  interval boundary to prepare the results for the metrics that are
+ *  always reported (the combined total, IP protocols, TCP and UDP ports,
+ *  continents and countries), with every port enabled.
+ *
+ *  "judy" repeats what the merger used to do: calloc a result and insert
+ *  it into a JudyL map for every metric at the start of the interval, then
+ *  free them all once the interval has been written. "dense" repeats what
+ *  it does now: clear and memset one persistent array of results, which
+ *  is built once when the merger starts.
+ *
+ *  Usage: bench_report_merge [intervals]
+ */
+
+/** The number of continent and country codes that merging_thread.c
+ *  creates results for */
+#define BENCH_NUM_CONTINENTS (8)
+#define BENCH_NUM_COUNTRIES (255)
+
+/** Lists the IDs of the metrics that always have a result, in the order
+ *  that the merger used to create them.
+ */
+static uint64_t *make_metricids(uint32_t *count) {
+    uint64_t *ids;
+    uint32_t i, n = 0;
+
+    ids = calloc(1 + METRIC_IPPROTOS_MAX + (4 * METRIC_PORT_MAX) +
+            (2 * BENCH_NUM_CONTINENTS) + (2 * BENCH_NUM_COUNTRIES),
+            sizeof(uint64_t));
+    if (ids == NULL) {
+        return NULL;
+    }
+
+    ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_COMBINED, 0);
+    for (i = 0; i < METRIC_IPPROTOS_MAX; i++) {
+        ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_IP_PROTOCOL, i);
+    }
+    for (i = 0; i < METRIC_PORT_MAX; i++) {
+        ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_TCP_SOURCE_PORT, i);
+        ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_TCP_DEST_PORT, i);
+        ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_UDP_SOURCE_PORT, i);
+        ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_UDP_DEST_PORT, i);
+    }
+    for (i = 0; i < BENCH_NUM_CONTINENTS; i++) {
+        ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_MAXMIND_CONTINENT, i);
+        ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_NETACQ_CONTINENT, i);
+    }
+    for (i = 0; i < BENCH_NUM_COUNTRIES; i++) {
+        ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_MAXMIND_COUNTRY, i);
+        ids[n++] = GEN_METRICID(CORSARO_METRIC_CLASS_NETACQ_COUNTRY, i);
+    }
+    *count = n;
+    return ids;
+}
+
+/** Allocates a result for every metric, as the merger used to. The
+ *  allocations and the JudyL inserts are timed separately (adding to
+ *  'allocsecs' and 'judysecs'), so that the cost of the allocations can
+ *  be seen regardless of which Judy build the bench is linked against.
+ */
+static void judy_setup(Pvoid_t *resultmap, corsaro_report_result_t **rs,
+        uint64_t *ids, uint32_t count, char *label, uint32_t ts,
+        double *allocsecs, double *judysecs) {
+
+    struct timespec start;
+    PWord_t pval;
+    uint32_t i;
+
+    bench_start(&start);
+    for (i = 0; i < count; i++) {
+        rs[i] = calloc(1, sizeof(corsaro_report_result_t));
+        rs[i]->metricid = ids[i];
+        rs[i]->attimestamp = ts;
+        rs[i]->label = label;
+    }
+    *allocsecs += bench_elapsed(&start);
+
+    bench_start(&start);
+    for (i = 0; i < count; i++) {
+        JLI(pval, *resultmap, ids[i]);
+        *pval = (Word_t)rs[i];
+    }
+    *judysecs += bench_elapsed(&start);
+}
+
+/** Frees every result in the map, as the merger used to once an interval
+ *  had been written. Walking and freeing the map is timed separately from
+ *  freeing the results themselves.
+ */
+static void judy_teardown(Pvoid_t *resultmap, corsaro_report_result_t **rs,
+        double *freesecs, double *judysecs) {
+
+    struct timespec start;
+    corsaro_report_result_t *r;
+    Word_t index = 0, judyret;
+    PWord_t pval;
+    uint32_t i, n = 0;
+
+    bench_start(&start);
+    JLF(pval, *resultmap, index);
+    while (pval) {
+        rs[n++] = (corsaro_report_result_t *)(*pval);
+        JLN(pval, *resultmap, index);
+    }
+    JLFA(judyret, *resultmap);
+    *judysecs += bench_elapsed(&start);
+
+    bench_start(&start);
+    for (i = 0; i < n; i++) {
+        r = rs[i];
+        J1FA(judyret, r->uniq_src_asns);
+        J1FA(judyret, r->uniq_src_ipset);
+        J1FA(judyret, r->uniq_dst_ipset);
+        free(r->src_hll);
+        free(r->dst_hll);
+        free(r);
+    }
+    *freesecs += bench_elapsed(&start);
+}
+
+static void dense_reset(corsaro_report_result_t *dense, uint64_t *ids,
+        uint32_t count, char *label, uint32_t ts) {
+
+    corsaro_report_result_t *r;
+    Word_t judyret;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        r = &(dense[i]);
+        J1FA(judyret, r->uniq_src_asns);
+        J1FA(judyret, r->uniq_src_ipset);
+        J1FA(judyret, r->uniq_dst_ipset);
+        free(r->src_hll);
+        free(r->dst_hll);
+    }
+    memset(dense, 0, count * sizeof(corsaro_report_result_t));
+    for (i = 0; i < count; i++) {
+        dense[i].metricid = ids[i];
+        dense[i].attimestamp = ts;
+        dense[i].label = label;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    corsaro_report_result_t *dense, **rs;
+    Pvoid_t resultmap = NULL;
+    struct timespec start;
+    uint64_t *ids;
+    uint32_t count, ts = 1600000000;
+    int intervals = 60, i;
+    double allocsecs = 0, insertsecs = 0, walksecs = 0, freesecs = 0;
+    double densesecs = 0;
+    char *label = "bench";
+
+    if (argc > 1) {
+        intervals = strtoul(argv[1], NULL, 0);
+    }
+
+    ids = make_metricids(&count);
+    dense = ids ? calloc(count, sizeof(corsaro_report_result_t)) : NULL;
+    rs = ids ? calloc(count, sizeof(corsaro_report_result_t *)) : NULL;
+    if (dense == NULL || rs == NULL) {
+        fprintf(stderr, "unable to allocate %u report results\n", count);
+        free(dense);
+        free(rs);
+        free(ids);
+        return 1;
+    }
+    printf("%u always-reported metrics x %d intervals\n", count, intervals);
+
+    for (i = 0; i < intervals; i++) {
+        judy_setup(&resultmap, rs, ids, count, label, ts + i * 60,
+                &allocsecs, &insertsecs);
+        judy_teardown(&resultmap, rs, &freesecs, &walksecs);
+
+        bench_start(&start);
+        dense_reset(dense, ids, count, label, ts + i * 60);
+        densesecs += bench_elapsed(&start);
+    }
+
+    printf("judy   setup    %8.2f ms per interval (calloc %.2f, JLI %.2f)\n",
+            (allocsecs + insertsecs) * 1000.0 / intervals,
+            allocsecs * 1000.0 / intervals, insertsecs * 1000.0 / intervals);
+    printf("judy   teardown %8.2f ms per interval (free %.2f, walk %.2f)\n",
+            (freesecs + walksecs) * 1000.0 / intervals,
+            freesecs * 1000.0 / intervals, walksecs * 1000.0 / intervals);
+    printf("dense  reset    %8.2f ms per interval\n",
+            densesecs * 1000.0 / intervals);
+
+    free(rs);
+    free(dense);
+    free(ids);
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,211 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <Judy.h>
+#include <libtrace.h>
+
+#include "corsarowdcap/corsarowdcap.h"
+#include "corsarowdcap/srcindex.h"
+#include "benchutil.h"
+
+/** Measures what the wdcap source index costs per packet, by timing the
+ *  header walk that corsarowdcap already does for per-protocol snap lengths
+ *  with and without the Judy1 insert of the source address. Each round
+ *  stands in for one interval: the packets are spread across the
+ *  processing threads' sets, which are then unioned and written out as
+ *  both a sorted list and a bloom filter, as the merging thread does.
+ *
+ *  Usage: bench_wdcap_srcindex <trace uri> [packets] [rounds] [threads]
+ */
+
+/** Walks each packet to its IPv4 header and, if 'sets' is not NULL,
+ *  adds the source address to the set for the thread that would have
+ *  received the packet.
+ */
+static uint64_t walk_packets(bench_packets_t *bp, Pvoid_t *sets,
+        int threads) {
+
+    uint8_t *l3;
+    uint16_t ethertype, off;
+    uint32_t caplen, i;
+    uint64_t acc = 0;
+    int ret;
+
+    for (i = 0; i < bp->count; i++) {
+        caplen = trace_get_capture_length(bp->pkts[i]);
+        off = corsaro_find_network_header((uint8_t *)bp->pkts[i]->payload,
+                caplen, &ethertype);
+        if (off == 0 || ethertype != TRACE_ETHERTYPE_IP ||
+                caplen - off < 20) {
+            continue;
+        }
+        l3 = ((uint8_t *)bp->pkts[i]->payload) + off;
+        if (sets) {
+            J1S(ret, sets[i % threads], ntohl(*((uint32_t *)(l3 + 12))));
+        }
+        acc += l3[9];
+    }
+    return acc;
+}
+
+/** Unions the per-thread sets and writes the result with the given bloom
+ *  filter threshold, returning the number of seconds taken.
+ */
+static double write_index(Pvoid_t *sets, int threads, char *filename,
+        uint64_t bloomthresh, Word_t *sources) {
+
+    struct timespec start;
+    Pvoid_t merged = NULL;
+    Word_t freed;
+    double secs;
+    int i;
+
+    bench_start(&start);
+    for (i = 0; i < threads; i++) {
+        corsaro_wdcap_srcindex_union(&merged, &(sets[i]));
+    }
+    if (corsaro_wdcap_srcindex_write(NULL, filename, 0, merged,
+                bloomthresh) < 0) {
+        fprintf(stderr, "unable to write source index to %s\n", filename);
+    }
+    secs = bench_elapsed(&start);
+
+    J1C(*sources, merged, 0, -1);
+    J1FA(freed, merged);
+    return secs;
+}
+
+int main(int argc, char *argv[]) {
+    bench_packets_t bp;
+    struct timespec start;
+    Pvoid_t *sets;
+    Word_t sources = 0, freed;
+    char filename[] = "/tmp/bench_wdcap_srcindex.XXXXXX";
+    uint32_t maxpkts = 1000000;
+    int rounds = 10, threads = 4, r, i, fd;
+    double walksecs = 0, insertsecs = 0, listsecs = 0, bloomsecs = 0;
+    uint64_t acc = 0;
+
+    if (argc < 2) {
+        fprintf(stderr,
+                "Usage: %s <trace uri> [packets] [rounds] [threads]\n",
+                argv[0]);
+        return 1;
+    }
+    if (argc > 2) {
+        maxpkts = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3) {
+        rounds = strtoul(argv[3], NULL, 0);
+    }
+    if (argc > 4) {
+        threads = strtoul(argv[4], NULL, 0);
+    }
+
+    if ((fd = mkstemp(filename)) < 0) {
+        fprintf(stderr, "unable to create a temporary index file\n");
+        return 1;
+    }
+    close(fd);
+
+    sets = calloc(threads, sizeof(Pvoid_t));
+    if (sets == NULL) {
+        fprintf(stderr, "unable to allocate per-thread source sets\n");
+        unlink(filename);
+        return 1;
+    }
+    if (bench_load_packets(&bp, argv[1], maxpkts) < 0) {
+        bench_free_packets(&bp);
+        free(sets);
+        unlink(filename);
+        return 1;
+    }
+    printf("indexing %u packets x %d rounds over %d threads\n", bp.count,
+            rounds, threads);
+
+    for (r = 0; r < rounds; r++) {
+        bench_start(&start);
+        acc += walk_packets(&bp, NULL, threads);
+        walksecs += bench_elapsed(&start);
+
+        bench_start(&start);
+        acc += walk_packets(&bp, sets, threads);
+        insertsecs += bench_elapsed(&start);
+
+        /* The union empties the per-thread sets, so fill them again for
+         * the second write */
+        listsecs += write_index(sets, threads, filename, (uint64_t)-1,
+                &sources);
+        walk_packets(&bp, sets, threads);
+        bloomsecs += write_index(sets, threads, filename, 0, &sources);
+    }
+
+    printf("header walk       %8.2f ns/pkt\n",
+            walksecs * 1000000000.0 / bp.count / rounds);
+    printf("walk + insert     %8.2f ns/pkt\n",
+            insertsecs * 1000000000.0 / bp.count / rounds);
+    printf("insert only       %8.2f ns/pkt\n",
+            (insertsecs - walksecs) * 1000000000.0 / bp.count / rounds);
+    printf("%lu sources per interval, union + write: list %.2f ms, bloom %.2f ms  [%lu]\n",
+            sources, listsecs * 1000.0 / rounds, bloomsecs * 1000.0 / rounds,
+            acc & 0xff);
+
+    for (i = 0; i < threads; i++) {
+        J1FA(freed, sets[i]);
+    }
+    free(sets);
+    unlink(filename);
+    bench_free_packets(&bp);
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
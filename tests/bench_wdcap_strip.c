@@ -0,0 +1,193 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libtrace.h>
+
+#include "libcorsaro.h"
+#include "libcorsaro_trace.h"
+#include "benchutil.h"
+
+/** Compares the ways that corsarowdcap can remove VLAN and MPLS headers
+ *  from captured packets: calling trace_strip_packet() on each packet
+ *  before handing it to the fast writer, or finding the network header
+ *  with corsaro_find_network_header() and letting the fast writer skip
+ *  the encapsulation as it copies the packet. Writing the packets without
+ *  stripping anything is timed as well, as a baseline.
+ *
+ *  The packets are converted into ERF records with the chosen
+ *  encapsulation added before anything is timed, and are written to
+ *  /dev/null so that disk speed does not get measured.
+ *
+ *  Usage: bench_wdcap_strip <trace uri> [packets] [rounds]
+ */
+
+typedef struct bench_encap {
+    const char *name;
+    uint8_t bytes[8];
+    uint16_t len;
+    /** Whether the original ethertype follows the extra headers */
+    uint8_t keeptype;
+} bench_encap_t;
+
+static bench_encap_t encaps[] = {
+    {"none", {0}, 0, 1},
+    {"vlan", {0x81, 0x00, 0x00, 0x64}, 4, 1},
+    {"qinq", {0x88, 0xa8, 0x00, 0x0a, 0x81, 0x00, 0x00, 0x64}, 8, 1},
+    {"mpls", {0x88, 0x47, 0x00, 0x01, 0x41, 0x40}, 6, 0},
+    {NULL, {0}, 0, 0}
+};
+
+enum {
+    STRIP_NONE,
+    STRIP_LIBTRACE,
+    STRIP_FAST,
+};
+
+static const char *stripnames[] = {
+    "no stripping", "trace_strip_packet", "find + copy"
+};
+
+/** Writes every packet once using the given stripping method, returning
+ *  the number of seconds taken */
+static double write_packets(bench_erf_packets_t *ep, int method) {
+    corsaro_fast_trace_writer_t *writer;
+    struct timespec start;
+    uint16_t l3off = 0, ethertype = 0;
+    uint32_t i;
+    double secs;
+    int fd;
+
+    writer = corsaro_create_fast_trace_writer();
+    if (writer == NULL ||
+            corsaro_start_fast_trace_writer(NULL, writer,
+                "/dev/null") < 0) {
+        fprintf(stderr, "unable to start fast writer\n");
+        exit(1);
+    }
+
+    bench_start(&start);
+    for (i = 0; i < ep->count; i++) {
+        if (method == STRIP_LIBTRACE) {
+            trace_strip_packet(ep->pkts[i]);
+        } else if (method == STRIP_FAST) {
+            l3off = corsaro_find_network_header(
+                    (uint8_t *)ep->pkts[i]->payload,
+                    trace_get_capture_length(ep->pkts[i]), &ethertype);
+        }
+        if (corsaro_fast_write_erf_packet(NULL, writer, ep->pkts[i], 0,
+                    l3off, ethertype) < 0) {
+            fprintf(stderr, "unable to write packet %u\n", i);
+            exit(1);
+        }
+    }
+    fd = corsaro_reset_fast_trace_writer(NULL, writer);
+    secs = bench_elapsed(&start);
+
+    close(fd);
+    corsaro_destroy_fast_trace_writer(NULL, writer);
+    return secs;
+}
+
+int main(int argc, char *argv[]) {
+    bench_packets_t bp;
+    bench_erf_packets_t ep;
+    uint32_t maxpkts = 1000000;
+    int rounds = 5, e, m, r;
+    double secs;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace uri> [packets] [rounds]\n",
+                argv[0]);
+        return 1;
+    }
+    if (argc > 2) {
+        maxpkts = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3) {
+        rounds = strtoul(argv[3], NULL, 0);
+    }
+
+    if (bench_load_packets(&bp, argv[1], maxpkts) < 0) {
+        bench_free_packets(&bp);
+        return 1;
+    }
+    printf("writing %u packets x %d rounds\n", bp.count, rounds);
+    printf("%-6s %20s %20s %20s\n", "encap", stripnames[STRIP_NONE],
+            stripnames[STRIP_LIBTRACE], stripnames[STRIP_FAST]);
+
+    for (e = 0; encaps[e].name != NULL; e++) {
+        if (bench_make_erf_packets(&ep, &bp, encaps[e].bytes, encaps[e].len,
+                    encaps[e].keeptype) < 0) {
+            bench_free_erf_packets(&ep);
+            bench_free_packets(&bp);
+            return 1;
+        }
+        printf("%-6s", encaps[e].name);
+        for (m = STRIP_NONE; m <= STRIP_FAST; m++) {
+            secs = 0;
+            for (r = 0; r < rounds; r++) {
+                /* Undo the previous round of trace_strip_packet() */
+                bench_reset_erf_packets(&ep);
+                secs += write_packets(&ep, m);
+            }
+            printf(" %14.2f ns/pkt", secs * 1000000000.0 / ep.count / rounds);
+        }
+        printf("\n");
+        bench_free_erf_packets(&ep);
+    }
+
+    bench_free_packets(&bp);
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
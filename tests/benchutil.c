@@ -0,0 +1,247 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libtrace.h>
+
+#include "libcorsaro.h"
+#include "benchutil.h"
+
+/** An ERF record header */
+typedef struct bench_erf_header {
+    uint64_t ts;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t rlen;
+    uint16_t lctr;
+    uint16_t wlen;
+} PACKED bench_erf_header_t;
+
+int bench_load_packets(bench_packets_t *bp, char *uri, uint32_t max) {
+    libtrace_packet_t *packet;
+
+    bp->count = 0;
+    bp->pkts = calloc(max, sizeof(libtrace_packet_t *));
+    bp->trace = trace_create(uri);
+    if (bp->pkts == NULL) {
+        fprintf(stderr, "unable to allocate space for %u packets\n", max);
+        return -1;
+    }
+    if (trace_is_err(bp->trace)) {
+        trace_perror(bp->trace, "opening %s", uri);
+        return -1;
+    }
+    if (trace_start(bp->trace) < 0) {
+        trace_perror(bp->trace, "starting %s", uri);
+        return -1;
+    }
+
+    packet = trace_create_packet();
+    while (bp->count < max && trace_read_packet(bp->trace, packet) > 0) {
+        bp->pkts[bp->count] = trace_copy_packet(packet);
+        if (bp->pkts[bp->count] == NULL) {
+            break;
+        }
+        bp->count ++;
+    }
+    trace_destroy_packet(packet);
+
+    if (bp->count == 0) {
+        fprintf(stderr, "no packets could be read from %s\n", uri);
+        return -1;
+    }
+    return 0;
+}
+
+void bench_free_packets(bench_packets_t *bp) {
+    uint32_t i;
+
+    for (i = 0; i < bp->count; i++) {
+        trace_destroy_packet(bp->pkts[i]);
+    }
+    free(bp->pkts);
+    if (bp->trace) {
+        trace_destroy(bp->trace);
+    }
+    bp->pkts = NULL;
+    bp->trace = NULL;
+    bp->count = 0;
+}
+
+/** Points each ERF packet at its record */
+static int prepare_erf_packets(bench_erf_packets_t *ep) {
+    uint8_t *ptr = ep->records;
+    uint32_t i;
+
+    for (i = 0; i < ep->count; i++) {
+        if (trace_prepare_packet(ep->dead, ep->pkts[i], ptr,
+                    TRACE_RT_DATA_ERF, TRACE_PREP_DO_NOT_OWN_BUFFER) < 0) {
+            return -1;
+        }
+        ptr += ntohs(((bench_erf_header_t *)ptr)->rlen);
+    }
+    return 0;
+}
+
+int bench_make_erf_packets(bench_erf_packets_t *ep, bench_packets_t *bp,
+        const uint8_t *encap, uint16_t encaplen, uint8_t keeptype) {
+
+    bench_erf_header_t *erf;
+    libtrace_linktype_t linktype;
+    uint32_t i, caplen;
+    uint16_t added;
+    uint8_t *ptr, *l2;
+    double ts;
+
+    memset(ep, 0, sizeof(bench_erf_packets_t));
+    added = keeptype ? encaplen : encaplen - 2;
+    for (i = 0; i < bp->count; i++) {
+        ep->length += CORSARO_ERF_ETHERNET_FRAMING + added +
+                trace_get_capture_length(bp->pkts[i]);
+    }
+
+    ep->dead = trace_create_dead("erf:/dev/null");
+    ep->pkts = calloc(bp->count, sizeof(libtrace_packet_t *));
+    ep->records = malloc(ep->length);
+    ep->pristine = malloc(ep->length);
+    if (ep->pkts == NULL || ep->records == NULL || ep->pristine == NULL) {
+        fprintf(stderr, "unable to allocate ERF copies of %u packets\n",
+                bp->count);
+        return -1;
+    }
+
+    ptr = ep->records;
+    for (i = 0; i < bp->count; i++) {
+        l2 = trace_get_layer2(bp->pkts[i], &linktype, &caplen);
+        if (l2 == NULL || caplen < 14) {
+            continue;
+        }
+        ts = trace_get_seconds(bp->pkts[i]);
+
+        erf = (bench_erf_header_t *)ptr;
+        erf->ts = ((uint64_t)ts << 32) +
+                (uint64_t)((ts - (uint64_t)ts) * 4294967296.0);
+        erf->type = TRACE_ERF_TYPE_ETH;
+        erf->flags = 0;
+        erf->rlen = htons(CORSARO_ERF_ETHERNET_FRAMING + added + caplen);
+        erf->lctr = 0;
+        /* ERF wire lengths include the frame check sequence */
+        erf->wlen = htons(trace_get_wire_length(bp->pkts[i]) + added + 4);
+        ptr += sizeof(bench_erf_header_t);
+        memset(ptr, 0, CORSARO_ERF_ETHERNET_FRAMING -
+                sizeof(bench_erf_header_t));
+        ptr += CORSARO_ERF_ETHERNET_FRAMING - sizeof(bench_erf_header_t);
+
+        memcpy(ptr, l2, 12);
+        ptr += 12;
+        if (encaplen > 0) {
+            memcpy(ptr, encap, encaplen);
+            ptr += encaplen;
+        }
+        if (keeptype) {
+            memcpy(ptr, l2 + 12, caplen - 12);
+            ptr += caplen - 12;
+        } else {
+            memcpy(ptr, l2 + 14, caplen - 14);
+            ptr += caplen - 14;
+        }
+
+        ep->pkts[ep->count] = trace_create_packet();
+        if (ep->pkts[ep->count] == NULL) {
+            return -1;
+        }
+        ep->count ++;
+    }
+    ep->length = ptr - ep->records;
+    memcpy(ep->pristine, ep->records, ep->length);
+
+    if (prepare_erf_packets(ep) < 0) {
+        fprintf(stderr, "unable to prepare ERF packets\n");
+        return -1;
+    }
+    return 0;
+}
+
+void bench_reset_erf_packets(bench_erf_packets_t *ep) {
+    memcpy(ep->records, ep->pristine, ep->length);
+    prepare_erf_packets(ep);
+}
+
+void bench_free_erf_packets(bench_erf_packets_t *ep) {
+    uint32_t i;
+
+    if (ep->pkts) {
+        for (i = 0; i < ep->count; i++) {
+            trace_destroy_packet(ep->pkts[i]);
+        }
+    }
+    free(ep->pkts);
+    free(ep->records);
+    free(ep->pristine);
+    if (ep->dead) {
+        trace_destroy_dead(ep->dead);
+    }
+    memset(ep, 0, sizeof(bench_erf_packets_t));
+}
+
+void bench_start(struct timespec *start) {
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+double bench_elapsed(struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) +
+            ((now.tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
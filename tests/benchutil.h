@@ -0,0 +1,150 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#ifndef CORSARO_BENCHUTIL_H
+#define CORSARO_BENCHUTIL_H
+
+#include <stdint.h>
+#include <time.h>
+#include <libtrace.h>
+
+/** Helpers shared by the benchmark programs in this directory.
+ *
+ *  The benchmarks read their packets from a trace file into memory before
+ *  timing anything, so that I/O and decompression don't get measured.
+ *  They are intended to be run against files produced by corsarogen, so
+ *  that everyone benchmarks against the same traffic, e.g.
+ *
+ *      corsarogen -p mixed -s 1 -r 1000000 -d 10 -c 10 \
+ *              -o pcapfile:/tmp/bench-%s.pcap
+ */
+
+/** A set of packets held in memory for a benchmark */
+typedef struct bench_packets {
+    /** The trace that the packets were read from, which must stay open
+     *  for as long as the packets are in use */
+    libtrace_t *trace;
+    libtrace_packet_t **pkts;
+    uint32_t count;
+} bench_packets_t;
+
+/** A copy of a set of packets as ERF records, as corsarowdcap would
+ *  receive them from a DAG card */
+typedef struct bench_erf_packets {
+    /** The dead ERF trace that the packets belong to */
+    libtrace_t *dead;
+    libtrace_packet_t **pkts;
+    uint32_t count;
+    /** The ERF records that the packets point into */
+    uint8_t *records;
+    /** An untouched copy of the records, for undoing any changes made to
+     *  the packets by a benchmark */
+    uint8_t *pristine;
+    uint64_t length;
+} bench_erf_packets_t;
+
+/** Reads up to 'max' packets from a trace into memory.
+ *
+ *  @param bp       The packet set to populate
+ *  @param uri      The libtrace URI of the trace to read
+ *  @param max      The maximum number of packets to read
+ *  @return 0 if at least one packet was read, -1 otherwise.
+ */
+int bench_load_packets(bench_packets_t *bp, char *uri, uint32_t max);
+
+/** Frees a set of packets loaded by bench_load_packets().
+ *
+ *  @param bp       The packet set to free
+ */
+void bench_free_packets(bench_packets_t *bp);
+
+/** Converts a set of packets into ERF Ethernet records.
+ *
+ *  @param ep       The ERF packet set to populate
+ *  @param bp       The packets to convert
+ *  @param encap    If not NULL, extra headers to insert after the source
+ *                  MAC address of each packet, starting with their own
+ *                  ethertype (e.g. a VLAN tag)
+ *  @param encaplen The number of bytes in 'encap'
+ *  @param keeptype If 0, the original ethertype of each packet is dropped
+ *                  after the extra headers, as it would be for MPLS
+ *  @return 0 if successful, -1 otherwise.
+ */
+int bench_make_erf_packets(bench_erf_packets_t *ep, bench_packets_t *bp,
+        const uint8_t *encap, uint16_t encaplen, uint8_t keeptype);
+
+/** Undoes any changes made to a set of ERF packets since they were
+ *  created, e.g. by trace_strip_packet().
+ *
+ *  @param ep       The ERF packet set to restore
+ */
+void bench_reset_erf_packets(bench_erf_packets_t *ep);
+
+/** Frees a set of packets created by bench_make_erf_packets().
+ *
+ *  @param ep       The ERF packet set to free
+ */
+void bench_free_erf_packets(bench_erf_packets_t *ep);
+
+/** Starts a benchmark timer.
+ *
+ *  @param start    The timer to start
+ */
+void bench_start(struct timespec *start);
+
+/** Returns the number of seconds since a timer was started.
+ *
+ *  @param start    A timer started with bench_start()
+ *  @return the elapsed time in seconds
+ */
+double bench_elapsed(struct timespec *start);
+
+#endif
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,272 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include "libcorsaro_log.h"
+#include "libcorsaro_avro.h"
+#include "libcorsaro_flowtuple.h"
+
+#include <libipmeta.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Test helper for corsaroftmerge.
+ *
+ *  'gen' writes a set of flowtuple files in which many flowtuples appear
+ *  in more than one file, with differing packet counts and tags. Each
+ *  input is written twice: once in the flowtuple sort order (for the
+ *  default merge mode) and once shuffled (for the aggregation mode).
+ *
+ *  'cmp' decodes two merged files and checks that they contain exactly
+ *  the same records in the same order. The avro container files
+ *  themselves are never byte-identical, as each one gets a random sync
+ *  marker.
+ */
+
+/** Number of distinct flowtuple keys to choose from */
+#define TESTDATA_KEYS 50000
+
+static uint64_t rngstate = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t next_rand(void) {
+    rngstate ^= rngstate << 13;
+    rngstate ^= rngstate >> 7;
+    rngstate ^= rngstate << 17;
+    return rngstate;
+}
+
+static int ft_qsort_cmp(const void *a, const void *b) {
+    return corsaro_flowtuple_data_cmp((struct corsaro_flowtuple_data *)a,
+            (struct corsaro_flowtuple_data *)b);
+}
+
+static void make_key(struct corsaro_flowtuple_data *ft, uint32_t k) {
+    memset(ft, 0, sizeof(struct corsaro_flowtuple_data));
+    /* Spread the keys over two intervals, with a few keys that differ
+     * only by their SYN properties.
+     */
+    ft->interval_ts = 1600000000 + (k % 2) * 60;
+    ft->src_ip = 0x0a000000 + (k >> 3);
+    ft->dst_ip = 0xc0a80000 + ((k * 2654435761U) & 0xffff);
+    ft->src_port = 1024 + (k & 0x3ff);
+    ft->dst_port = 23;
+    ft->protocol = 6;
+    ft->ttl = 64 - (k & 0x7);
+    ft->tcp_flags = 0x02;
+    ft->ip_len = 40;
+    ft->tcp_synlen = 20 + ((k >> 2) & 1) * 4;
+    ft->tcp_synwinlen = 1024;
+}
+
+static void make_tags(struct corsaro_flowtuple_data *ft) {
+    static const char *continents[] = {"EU", "AS", "NA", "SA", "??"};
+    static const char *countries[] = {"DE", "CN", "US", "BR", "NZ"};
+    int c = next_rand() % 5;
+
+    ft->packet_cnt = 1 + (next_rand() % 100);
+    ft->is_spoofed = next_rand() % 2;
+    ft->is_masscan = next_rand() % 2;
+    ft->maxmind_continent = continents[c][0] | (continents[c][1] << 8);
+    ft->maxmind_country = countries[c][0] | (countries[c][1] << 8);
+    c = next_rand() % 5;
+    ft->netacq_continent = continents[c][0] | (continents[c][1] << 8);
+    ft->netacq_country = countries[c][0] | (countries[c][1] << 8);
+    ft->prefixasn = next_rand() % 4;
+    /* The decoder always marks every tag as valid */
+    ft->tagproviders = (1 << IPMETA_PROVIDER_MAXMIND) |
+            (1 << IPMETA_PROVIDER_NETACQ_EDGE) |
+            (1 << IPMETA_PROVIDER_PFX2AS);
+}
+
+static int write_fts(corsaro_logger_t *logger, char *fname,
+        struct corsaro_flowtuple_data *fts, uint32_t count) {
+
+    corsaro_avro_writer_t *avwrt;
+    uint32_t i;
+    int ret = 0;
+
+    avwrt = corsaro_create_avro_writer(logger, FLOWTUPLE_RESULT_SCHEMA);
+    if (avwrt == NULL) {
+        return -1;
+    }
+    if (corsaro_start_avro_writer(avwrt, fname, 0) < 0) {
+        corsaro_destroy_avro_writer(avwrt);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        encode_flowtuple_as_avro(&(fts[i]), avwrt, logger);
+        if (corsaro_append_avro_writer(avwrt, NULL) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    corsaro_destroy_avro_writer(avwrt);
+    return ret;
+}
+
+static int generate(corsaro_logger_t *logger, char *prefix, int files) {
+    struct corsaro_flowtuple_data *fts;
+    uint32_t count, i, j, k;
+    char fname[4096];
+    int f;
+
+    fts = calloc(TESTDATA_KEYS, sizeof(struct corsaro_flowtuple_data));
+    if (fts == NULL) {
+        return -1;
+    }
+
+    for (f = 0; f < files; f++) {
+        /* Each key appears in roughly half of the inputs */
+        count = 0;
+        for (k = 0; k < TESTDATA_KEYS; k++) {
+            if (next_rand() % 2 == 0) {
+                continue;
+            }
+            make_key(&(fts[count]), k);
+            make_tags(&(fts[count]));
+            count ++;
+        }
+
+        for (i = count - 1; i > 0; i--) {
+            struct corsaro_flowtuple_data tmp;
+
+            j = next_rand() % (i + 1);
+            tmp = fts[i];
+            fts[i] = fts[j];
+            fts[j] = tmp;
+        }
+        snprintf(fname, sizeof(fname), "%s-%d.unsorted.avro", prefix, f);
+        if (write_fts(logger, fname, fts, count) < 0) {
+            free(fts);
+            return -1;
+        }
+
+        qsort(fts, count, sizeof(struct corsaro_flowtuple_data),
+                ft_qsort_cmp);
+        snprintf(fname, sizeof(fname), "%s-%d.sorted.avro", prefix, f);
+        if (write_fts(logger, fname, fts, count) < 0) {
+            free(fts);
+            return -1;
+        }
+    }
+    free(fts);
+    return 0;
+}
+
+static int compare(corsaro_logger_t *logger, char *afile, char *bfile) {
+    corsaro_avro_reader_t *ardr, *brdr;
+    avro_value_t *arec, *brec;
+    struct corsaro_flowtuple_data aft, bft;
+    uint64_t n = 0;
+    int aret, bret, ret = 0;
+
+    ardr = corsaro_create_avro_reader(logger, afile);
+    brdr = corsaro_create_avro_reader(logger, bfile);
+    if (ardr == NULL || brdr == NULL) {
+        return -1;
+    }
+
+    while (1) {
+        aret = corsaro_read_next_avro_record(ardr, &arec);
+        bret = corsaro_read_next_avro_record(brdr, &brec);
+        if (aret < 0 || bret < 0) {
+            ret = -1;
+            break;
+        }
+        if (aret == 0 || bret == 0) {
+            if (aret != bret) {
+                fprintf(stderr, "%s has more records than %s\n",
+                        aret ? afile : bfile, aret ? bfile : afile);
+                ret = -1;
+            }
+            break;
+        }
+
+        memset(&aft, 0, sizeof(aft));
+        memset(&bft, 0, sizeof(bft));
+        decode_flowtuple_from_avro(arec, &aft);
+        decode_flowtuple_from_avro(brec, &bft);
+        if (memcmp(&aft, &bft, sizeof(aft)) != 0) {
+            fprintf(stderr, "record %lu differs between %s and %s\n",
+                    n, afile, bfile);
+            ret = -1;
+            break;
+        }
+        n ++;
+    }
+
+    if (ret == 0) {
+        printf("%lu records match\n", n);
+    }
+    corsaro_destroy_avro_reader(ardr);
+    corsaro_destroy_avro_reader(brdr);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    corsaro_logger_t *logger;
+    int ret = -1;
+
+    logger = init_corsaro_logger("ftmerge_testdata", "");
+
+    if (argc == 4 && strcmp(argv[1], "gen") == 0) {
+        ret = generate(logger, argv[2], atoi(argv[3]));
+    } else if (argc == 4 && strcmp(argv[1], "cmp") == 0) {
+        ret = compare(logger, argv[2], argv[3]);
+    } else {
+        fprintf(stderr,
+                "Usage: %s gen <prefix> <files> | cmp <file> <file>\n",
+                argv[0]);
+    }
+
+    destroy_corsaro_logger(logger);
+    return ret < 0 ? 1 : 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
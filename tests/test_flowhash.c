@@ -0,0 +1,222 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libtrace.h>
+
+#include "libcorsaro_flowhash.h"
+
+/** Tests for the table-driven flow hasher used by corsarotagger.
+ *
+ *  Every hash is checked against a straightforward bit-by-bit Toeplitz
+ *  hash of the same tuple, and swapping the source and destination
+ *  addresses and ports must not change the hash (otherwise the two
+ *  directions of a flow would be sent to different threads).
+ */
+
+#define TEST_ITERATIONS 100000
+
+#define ETH_HDR_LEN 14
+#define IP4_OFF (ETH_HDR_LEN)
+#define IP6_OFF (ETH_HDR_LEN)
+
+static uint64_t rngstate = 0x2545f4914f6cdd1dULL;
+
+static uint8_t next_byte(void) {
+    rngstate ^= rngstate << 13;
+    rngstate ^= rngstate >> 7;
+    rngstate ^= rngstate << 17;
+    return (uint8_t)(rngstate >> 24);
+}
+
+/** Bit-by-bit Toeplitz hash using the repeating 0x6d5a key */
+static uint32_t reference_toeplitz(const uint8_t *in, int len) {
+    const uint64_t key = 0x6d5a6d5a6d5a6d5aULL;
+    uint32_t h = 0, window;
+    int n, b;
+
+    for (n = 0; n < len * 8; n++) {
+        if (!(in[n / 8] & (0x80 >> (n % 8)))) {
+            continue;
+        }
+        window = 0;
+        for (b = 0; b < 32; b++) {
+            window = (window << 1) | ((key >> (63 - ((n + b) % 16))) & 1);
+        }
+        h ^= window;
+    }
+    return h;
+}
+
+/** Builds an ethernet frame containing an IPv4 or IPv6 packet with random
+ *  addresses and ports, and returns the tuple that should be hashed.
+ */
+static int build_frame(uint8_t *frame, int v6, uint8_t proto, int frag,
+        uint8_t *tuple, int *tuplelen, int *framelen) {
+
+    int i, addrlen, l3off, l4off;
+
+    memset(frame, 0, 128);
+    frame[12] = v6 ? 0x86 : 0x08;
+    frame[13] = v6 ? 0xdd : 0x00;
+
+    if (v6) {
+        frame[IP6_OFF] = 0x60;
+        frame[IP6_OFF + 5] = 8;
+        frame[IP6_OFF + 6] = proto;
+        frame[IP6_OFF + 7] = 64;
+        addrlen = 16;
+        l3off = IP6_OFF + 8;
+        l4off = IP6_OFF + 40;
+    } else {
+        frame[IP4_OFF] = 0x45;
+        frame[IP4_OFF + 3] = 28;
+        if (frag) {
+            /* Second fragment, 8 bytes in */
+            frame[IP4_OFF + 7] = 1;
+        }
+        frame[IP4_OFF + 8] = 64;
+        frame[IP4_OFF + 9] = proto;
+        addrlen = 4;
+        l3off = IP4_OFF + 12;
+        l4off = IP4_OFF + 20;
+    }
+
+    for (i = 0; i < addrlen * 2; i++) {
+        frame[l3off + i] = next_byte();
+    }
+    for (i = 0; i < 8; i++) {
+        frame[l4off + i] = next_byte();
+    }
+
+    memcpy(tuple, frame + l3off, addrlen * 2);
+    *tuplelen = addrlen * 2;
+    if ((proto == 6 || proto == 17 || proto == 132) && !frag) {
+        memcpy(tuple + *tuplelen, frame + l4off, 4);
+        *tuplelen += 4;
+    }
+    *framelen = l4off + 8;
+    return l4off;
+}
+
+/** Swaps the addresses and ports of the packet in a frame */
+static void swap_frame(uint8_t *frame, int v6, int l4off) {
+    uint8_t tmp[16];
+    int addrlen = v6 ? 16 : 4;
+    int l3off = v6 ? IP6_OFF + 8 : IP4_OFF + 12;
+
+    memcpy(tmp, frame + l3off, addrlen);
+    memmove(frame + l3off, frame + l3off + addrlen, addrlen);
+    memcpy(frame + l3off + addrlen, tmp, addrlen);
+
+    memcpy(tmp, frame + l4off, 2);
+    memmove(frame + l4off, frame + l4off + 2, 2);
+    memcpy(frame + l4off + 2, tmp, 2);
+}
+
+int main(int argc, char *argv[]) {
+    corsaro_flowhash_t fh;
+    libtrace_packet_t *packet;
+    static const uint8_t protos[] = {6, 17, 132, 1, 47};
+    uint8_t frame[128], tuple[40];
+    uint64_t h, swapped;
+    int i, v6, frag, proto, tuplelen, framelen, l4off;
+    int mismatches = 0, asymmetric = 0;
+
+    (void)argc;
+    (void)argv;
+
+    corsaro_init_flowhash(&fh);
+    packet = trace_create_packet();
+
+    for (i = 0; i < TEST_ITERATIONS; i++) {
+        v6 = (i % 3 == 0);
+        proto = protos[i % 5];
+        frag = !v6 && (i % 7 == 0);
+
+        l4off = build_frame(frame, v6, proto, frag, tuple, &tuplelen,
+                &framelen);
+        trace_construct_packet(packet, TRACE_TYPE_ETH, frame, framelen);
+        h = corsaro_flowhash_packet(packet, &fh);
+
+        if (h != reference_toeplitz(tuple, tuplelen)) {
+            mismatches ++;
+        }
+
+        swap_frame(frame, v6, l4off);
+        trace_construct_packet(packet, TRACE_TYPE_ETH, frame, framelen);
+        swapped = corsaro_flowhash_packet(packet, &fh);
+        if (swapped != h) {
+            asymmetric ++;
+        }
+    }
+
+    /* Non-IP frames should always hash to zero */
+    memset(frame, 0, sizeof(frame));
+    frame[12] = 0x08;
+    frame[13] = 0x06;
+    trace_construct_packet(packet, TRACE_TYPE_ETH, frame, 60);
+    if (corsaro_flowhash_packet(packet, &fh) != 0) {
+        fprintf(stderr, "non-IP frame did not hash to zero\n");
+        mismatches ++;
+    }
+
+    trace_destroy_packet(packet);
+
+    printf("%d packets: %d differ from the reference hash, %d change when swapped\n",
+            TEST_ITERATIONS, mismatches, asymmetric);
+    if (mismatches > 0 || asymmetric > 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,170 @@
+/*
+ * corsaro
+ *
+ * Alistair King, CAIDA, UC San Diego
+ * Shane Alcock, WAND, University of Waikato
+ *
+ * corsaro-info@caida.org
+ *
+ * Copyright (C) 2012-2019 The Regents of the University of California.
+ * All Rights Reserved.
+ *
+ * This file is part of corsaro.
+ *
+ * Permission to copy, modify, and distribute this software and its
+ * documentation for academic research and education purposes, without fee, and
+ * without a written agreement is hereby granted, provided that
+ * the above copyright notice, this paragraph and the following paragraphs
+ * appear in all copies.
+ *
+ * Permission to make use of this software for other than academic research and
+ * education purposes may be obtained by contacting:
+ *
+ * Office of Innovation and Commercialization
+ * 9500 Gilman Drive, Mail Code 0910
+ * University of California
+ * La Jolla, CA 92093-0910
+ * (858) 534-5815
+ * invent@ucsd.edu
+ *
+ * This software program and documentation are copyrighted by The Regents of the
+ * University of California. The software program and documentation are supplied
+ * “as is”, without any accompanying services from The Regents. The Regents does
+ * not warrant that the operation of the program will be uninterrupted or
+ * error-free. The end-user understands that the program was developed for
+ * research purposes and is advised not to rely exclusively on the program for
+ * any reason.
+ *
+ * IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE UNIVERSITY OF CALIFORNIA HAS BEEN ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE. THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. THE SOFTWARE PROVIDED
+ * HEREUNDER IS ON AN “AS IS” BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO
+ * OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
+ * MODIFICATIONS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "libcorsaro_flowtuple.h"
+
+/** Collision test for the flowtuple key hash.
+ *
+ *  Hashes a large number of distinct flowtuple keys, laid out the way
+ *  darknet traffic tends to be (many destinations in one prefix, few
+ *  sources, sequential ports), and counts how many of them collide. The
+ *  full 64-bit hash should never collide at these sizes, and the 32-bit
+ *  folded hash that is carried in the packet tags should collide about as
+ *  often as a random function would.
+ *
+ *  The default is 10 million tuples per pattern so that 'make check'
+ *  stays quick; pass 100000000 to run at full size (needs 800 MB).
+ */
+
+#define DEFAULT_TUPLES 10000000
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    if (x == y) {
+        return 0;
+    }
+    return (x < y) ? -1 : 1;
+}
+
+/** Counts the values in a sorted array that are equal to the value
+ *  before them */
+static uint64_t count_duplicates(uint64_t *vals, uint64_t n) {
+    uint64_t i, dups = 0;
+
+    for (i = 1; i < n; i++) {
+        if (vals[i] == vals[i - 1]) {
+            dups ++;
+        }
+    }
+    return dups;
+}
+
+/** Generates the i-th distinct key for a given pattern and hashes it */
+static uint64_t hash_tuple(int pattern, uint64_t i) {
+    if (pattern == 0) {
+        /* Scans: sweeping a /8 darknet from a growing set of sources */
+        return corsaro_flowtuple_key_hash(0x5d000000 | ((i >> 24) << 4),
+                0x2c000000 | (i & 0xffffff), 40000, 23, 6, 241, 0x02, 40);
+    }
+    /* Backscatter: a handful of victims, every source port */
+    return corsaro_flowtuple_key_hash(0xc6336400 | ((i >> 16) & 0xff),
+            0x2c000000 | ((i >> 24) & 0xffff), 80, i & 0xffff, 6, 52,
+            0x12, 44);
+}
+
+static int run_pattern(int pattern, const char *name, uint64_t *vals,
+        uint64_t n) {
+
+    uint64_t i, dups64, dups32;
+    double expected, m = 4294967296.0;
+
+    for (i = 0; i < n; i++) {
+        vals[i] = hash_tuple(pattern, i);
+    }
+    qsort(vals, n, sizeof(uint64_t), cmp_u64);
+    dups64 = count_duplicates(vals, n);
+
+    for (i = 0; i < n; i++) {
+        vals[i] = corsaro_flowtuple_fold_hash(vals[i]);
+    }
+    qsort(vals, n, sizeof(uint64_t), cmp_u64);
+    dups32 = count_duplicates(vals, n);
+
+    /* Expected number of repeated values for a random function */
+    expected = n - m * (1.0 - exp(-(double)n / m));
+
+    printf("%-12s %lu tuples: %lu 64-bit collisions, %lu 32-bit collisions (%.0f expected)\n",
+            name, n, dups64, dups32, expected);
+
+    if (dups64 != 0) {
+        return -1;
+    }
+    if (fabs((double)dups32 - expected) > expected * 0.1 + 10) {
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t n = DEFAULT_TUPLES;
+    uint64_t *vals;
+    int ret = 0;
+
+    if (argc > 1) {
+        n = strtoull(argv[1], NULL, 0);
+    }
+    if (n > (1ULL << 32)) {
+        fprintf(stderr, "at most %llu tuples can be tested\n", 1ULL << 32);
+        return 1;
+    }
+
+    vals = malloc(n * sizeof(uint64_t));
+    if (vals == NULL) {
+        fprintf(stderr, "unable to allocate space for %lu hashes\n", n);
+        return 1;
+    }
+
+    if (run_pattern(0, "scan", vals, n) < 0) {
+        ret = 1;
+    }
+    if (run_pattern(1, "backscatter", vals, n) < 0) {
+        ret = 1;
+    }
+    free(vals);
+    return ret;
+}
+
+// vim: set sw=4 tabstop=4 softtabstop=4 expandtab :
@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# Checks that corsaroftmerge produces the same flowtuples in hash
+# aggregation mode (with unsorted inputs) as it does when merging the
+# same inputs after sorting them. The inputs contain many duplicate
+# flowtuples with conflicting tags, so this also checks that the copy
+# that is kept does not depend on thread scheduling.
+
+set -e
+
+FTMERGE=${top_builddir:-..}/corsaroftmerge/corsaroftmerge
+TMPDIR=$(mktemp -d)
+trap 'rm -rf "$TMPDIR"' EXIT
+
+./ftmerge_testdata gen "$TMPDIR/in" 6
+
+$FTMERGE -l disabled -o "$TMPDIR/merged.avro" "$TMPDIR"/in-*.sorted.avro
+
+# Run the aggregation with a few different partition counts and a small
+# enough table that some of them have to spill to disk.
+for args in "-p 1" "-p 4" "-p 3 -m 30000"; do
+    rm -f "$TMPDIR/agg.avro"
+    $FTMERGE -l disabled -a $args -o "$TMPDIR/agg.avro" \
+            "$TMPDIR"/in-*.unsorted.avro
+    ./ftmerge_testdata cmp "$TMPDIR/merged.avro" "$TMPDIR/agg.avro"
+done